@@ -15,6 +15,7 @@
  */
 #include <jni.h>
 #include "sampling/SamplingCollector.h"
+#include "sampling/AggregationCollector.h"
 #include "utils/log.h"
 
 extern "C"
@@ -24,6 +25,8 @@ Java_com_bytedance_rheatrace_trace_base_TraceAbility_nativeCreate(
     switch (type) {
         case rheatrace::TYPE_SAMPLING:
             return reinterpret_cast<jlong>(rheatrace::SamplingCollector::create(env,configs));
+        case rheatrace::TYPE_AGGREGATION:
+            return reinterpret_cast<jlong>(rheatrace::AggregationCollector::create(env, configs));
         default:
             return 0;
     }
@@ -72,6 +75,57 @@ Java_com_bytedance_rheatrace_trace_base_TraceAbility_nativeDumpTokenRange(
     return result;
 }
 
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_bytedance_rheatrace_trace_base_TraceAbility_nativeDumpTimeWindows(
+        JNIEnv* env, jobject thiz, jlong collector, jlong end, jlongArray jwindows, jstring path,
+        jstring jextra) {
+    jsize windowsLength = env->GetArrayLength(jwindows);
+    if (windowsLength < 2) {
+        return 1;
+    }
+    const char *dump_path = env->GetStringUTFChars(path, nullptr);
+    const char* extra = nullptr;
+    int32_t extraLen = 0;
+    if (jextra != nullptr) {
+        extra = env->GetStringUTFChars(jextra, nullptr);
+        extraLen = env->GetStringUTFLength(jextra);
+    }
+    auto windows = env->GetLongArrayElements(jwindows, nullptr);
+    static_assert(sizeof(jlong) == sizeof(uint64_t), "time windows are passed as uint64_t");
+    int result = reinterpret_cast<rheatrace::PerfCollector*>(collector)->dumpTimeWindows(
+            env, dump_path, extra, extraLen, end, reinterpret_cast<const uint64_t*>(windows),
+            windowsLength / 2);
+    ALOGI("dump %d windows before %ld result is %d, error is %s", windowsLength / 2, end, result,
+          strerror(result));
+    env->ReleaseLongArrayElements(jwindows, windows, JNI_ABORT);
+    env->ReleaseStringUTFChars(path, dump_path);
+    if (extra != nullptr) {
+        env->ReleaseStringUTFChars(jextra, extra);
+    }
+    return result;
+}
+
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_bytedance_rheatrace_trace_base_TraceAbility_nativeStartStreaming(
+        JNIEnv* env, jobject thiz, jlong collector, jstring dir, jlong intervalMs,
+        jlong segmentBytes, jint maxSegments) {
+    const char* streamDir = env->GetStringUTFChars(dir, nullptr);
+    int result = reinterpret_cast<rheatrace::PerfCollector*>(collector)->startStreaming(
+            streamDir, intervalMs, segmentBytes, maxSegments);
+    ALOGI("start streaming to %s result is %d", streamDir, result);
+    env->ReleaseStringUTFChars(dir, streamDir);
+    return result;
+}
+
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_bytedance_rheatrace_trace_base_TraceAbility_nativeStopStreaming(
+        JNIEnv* env, jobject thiz, jlong collector) {
+    reinterpret_cast<rheatrace::PerfCollector*>(collector)->stopStreaming();
+}
+
 extern "C"
 JNIEXPORT void JNICALL
 Java_com_bytedance_rheatrace_trace_base_TraceAbility_nativeStop(
@@ -20,6 +20,7 @@
 #include "trace/java_alloc/thread_list.h"
 #include "utils/log.h"
 #include "sampling/SamplingCollector.h"
+#include "utils/SymbolOffsetCache.h"
 
 #ifdef LOG_TAG
 #undef LOG_TAG
@@ -47,4 +48,27 @@ Java_com_bytedance_rheatrace_trace_base_TraceGlobal_nativeCapture(JNIEnv* env, j
     if (collector != nullptr) {
         collector->request(rheatrace::SamplingType::kCustom, nullptr, force);
     }
-}
\ No newline at end of file
+}
+extern "C"
+JNIEXPORT void JNICALL
+Java_com_bytedance_rheatrace_trace_base_TraceGlobal_nativeInitSymbolCache(JNIEnv* env, jclass clazz, jstring dir) {
+    const char* path = env->GetStringUTFChars(dir, nullptr);
+    rheatrace::symbol_offset_cache::init(path);
+    env->ReleaseStringUTFChars(dir, path);
+}
+extern "C"
+JNIEXPORT jboolean JNICALL
+Java_com_bytedance_rheatrace_trace_base_TraceGlobal_nativeInitPersistence(JNIEnv* env, jclass clazz, jstring dir) {
+    const char* path = env->GetStringUTFChars(dir, nullptr);
+    bool hasPrevious = rheatrace::SamplingCollector::initPersistence(path);
+    env->ReleaseStringUTFChars(dir, path);
+    return hasPrevious;
+}
+extern "C"
+JNIEXPORT jint JNICALL
+Java_com_bytedance_rheatrace_trace_base_TraceGlobal_nativeRecoverBuffer(JNIEnv* env, jclass clazz, jstring out_dir) {
+    const char* path = env->GetStringUTFChars(out_dir, nullptr);
+    int result = rheatrace::SamplingCollector::recover(env, path);
+    env->ReleaseStringUTFChars(out_dir, path);
+    return result;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <errno.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace rheatrace {
+
+/**
+ * Accumulate small writes in memory and hand them to the fd in large chunks, so that writing a
+ * file made of many tiny fields doesn't cost one syscall per field.
+ */
+class BufferedWriter {
+public:
+    explicit BufferedWriter(int fd, size_t capacity = 64 * 1024)
+            : mFd(fd), mBuffer(capacity), mSize(0), mError(0) {}
+
+    ~BufferedWriter() {
+        flush();
+    }
+
+    BufferedWriter(BufferedWriter const &) = delete;
+    BufferedWriter &operator=(BufferedWriter const &) = delete;
+
+    bool write(const void* data, size_t len) {
+        if (mError != 0) {
+            return false;
+        }
+        if (mSize + len > mBuffer.size()) {
+            if (!flush()) {
+                return false;
+            }
+            if (len > mBuffer.size()) {
+                return writeFully(data, len);
+            }
+        }
+        memcpy(mBuffer.data() + mSize, data, len);
+        mSize += len;
+        return true;
+    }
+
+    template<typename V>
+    bool writeValue(V value) {
+        return write(&value, sizeof(V));
+    }
+
+    bool flush() {
+        if (mError != 0) {
+            return false;
+        }
+        size_t size = mSize;
+        mSize = 0;
+        return size == 0 || writeFully(mBuffer.data(), size);
+    }
+
+    /**
+     * @return errno of the first failed write, 0 if every write succeeded.
+     */
+    int error() const {
+        return mError;
+    }
+
+private:
+    bool writeFully(const void* data, size_t len) {
+        auto* cur = reinterpret_cast<const char*>(data);
+        while (len > 0) {
+            ssize_t written = ::write(mFd, cur, len);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                mError = errno;
+                return false;
+            }
+            cur += written;
+            len -= written;
+        }
+        return true;
+    }
+
+    const int mFd;
+    std::vector<char> mBuffer;
+    size_t mSize;
+    int mError;
+};
+
+} // namespace rheatrace
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+namespace rheatrace {
+
+/**
+ * A byte ring for variable-length payloads of ring buffer records, such as stack frames.
+ * Records keep the returned position, and readers validate that the payload has not been
+ * overwritten by later writes before trusting the copied bytes.
+ */
+class PayloadArena {
+private:
+    const int64_t mCapacity;
+    std::atomic<int64_t> mCursor;
+    char mData[];
+public:
+    static constexpr size_t calculateAllocationSize(size_t bytes) {
+        return sizeof(PayloadArena) + bytes;
+    }
+
+    static PayloadArena* allocateAt(int64_t capacity, void* addr) {
+        return new(addr) PayloadArena(capacity);
+    }
+
+    /**
+     * Reuse the arena at addr with its cursor and bytes, such as one recovered from a file.
+     */
+    static PayloadArena* attachAt(void* addr) {
+        return reinterpret_cast<PayloadArena*>(addr);
+    }
+
+    PayloadArena() = delete;
+    PayloadArena(PayloadArena const &) = delete;
+    PayloadArena &operator=(PayloadArena const &) = delete;
+
+    int64_t capacity() const {
+        return mCapacity;
+    }
+
+    int64_t getCurrentPosition() {
+        return mCursor.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @return position of the written payload, or -1 if payload is larger than the arena.
+     */
+    int64_t write(const void* data, uint32_t len) {
+        if (len > mCapacity) {
+            return -1;
+        }
+        int64_t position = mCursor.fetch_add(len, std::memory_order_relaxed);
+        copyIn(position, data, len);
+        std::atomic_thread_fence(std::memory_order_release);
+        return position;
+    }
+
+    /**
+     * Copy payload at position into dest.
+     * @return false if the payload is not valid anymore, which means it has been overwritten.
+     */
+    bool read(int64_t position, void* dest, uint32_t len) {
+        if (position < 0 || !isAlive(position, len)) {
+            return false;
+        }
+        copyOut(position, dest, len);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // writers may have wrapped around while we were copying
+        return isAlive(position, len);
+    }
+
+private:
+    explicit PayloadArena(int64_t capacity) noexcept : mCapacity(capacity), mCursor(0) {}
+
+    bool isAlive(int64_t position, uint32_t len) {
+        int64_t cursor = mCursor.load(std::memory_order_acquire);
+        return position + len <= cursor && position >= cursor - mCapacity;
+    }
+
+    void copyIn(int64_t position, const void* data, uint32_t len) {
+        int64_t index = position % mCapacity;
+        int64_t first = std::min(int64_t(len), mCapacity - index);
+        memcpy(mData + index, data, first);
+        if (first < len) {
+            memcpy(mData, static_cast<const char*>(data) + first, len - first);
+        }
+    }
+
+    void copyOut(int64_t position, void* dest, uint32_t len) {
+        int64_t index = position % mCapacity;
+        int64_t first = std::min(int64_t(len), mCapacity - index);
+        memcpy(dest, mData + index, first);
+        if (first < len) {
+            memcpy(static_cast<char*>(dest) + first, mData, len - first);
+        }
+    }
+};
+
+} // namespace rheatrace
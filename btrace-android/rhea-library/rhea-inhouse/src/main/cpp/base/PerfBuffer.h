@@ -17,122 +17,465 @@
 
 
 #include <errno.h>
+#include <fcntl.h>
+#include <jni.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <vector>
 #include "RingBuffer.h"
+#include "PayloadArena.h"
+#include "TimeIndex.h"
 #include "common_write.h"
 
 namespace rheatrace {
 
 class Dumper {
 public:
-    virtual uint32_t dumpRecord(JNIEnv* env, void* addr, void* r) = 0;
+    /**
+     * @param payload payload arena of the shard which record r belongs to, nullptr if buffer has
+     *     no payload arena.
+     */
+    virtual uint32_t dumpRecord(JNIEnv* env, void* addr, void* r, PayloadArena* payload) = 0;
+    /**
+     * @return upper bound of bytes written by a single dumpRecord() call.
+     */
+    virtual uint32_t maxRecordSize() = 0;
     virtual bool hasMapping() = 0;
     virtual bool dumpMapping(int fd) = 0;
+    /**
+     * @return false if records are written in a self-describing format which must not be preceded
+     *     by dump header, such as a perfetto trace.
+     */
+    virtual bool hasHeader() {
+        return true;
+    }
+    /**
+     * Called before records which should be decodable without any preceding records, such as the
+     * first records of a stream segment or block.
+     */
+    virtual void beginChunk() {}
     virtual ~Dumper() {}
 };
 
 template<typename T>
 class PerfBuffer {
+public:
+    /**
+     * Tickets of every shard at the time mark() is called, keyed by the token returned to caller.
+     * A snapshot is kept until all its tickets are overwritten or kMaxMarkHistory newer ones are
+     * taken. Tokens no newer than mEvictedToken only point to overwritten records.
+     */
+    struct MarkSnapshot {
+        int64_t token;
+        std::vector<int64_t> tickets;
+    };
+
 private:
-    std::atomic<int64_t> mTicket;
-    RingBuffer<T>* mMajorBuffer;
-    RingBuffer<T>* mBackupBuffer;
+    // bounds marks kept alive by a shard which is never written
+    static constexpr uint32_t kMaxMarkHistory = 1024;
+    // uncommitted records older than this are considered abandoned by drain()
+    static constexpr int64_t kInflightSlack = 1024;
+    static constexpr uint32_t kDrainChunkSize = 256 * 1024;
+    // magic, type, version and time come before count in dump header
+    static constexpr off_t kHeaderCountOffset = 4 + 4 + 4 + 8;
+    static constexpr uint32_t kAreaMagic = 0x42504852; // "RHPB"
+    static constexpr uint32_t kAreaVersion = 1;
+
+    /**
+     * Head of the memory area, followed by the ticket line of every shard and then the buffers of
+     * every shard. It describes the layout of a file backed area so that a later process can
+     * recover the buffer from the file, hence it only holds plain values.
+     */
+    struct AreaHeader {
+        uint32_t magic; // written last, a file without it was not completely laid out
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t shardCount;
+        uint64_t shardCapacity;
+        uint64_t shardPayloadCapacity;
+        uint64_t areaSize;
+        uint32_t snapshotDump;
+        int32_t pid;
+    };
+
+    // tickets are kept in different cache lines, so that shards don't bounce them between cores
+    struct alignas(64) TicketLine {
+        std::atomic<int64_t> ticket;
+    };
+
+    struct Layout {
+        size_t headerSize;
+        size_t singleBufferSize;
+        size_t payloadSize;
+        size_t indexSize;
+        size_t areaSize;
+    };
+
+    /**
+     * A shard owns a ticket, a pair of ring buffers and an optional payload arena. Threads are
+     * spread over shards so that concurrent writers don't bounce the same ticket cache line
+     * between cores.
+     */
+    struct Shard {
+        std::atomic<int64_t>* ticket;
+        RingBuffer<T>* majorBuffer;
+        RingBuffer<T>* backupBuffer;
+        PayloadArena* payloadArena;
+        TimeIndex* timeIndex;
+    };
+
+    struct TicketRange {
+        int64_t start;
+        int64_t end;
+    };
+
+    // sorted and disjoint ticket ranges to dump of every shard
+    using ShardRanges = std::vector<std::vector<TicketRange>>;
+
+    uint32_t mShardCount;
+    Shard* mShards;
+    bool mSnapshotDump; // no backup buffers, dump validates every slot against writers instead
     bool mUseBackupBuffer;
     void* mMemoryArea;
     size_t mMemroyAreaSize;
+    std::mutex mMarkLock;
+    std::mutex mDumpLock; // dumps and drains never run concurrently
+    std::deque<MarkSnapshot> mMarks; // ascending by token
+    int64_t mEvictedToken; // newest mark whose tickets have all been overwritten
 
     class AutoSwitchBufferHandler {
     private:
         PerfBuffer<T>& mPerfBuffer;
-        int64_t mRoughStartTicket;
+        int64_t* mRoughStartTickets;
     public:
         AutoSwitchBufferHandler(PerfBuffer<T>& perfBuffer) : mPerfBuffer(perfBuffer) {
-            mPerfBuffer.mBackupBuffer->clear();
-            mRoughStartTicket = mPerfBuffer.mMajorBuffer->getCurrentTicket();
-            mPerfBuffer.mUseBackupBuffer = true;
+            mRoughStartTickets = new int64_t[mPerfBuffer.mShardCount];
+            for (uint32_t i = 0; i < mPerfBuffer.mShardCount; ++i) {
+                auto& shard = mPerfBuffer.mShards[i];
+                if (!mPerfBuffer.mSnapshotDump) {
+                    shard.backupBuffer->clear();
+                }
+                mRoughStartTickets[i] = shard.majorBuffer->getCurrentTicket();
+            }
+            if (!mPerfBuffer.mSnapshotDump) {
+                mPerfBuffer.mUseBackupBuffer = true;
+            }
         }
 
-        int64_t getMarkedTicket() {
-            return mRoughStartTicket;
+        int64_t getMarkedTicket(uint32_t shard = 0) {
+            return mRoughStartTickets[shard];
         }
 
         ~AutoSwitchBufferHandler() {
-            auto* backupBuffer = mPerfBuffer.mBackupBuffer;
+            if (mPerfBuffer.mSnapshotDump) {
+                delete[] mRoughStartTickets;
+                return;
+            }
             mPerfBuffer.mUseBackupBuffer = false;
-            int64_t roughEndTicket = mPerfBuffer.mMajorBuffer->getCurrentTicket();
-            int64_t accurateStartTicket, accurateEndTicket;
-            if (backupBuffer->findValidTicketRange(mRoughStartTicket, roughEndTicket,
-                                                   &accurateStartTicket,
-                                                   &accurateEndTicket)) {
-                mPerfBuffer.mMajorBuffer->writesBack(*backupBuffer, accurateStartTicket, accurateEndTicket);
+            for (uint32_t i = 0; i < mPerfBuffer.mShardCount; ++i) {
+                auto& shard = mPerfBuffer.mShards[i];
+                int64_t roughEndTicket = shard.majorBuffer->getCurrentTicket();
+                int64_t accurateStartTicket, accurateEndTicket;
+                if (shard.backupBuffer->findValidTicketRange(mRoughStartTickets[i], roughEndTicket,
+                                                             &accurateStartTicket,
+                                                             &accurateEndTicket)) {
+                    shard.majorBuffer->writesBack(*shard.backupBuffer, accurateStartTicket,
+                                                  accurateEndTicket);
+                }
             }
+            delete[] mRoughStartTickets;
         }
     };
 
 public:
 
-    static PerfBuffer<T>* create(uint64_t capacity, GetTimeFn<T> getTimeFn) {
-        size_t singleBufferSize = RingBuffer<T>::calculateAllocationSize(capacity);
-        size_t memorySize = ((singleBufferSize * 2) + ~PAGE_MASK) & PAGE_MASK;
-        void* memory = mmap(nullptr, memorySize, PROT_READ | PROT_WRITE,
-                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    /**
+     * @param capacity total record count of all shards
+     * @param shardCount count of shards that writer threads are spread over
+     * @param payloadCapacity total bytes of payload arenas for variable-length record data, 0 if
+     *     records are self-contained
+     * @param snapshotDump dump a snapshot of live buffer which is validated slot by slot, instead
+     *     of redirecting writers to a backup buffer during dump. It halves memory of the buffer,
+     *     records overwritten during dump are dropped.
+     */
+    static PerfBuffer<T>* create(uint64_t capacity, GetTimeFn<T> getTimeFn, uint32_t shardCount = 1,
+                                 uint64_t payloadCapacity = 0, bool snapshotDump = false) {
+        return create(capacity, getTimeFn, shardCount, payloadCapacity, snapshotDump, nullptr);
+    }
+
+    /**
+     * Same as above, but if filePath is not null, the buffer is a shared mapping of that file
+     * instead of anonymous memory. Records reach the file through page cache as they are written,
+     * so nothing needs to be done when the process dies, and recover() could read them later.
+     */
+    static PerfBuffer<T>* create(uint64_t capacity, GetTimeFn<T> getTimeFn, uint32_t shardCount,
+                                 uint64_t payloadCapacity, bool snapshotDump,
+                                 const char* filePath) {
+        if (shardCount == 0) {
+            shardCount = 1;
+        }
+        uint64_t shardCapacity = std::max(uint64_t(1), capacity / shardCount);
+        uint64_t shardPayloadCapacity = payloadCapacity / shardCount;
+        Layout layout = layoutOf(shardCapacity, shardCount, shardPayloadCapacity, snapshotDump);
+        void* memory;
+        if (filePath == nullptr) {
+            memory = mmap(nullptr, layout.areaSize, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        } else {
+            int fd = open(filePath, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+            if (fd == -1) {
+                return nullptr;
+            }
+            memory = ftruncate(fd, layout.areaSize) == 0 ? mmap(nullptr, layout.areaSize,
+                                                                PROT_READ | PROT_WRITE, MAP_SHARED,
+                                                                fd, 0) : MAP_FAILED;
+            close(fd);
+        }
         if (memory == MAP_FAILED) {
             return nullptr;
         }
-        return new PerfBuffer<T>(capacity, memory, memorySize, getTimeFn);
+        auto* header = reinterpret_cast<AreaHeader*>(memory);
+        header->version = kAreaVersion;
+        header->recordSize = sizeof(T);
+        header->shardCount = shardCount;
+        header->shardCapacity = shardCapacity;
+        header->shardPayloadCapacity = shardPayloadCapacity;
+        header->areaSize = layout.areaSize;
+        header->snapshotDump = snapshotDump ? 1 : 0;
+        header->pid = getpid();
+        auto* buffer = new PerfBuffer<T>(shardCapacity, shardCount, shardPayloadCapacity,
+                                         snapshotDump, memory, layout, getTimeFn, false);
+        header->magic = kAreaMagic;
+        return buffer;
     }
 
-    PerfBuffer(uint64_t capacity, void* addr, size_t memorySize, GetTimeFn<T> getTimeFn)
-            : mTicket(0), mMajorBuffer(nullptr), mBackupBuffer(nullptr),
-              mUseBackupBuffer(false), mMemoryArea(addr), mMemroyAreaSize(memorySize) {
+    /**
+     * Map a buffer file left by create() of a previous process, for dumping records in it. The
+     * mapping is private, so that the file is never changed. Records being written when the
+     * process died are dropped by slot validation of snapshot dump, and records written to backup
+     * buffers by a dump in progress are kept.
+     * @return nullptr if the file is missing, incomplete or laid out for another record type.
+     */
+    static PerfBuffer<T>* recover(const char* filePath, GetTimeFn<T> getTimeFn) {
+        int fd = open(filePath, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return nullptr;
+        }
+        AreaHeader header{};
+        struct stat st{};
+        bool valid = pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+                     fstat(fd, &st) == 0 && header.magic == kAreaMagic &&
+                     header.version == kAreaVersion && header.recordSize == sizeof(T) &&
+                     header.shardCount > 0 && header.shardCapacity > 0 &&
+                     header.shardCapacity <= UINT32_MAX;
+        Layout layout{};
+        if (valid) {
+            layout = layoutOf(header.shardCapacity, header.shardCount,
+                              header.shardPayloadCapacity, header.snapshotDump != 0);
+            valid = layout.areaSize == header.areaSize && uint64_t(st.st_size) >= layout.areaSize;
+        }
+        void* memory = valid ? mmap(nullptr, layout.areaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                                    fd, 0) : MAP_FAILED;
+        close(fd);
+        if (memory == MAP_FAILED) {
+            return nullptr;
+        }
+        return new PerfBuffer<T>(header.shardCapacity, header.shardCount,
+                                 header.shardPayloadCapacity, header.snapshotDump != 0, memory,
+                                 layout, getTimeFn, true);
+    }
+
+    /**
+     * @param attach keep records already laid out in memory, which is a recovered file, and dump
+     *     them as a snapshot. Each record is taken from whichever of major and backup buffer holds
+     *     its ticket, as it is not known whether the dead writer was dumping.
+     */
+    PerfBuffer(uint64_t shardCapacity, uint32_t shardCount, uint64_t shardPayloadCapacity,
+               bool snapshotDump, void* addr, const Layout& layout, GetTimeFn<T> getTimeFn,
+               bool attach)
+            : mShardCount(shardCount), mShards(new Shard[shardCount]),
+              mSnapshotDump(snapshotDump || attach), mUseBackupBuffer(false),
+              mMemoryArea(addr), mMemroyAreaSize(layout.areaSize), mMarks(), mEvictedToken(0) {
         char* memory = reinterpret_cast<char*>(mMemoryArea);
-        mMajorBuffer = RingBuffer<T>::allocateAt(capacity, mTicket, getTimeFn, memory);
-        mBackupBuffer = RingBuffer<T>::allocateAt(capacity,
-                                                  mTicket,
-                                                  getTimeFn,
-                                                  (void*) (memory + memorySize / 2));
+        auto* tickets = reinterpret_cast<TicketLine*>(memory + alignUp(sizeof(AreaHeader)));
+        memory += layout.headerSize;
+        for (uint32_t i = 0; i < shardCount; ++i) {
+            auto& shard = mShards[i];
+            shard.ticket = &tickets[i].ticket;
+            if (attach) {
+                shard.majorBuffer = RingBuffer<T>::attachAt(shardCapacity, *shard.ticket,
+                                                            getTimeFn, memory);
+                memory += layout.singleBufferSize;
+                // writer may have died during a dump, when new records only went to backup
+                shard.backupBuffer = snapshotDump ? nullptr : RingBuffer<T>::attachAt(
+                        shardCapacity, *shard.ticket, getTimeFn, memory);
+                memory += snapshotDump ? 0 : layout.singleBufferSize;
+                shard.payloadArena = layout.payloadSize == 0 ? nullptr
+                                                             : PayloadArena::attachAt(memory);
+                memory += layout.payloadSize;
+                shard.timeIndex = TimeIndex::attachAt(memory);
+                memory += layout.indexSize;
+                continue;
+            }
+            shard.ticket->store(0, std::memory_order_relaxed);
+            shard.majorBuffer = RingBuffer<T>::allocateAt(shardCapacity, *shard.ticket, getTimeFn,
+                                                          memory);
+            memory += layout.singleBufferSize;
+            if (snapshotDump) {
+                shard.backupBuffer = nullptr;
+            } else {
+                shard.backupBuffer = RingBuffer<T>::allocateAt(shardCapacity, *shard.ticket,
+                                                               getTimeFn, memory);
+                memory += layout.singleBufferSize;
+            }
+            shard.payloadArena = layout.payloadSize == 0 ? nullptr : PayloadArena::allocateAt(
+                    shardPayloadCapacity, memory);
+            memory += layout.payloadSize;
+            shard.timeIndex = TimeIndex::allocateAt(shardCapacity, memory);
+            memory += layout.indexSize;
+        }
     }
 
     ~PerfBuffer() {
         munmap(mMemoryArea, mMemroyAreaSize);
+        delete[] mShards;
+    }
+
+    /**
+     * @return pid of the process which created the buffer, the writer of a recovered one.
+     */
+    int32_t ownerPid() {
+        return reinterpret_cast<AreaHeader*>(mMemoryArea)->pid;
     }
 
     int64_t capacity() {
-        return mMajorBuffer->capacity();
+        return mShards[0].majorBuffer->capacity() * int64_t(mShardCount);
     }
 
     int64_t write(T& value) {
-        return getCurrentRingBuffer()->write(value);
+        Shard& shard = getCurrentShard();
+        RingBuffer<T>* buffer = __builtin_expect(mUseBackupBuffer, false) ? shard.backupBuffer
+                                                                           : shard.majorBuffer;
+        int64_t ticket = buffer->write(value);
+        if (TimeIndex::shouldRecord(ticket)) {
+            shard.timeIndex->record(ticket, buffer->mGetTimeFn(value));
+        }
+        return ticket;
     }
 
+    /**
+     * Returns a token which could be used as ticket bound of dumpPart(). For sharded buffer, the
+     * token is the sum of all shard tickets, so that the difference of two tokens still equals the
+     * number of records written in between. Once records behind a token are all overwritten, it
+     * covers the whole buffer as a start bound and nothing as an end bound. Dumps return 10 for a
+     * token which is never returned here or dropped from the history. Snapshots are taken for a
+     * single shard too, since streaming splits segments at them.
+     */
     int64_t mark() {
-        return getCurrentRingBuffer()->getCurrentTicket();
+        MarkSnapshot snapshot{0, std::vector<int64_t>(mShardCount)};
+        std::lock_guard<std::mutex> lock(mMarkLock);
+        for (uint32_t i = 0; i < mShardCount; ++i) {
+            snapshot.tickets[i] = mShards[i].ticket->load(std::memory_order_relaxed);
+            snapshot.token += snapshot.tickets[i];
+        }
+        int64_t token = snapshot.token;
+        // tickets only grow, so an equal sum means nothing is written since last mark
+        if (token <= mEvictedToken || (!mMarks.empty() && mMarks.back().token == token)) {
+            return token;
+        }
+        mMarks.push_back(std::move(snapshot));
+        while (mMarks.size() > 1 && isOverwritten(mMarks.front())) {
+            mEvictedToken = mMarks.front().token;
+            mMarks.pop_front();
+        }
+        if (mMarks.size() > kMaxMarkHistory) {
+            mMarks.pop_front();
+        }
+        return token;
+    }
+
+    /**
+     * Collect marks whose token is greater than token, oldest first.
+     */
+    void marksAfter(int64_t token, std::vector<MarkSnapshot>* out) {
+        std::lock_guard<std::mutex> lock(mMarkLock);
+        for (auto& mark : mMarks) {
+            if (mark.token > token) {
+                out->push_back(mark);
+            }
+        }
     }
 
     T& acquire() {
         return getCurrentRingBuffer()->acquire();
     }
 
+    /**
+     * Save variable-length data of a record which is going to be written by current thread.
+     * @return position of the payload which should be kept in the record, -1 if failed.
+     */
+    int64_t writePayload(const void* data, uint32_t len) {
+        PayloadArena* arena = getCurrentShard().payloadArena;
+        if (arena == nullptr) {
+            return -1;
+        }
+        return arena->write(data, len);
+    }
+
+    /**
+     * @return true if payload at position is in the newer half of current thread's arena, so that
+     *     it is unlikely to be overwritten before payloads written now.
+     */
+    bool isPayloadRecent(int64_t position) {
+        PayloadArena* arena = getCurrentShard().payloadArena;
+        return arena != nullptr && position >= 0 &&
+               position >= arena->getCurrentPosition() - arena->capacity() / 2;
+    }
+
     int
     dump(JNIEnv* env, int fd, int mappingFd, uint32_t type, uint32_t version, uint64_t time,
          const char* extra, int32_t extraLen, bool dumpRaw, Dumper* dumper) {
+        std::lock_guard<std::mutex> lock(mDumpLock);
         AutoSwitchBufferHandler handler(*this);
-        int64_t endTicket = handler.getMarkedTicket();
-        uint32_t count = mMajorBuffer->availableCount(endTicket);
+        std::vector<int64_t> startTickets(mShardCount), endTickets(mShardCount);
+        for (uint32_t i = 0; i < mShardCount; ++i) {
+            endTickets[i] = handler.getMarkedTicket(i);
+            startTickets[i] = endTickets[i] - mShards[i].majorBuffer->availableCount(endTickets[i]);
+        }
         return innerDump(env, fd, mappingFd, type, version, time, extra, extraLen, dumpRaw, dumper,
-                         endTicket - count, endTicket);
+                         startTickets.data(), endTickets.data());
     }
 
     int dumpPart(JNIEnv* env, int fd, int mappingFd, uint32_t type, uint32_t version, uint64_t time,
                  const char* extra, int32_t extraLen, bool dumpRaw, Dumper* dumper, int64_t startTicket, int64_t endTicket) {
+        std::lock_guard<std::mutex> lock(mDumpLock);
         AutoSwitchBufferHandler handler(*this);
-        int64_t curBufferStartTicket = std::max(
-                handler.getMarkedTicket() - mMajorBuffer->capacity(), int64_t(0));
-        int64_t realStartTicket = std::max(curBufferStartTicket, startTicket);
-        int64_t realEndTicket = std::min(handler.getMarkedTicket(), endTicket);
-        if (realStartTicket < realEndTicket) {
+        std::vector<int64_t> startTickets(mShardCount), endTickets(mShardCount);
+        if (!resolveMark(startTicket, startTickets.data()) ||
+            !resolveMark(endTicket, endTickets.data())) {
+            return 10;
+        }
+        int64_t count = 0;
+        for (uint32_t i = 0; i < mShardCount; ++i) {
+            int64_t markedTicket = handler.getMarkedTicket(i);
+            int64_t curBufferStartTicket = std::max(
+                    markedTicket - mShards[i].majorBuffer->capacity(), int64_t(0));
+            startTickets[i] = std::max(curBufferStartTicket, startTickets[i]);
+            endTickets[i] = std::min(markedTicket, endTickets[i]);
+            if (startTickets[i] > endTickets[i]) {
+                startTickets[i] = endTickets[i];
+            }
+            count += endTickets[i] - startTickets[i];
+        }
+        if (count > 0) {
             return innerDump(env, fd, mappingFd, type, version, time, extra, extraLen, dumpRaw,
-                             dumper, realStartTicket, realEndTicket);
+                             dumper, startTickets.data(), endTickets.data());
         } else {
             return 8;
         }
@@ -140,28 +483,376 @@ public:
 
     int dumpTimedPart(JNIEnv* env, int fd, int mappingFd, uint32_t type, uint32_t version,
                       uint64_t time, const char* extra, int32_t extraLen, bool dumpRaw,
-                      Dumper* dumper, int64_t endTicket, uint64_t startTimeMillis) {
+                      Dumper* dumper, int64_t endTicket, uint64_t startTime) {
+        uint64_t window[2] = {startTime, UINT64_MAX};
+        return dumpTimeWindows(env, fd, mappingFd, type, version, time, extra, extraLen, dumpRaw,
+                               dumper, endTicket, window, 1);
+    }
+
+    /**
+     * Dump records in several time windows into one file, records of overlapping windows are
+     * dumped only once.
+     * @param windows pairs of [begin, end) in the time unit of GetTimeFn
+     */
+    int dumpTimeWindows(JNIEnv* env, int fd, int mappingFd, uint32_t type, uint32_t version,
+                        uint64_t time, const char* extra, int32_t extraLen, bool dumpRaw,
+                        Dumper* dumper, int64_t endTicket, const uint64_t* windows,
+                        uint32_t windowCount) {
+        std::lock_guard<std::mutex> lock(mDumpLock);
         AutoSwitchBufferHandler handler(*this);
-        int64_t startTicket;
-        if (mMajorBuffer->findTimeTicket(startTimeMillis, endTicket, &startTicket) && startTicket < endTicket) {
+        std::vector<int64_t> endTickets(mShardCount);
+        if (!resolveMark(endTicket, endTickets.data())) {
+            return 10;
+        }
+        ShardRanges ranges(mShardCount);
+        for (uint32_t i = 0; i < mShardCount; ++i) {
+            int64_t shardEnd = std::min(endTickets[i], handler.getMarkedTicket(i));
+            int64_t shardStart = std::max(shardEnd - int64_t(mShards[i].majorBuffer->capacity()),
+                                          int64_t(0));
+            for (uint32_t w = 0; w < windowCount; ++w) {
+                uint64_t begin = windows[w * 2];
+                uint64_t end = windows[w * 2 + 1];
+                if (begin >= end) {
+                    continue;
+                }
+                int64_t start = findTimeTicket(i, begin, shardStart, shardEnd);
+                int64_t stop = end == UINT64_MAX ? shardEnd : findTimeTicket(i, end, start, shardEnd);
+                if (start < stop) {
+                    ranges[i].push_back({start, stop});
+                }
+            }
+            mergeRanges(ranges[i]);
+        }
+        if (rangesCount(ranges) > 0) {
             return innerDump(env, fd, mappingFd, type, version, time, extra, extraLen, dumpRaw,
-                             dumper, startTicket, endTicket);
+                             dumper, ranges);
         }
         return 9;
     }
 
+    /**
+     * Encode committed records after cursors with dumper and append them to fd, so that streaming
+     * flush can drain buffer incrementally without blocking writers. Records still being written
+     * are left to next drain, and records overwritten before being drained are dropped.
+     * @param cursors tickets of every shard where last drain stopped, advanced after draining
+     * @param outBytes bytes appended to fd
+     * @param limitTickets tickets of every shard to stop at, nullptr to drain all committed ones
+     * @return count of drained records, -1 if writing fd failed
+     */
+    int64_t drain(JNIEnv* env, int fd, Dumper* dumper, int64_t* cursors, int64_t* outBytes,
+                  const int64_t* limitTickets = nullptr) {
+        std::lock_guard<std::mutex> lock(mDumpLock);
+        std::vector<int64_t> endTickets(mShardCount);
+        for (uint32_t i = 0; i < mShardCount; ++i) {
+            RingBuffer<T>* buffer = mShards[i].majorBuffer;
+            int64_t current = buffer->getCurrentTicket();
+            cursors[i] = std::max(cursors[i], current - int64_t(buffer->capacity()));
+            int64_t limit = limitTickets == nullptr ? current : std::min(current, limitTickets[i]);
+            int64_t end = cursors[i];
+            while (end < limit &&
+                   (buffer->isCommitted(end) || current - end > kInflightSlack)) {
+                ++end;
+            }
+            endTickets[i] = end;
+        }
+        uint32_t chunkSize = std::max(kDrainChunkSize, dumper->maxRecordSize() * 2);
+        std::vector<char> chunk(chunkSize);
+        uint32_t used = 0;
+        int64_t count = 0;
+        *outBytes = 0;
+        T record;
+        int32_t shard;
+        while ((shard = nextShard(cursors, endTickets.data())) >= 0) {
+            int64_t ticket = cursors[shard]++;
+            if (!mShards[shard].majorBuffer->readAt(ticket, record)) {
+                continue;
+            }
+            if (chunkSize - used < dumper->maxRecordSize()) {
+                if (!writeFully(fd, chunk.data(), used)) {
+                    return -1;
+                }
+                *outBytes += used;
+                used = 0;
+            }
+            used += dumper->dumpRecord(env, chunk.data() + used, &record,
+                                       mShards[shard].payloadArena);
+            count++;
+        }
+        if (used > 0) {
+            if (!writeFully(fd, chunk.data(), used)) {
+                return -1;
+            }
+            *outBytes += used;
+        }
+        return count;
+    }
+
+    /**
+     * @return the mark token of drain cursors, comparable with tokens returned by mark().
+     */
+    static int64_t cursorsToken(const int64_t* cursors, uint32_t shardCount) {
+        int64_t token = 0;
+        for (uint32_t i = 0; i < shardCount; ++i) {
+            token += cursors[i];
+        }
+        return token;
+    }
+
+    uint32_t shardCount() {
+        return mShardCount;
+    }
+
+    /**
+     * Find the earliest ticket in [startTicket, endTicket) whose record time is greater than or
+     * equal to time, endTicket if there is none.
+     */
+    int64_t findTimeTicket(uint32_t shardIndex, uint64_t time, int64_t startTicket,
+                           int64_t endTicket) {
+        Shard& shard = mShards[shardIndex];
+        RingBuffer<T>* buffer = shard.majorBuffer;
+        int64_t low, high;
+        if (!shard.timeIndex->locate(time, startTicket, endTicket, &low, &high)) {
+            int64_t ticket;
+            if (!buffer->findTimeTicket(time, endTicket, &ticket)) {
+                return endTicket;
+            }
+            return std::min(std::max(ticket, startTicket), endTicket);
+        }
+        T value;
+        for (int64_t ticket = low; ticket < high; ++ticket) {
+            if (buffer->readAt(ticket, value) && buffer->mGetTimeFn(value) >= time) {
+                return ticket;
+            }
+        }
+        return high;
+    }
+
+    static uint32_t writeHeader(char* writeAddr, uint32_t magicNumber, uint32_t type,
+                                uint32_t version, uint64_t time, uint32_t count, const char* extra,
+                                int32_t extraLen) {
+        uint32_t offset = rheatrace::writeBuf(writeAddr, magicNumber); // magic number
+        offset += rheatrace::writeBuf(writeAddr + offset, type); // type
+        offset += rheatrace::writeBuf(writeAddr + offset, version); // version
+        offset += rheatrace::writeBuf(writeAddr + offset, time); // time
+        offset += rheatrace::writeBuf(writeAddr + offset, count); // count
+        // dump extra info
+        if (extraLen > 0 && extra != nullptr) {
+            offset += rheatrace::writeBuf(writeAddr + offset, extraLen);
+            memcpy(writeAddr + offset, extra, extraLen);
+            offset += extraLen;
+        } else {
+            offset += rheatrace::writeBuf(writeAddr + offset, int32_t(0));
+        }
+        return offset;
+    }
+
+    static bool writeFully(int fd, const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t written = ::write(fd, data, len);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            len -= written;
+        }
+        return true;
+    }
+
 private:
+    static size_t alignUp(size_t size) {
+        return (size + 63) & ~size_t(63);
+    }
+
+    static Layout layoutOf(uint64_t shardCapacity, uint32_t shardCount,
+                           uint64_t shardPayloadCapacity, bool snapshotDump) {
+        Layout layout;
+        layout.headerSize = alignUp(sizeof(AreaHeader)) + sizeof(TicketLine) * shardCount;
+        layout.singleBufferSize = alignUp(RingBuffer<T>::calculateAllocationSize(shardCapacity));
+        layout.payloadSize = shardPayloadCapacity == 0 ? 0 : alignUp(
+                PayloadArena::calculateAllocationSize(shardPayloadCapacity));
+        layout.indexSize = alignUp(TimeIndex::calculateAllocationSize(shardCapacity));
+        size_t buffersSize = layout.singleBufferSize * (snapshotDump ? 1 : 2);
+        layout.areaSize = alignToPage(
+                layout.headerSize + (buffersSize + layout.payloadSize + layout.indexSize) * shardCount);
+        return layout;
+    }
+
+    /**
+     * Page size is queried at runtime rather than taken from PAGE_MASK, which is fixed at build
+     * time and wrong on 16KB page devices, and is not defined by glibc.
+     */
+    static size_t alignToPage(size_t size) {
+        static const size_t pageSize = sysconf(_SC_PAGE_SIZE);
+        return (size + pageSize - 1) & ~(pageSize - 1);
+    }
+
+    Shard& getCurrentShard() {
+        return mShards[mShardCount == 1 ? 0 : currentThreadOrdinal() % mShardCount];
+    }
+
     RingBuffer<T>* getCurrentRingBuffer() {
+        Shard& shard = getCurrentShard();
         if (__builtin_expect(mUseBackupBuffer, false)) {
-            return mBackupBuffer;
+            return shard.backupBuffer;
         } else {
-            return mMajorBuffer;
+            return shard.majorBuffer;
+        }
+    }
+
+    /**
+     * @return record of ticket to dump. In snapshot mode writers are still running, so the record
+     * is copied into tmp and validated, nullptr is returned if it is torn or overwritten.
+     */
+    T* recordForDump(uint32_t shard, int64_t ticket, T& tmp) {
+        RingBuffer<T>* buffer = mShards[shard].majorBuffer;
+        if (!mSnapshotDump) {
+            return &buffer->getAt(ticket);
+        }
+        if (buffer->readAt(ticket, tmp)) {
+            return &tmp;
+        }
+        // only a recovered buffer has backup buffers in snapshot dump
+        RingBuffer<T>* backup = mShards[shard].backupBuffer;
+        return backup != nullptr && backup->readAt(ticket, tmp) ? &tmp : nullptr;
+    }
+
+    static uint32_t currentThreadOrdinal() {
+        static std::atomic<uint32_t> sNextOrdinal(0);
+        static thread_local uint32_t sOrdinal = sNextOrdinal.fetch_add(1, std::memory_order_relaxed);
+        return sOrdinal;
+    }
+
+    bool resolveMark(int64_t token, int64_t* outTickets) {
+        if (mShardCount == 1) {
+            outTickets[0] = token;
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(mMarkLock);
+        if (token <= mEvictedToken) {
+            // records behind it are all overwritten, 0 is clamped to the buffer start by callers.
+            // Older tokens are never newer than mEvictedToken on any shard, so it holds for them.
+            memset(outTickets, 0, sizeof(int64_t) * mShardCount);
+            return true;
+        }
+        auto it = std::lower_bound(mMarks.begin(), mMarks.end(), token,
+                                   [](const MarkSnapshot& mark, int64_t value) {
+                                       return mark.token < value;
+                                   });
+        if (it == mMarks.end() || it->token != token) {
+            return false;
         }
+        memcpy(outTickets, it->tickets.data(), sizeof(int64_t) * mShardCount);
+        return true;
+    }
+
+    bool isOverwritten(const MarkSnapshot& mark) {
+        for (uint32_t i = 0; i < mShardCount; ++i) {
+            int64_t bufferStart = mShards[i].ticket->load(std::memory_order_relaxed) -
+                                  int64_t(mShards[i].majorBuffer->capacity());
+            if (mark.tickets[i] > bufferStart) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Pick the shard whose next record is the earliest one, so that records of all shards are
+     * dumped in (loosely) time sorted order.
+     */
+    int32_t nextShard(const int64_t* cursors, const int64_t* endTickets) {
+        int32_t result = -1;
+        uint64_t minTime = UINT64_MAX;
+        for (uint32_t i = 0; i < mShardCount; ++i) {
+            if (cursors[i] >= endTickets[i]) {
+                continue;
+            }
+            RingBuffer<T>* buffer = mShards[i].majorBuffer;
+            uint64_t recordTime = buffer->mGetTimeFn(buffer->getAt(cursors[i]));
+            if (result < 0 || recordTime < minTime) {
+                result = i;
+                minTime = recordTime;
+            }
+        }
+        return result;
+    }
+
+    static void mergeRanges(std::vector<TicketRange>& ranges) {
+        std::sort(ranges.begin(), ranges.end(), [](const TicketRange& a, const TicketRange& b) {
+            return a.start < b.start;
+        });
+        size_t merged = 0;
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            if (merged > 0 && ranges[i].start <= ranges[merged - 1].end) {
+                ranges[merged - 1].end = std::max(ranges[merged - 1].end, ranges[i].end);
+            } else {
+                ranges[merged++] = ranges[i];
+            }
+        }
+        ranges.resize(merged);
+    }
+
+    static int64_t rangesCount(const ShardRanges& ranges) {
+        int64_t count = 0;
+        for (auto& shardRanges : ranges) {
+            for (auto& range : shardRanges) {
+                count += range.end - range.start;
+            }
+        }
+        return count;
+    }
+
+    /**
+     * Advance to next record of all ranges in (loosely) time sorted order.
+     * @param rangeIndexes current range of every shard
+     * @return false if all ranges are exhausted
+     */
+    bool nextRecord(const ShardRanges& ranges, std::vector<size_t>& rangeIndexes,
+                    std::vector<int64_t>& cursors, std::vector<int64_t>& ends,
+                    uint32_t* outShard, int64_t* outTicket) {
+        int32_t shard = nextShard(cursors.data(), ends.data());
+        if (shard < 0) {
+            return false;
+        }
+        *outShard = shard;
+        *outTicket = cursors[shard]++;
+        if (cursors[shard] >= ends[shard] && ++rangeIndexes[shard] < ranges[shard].size()) {
+            cursors[shard] = ranges[shard][rangeIndexes[shard]].start;
+            ends[shard] = ranges[shard][rangeIndexes[shard]].end;
+        }
+        return true;
+    }
+
+    int innerDump(JNIEnv* env, int fd, int mappingFd, uint32_t type, uint32_t version, uint64_t time,
+                  const char* extra, int32_t extraLen, bool dumpRaw, Dumper* dumper,
+                  const int64_t* startTickets, const int64_t* endTickets) {
+        ShardRanges ranges(mShardCount);
+        for (uint32_t i = 0; i < mShardCount; ++i) {
+            if (startTickets[i] < endTickets[i]) {
+                ranges[i].push_back({startTickets[i], endTickets[i]});
+            }
+        }
+        return innerDump(env, fd, mappingFd, type, version, time, extra, extraLen, dumpRaw, dumper,
+                         ranges);
     }
 
     int innerDump(JNIEnv* env, int fd, int mappingFd, uint32_t type, uint32_t version, uint64_t time,
-                  const char* extra, int32_t extraLen, bool dumpRaw, Dumper* dumper, int64_t startTicket, int64_t endTicket) {
-        uint32_t count = endTicket - startTicket;
+                  const char* extra, int32_t extraLen, bool dumpRaw, Dumper* dumper,
+                  const ShardRanges& ranges) {
+        uint32_t count = rangesCount(ranges);
+        std::vector<size_t> rangeIndexes(mShardCount, 0);
+        std::vector<int64_t> cursors(mShardCount, 0), ends(mShardCount, 0);
+        for (uint32_t i = 0; i < mShardCount; ++i) {
+            if (!ranges[i].empty()) {
+                cursors[i] = ranges[i][0].start;
+                ends[i] = ranges[i][0].end;
+            }
+        }
+        uint32_t shard;
+        int64_t ticket;
         uint32_t magicNumber = 0x01020304;
         if (dumpRaw) {
             int64_t dumpSize =
@@ -171,36 +862,44 @@ private:
             if (ftruncate(fd, dumpSize) != 0) {
                 return 3;
             }
-            int64_t mmapSize = (dumpSize + ~PAGE_MASK) & PAGE_MASK;
+            int64_t mmapSize = alignToPage(dumpSize);
             void* addr = mmap(nullptr, mmapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
             if (addr == MAP_FAILED) {
                 return errno;
             }
             char* writeAddr = static_cast<char*>(addr);
-            uint32_t offset = rheatrace::writeBuf(writeAddr, magicNumber); // magic number
-            offset += rheatrace::writeBuf(writeAddr + offset, type); // type
-            offset += rheatrace::writeBuf(writeAddr + offset, version); // version
-            offset += rheatrace::writeBuf(writeAddr + offset, time); // time
-            offset += rheatrace::writeBuf(writeAddr + offset, count); // count
-            // dump extra info
-            if (extraLen > 0 && extra != nullptr) {
-                offset += rheatrace::writeBuf(writeAddr + offset, extraLen);
-                memcpy(writeAddr + offset, extra, extraLen);
-                offset += extraLen;
+            uint32_t offset = writeHeader(writeAddr, magicNumber, type, version, time, count,
+                                          extra, extraLen);
+            uint32_t dumpedCount = count;
+            if (mShardCount == 1 && ranges[0].size() == 1 && !mSnapshotDump) {
+                mShards[0].majorBuffer->quickDump(reinterpret_cast<T*>(writeAddr + offset),
+                                                  ranges[0][0].start, ranges[0][0].end);
             } else {
-                offset += rheatrace::writeBuf(writeAddr + offset, int32_t(0));
+                dumpedCount = 0;
+                T tmp;
+                while (nextRecord(ranges, rangeIndexes, cursors, ends, &shard, &ticket)) {
+                    T* record = recordForDump(shard, ticket, tmp);
+                    if (record == nullptr) {
+                        continue;
+                    }
+                    memcpy(writeAddr + offset, record, sizeof(T));
+                    offset += sizeof(T);
+                    dumpedCount++;
+                }
             }
-            mMajorBuffer->quickDump(reinterpret_cast<T*>(writeAddr + offset),
-                                    startTicket, endTicket);
             msync(addr, dumpSize, MS_SYNC);
             munmap(addr, mmapSize);
+            if (dumpedCount != count) {
+                ftruncate(fd, offset);
+                pwrite(fd, &dumpedCount, sizeof(dumpedCount), kHeaderCountOffset);
+            }
             return 0;
         } else if (dumper != nullptr) {
             int64_t pageSize = sysconf(_SC_PAGE_SIZE);
-            int64_t mapUnit = 128 * 1024;
-            if (pageSize > mapUnit) {
-                mapUnit = pageSize;
-            }
+            // a record must fit into the room left before remapping, and remapping offset must
+            // be page aligned
+            int64_t mapUnit = std::max<int64_t>(128 * 1024, dumper->maxRecordSize());
+            mapUnit = (mapUnit + pageSize - 1) / pageSize * pageSize;
             int64_t mmapSize = mapUnit * 4;
             if (ftruncate(fd, mmapSize) != 0) {
                 return 5;
@@ -210,21 +909,17 @@ private:
                 return errno;
             }
             char* writeAddr = static_cast<char*>(addr);
-            uint32_t offset = rheatrace::writeBuf(writeAddr, magicNumber); // magic number
-            offset += rheatrace::writeBuf(writeAddr + offset, type); // type
-            offset += rheatrace::writeBuf(writeAddr + offset, version); // version
-            offset += rheatrace::writeBuf(writeAddr + offset, time); // time
-            offset += rheatrace::writeBuf(writeAddr + offset, count); // count
-            // dump extra info
-            if (extraLen > 0 && extra != nullptr) {
-                offset += rheatrace::writeBuf(writeAddr + offset, extraLen);
-                memcpy(writeAddr + offset, extra, extraLen);
-                offset += extraLen;
-            } else {
-                offset += rheatrace::writeBuf(writeAddr + offset, int32_t(0));
-            }
+            bool hasHeader = dumper->hasHeader();
+            uint32_t offset = hasHeader ? writeHeader(writeAddr, magicNumber, type, version, time,
+                                                      count, extra, extraLen) : 0;
             int64_t currentFileMmapOffset = 0;
-            for (int64_t i = endTicket - count; i < endTicket; i++) {
+            uint32_t dumpedCount = 0;
+            T tmp;
+            while (nextRecord(ranges, rangeIndexes, cursors, ends, &shard, &ticket)) {
+                T* record = recordForDump(shard, ticket, tmp);
+                if (record == nullptr) {
+                    continue;
+                }
                 if (mmapSize + currentFileMmapOffset - offset < mapUnit) {
                     // sync already dumped
                     msync(addr, mmapSize, MS_SYNC);
@@ -242,11 +937,15 @@ private:
                 }
                 offset += dumper->dumpRecord(env, static_cast<char*>(addr) + offset -
                                                   currentFileMmapOffset,
-                                             &(mMajorBuffer->getAt(i)));
+                                             record, mShards[shard].payloadArena);
+                dumpedCount++;
             }
             msync(addr, mmapSize, MS_SYNC);
             munmap(addr, mmapSize);
             ftruncate(fd, offset);
+            if (hasHeader && dumpedCount != count) {
+                pwrite(fd, &dumpedCount, sizeof(dumpedCount), kHeaderCountOffset);
+            }
 
             if (dumper->hasMapping() && mappingFd != -1) {
                 dumper->dumpMapping(mappingFd);
@@ -22,6 +22,7 @@
 namespace rheatrace {
 
 static constexpr int TYPE_SAMPLING = 0;
+static constexpr int TYPE_AGGREGATION = 1;
 
 class PerfCollector {
 public:
@@ -36,8 +37,26 @@ public:
     virtual int dumpPart(JNIEnv* env, const char* outDir, const char* extra, int32_t extraLen,
                          int64_t startTicket, int64_t endTicket) = 0;
 
+    /**
+     * Dump records in several time windows before endTicket into one file.
+     * @param windows pairs of [begin, end) in the time unit of records, which is nanoseconds of
+     *     boot time for sampling
+     */
+    virtual int dumpTimeWindows(JNIEnv* env, const char* outDir, const char* extra,
+                                int32_t extraLen, int64_t endTicket, const uint64_t* windows,
+                                uint32_t windowCount) = 0;
+
     virtual int64_t mark() = 0;
 
+    /**
+     * Start draining buffer into segment files under dir in background, later dumps are made by
+     * concatenating segments.
+     */
+    virtual int startStreaming(const char* dir, uint32_t intervalMs, uint64_t segmentBytes,
+                               uint32_t maxSegments) = 0;
+
+    virtual void stopStreaming() = 0;
+
     virtual void stop() = 0;
 };
 
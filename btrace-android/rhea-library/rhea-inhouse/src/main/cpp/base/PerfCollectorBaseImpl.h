@@ -16,7 +16,9 @@
 #pragma once
 
 #include <fcntl.h>
+#include <mutex>
 #include "PerfCollector.h"
+#include "StreamFlusher.h"
 #include "../utils/time.h"
 
 namespace rheatrace {
@@ -25,36 +27,95 @@ template<uint32_t type, uint32_t version, bool dumpRawData, typename T>
 class PerfCollectorBaseImpl : public PerfCollector {
 protected:
     PerfBuffer<T>* mBuffer;
+    StreamFlusher<T>* mFlusher = nullptr;
+    std::mutex mFlusherLock;
 public:
     int dump(JNIEnv* env, const char* outDir, const char* extra, int32_t extraLen) override {
-        if (outDir == nullptr) {
+        return dumpToDir(outDir, [&](int fd, int mappingFd, Dumper* dumper, uint64_t curTime) {
+            std::lock_guard<std::mutex> lock(mFlusherLock);
+            if (mFlusher != nullptr) {
+                return mFlusher->concat(env, fd, mappingFd, type, version, curTime, extra,
+                                        extraLen, INT64_MIN, INT64_MAX);
+            }
+            return mBuffer->dump(env, fd, mappingFd, type, version, curTime, extra, extraLen,
+                                 dumpRawData, dumper);
+        });
+    }
+
+    int dumpPart(JNIEnv* env, const char* outDir, const char* extra, int32_t extraLen,
+                 int64_t startTicket, int64_t endTicket) override {
+        return dumpToDir(outDir, [&](int fd, int mappingFd, Dumper* dumper, uint64_t curTime) {
+            std::lock_guard<std::mutex> lock(mFlusherLock);
+            if (mFlusher != nullptr) {
+                return mFlusher->concat(env, fd, mappingFd, type, version, curTime, extra,
+                                        extraLen, startTicket, endTicket);
+            }
+            return mBuffer->dumpPart(env, fd, mappingFd, type, version, curTime, extra, extraLen,
+                                     dumpRawData, dumper, startTicket, endTicket);
+        });
+    }
+
+    int dumpTimeWindows(JNIEnv* env, const char* outDir, const char* extra, int32_t extraLen,
+                        int64_t endTicket, const uint64_t* windows, uint32_t windowCount) override {
+        return dumpToDir(outDir, [&](int fd, int mappingFd, Dumper* dumper, uint64_t curTime) {
+            return mBuffer->dumpTimeWindows(env, fd, mappingFd, type, version, curTime, extra,
+                                            extraLen, dumpRawData, dumper, endTicket, windows,
+                                            windowCount);
+        });
+    }
+
+    int64_t mark() override {
+        return mBuffer->mark();
+    }
+
+    int startStreaming(const char* dir, uint32_t intervalMs, uint64_t segmentBytes,
+                       uint32_t maxSegments) override {
+        if (dir == nullptr) {
             return 1;
         }
-        int dirPathLen = strlen(outDir);
-        char* path = new char[dirPathLen + 64]; // suppose that dumpFileName is not longer than 64
-        sprintf(path, "%s/%s", outDir, getDumpPerfFileName());
-        int fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP);
-        if (fd == -1) {
-            return errno;
+        if (dumpRawData) {
+            // raw records are dumped by memory copy which is already cheap
+            return 2;
         }
         Dumper* dumper = newDumper();
-        int mappingFd = -1;
-        if (dumper != nullptr && dumper->hasMapping()) {
-            memset(path, 0, dirPathLen + 64);
-            sprintf(path, "%s/%s", outDir, getDumpMappingFileName());
-            mappingFd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP);
+        if (dumper == nullptr) {
+            return 9;
         }
-        uint64_t curTime = current_boot_time_millis();
-        int result = mBuffer->dump(env, fd, mappingFd, type, version, curTime, extra, extraLen,
-                                   dumpRawData, dumper);
-        delete[] path;
-        delete dumper;
-        close(fd);
-        return result;
+        if (!dumper->hasHeader()) {
+            // segments are concatenated by rewriting their headers
+            delete dumper;
+            return 2;
+        }
+        std::lock_guard<std::mutex> lock(mFlusherLock);
+        if (mFlusher != nullptr) {
+            delete dumper;
+            return 0;
+        }
+        auto* flusher = new StreamFlusher<T>(mBuffer, dumper, dir, getDumpPerfFileName(),
+                                             {intervalMs, segmentBytes, maxSegments});
+        int result = flusher->start();
+        if (result != 0) {
+            delete flusher;
+            return result;
+        }
+        mFlusher = flusher;
+        return 0;
     }
 
-    int dumpPart(JNIEnv* env, const char* outDir, const char* extra, int32_t extraLen,
-                 int64_t startTicket, int64_t endTicket) override {
+    void stopStreaming() override {
+        std::lock_guard<std::mutex> lock(mFlusherLock);
+        delete mFlusher;
+        mFlusher = nullptr;
+    }
+
+protected:
+    PerfCollectorBaseImpl(PerfBuffer<T>* buffer) : mBuffer(buffer) {}
+
+    /**
+     * Open dump file and mapping file under outDir, and run dumpFn with them.
+     */
+    template<typename DumpFn>
+    int dumpToDir(const char* outDir, DumpFn dumpFn) {
         if (outDir == nullptr) {
             return 1;
         }
@@ -63,6 +124,7 @@ public:
         sprintf(path, "%s/%s", outDir, getDumpPerfFileName());
         int fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP);
         if (fd == -1) {
+            delete[] path;
             return errno;
         }
         Dumper* dumper = newDumper();
@@ -73,22 +135,18 @@ public:
             mappingFd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP);
         }
         uint64_t curTime = current_boot_time_millis();
-        int result = mBuffer->dumpPart(env, fd, mappingFd, type, version, curTime, extra, extraLen,
-                                       dumpRawData, dumper, startTicket, endTicket);
+        int result = dumpFn(fd, mappingFd, dumper, curTime);
         delete[] path;
         delete dumper;
         close(fd);
+        if (mappingFd != -1) {
+            close(mappingFd);
+        }
         return result;
     }
 
-    int64_t mark() override {
-        return mBuffer->mark();
-    }
-
-protected:
-    PerfCollectorBaseImpl(PerfBuffer<T>* buffer) : mBuffer(buffer) {}
-
     virtual ~PerfCollectorBaseImpl() override {
+        delete mFlusher;
         delete mBuffer;
     }
 
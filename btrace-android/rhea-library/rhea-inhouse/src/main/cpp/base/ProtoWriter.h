@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include "common_write.h"
+
+namespace rheatrace {
+
+/**
+ * Minimal protobuf encoder writing into a caller provided buffer, which must be large enough for
+ * everything written. Nested messages reserve a fixed 4 bytes redundant varint for their length,
+ * so that they can be written in one pass without knowing their size in advance.
+ */
+class ProtoWriter {
+public:
+    static constexpr uint32_t kNestedSizeBytes = 4;
+
+    explicit ProtoWriter(char* out) : mOut(out), mSize(0) {}
+
+    void writeVarint(uint32_t field, uint64_t value) {
+        writeTag(field, kWireVarint);
+        mSize += rheatrace::writeVarint(mOut + mSize, value);
+    }
+
+    void writeFixed64(uint32_t field, uint64_t value) {
+        writeTag(field, kWireFixed64);
+        for (uint32_t i = 0; i < sizeof(value); ++i) {
+            mOut[mSize++] = char(value >> (8 * i));
+        }
+    }
+
+    void writeBytes(uint32_t field, const void* data, uint32_t len) {
+        writeTag(field, kWireLengthDelimited);
+        mSize += rheatrace::writeVarint(mOut + mSize, len);
+        memcpy(mOut + mSize, data, len);
+        mSize += len;
+    }
+
+    void writeString(uint32_t field, const char* str) {
+        writeBytes(field, str, strlen(str));
+    }
+
+    struct Nested {
+        // offset of the tag, and of the reserved length
+        uint32_t begin;
+        uint32_t length;
+    };
+
+    Nested beginNested(uint32_t field) {
+        Nested nested{mSize, 0};
+        writeTag(field, kWireLengthDelimited);
+        nested.length = mSize;
+        mSize += kNestedSizeBytes;
+        return nested;
+    }
+
+    /**
+     * @param dropIfEmpty removes the whole field if nothing has been written into it.
+     */
+    void endNested(Nested nested, bool dropIfEmpty = false) {
+        uint32_t len = mSize - nested.length - kNestedSizeBytes;
+        if (len == 0 && dropIfEmpty) {
+            mSize = nested.begin;
+            return;
+        }
+        for (uint32_t i = 0; i < kNestedSizeBytes; ++i) {
+            uint8_t byte = (len >> (7 * i)) & 0x7f;
+            if (i + 1 < kNestedSizeBytes) {
+                byte |= 0x80;
+            }
+            mOut[nested.length + i] = char(byte);
+        }
+    }
+
+    uint32_t size() const {
+        return mSize;
+    }
+
+    /**
+     * @return upper bound of bytes taken by tag and varint of a field.
+     */
+    static constexpr uint32_t maxVarintFieldSize() {
+        return 2 + 10;
+    }
+
+    /**
+     * @return upper bound of bytes taken by tag and value of a fixed64 field.
+     */
+    static constexpr uint32_t maxFixed64FieldSize() {
+        return 2 + 8;
+    }
+
+    /**
+     * @return upper bound of bytes taken by tag and length of a length delimited field.
+     */
+    static constexpr uint32_t maxLengthFieldSize() {
+        return 2 + 5;
+    }
+
+private:
+    static constexpr uint32_t kWireVarint = 0;
+    static constexpr uint32_t kWireFixed64 = 1;
+    static constexpr uint32_t kWireLengthDelimited = 2;
+
+    void writeTag(uint32_t field, uint32_t wireType) {
+        mSize += rheatrace::writeVarint(mOut + mSize, (field << 3) | wireType);
+    }
+
+    char* mOut;
+    uint32_t mSize;
+};
+
+} // namespace rheatrace
@@ -19,6 +19,9 @@
 #include <iterator>
 #include <type_traits>
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
 #include <sys/mman.h>
 
 namespace rheatrace {
@@ -75,6 +78,15 @@ public:
         return true;
     }
 
+    bool committed(int64_t ticket) {
+        return true;
+    }
+
+    bool readAt(int64_t ticket, T& dest) {
+        memcpy(&dest, &data, sizeof(T));
+        return true;
+    }
+
     void atomicWrite(int64_t newTicket, T& value) {
         reinterpret_cast<std::atomic<T>*>(&data)->store(value, std::memory_order_release);
     }
@@ -103,7 +115,9 @@ public:
     }
 
     void write(int64_t newTicket, T& value) {
-        preTicket.store(newTicket, std::memory_order_release);
+        preTicket.store(newTicket, std::memory_order_relaxed);
+        // keep data stores after preTicket store, so that readAt() can detect torn slots
+        std::atomic_thread_fence(std::memory_order_release);
         memcpy(&data, &value, sizeof(T));
         postTicket.store(newTicket, std::memory_order_release);
     }
@@ -118,6 +132,24 @@ public:
         return false;
     }
 
+    bool committed(int64_t ticket) {
+        return postTicket.load(std::memory_order_acquire) == ticket &&
+               preTicket.load(std::memory_order_acquire) == ticket;
+    }
+
+    /**
+     * Seqlock style read which is safe against concurrent writers.
+     * @return false if slot doesn't hold record of ticket, or it was rewritten during copying.
+     */
+    bool readAt(int64_t ticket, T& dest) {
+        if (!committed(ticket)) {
+            return false;
+        }
+        memcpy(&dest, &data, sizeof(T));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return preTicket.load(std::memory_order_relaxed) == ticket;
+    }
+
     void atomicWrite(int64_t newTicket, T& value) {
         write(newTicket, value);
     }
@@ -193,6 +225,22 @@ public:
         return mSlots[index(ticket)].ref();
     }
 
+    /**
+     * @return true if writing of record with ticket has finished and it is not overwritten yet.
+     * Always true for slots without ticket guards.
+     */
+    bool isCommitted(int64_t ticket) {
+        return mSlots[index(ticket)].committed(ticket);
+    }
+
+    /**
+     * Copy record of ticket while writers may be running.
+     * @return false if record of ticket is being written or has been overwritten.
+     */
+    bool readAt(int64_t ticket, T& dest) {
+        return mSlots[index(ticket)].readAt(ticket, dest);
+    }
+
     // Find earliest ticket whose slot record time is great than or equal to target time
     // Note: We assume that RingBuffer have been protected from writing during searching.
     bool findTimeTicket(uint64_t startTimeMillis, int64_t endTicket, int64_t* outTicket) {
@@ -324,6 +372,15 @@ private:
         return buffer;
     }
 
+    /**
+     * Rebuild the buffer header at addr while keeping slots there, which were written by another
+     * process into a file backed buffer.
+     */
+    static RingBuffer<T>*
+    attachAt(uint32_t capacity, std::atomic<int64_t>& ticket, GetTimeFn<T> getTimeFn, void* addr) {
+        return new(addr) RingBuffer<T>(capacity, ticket, getTimeFn);
+    }
+
     explicit RingBuffer(uint32_t capacity, std::atomic<int64_t>& ticket, GetTimeFn<T> getTimeFn) noexcept
             :mCapacity(capacity), mTicket(ticket), mGetTimeFn(getTimeFn), mInConcurrentSafeMode(false) {}
 
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "PerfBuffer.h"
+
+namespace rheatrace {
+
+/**
+ * Background flusher which drains a PerfBuffer into rolling segment files periodically, so that a
+ * dump only needs to concatenate segments instead of encoding the whole buffer on caller's thread.
+ * Segments hold encoded records without file header, and the oldest ones are removed when there
+ * are more than maxSegments of them. Segments are split into blocks at every mark of the buffer,
+ * each block decodes on its own, so that a dump between two marks takes exactly the blocks
+ * between them.
+ */
+template<typename T>
+class StreamFlusher {
+public:
+    struct Options {
+        uint32_t intervalMs;
+        uint64_t segmentBytes;
+        uint32_t maxSegments;
+    };
+
+    /**
+     * @param dumper encoder of drained records, owned by flusher. It is kept for the whole stream
+     *     so that mapping covers every segment.
+     */
+    StreamFlusher(PerfBuffer<T>* buffer, Dumper* dumper, const char* dir, const char* name,
+                  Options options)
+            : mBuffer(buffer), mDumper(dumper), mPathPrefix(std::string(dir) + "/" + name),
+              mOptions(options), mCursors(buffer->shardCount(), 0), mSegmentFd(-1),
+              mNextSegmentIndex(0), mLastSplitToken(-1), mStopped(false) {
+        if (mOptions.intervalMs == 0) {
+            mOptions.intervalMs = 1000;
+        }
+        if (mOptions.maxSegments == 0) {
+            mOptions.maxSegments = 1;
+        }
+    }
+
+    ~StreamFlusher() {
+        stop();
+        for (auto& segment : mSegments) {
+            unlink(segmentPath(segment.index).c_str());
+        }
+        delete mDumper;
+    }
+
+    /**
+     * @return 0 if flusher thread is started, error code otherwise.
+     */
+    int start() {
+        std::lock_guard<std::mutex> lock(mLock);
+        int result = openSegment();
+        if (result != 0) {
+            return result;
+        }
+        mThread = std::thread(&StreamFlusher<T>::loop, this);
+        return 0;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mLock);
+            if (mStopped) {
+                return;
+            }
+            mStopped = true;
+        }
+        mCond.notify_all();
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+        std::lock_guard<std::mutex> lock(mLock);
+        if (mSegmentFd != -1) {
+            close(mSegmentFd);
+            mSegmentFd = -1;
+        }
+    }
+
+    /**
+     * Drain what is left in buffer, then write a dump file made of header and blocks that overlap
+     * with [startToken, endToken). Records still being written before endToken are waited for
+     * kInflightWaitMs at most, those which are not done by then are left to later segments.
+     */
+    int concat(JNIEnv* env, int fd, int mappingFd, uint32_t type, uint32_t version, uint64_t time,
+               const char* extra, int32_t extraLen, int64_t startToken, int64_t endToken) {
+        std::lock_guard<std::mutex> lock(mLock);
+        if (!mStopped) {
+            int64_t target = std::min(endToken, mBuffer->mark());
+            for (uint32_t waited = 0;; ++waited) {
+                int result = flushLocked(env);
+                if (result != 0) {
+                    return result;
+                }
+                if (mLastSplitToken >= target || waited >= kInflightWaitMs) {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        uint64_t count = 0;
+        for (auto& segment : mSegments) {
+            for (auto& block : segment.blocks) {
+                if (overlaps(block, startToken, endToken)) {
+                    count += block.count;
+                }
+            }
+        }
+        if (count == 0) {
+            return 8;
+        }
+        if (count > UINT32_MAX) {
+            return 10;
+        }
+        if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+            return 3;
+        }
+        std::vector<char> header(32 + std::max(extraLen, 0));
+        uint32_t headerSize = PerfBuffer<T>::writeHeader(header.data(), 0x01020304, type, version,
+                                                         time, count, extra, extraLen);
+        if (!PerfBuffer<T>::writeFully(fd, header.data(), headerSize)) {
+            return errno;
+        }
+        std::vector<char> chunk(kCopyChunkSize);
+        for (auto& segment : mSegments) {
+            int segmentFd = -1;
+            for (auto& block : segment.blocks) {
+                if (!overlaps(block, startToken, endToken)) {
+                    continue;
+                }
+                if (segmentFd == -1) {
+                    segmentFd = open(segmentPath(segment.index).c_str(), O_RDONLY);
+                    if (segmentFd == -1) {
+                        return errno;
+                    }
+                }
+                int result = copyRange(segmentFd, block.offset, block.bytes, fd, chunk);
+                if (result != 0) {
+                    close(segmentFd);
+                    return result;
+                }
+            }
+            if (segmentFd != -1) {
+                close(segmentFd);
+            }
+        }
+        if (mDumper->hasMapping() && mappingFd != -1) {
+            ftruncate(mappingFd, 0);
+            mDumper->dumpMapping(mappingFd);
+        }
+        return 0;
+    }
+
+private:
+    static constexpr uint32_t kCopyChunkSize = 128 * 1024;
+    static constexpr uint32_t kInflightWaitMs = 10;
+
+    /**
+     * Records of [startToken, endToken) at [offset, offset + bytes) of segment file, which starts
+     * with a fresh chunk of dumper.
+     */
+    struct Block {
+        int64_t startToken;
+        int64_t endToken;
+        int64_t offset;
+        int64_t bytes;
+        int64_t count;
+    };
+
+    struct Segment {
+        uint32_t index;
+        int64_t bytes;
+        std::vector<Block> blocks;
+    };
+
+    static bool overlaps(const Block& block, int64_t startToken, int64_t endToken) {
+        return block.count > 0 && block.endToken > startToken && block.startToken < endToken;
+    }
+
+    static int copyRange(int from, int64_t offset, int64_t bytes, int to,
+                         std::vector<char>& chunk) {
+        while (bytes > 0) {
+            ssize_t readBytes = pread(from, chunk.data(),
+                                      std::min(int64_t(chunk.size()), bytes), offset);
+            if (readBytes <= 0) {
+                return readBytes < 0 ? errno : 3;
+            }
+            if (!PerfBuffer<T>::writeFully(to, chunk.data(), readBytes)) {
+                return errno;
+            }
+            offset += readBytes;
+            bytes -= readBytes;
+        }
+        return 0;
+    }
+
+    std::string segmentPath(uint32_t index) {
+        return mPathPrefix + "-" + std::to_string(index) + ".seg";
+    }
+
+    int openSegment() {
+        uint32_t index = mNextSegmentIndex++;
+        mSegmentFd = open(segmentPath(index).c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                          S_IRUSR | S_IWUSR);
+        if (mSegmentFd == -1) {
+            return errno;
+        }
+        int64_t token = PerfBuffer<T>::cursorsToken(mCursors.data(), mCursors.size());
+        mSegments.push_back({index, 0, {}});
+        startBlock(token);
+        while (mSegments.size() > mOptions.maxSegments) {
+            unlink(segmentPath(mSegments.front().index).c_str());
+            mSegments.pop_front();
+        }
+        return 0;
+    }
+
+    void startBlock(int64_t token) {
+        auto& segment = mSegments.back();
+        if (!segment.blocks.empty() && segment.blocks.back().count == 0) {
+            segment.blocks.pop_back();
+        }
+        segment.blocks.push_back({token, token, segment.bytes, 0, 0});
+        mDumper->beginChunk();
+    }
+
+    /**
+     * Drain committed records into current block, up to limitTickets if not nullptr.
+     */
+    int drainLocked(JNIEnv* env, const int64_t* limitTickets) {
+        int64_t bytes;
+        int64_t count = mBuffer->drain(env, mSegmentFd, mDumper, mCursors.data(), &bytes,
+                                       limitTickets);
+        if (count < 0) {
+            return errno;
+        }
+        auto& segment = mSegments.back();
+        auto& block = segment.blocks.back();
+        segment.bytes += bytes;
+        block.count += count;
+        block.bytes += bytes;
+        block.endToken = std::max(block.endToken, PerfBuffer<T>::cursorsToken(mCursors.data(),
+                                                                             mCursors.size()));
+        return 0;
+    }
+
+    int flushLocked(JNIEnv* env) {
+        if (mSegmentFd == -1) {
+            return 11;
+        }
+        std::vector<typename PerfBuffer<T>::MarkSnapshot> marks;
+        mBuffer->marksAfter(mLastSplitToken, &marks);
+        for (auto& mark : marks) {
+            int result = drainLocked(env, mark.tickets.data());
+            if (result != 0) {
+                return result;
+            }
+            bool reached = true;
+            for (size_t i = 0; i < mCursors.size(); ++i) {
+                reached = reached && mCursors[i] >= mark.tickets[i];
+            }
+            if (!reached) {
+                // a record before the mark is still being written, records after the mark are
+                // left in buffer too so that they don't get into this block
+                return 0;
+            }
+            mSegments.back().blocks.back().endToken = mark.token;
+            startBlock(mark.token);
+            mLastSplitToken = mark.token;
+        }
+        int result = drainLocked(env, nullptr);
+        if (result != 0) {
+            return result;
+        }
+        if (mSegments.back().bytes >= int64_t(mOptions.segmentBytes)) {
+            close(mSegmentFd);
+            mSegmentFd = -1;
+            return openSegment();
+        }
+        return 0;
+    }
+
+    void loop() {
+        std::unique_lock<std::mutex> lock(mLock);
+        while (!mStopped) {
+            mCond.wait_for(lock, std::chrono::milliseconds(mOptions.intervalMs));
+            if (!mStopped) {
+                flushLocked(nullptr);
+            }
+        }
+    }
+
+    PerfBuffer<T>* mBuffer;
+    Dumper* mDumper;
+    const std::string mPathPrefix;
+    Options mOptions;
+    std::vector<int64_t> mCursors;
+    std::deque<Segment> mSegments;
+    int mSegmentFd;
+    uint32_t mNextSegmentIndex;
+    int64_t mLastSplitToken; // token of the last mark which blocks are split at
+    bool mStopped;
+    std::mutex mLock;
+    std::condition_variable mCond;
+    std::thread mThread;
+};
+
+} // namespace rheatrace
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace rheatrace {
+
+/**
+ * Coarse (ticket, time) index of a ring buffer. Writer of every kStride-th ticket records the time
+ * of its record, so that a time lookup only binary searches over a few index entries and then
+ * scans at most kStride slots, instead of searching the whole buffer.
+ */
+class TimeIndex {
+public:
+    static constexpr int64_t kStride = 64;
+
+private:
+    struct Entry {
+        std::atomic<int64_t> ticket;
+        std::atomic<uint64_t> time;
+    };
+
+    const uint32_t mCapacity;
+    Entry mEntries[];
+
+public:
+    static constexpr uint32_t entryCount(uint64_t bufferCapacity) {
+        // one more entry so that the oldest live records are still covered after wrapping
+        return uint32_t(bufferCapacity / kStride + 2);
+    }
+
+    static constexpr size_t calculateAllocationSize(uint64_t bufferCapacity) {
+        return sizeof(TimeIndex) + entryCount(bufferCapacity) * sizeof(Entry);
+    }
+
+    static TimeIndex* allocateAt(uint64_t bufferCapacity, void* addr) {
+        auto* index = new(addr) TimeIndex(entryCount(bufferCapacity));
+        for (uint32_t i = 0; i < index->mCapacity; ++i) {
+            new(&index->mEntries[i]) Entry();
+            index->mEntries[i].ticket.store(-1, std::memory_order_relaxed);
+        }
+        return index;
+    }
+
+    /**
+     * Reuse the index at addr with its entries, such as one recovered from a file.
+     */
+    static TimeIndex* attachAt(void* addr) {
+        return reinterpret_cast<TimeIndex*>(addr);
+    }
+
+    TimeIndex() = delete;
+    TimeIndex(TimeIndex const &) = delete;
+    TimeIndex &operator=(TimeIndex const &) = delete;
+
+    static bool shouldRecord(int64_t ticket) {
+        return (ticket & (kStride - 1)) == 0;
+    }
+
+    void record(int64_t ticket, uint64_t time) {
+        Entry& entry = mEntries[(ticket / kStride) % mCapacity];
+        entry.ticket.store(-1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        entry.time.store(time, std::memory_order_relaxed);
+        entry.ticket.store(ticket, std::memory_order_release);
+    }
+
+    /**
+     * Narrow down tickets in [startTicket, endTicket) to [*outLow, *outHigh), which contains the
+     * earliest record whose time is greater than or equal to time, assuming records are loosely
+     * time sorted.
+     * @return false if index doesn't cover the range, caller should fallback to other searches.
+     */
+    bool locate(uint64_t time, int64_t startTicket, int64_t endTicket, int64_t* outLow,
+                int64_t* outHigh) {
+        if (startTicket >= endTicket) {
+            return false;
+        }
+        int64_t low = (startTicket + kStride - 1) / kStride;
+        int64_t high = (endTicket - 1) / kStride;
+        if (low > high) {
+            return false;
+        }
+        // find the first entry whose time >= target
+        int64_t first = high + 1;
+        int64_t left = low, right = high;
+        while (left <= right) {
+            int64_t mid = left + (right - left) / 2;
+            uint64_t entryTime;
+            if (!timeAt(mid * kStride, &entryTime)) {
+                return false;
+            }
+            if (entryTime >= time) {
+                first = mid;
+                right = mid - 1;
+            } else {
+                left = mid + 1;
+            }
+        }
+        *outLow = first == low ? startTicket : (first - 1) * kStride;
+        *outHigh = first > high ? endTicket : first * kStride + 1;
+        return true;
+    }
+
+private:
+    explicit TimeIndex(uint32_t capacity) noexcept : mCapacity(capacity) {}
+
+    bool timeAt(int64_t ticket, uint64_t* time) {
+        Entry& entry = mEntries[(ticket / kStride) % mCapacity];
+        if (entry.ticket.load(std::memory_order_acquire) != ticket) {
+            return false;
+        }
+        *time = entry.time.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return entry.ticket.load(std::memory_order_relaxed) == ticket;
+    }
+};
+
+} // namespace rheatrace
@@ -27,4 +27,24 @@ uint32_t writeBuf(char* addr, T data) {
     return sizeof(T);
 }
 
+/**
+ * Write value as LEB128 varint, which takes at most 10 bytes.
+ */
+static inline uint32_t writeVarint(char* addr, uint64_t value) {
+    uint32_t size = 0;
+    while (value >= 0x80) {
+        addr[size++] = char((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    addr[size++] = char(value);
+    return size;
+}
+
+/**
+ * Write signed value as zigzag varint, so that small negative deltas stay small.
+ */
+static inline uint32_t writeZigzag(char* addr, int64_t value) {
+    return writeVarint(addr, (uint64_t(value) << 1) ^ uint64_t(value >> 63));
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,419 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "AggregationCollector.h"
+#include "SymbolCache.h"
+#include "../stat/JavaObjectStat.h"
+#include "../base/BufferedWriter.h"
+#include "../utils/time.h"
+#include "../utils/FastClock.h"
+#include "../utils/misc.h"
+
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <string>
+
+#define LOG_TAG "RheaTrace:Aggregation"
+#include "../utils/log.h"
+
+namespace rheatrace {
+
+AggregationCollector* AggregationCollector::sInstance = nullptr;
+thread_local AggregationCollector::ThreadPending AggregationCollector::sThreadPending;
+
+static constexpr uint32_t DEFAULT_CAPACITY = 64 * 1024;
+
+// root node of a stack is a pseudo frame encoding (type, thread class), which is far below any
+// valid ArtMethod address
+static constexpr uint32_t kThreadClassBits = 2;
+
+static inline uint64_t rootKey(SamplingType type, uint32_t threadClass) {
+    return ((uint64_t(type) << kThreadClassBits) | threadClass) + 1;
+}
+
+static const char* typeName(uint32_t type) {
+    static const char* kNames[] = {
+            "unknown", "invalid", "binder", "jankMessage", "custom", "traceStack", "wait", "park",
+            "monitor", "objectAllocation", "jniTrampoline", "gc", "mutex", "dispatchVsync",
+            "syncAndDrawFrame", "traceArg", "flush", "unpark", "scene", "gcInternal", "loadLibrary",
+            "nativePollOnce", "notify", "unlock",
+    };
+    return type < sizeof(kNames) / sizeof(kNames[0]) ? kNames[type] : "unknown";
+}
+
+static const char* threadClassName(uint32_t threadClass) {
+    switch (threadClass) {
+        case AggregationCollector::kMainThread:
+            return "main";
+        case AggregationCollector::kRenderThread:
+            return "render";
+        case AggregationCollector::kBinderThread:
+            return "binder";
+        default:
+            return "other";
+    }
+}
+
+/**
+ * Baseline of the previous sample of current thread, instant samples are weighted by the time
+ * elapsed since it.
+ */
+struct ThreadBaseline {
+    uint32_t session;
+    uint32_t threadClass;
+    uint64_t nano;
+    uint64_t cpuNano;
+    uint64_t allocatedBytes;
+};
+
+static thread_local ThreadBaseline sBaseline;
+
+static uint32_t classifyCurrentThread() {
+    if (is_main_thread()) {
+        return AggregationCollector::kMainThread;
+    }
+    char name[17] = {0};
+    if (prctl(PR_GET_NAME, name) != 0) {
+        return AggregationCollector::kOtherThread;
+    }
+    if (strcmp(name, "RenderThread") == 0) {
+        return AggregationCollector::kRenderThread;
+    }
+    if (strncmp(name, "binder:", 7) == 0 || strncmp(name, "HwBinder:", 9) == 0) {
+        return AggregationCollector::kBinderThread;
+    }
+    return AggregationCollector::kOtherThread;
+}
+
+AggregationCollector* AggregationCollector::create(JNIEnv* env, jlongArray rawConfig) {
+    if (sInstance == nullptr) {
+        uint32_t capacity = DEFAULT_CAPACITY;
+        bool exclusive = false;
+        auto length = env->GetArrayLength(rawConfig);
+        auto values = env->GetLongArrayElements(rawConfig, nullptr);
+        if (length > 0 && values[0] > 0) {
+            capacity = values[0];
+        }
+        if (length > 1) {
+            exclusive = values[1] != 0;
+        }
+        env->ReleaseLongArrayElements(rawConfig, values, JNI_ABORT);
+        StackTable* table = StackTable::create(capacity);
+        if (table == nullptr) {
+            return nullptr;
+        }
+        size_t metricsSize = sizeof(Metrics) * table->capacity();
+        void* memory = mmap(nullptr, metricsSize, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            delete table;
+            return nullptr;
+        }
+        ALOGI("aggregation capacity is %u, exclusive is %d", table->capacity(), exclusive);
+        // anonymous memory is zero filled, which means every metric starts from 0
+        sInstance = new AggregationCollector(table, reinterpret_cast<Metrics*>(memory),
+                                             metricsSize, exclusive);
+    }
+    return sInstance;
+}
+
+AggregationCollector::~AggregationCollector() {
+    delete mTable;
+    munmap(mMetrics, mMetricsSize);
+}
+
+void AggregationCollector::start(JNIEnv* env, jlongArray asyncConfigs) {
+    // interned nodes are kept, so that a new session doesn't need to grow table again
+    for (uint32_t i = 0; i < mTable->capacity(); ++i) {
+        Metrics& metrics = mMetrics[i];
+        metrics.count.store(0, std::memory_order_relaxed);
+        metrics.wallNanos.store(0, std::memory_order_relaxed);
+        metrics.cpuNanos.store(0, std::memory_order_relaxed);
+        metrics.allocatedBytes.store(0, std::memory_order_relaxed);
+    }
+    mDropped.store(0, std::memory_order_relaxed);
+    mSession.fetch_add(1, std::memory_order_release);
+    mPaused = false;
+}
+
+bool AggregationCollector::fold(SamplingType type, Stack& stack, bool captureAtEnd,
+                                uint64_t beginNano, uint64_t beginCpuNano, uint64_t currentNano) {
+    auto* collector = sInstance;
+    if (collector == nullptr || collector->mPaused) {
+        return false;
+    }
+    auto& baseline = sBaseline;
+    uint32_t session = collector->mSession.load(std::memory_order_acquire);
+    uint64_t nano = fast_clock::boot_time_nanos();
+    uint64_t cpuNano = current_thread_cpu_time_nanos();
+    uint64_t allocatedBytes = JavaObjectStat::getAllocatedObjectStat().bytes;
+    if (baseline.session != session) {
+        // the first sample of a thread only establishes the baseline
+        baseline = {session, classifyCurrentThread(), nano, cpuNano, allocatedBytes};
+    }
+    uint64_t wall;
+    uint64_t cpu;
+    if (captureAtEnd) {
+        wall = currentNano > beginNano ? currentNano - beginNano : 0;
+        // begin cpu time is 0 for wakeups, whose begin is when another thread blocked, and for
+        // scopes which began inside the java interval
+        cpu = beginCpuNano != 0 && cpuNano > beginCpuNano ? cpuNano - beginCpuNano : 0;
+    } else {
+        wall = nano - baseline.nano;
+        cpu = cpuNano - baseline.cpuNano;
+    }
+    uint64_t allocated = allocatedBytes - baseline.allocatedBytes;
+    baseline.nano = nano;
+    baseline.cpuNano = cpuNano;
+    baseline.allocatedBytes = allocatedBytes;
+    collector->add(type, stack, session, wall, cpu, allocated);
+    return true;
+}
+
+static inline void addRelaxed(std::atomic<uint64_t>& value, uint64_t delta) {
+    // only written by owner thread, no need of atomic read-modify-write
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+void AggregationCollector::add(SamplingType type, Stack& stack, uint32_t session,
+                               uint64_t wallNanos, uint64_t cpuNanos, uint64_t allocatedBytes) {
+    uint64_t root = rootKey(type, sBaseline.threadClass);
+    uint32_t id = mTable->insert(&root, 1, 0, nullptr);
+    if (id != 0) {
+        id = mTable->insert(stack.mStackMethods, std::min(stack.mSavedDepth, MAX_STACK_DEPTH), id,
+                            nullptr);
+    }
+    if (id == 0) {
+        mDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto& thread = sThreadPending;
+    if (!thread.registered) {
+        std::lock_guard<std::mutex> lock(mPendingLock);
+        mPendingList.push_back(&thread.pending);
+        thread.registered = true;
+    }
+    auto& pending = thread.pending;
+    uint32_t sequence = pending.sequence.load(std::memory_order_relaxed);
+    pending.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    if (pending.id.load(std::memory_order_relaxed) != id ||
+        pending.session.load(std::memory_order_relaxed) != session) {
+        flushPending(pending);
+        pending.session.store(session, std::memory_order_relaxed);
+        pending.id.store(id, std::memory_order_relaxed);
+    }
+    addRelaxed(pending.metrics.count, 1);
+    addRelaxed(pending.metrics.wallNanos, wallNanos);
+    addRelaxed(pending.metrics.cpuNanos, cpuNanos);
+    addRelaxed(pending.metrics.allocatedBytes, allocatedBytes);
+    pending.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void AggregationCollector::flushPending(PendingMetrics& pending) {
+    uint32_t id = pending.id.load(std::memory_order_relaxed);
+    uint64_t count = pending.metrics.count.load(std::memory_order_relaxed);
+    // metrics of previous sessions are cleared by start()
+    if (id != 0 && count != 0 && pending.session.load(std::memory_order_relaxed) ==
+                                 mSession.load(std::memory_order_acquire)) {
+        Metrics& metrics = mMetrics[id - 1];
+        metrics.count.fetch_add(count, std::memory_order_relaxed);
+        metrics.wallNanos.fetch_add(pending.metrics.wallNanos.load(std::memory_order_relaxed),
+                                    std::memory_order_relaxed);
+        metrics.cpuNanos.fetch_add(pending.metrics.cpuNanos.load(std::memory_order_relaxed),
+                                   std::memory_order_relaxed);
+        metrics.allocatedBytes.fetch_add(
+                pending.metrics.allocatedBytes.load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+    }
+    pending.id.store(0, std::memory_order_relaxed);
+    pending.metrics.count.store(0, std::memory_order_relaxed);
+    pending.metrics.wallNanos.store(0, std::memory_order_relaxed);
+    pending.metrics.cpuNanos.store(0, std::memory_order_relaxed);
+    pending.metrics.allocatedBytes.store(0, std::memory_order_relaxed);
+}
+
+void AggregationCollector::retirePending(PendingMetrics* pending) {
+    std::lock_guard<std::mutex> lock(mPendingLock);
+    flushPending(*pending);
+    mPendingList.erase(std::remove(mPendingList.begin(), mPendingList.end(), pending),
+                       mPendingList.end());
+}
+
+AggregationCollector::ThreadPending::~ThreadPending() {
+    if (registered && sInstance != nullptr) {
+        sInstance->retirePending(&pending);
+    }
+}
+
+std::unordered_map<uint32_t, AggregationCollector::Values> AggregationCollector::collectPending() {
+    std::unordered_map<uint32_t, Values> result;
+    uint32_t session = mSession.load(std::memory_order_acquire);
+    std::lock_guard<std::mutex> lock(mPendingLock);
+    for (auto* pending : mPendingList) {
+        uint32_t id;
+        Values values;
+        uint32_t before;
+        do {
+            before = pending->sequence.load(std::memory_order_acquire);
+            id = pending->session.load(std::memory_order_relaxed) == session
+                 ? pending->id.load(std::memory_order_relaxed) : 0;
+            values.count = pending->metrics.count.load(std::memory_order_relaxed);
+            values.wallNanos = pending->metrics.wallNanos.load(std::memory_order_relaxed);
+            values.cpuNanos = pending->metrics.cpuNanos.load(std::memory_order_relaxed);
+            values.allocatedBytes = pending->metrics.allocatedBytes.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((before & 1) != 0 || pending->sequence.load(std::memory_order_relaxed) != before);
+        if (id == 0 || values.count == 0) {
+            continue;
+        }
+        auto& merged = result[id];
+        merged.count += values.count;
+        merged.wallNanos += values.wallNanos;
+        merged.cpuNanos += values.cpuNanos;
+        merged.allocatedBytes += values.allocatedBytes;
+    }
+    return result;
+}
+
+static thread_local struct sigaction preSEGVAction;
+static thread_local jmp_buf dumpFoldedJmp;
+
+static void dumpFoldedSIGSEGVHandler(int signo, siginfo_t* info, void* context) {
+    if (sigaction(signo, &preSEGVAction, nullptr) != 0) {
+        ALOGE("unregister signal %d handler failed: %m", signo);
+    }
+    siglongjmp(dumpFoldedJmp, 1);
+}
+
+int AggregationCollector::dump(JNIEnv* env, const char* outDir, const char* extra,
+                               int32_t extraLen) {
+    if (outDir == nullptr) {
+        return 1;
+    }
+    std::string path = std::string(outDir) + "/sampling-folded";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP);
+    if (fd == -1) {
+        return errno;
+    }
+    struct sigaction act{};
+    act.sa_flags = SA_SIGINFO;
+    act.sa_sigaction = dumpFoldedSIGSEGVHandler;
+    if (sigaction(SIGSEGV, &act, &preSEGVAction) != 0) {
+        ALOGE("sigaction failed.");
+        close(fd);
+        return 3;
+    }
+    int result;
+    if (sigsetjmp(dumpFoldedJmp, 1) == 0) {
+        result = writeFolded(fd, extra, extraLen) ? 0 : 4;
+        if (sigaction(SIGSEGV, &preSEGVAction, nullptr) != 0) {
+            ALOGE("restore SIGSEGV handler failed: %m");
+        }
+    } else {
+        result = 5;
+    }
+    close(fd);
+    return result;
+}
+
+/**
+ * Every line is "type;threadClass;outermost frame;...;innermost frame count wallNs cpuNs
+ * allocatedBytes", which is the folded stack format with 3 extra value columns. Symbols may
+ * contain spaces, so values are the last 4 columns. Header lines start with '#'.
+ */
+bool AggregationCollector::writeFolded(int fd, const char* extra, int32_t extraLen) {
+    auto begin = current_boot_time_millis();
+    BufferedWriter writer(fd);
+    // a stack folded again while dumping may be counted in both pending and shared metrics, which
+    // is as loose as reading shared metrics of a running session anyway
+    auto pending = collectPending();
+    uint64_t dropped = mDropped.load(std::memory_order_relaxed);
+    uint64_t samples = dropped;
+    for (uint32_t i = 0; i < mTable->capacity(); ++i) {
+        samples += mMetrics[i].count.load(std::memory_order_relaxed);
+    }
+    for (auto& item : pending) {
+        samples += item.second.count;
+    }
+    char line[128];
+    int len = snprintf(line, sizeof(line), "# version 1, samples %" PRIu64 ", dropped %" PRIu64 "\n",
+                       samples, dropped);
+    writer.write(line, len);
+    if (extra != nullptr && extraLen > 0) {
+        writer.write("# ", 2);
+        writer.write(extra, extraLen);
+        writer.write("\n", 1);
+    }
+    auto& symbols = SymbolCache::instance();
+    uint64_t methods[MAX_STACK_DEPTH + 1];
+    uint32_t stacks = 0;
+    for (uint32_t id = 1; id <= mTable->capacity(); ++id) {
+        Metrics& metrics = mMetrics[id - 1];
+        Values values{metrics.count.load(std::memory_order_relaxed),
+                      metrics.wallNanos.load(std::memory_order_relaxed),
+                      metrics.cpuNanos.load(std::memory_order_relaxed),
+                      metrics.allocatedBytes.load(std::memory_order_relaxed)};
+        auto it = pending.find(id);
+        if (it != pending.end()) {
+            values.count += it->second.count;
+            values.wallNanos += it->second.wallNanos;
+            values.cpuNanos += it->second.cpuNanos;
+            values.allocatedBytes += it->second.allocatedBytes;
+        }
+        if (values.count == 0) {
+            continue;
+        }
+        // collect frames from innermost to root
+        uint32_t depth = 0;
+        uint32_t nodeId = id;
+        uint32_t parent;
+        while (depth <= MAX_STACK_DEPTH && mTable->getNode(nodeId, &parent, methods + depth)) {
+            depth++;
+            nodeId = parent;
+        }
+        if (depth == 0 || nodeId != 0) {
+            continue;
+        }
+        uint64_t root = methods[depth - 1] - 1;
+        const char* type = typeName(root >> kThreadClassBits);
+        const char* threadClass = threadClassName(root & ((1u << kThreadClassBits) - 1));
+        writer.write(type, strlen(type));
+        writer.write(";", 1);
+        writer.write(threadClass, strlen(threadClass));
+        for (int64_t i = int64_t(depth) - 2; i >= 0; --i) {
+            const std::string& symbol = symbols.get(methods[i]);
+            writer.write(";", 1);
+            writer.write(symbol.c_str(), symbol.length());
+        }
+        len = snprintf(line, sizeof(line), " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+                       values.count, values.wallNanos, values.cpuNanos, values.allocatedBytes);
+        writer.write(line, len);
+        stacks++;
+    }
+    bool success = writer.flush();
+    ALOGD("dump %u folded stacks of %u nodes cost %lums", stacks, mTable->size(),
+          current_boot_time_millis() - begin);
+    return success;
+}
+
+} // namespace rheatrace
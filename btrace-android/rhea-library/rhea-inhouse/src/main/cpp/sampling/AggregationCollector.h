@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <jni.h>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "../base/PerfCollector.h"
+#include "SamplingRecord.h"
+#include "Stack.h"
+#include "StackTable.h"
+
+namespace rheatrace {
+
+/**
+ * Collector folding samples into a flame graph instead of keeping every record. Stacks captured
+ * by SamplingCollector are interned into a fixed size StackTable, whose roots are keyed by
+ * sampling type and thread class, and every stack accumulates sample count, wall time, cpu time
+ * and allocated bytes on its innermost node. Memory is fixed at creation no matter how long the
+ * session lasts, and the dump is a folded stack text file. A thread keeps metrics of the stack it
+ * folded last to itself until it folds another one, so repeated samples of the same stack don't
+ * touch shared counters.
+ */
+class AggregationCollector : public PerfCollector {
+public:
+    enum ThreadClass : uint32_t {
+        kMainThread = 0,
+        kRenderThread,
+        kBinderThread,
+        kOtherThread,
+    };
+
+    static AggregationCollector* create(JNIEnv* env, jlongArray configs);
+
+    static AggregationCollector* getInstance() {
+        return sInstance;
+    }
+
+    /**
+     * Fold a stack captured by SamplingCollector.
+     * @return false if aggregation is not running.
+     */
+    static bool fold(SamplingType type, Stack& stack, bool captureAtEnd, uint64_t beginNano,
+                     uint64_t beginCpuNano, uint64_t currentNano);
+
+    /**
+     * @return true if SamplingCollector should not keep raw records of folded stacks.
+     */
+    static bool exclusive() {
+        auto* collector = sInstance;
+        return collector != nullptr && !collector->mPaused && collector->mExclusive;
+    }
+
+    void start(JNIEnv* env, jlongArray asyncConfigs) override;
+
+    void updateConfigs(JNIEnv* env, jlongArray configs) override {}
+
+    int dump(JNIEnv* env, const char* outDir, const char* extra, int32_t extraLen) override;
+
+    /**
+     * Aggregated data has no ticket, the whole aggregation since start is dumped.
+     */
+    int dumpPart(JNIEnv* env, const char* outDir, const char* extra, int32_t extraLen,
+                 int64_t startTicket, int64_t endTicket) override {
+        return dump(env, outDir, extra, extraLen);
+    }
+
+    int dumpTimeWindows(JNIEnv* env, const char* outDir, const char* extra, int32_t extraLen,
+                        int64_t endTicket, const uint64_t* windows,
+                        uint32_t windowCount) override {
+        // time is folded away
+        return 2;
+    }
+
+    int64_t mark() override {
+        return 0;
+    }
+
+    int startStreaming(const char* dir, uint32_t intervalMs, uint64_t segmentBytes,
+                       uint32_t maxSegments) override {
+        // aggregation is already small enough to be dumped at once
+        return 2;
+    }
+
+    void stopStreaming() override {}
+
+    void stop() override {
+        mPaused = true;
+    }
+
+private:
+    struct Metrics {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> wallNanos;
+        std::atomic<uint64_t> cpuNanos;
+        std::atomic<uint64_t> allocatedBytes;
+    };
+
+    struct Values {
+        uint64_t count;
+        uint64_t wallNanos;
+        uint64_t cpuNanos;
+        uint64_t allocatedBytes;
+    };
+
+    /**
+     * Metrics of the stack a thread folded last, which are only written by that thread. Dump reads
+     * them by seqlock.
+     */
+    struct PendingMetrics {
+        // odd while the owner is updating
+        std::atomic<uint32_t> sequence;
+        std::atomic<uint32_t> session;
+        std::atomic<uint32_t> id;
+        Metrics metrics;
+    };
+
+    /**
+     * Pending metrics of current thread, added to shared ones when the thread exits.
+     */
+    struct ThreadPending {
+        PendingMetrics pending{};
+        bool registered = false;
+
+        ~ThreadPending();
+    };
+
+    AggregationCollector(StackTable* table, Metrics* metrics, size_t metricsSize, bool exclusive)
+            : mTable(table), mMetrics(metrics), mMetricsSize(metricsSize), mExclusive(exclusive),
+              mPaused(true), mSession(0), mDropped(0) {}
+
+    ~AggregationCollector() override;
+
+    void add(SamplingType type, Stack& stack, uint32_t session, uint64_t wallNanos,
+             uint64_t cpuNanos, uint64_t allocatedBytes);
+
+    /**
+     * Add pending metrics to shared ones if they are of current session.
+     */
+    void flushPending(PendingMetrics& pending);
+
+    void retirePending(PendingMetrics* pending);
+
+    /**
+     * @return pending metrics of current session of every live thread, keyed by node id.
+     */
+    std::unordered_map<uint32_t, Values> collectPending();
+
+    bool writeFolded(int fd, const char* extra, int32_t extraLen);
+
+    static AggregationCollector* sInstance;
+    static thread_local ThreadPending sThreadPending;
+    StackTable* mTable;
+    // metrics of stacks indexed by node id - 1, same capacity as table
+    Metrics* mMetrics;
+    const size_t mMetricsSize;
+    const bool mExclusive;
+    volatile bool mPaused;
+    // bumped by every start, tells per-thread baselines of previous sessions from current ones
+    std::atomic<uint32_t> mSession;
+    // samples whose stack doesn't fit into table
+    std::atomic<uint64_t> mDropped;
+    std::mutex mPendingLock;
+    std::vector<PendingMetrics*> mPendingList;
+};
+
+} // namespace rheatrace
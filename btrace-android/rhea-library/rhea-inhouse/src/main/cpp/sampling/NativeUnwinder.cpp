@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "NativeUnwinder.h"
+
+#include <dlfcn.h>
+#include <link.h>
+#include <pthread.h>
+#include <algorithm>
+
+#define LOG_TAG "RheaTrace:NativeUnwinder"
+#include "../utils/log.h"
+
+namespace rheatrace {
+
+#if defined(__aarch64__) || defined(__x86_64__)
+#define RHEA_FRAME_POINTER_UNWIND 1
+#endif
+
+// top of the stack of current thread, 0 if not known yet
+static thread_local uintptr_t sStackHigh = 0;
+
+static uintptr_t sSelfLow = 0;
+static uintptr_t sSelfHigh = 0;
+
+static inline uintptr_t stripPointerAuth(uintptr_t pc) {
+#if defined(__aarch64__)
+    // return addresses may be signed by PAC, user space addresses never use the top bits
+    return pc & ((uintptr_t(1) << 48) - 1);
+#else
+    return pc;
+#endif
+}
+
+/**
+ * Only the high bound is taken from thread attributes. Their low bound includes the guard pages
+ * below the stack, the frame of the caller is used as low bound instead.
+ */
+static bool currentStackHigh(uintptr_t& high) {
+    if (high != 0) {
+        return true;
+    }
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+        return false;
+    }
+    void* addr = nullptr;
+    size_t size = 0;
+    int result = pthread_attr_getstack(&attr, &addr, &size);
+    pthread_attr_destroy(&attr);
+    if (result != 0 || addr == nullptr || size == 0) {
+        return false;
+    }
+    high = reinterpret_cast<uintptr_t>(addr) + size;
+    return true;
+}
+
+static int findSelfRange(struct dl_phdr_info* info, size_t, void* data) {
+    auto probe = reinterpret_cast<uintptr_t>(data);
+    uintptr_t low = UINTPTR_MAX;
+    uintptr_t high = 0;
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const auto& phdr = info->dlpi_phdr[i];
+        if (phdr.p_type != PT_LOAD) {
+            continue;
+        }
+        uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+        low = std::min(low, start);
+        high = std::max(high, uintptr_t(start + phdr.p_memsz));
+    }
+    if (probe >= low && probe < high) {
+        sSelfLow = low;
+        sSelfHigh = high;
+        return 1;
+    }
+    return 0;
+}
+
+bool NativeUnwinder::init() {
+#ifndef RHEA_FRAME_POINTER_UNWIND
+    ALOGW("native stacks are not supported on this abi");
+    return false;
+#endif
+    if (sSelfHigh != 0) {
+        return true;
+    }
+    dl_iterate_phdr(findSelfRange, reinterpret_cast<void*>(&NativeUnwinder::unwind));
+    if (sSelfHigh == 0) {
+        ALOGE("find code range of self failed");
+        return false;
+    }
+    return true;
+}
+
+uint32_t NativeUnwinder::walkFramePointers(uintptr_t fp, uintptr_t stackLow, uintptr_t stackHigh,
+                                           uint64_t* pcs, uint32_t maxDepth) {
+    uint32_t depth = 0;
+    while (depth < maxDepth) {
+        if (fp < stackLow || fp > stackHigh - 2 * sizeof(uintptr_t) ||
+            (fp & (sizeof(uintptr_t) - 1)) != 0) {
+            break;
+        }
+        auto* record = reinterpret_cast<const uintptr_t*>(fp);
+        uintptr_t next = record[0];
+        uintptr_t pc = stripPointerAuth(record[1]);
+        if (pc == 0) {
+            break;
+        }
+        pcs[depth++] = pc;
+        // stack grows down, so frames of callers must be at higher addresses
+        if (next <= fp) {
+            break;
+        }
+        fp = next;
+    }
+    return depth;
+}
+
+uint32_t NativeUnwinder::unwind(uint64_t* pcs, uint32_t maxDepth) {
+#ifndef RHEA_FRAME_POINTER_UNWIND
+    return 0;
+#endif
+    if (!currentStackHigh(sStackHigh)) {
+        return 0;
+    }
+    uint64_t frames[kMaxDepth];
+    // frames of this library are skipped, so walk a bit more than asked for
+    uint32_t limit = std::min(kMaxDepth, maxDepth + 16);
+    auto fp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+    uint32_t depth = walkFramePointers(fp, fp, sStackHigh, frames, limit);
+    uint32_t first = 0;
+    while (first < depth && frames[first] >= sSelfLow && frames[first] < sSelfHigh) {
+        first++;
+    }
+    uint32_t count = std::min(depth - first, maxDepth);
+    std::copy(frames + first, frames + first + count, pcs);
+    return count;
+}
+
+} // namespace rheatrace
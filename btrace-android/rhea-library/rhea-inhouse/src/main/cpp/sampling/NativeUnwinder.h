@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace rheatrace {
+
+/**
+ * Frame pointer based unwinder of native stacks. It follows the chain of frame records
+ * {previous frame pointer, return address}, which has the same layout on aarch64 and x86_64, and
+ * stops as soon as a frame pointer leaves the stack of current thread, so it never reads wild
+ * memory. Frames of libraries built without frame pointers are simply missing. Only aarch64 and
+ * x86_64 are supported, frame records of arm32 differ between arm and thumb code.
+ */
+class NativeUnwinder {
+public:
+    static constexpr uint32_t kMaxDepth = 64;
+
+    /**
+     * Find out code range of this library, whose frames are skipped by unwind().
+     * @return false if unwinding is not supported or the range is not found.
+     */
+    static bool init();
+
+    /**
+     * Unwind stack of current thread, starting from the first frame outside of this library.
+     * @return count of return addresses written into pcs, ordered from callee to caller.
+     */
+    static uint32_t unwind(uint64_t* pcs, uint32_t maxDepth);
+
+    /**
+     * Walk frame records starting from fp, within [stackLow, stackHigh). Frame pointers must be
+     * aligned and strictly increasing.
+     * @return count of return addresses written into pcs.
+     */
+    static uint32_t walkFramePointers(uintptr_t fp, uintptr_t stackLow, uintptr_t stackHigh,
+                                      uint64_t* pcs, uint32_t maxDepth);
+};
+
+} // namespace rheatrace
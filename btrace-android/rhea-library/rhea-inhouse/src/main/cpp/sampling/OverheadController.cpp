@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "OverheadController.h"
+#include "SamplingThreadState.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+namespace rheatrace {
+
+static inline uint64_t movingAverage(uint64_t average, uint64_t sample) {
+    return average == 0 ? sample : average - average / 8 + sample / 8;
+}
+
+void OverheadController::configure(uint32_t threadBudget, uint32_t globalBudget) {
+    mThreadBudget.store(std::min(threadBudget, kBudgetUnit), std::memory_order_relaxed);
+    mGlobalBudget.store(std::min(globalBudget, kBudgetUnit), std::memory_order_relaxed);
+    if (globalBudget == 0) {
+        mScale.store(kScaleUnit, std::memory_order_relaxed);
+    }
+}
+
+uint64_t OverheadController::adjustInterval(uint64_t intervalNs, bool mainThread) {
+    uint64_t result = intervalNs;
+    uint32_t threadBudget = mThreadBudget.load(std::memory_order_relaxed);
+    if (threadBudget != 0) {
+        // cost / interval <= budget
+        result = std::max(result, sThreadState.averageCostNs * kBudgetUnit / threadBudget);
+    }
+    uint32_t scale = mScale.load(std::memory_order_relaxed);
+    if (scale != kScaleUnit) {
+        result = result / kScaleUnit * scale;
+    }
+    if (mainThread) {
+        mMainIntervalNs.store(result, std::memory_order_relaxed);
+    }
+    return result;
+}
+
+uint64_t OverheadController::minSampleGap() {
+    uint64_t cost = sThreadState.averageCostNs;
+    uint64_t result = 0;
+    uint32_t threadBudget = mThreadBudget.load(std::memory_order_relaxed);
+    if (threadBudget != 0) {
+        result = cost * kBudgetUnit / threadBudget;
+    }
+    uint32_t globalBudget = mGlobalBudget.load(std::memory_order_relaxed);
+    if (globalBudget != 0) {
+        // a single thread never takes more than the whole process may
+        result = std::max(result, cost * kBudgetUnit / globalBudget);
+    }
+    uint32_t scale = mScale.load(std::memory_order_relaxed);
+    if (scale != kScaleUnit) {
+        result = result / kScaleUnit * scale;
+    }
+    return result;
+}
+
+void OverheadController::onRequestDone(uint64_t beginNano, uint64_t endNano) {
+    if (endNano <= beginNano) {
+        return;
+    }
+    uint64_t cost = endNano - beginNano;
+    auto& state = sThreadState;
+    state.averageCostNs = movingAverage(state.averageCostNs, cost);
+    state.pendingCostNs += cost;
+    state.pendingRequests++;
+    if (state.foldBeginNano == 0) {
+        state.foldBeginNano = beginNano;
+    }
+    if (endNano - state.foldBeginNano >= kFoldNs) {
+        fold(state, endNano);
+    }
+}
+
+void OverheadController::fold(SamplingThreadState& state, uint64_t now) {
+    uint64_t cost = state.pendingCostNs;
+    uint32_t requests = state.pendingRequests;
+    state.pendingCostNs = 0;
+    state.pendingRequests = 0;
+    state.foldBeginNano = now;
+    // racy update is fine, it is only reported
+    mAverageCostNs.store(movingAverage(mAverageCostNs.load(std::memory_order_relaxed),
+                                       cost / requests), std::memory_order_relaxed);
+    mRequests.fetch_add(requests, std::memory_order_relaxed);
+    if (mGlobalBudget.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    mWindowCost.fetch_add(cost, std::memory_order_relaxed);
+    uint64_t windowBegin = mWindowBegin.load(std::memory_order_relaxed);
+    if (windowBegin == 0) {
+        mWindowBegin.compare_exchange_strong(windowBegin, now, std::memory_order_relaxed);
+    } else if (now - windowBegin >= kWindowNs &&
+               mWindowBegin.compare_exchange_strong(windowBegin, now,
+                                                    std::memory_order_relaxed)) {
+        // only the thread which wins the exchange finishes the window
+        finishWindow(windowBegin, now);
+    }
+}
+
+void OverheadController::finishWindow(uint64_t windowBegin, uint64_t now) {
+    uint64_t cost = mWindowCost.exchange(0, std::memory_order_relaxed);
+    uint64_t usage = cost * kBudgetUnit / (now - windowBegin);
+    mLastUsage.store(uint32_t(std::min(usage, uint64_t(UINT32_MAX))), std::memory_order_relaxed);
+    uint32_t budget = mGlobalBudget.load(std::memory_order_relaxed);
+    if (budget == 0) {
+        return;
+    }
+    uint64_t scale = mScale.load(std::memory_order_relaxed);
+    if (usage > budget) {
+        // intervals grow in proportion to overuse, so that next window is around budget
+        scale = std::min(uint64_t(kMaxScale), scale * usage / budget + 1);
+    } else if (usage * 2 < budget) {
+        // narrow back slowly to avoid oscillation
+        scale = std::max(uint64_t(kScaleUnit), scale * 3 / 4);
+    }
+    mScale.store(uint32_t(scale), std::memory_order_relaxed);
+}
+
+std::string OverheadController::appendStats(const char* extra, int32_t extraLen) {
+    std::string result = extra == nullptr || extraLen <= 0 ? "" : std::string(extra, extraLen);
+    if (!enabled()) {
+        return result;
+    }
+    char stats[256];
+    snprintf(stats, sizeof(stats),
+             "\"samplingOverhead\":{\"threadBudget\":%u,\"globalBudget\":%u,\"scale\":%.3f,"
+             "\"usage\":%u,\"averageCostNs\":%" PRIu64 ",\"mainIntervalNs\":%" PRIu64
+             ",\"requests\":%" PRIu64 "}",
+             mThreadBudget.load(std::memory_order_relaxed),
+             mGlobalBudget.load(std::memory_order_relaxed),
+             double(mScale.load(std::memory_order_relaxed)) / kScaleUnit,
+             mLastUsage.load(std::memory_order_relaxed),
+             mAverageCostNs.load(std::memory_order_relaxed),
+             mMainIntervalNs.load(std::memory_order_relaxed),
+             mRequests.load(std::memory_order_relaxed));
+    size_t end = result.find_last_not_of(" \t\r\n");
+    if (end == std::string::npos) {
+        return std::string("{") + stats + "}";
+    }
+    if (result[end] != '}') {
+        // not a json object, leave it as it is
+        return result;
+    }
+    size_t last = end == 0 ? std::string::npos : result.find_last_not_of(" \t\r\n", end - 1);
+    bool empty = last == std::string::npos || result[last] == '{';
+    result.insert(end, empty ? std::string(stats) : std::string(",") + stats);
+    return result;
+}
+
+} // namespace rheatrace
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace rheatrace {
+
+struct SamplingThreadState;
+
+/**
+ * Keep cost of sampling under a CPU budget by widening sampling intervals. Budgets are in units of
+ * 1/10000 of one CPU, 0 disables the corresponding limit.
+ *
+ * Thread budget bounds the interval of each thread by its own average cost per request, while
+ * global budget scales intervals of all threads by the measured cost of the whole process. Costs
+ * are summed per thread and folded into the process wide window every kFoldNs, so that a request
+ * doesn't touch shared counters.
+ */
+class OverheadController {
+public:
+    static constexpr uint32_t kBudgetUnit = 10000;
+
+    void configure(uint32_t threadBudget, uint32_t globalBudget);
+
+    bool enabled() const {
+        return mThreadBudget.load(std::memory_order_relaxed) != 0 ||
+               mGlobalBudget.load(std::memory_order_relaxed) != 0;
+    }
+
+    /**
+     * @return interval which current thread should use instead of intervalNs.
+     */
+    uint64_t adjustInterval(uint64_t intervalNs, bool mainThread);
+
+    /**
+     * @return minimum time between two samples of current thread which are not gated by interval,
+     *     like allocations sampled by bytes, so that their cost stays under budget.
+     */
+    uint64_t minSampleGap();
+
+    /**
+     * Account cost of a request of current thread which started at beginNano and finished at
+     * endNano.
+     */
+    void onRequestDone(uint64_t beginNano, uint64_t endNano);
+
+    /**
+     * Append current state as a json object member named samplingOverhead to extra, which is
+     * supposed to be a json object or empty.
+     */
+    std::string appendStats(const char* extra, int32_t extraLen);
+
+private:
+    static constexpr uint64_t kWindowNs = 100 * 1000 * 1000;
+    static constexpr uint64_t kFoldNs = 10 * 1000 * 1000;
+    static constexpr uint32_t kScaleUnit = 1000;
+    static constexpr uint32_t kMaxScale = 64 * kScaleUnit;
+
+    void fold(SamplingThreadState& state, uint64_t now);
+
+    void finishWindow(uint64_t windowBegin, uint64_t now);
+
+    std::atomic<uint32_t> mThreadBudget{0};
+    std::atomic<uint32_t> mGlobalBudget{0};
+    std::atomic<uint64_t> mWindowBegin{0};
+    std::atomic<uint64_t> mWindowCost{0};
+    // multiplier of intervals in 1/kScaleUnit
+    std::atomic<uint32_t> mScale{kScaleUnit};
+    // cost of the last finished window in budget unit
+    std::atomic<uint32_t> mLastUsage{0};
+    std::atomic<uint64_t> mAverageCostNs{0};
+    std::atomic<uint64_t> mMainIntervalNs{0};
+    std::atomic<uint64_t> mRequests{0};
+};
+
+} // namespace rheatrace
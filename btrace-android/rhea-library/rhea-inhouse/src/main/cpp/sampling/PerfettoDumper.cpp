@@ -0,0 +1,542 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "PerfettoDumper.h"
+#include "SymbolCache.h"
+#include "../trace/TraceThreadName.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cinttypes>
+#include <vector>
+
+#define LOG_TAG "RheaTrace:Perfetto"
+#include "../utils/log.h"
+
+namespace rheatrace {
+
+// field numbers of perfetto protos used here
+static constexpr uint32_t kTracePacket = 1;
+namespace packet {
+static constexpr uint32_t kTimestamp = 8;
+static constexpr uint32_t kTrustedPacketSequenceId = 10;
+static constexpr uint32_t kTrackEvent = 11;
+static constexpr uint32_t kInternedData = 12;
+static constexpr uint32_t kSequenceFlags = 13;
+static constexpr uint32_t kTrackDescriptor = 60;
+static constexpr uint32_t kPerfSample = 66;
+static constexpr uint32_t kSeqIncrementalStateCleared = 1;
+static constexpr uint32_t kSeqNeedsIncrementalState = 2;
+}
+namespace interned {
+static constexpr uint32_t kEventNames = 2;
+static constexpr uint32_t kDebugAnnotationNames = 3;
+static constexpr uint32_t kFunctionNames = 5;
+static constexpr uint32_t kFrames = 6;
+static constexpr uint32_t kCallstacks = 7;
+static constexpr uint32_t kMappingPaths = 17;
+static constexpr uint32_t kMappings = 19;
+}
+namespace track {
+static constexpr uint32_t kUuid = 1;
+static constexpr uint32_t kName = 2;
+static constexpr uint32_t kProcess = 3;
+static constexpr uint32_t kThread = 4;
+static constexpr uint32_t kParentUuid = 5;
+static constexpr uint32_t kProcessPid = 1;
+static constexpr uint32_t kProcessName = 6;
+static constexpr uint32_t kThreadPid = 1;
+static constexpr uint32_t kThreadTid = 2;
+static constexpr uint32_t kThreadName = 5;
+}
+namespace event {
+static constexpr uint32_t kDebugAnnotations = 4;
+static constexpr uint32_t kType = 9;
+static constexpr uint32_t kNameIid = 10;
+static constexpr uint32_t kTrackUuid = 11;
+static constexpr uint32_t kFlowIds = 47;
+static constexpr uint32_t kTerminatingFlowIds = 48;
+static constexpr uint32_t kTypeSliceBegin = 1;
+static constexpr uint32_t kTypeSliceEnd = 2;
+static constexpr uint32_t kTypeInstant = 3;
+}
+// iid fields of interned messages, and fields of Frame, Mapping, Callstack and PerfSample
+static constexpr uint32_t kIid = 1;
+static constexpr uint32_t kInternedString = 2;
+static constexpr uint32_t kEventName = 2;
+static constexpr uint32_t kFrameFunctionNameId = 2;
+static constexpr uint32_t kFrameMappingId = 3;
+static constexpr uint32_t kFrameRelPc = 4;
+static constexpr uint32_t kMappingStart = 4;
+static constexpr uint32_t kMappingPathStringIds = 7;
+static constexpr uint32_t kCallstackFrameIds = 2;
+static constexpr uint32_t kSamplePid = 2;
+static constexpr uint32_t kSampleTid = 3;
+static constexpr uint32_t kSampleCallstackIid = 4;
+static constexpr uint32_t kAnnotationNameIid = 1;
+static constexpr uint32_t kAnnotationUintValue = 3;
+
+static constexpr uint32_t kSequenceId = 0x52686561;
+// keep uuids of our tracks away from those of a concatenated system trace
+static constexpr uint64_t kUuidSalt = 0x5268000000000000ULL;
+static constexpr uint64_t kThreadUuidFlag = 1ULL << 32;
+static constexpr uint32_t kMaxSymbolLength = 256;
+static constexpr uint32_t kMaxPathLength = 128;
+static constexpr uint32_t kMaxFrames = MAX_STACK_DEPTH + NativeUnwinder::kMaxDepth;
+// wakee tid, blocked time, sampled bytes and perf counters
+static constexpr uint32_t kMaxAnnotations = 3 + PerfEventCounters::kCounterCount;
+static constexpr uint32_t kMaxAnnotationNameLength = 32;
+
+// names of perf counters in the order of PerfEventCounters::Counter
+static const char* const kCounterNames[] = {
+        "context_switches", "major_faults", "cpu_migrations", "instructions", "cycles",
+};
+static_assert(sizeof(kCounterNames) / sizeof(kCounterNames[0]) ==
+              PerfEventCounters::kCounterCount, "a name for every perf counter");
+
+static const char* typeName(SamplingType type) {
+    static const char* kNames[] = {
+            "unknown", "invalid", "binder", "jankMessage", "custom", "traceStack", "wait", "park",
+            "monitor", "objectAllocation", "jniTrampoline", "gc", "mutex", "dispatchVsync",
+            "syncAndDrawFrame", "traceArg", "flush", "unpark", "scene", "gcInternal", "loadLibrary",
+            "nativePollOnce", "notify", "unlock",
+    };
+    auto index = static_cast<uint32_t>(type);
+    return index < sizeof(kNames) / sizeof(kNames[0]) ? kNames[index] : "unknown";
+}
+
+static inline uint64_t processUuid() {
+    return kUuidSalt | uint32_t(getpid());
+}
+
+static inline uint64_t threadUuid(uint16_t tid) {
+    return kUuidSalt | kThreadUuidFlag | tid;
+}
+
+/**
+ * @return true if record is a wakeup, whose begin is when the wakee blocked on another thread.
+ */
+static inline bool isWakeup(SamplingType type) {
+    return type == SamplingType::kUnpark || type == SamplingType::kNotify ||
+           type == SamplingType::kUnlock;
+}
+
+static thread_local struct sigaction preSEGVAction;
+static thread_local sigjmp_buf symbolizeJmp;
+
+static void symbolizeSIGSEGVHandler(int signo, siginfo_t* info, void* context) {
+    if (sigaction(signo, &preSEGVAction, nullptr) != 0) {
+        ALOGE("unregister signal %d handler failed: %m", signo);
+    }
+    siglongjmp(symbolizeJmp, 1);
+}
+
+/**
+ * Symbolize method with SIGSEGV handled only for the duration of the call, as dumpMapping does,
+ * since a method may have been unloaded since it was sampled.
+ * @return false if symbolizing faulted or the handler can't be installed.
+ */
+static bool symbolizeGuarded(uint64_t method, std::string* out) {
+    struct sigaction act{};
+    act.sa_flags = SA_SIGINFO;
+    act.sa_sigaction = symbolizeSIGSEGVHandler;
+    if (sigaction(SIGSEGV, &act, &preSEGVAction) != 0) {
+        ALOGE("register SIGSEGV handler failed: %m");
+        return false;
+    }
+    if (sigsetjmp(symbolizeJmp, 1) == 0) {
+        *out = SymbolCache::instance().get(method);
+        if (sigaction(SIGSEGV, &preSEGVAction, nullptr) != 0) {
+            ALOGE("restore SIGSEGV handler failed: %m");
+        }
+        return true;
+    }
+    // handler has been unregistered before jumping back
+    ALOGE("symbolize method %" PRIx64 " failed", method);
+    return false;
+}
+
+PerfettoDumper::PerfettoDumper(StackTable* stackTable)
+        : mStackTable(stackTable), mFirstPacket(true), mNextIid(1), mNextFlowId(1) {
+    std::vector<TraceThreadName::Entry> names;
+    if (TraceThreadName::snapshot(names)) {
+        for (auto& item : names) {
+            mThreadNames[uint16_t(item.tid)] = std::string(item.name,
+                                                           strnlen(item.name, sizeof(item.name)));
+        }
+    }
+}
+
+PerfettoDumper::~PerfettoDumper() = default;
+
+/**
+ * Upper bound of a record: track descriptors of process, thread and wakee, two packets of track
+ * events with annotations on one of them, and a sample packet whose interned data holds every
+ * frame with a new function name and a new mapping, and every annotation name.
+ */
+uint32_t PerfettoDumper::maxRecordSize() {
+    constexpr uint32_t field = ProtoWriter::maxVarintFieldSize();
+    constexpr uint32_t nested = ProtoWriter::maxLengthFieldSize();
+    constexpr uint32_t trackDescriptors = 3 * (nested * 3 + field * 4 + kMaxPathLength * 2);
+    constexpr uint32_t events = 2 * (nested * 2 + field * 6 + ProtoWriter::maxFixed64FieldSize()) +
+                                kMaxAnnotations * (nested + field * 2);
+    constexpr uint32_t annotationNames = kMaxAnnotations * (nested * 2 + field +
+                                                            kMaxAnnotationNameLength);
+    constexpr uint32_t perFrame = (nested + field + nested + kMaxSymbolLength) + // function name
+                                  (nested + field * 4) + // frame
+                                  (nested + field * 3) + // mapping
+                                  (nested + field + nested + kMaxPathLength) + // mapping path
+                                  field; // callstack frame id
+    constexpr uint32_t sample = nested * 6 + field * 8 + kMaxFrames * perFrame +
+                                nested + field * 2 + 32; // event name
+    return trackDescriptors + events + annotationNames + sample;
+}
+
+void PerfettoDumper::writeProcessTrack(ProtoWriter& writer) {
+    char name[kMaxPathLength] = {0};
+    int fd = open("/proc/self/cmdline", O_RDONLY);
+    if (fd >= 0) {
+        read(fd, name, sizeof(name) - 1);
+        close(fd);
+    }
+    auto packet = writer.beginNested(kTracePacket);
+    writer.writeVarint(packet::kTrustedPacketSequenceId, kSequenceId);
+    auto descriptor = writer.beginNested(packet::kTrackDescriptor);
+    writer.writeVarint(track::kUuid, processUuid());
+    auto process = writer.beginNested(track::kProcess);
+    writer.writeVarint(track::kProcessPid, getpid());
+    if (name[0] != 0) {
+        writer.writeString(track::kProcessName, name);
+    }
+    writer.endNested(process);
+    writer.endNested(descriptor);
+    writer.endNested(packet);
+}
+
+void PerfettoDumper::writeThreadTrack(ProtoWriter& writer, uint16_t tid) {
+    auto found = mThreadNames.find(tid);
+    auto packet = writer.beginNested(kTracePacket);
+    writer.writeVarint(packet::kTrustedPacketSequenceId, kSequenceId);
+    auto descriptor = writer.beginNested(packet::kTrackDescriptor);
+    writer.writeVarint(track::kUuid, threadUuid(tid));
+    writer.writeVarint(track::kParentUuid, processUuid());
+    if (found != mThreadNames.end()) {
+        writer.writeString(track::kName, found->second.c_str());
+    }
+    auto thread = writer.beginNested(track::kThread);
+    writer.writeVarint(track::kThreadPid, getpid());
+    writer.writeVarint(track::kThreadTid, tid);
+    if (found != mThreadNames.end()) {
+        writer.writeString(track::kThreadName, found->second.c_str());
+    }
+    writer.endNested(thread);
+    writer.endNested(descriptor);
+    writer.endNested(packet);
+}
+
+uint32_t PerfettoDumper::readJavaFrames(SamplingRecord* record, PayloadArena* payload,
+                                        uint64_t* frames) {
+    uint64_t callees[MAX_STACK_DEPTH];
+    uint32_t depth = 0;
+    if (record->mStack.mStackId != 0) {
+        uint32_t id = record->mStack.mStackId;
+        uint32_t parent;
+        while (id != 0 && depth < MAX_STACK_DEPTH && mStackTable != nullptr &&
+               mStackTable->getNode(id, &parent, callees + depth)) {
+            depth++;
+            id = parent;
+        }
+    } else {
+        depth = std::min(record->mStack.mSavedDepth, MAX_STACK_DEPTH);
+        if (!record->mStack.readFrames(payload, callees)) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < depth; ++i) {
+        frames[i] = callees[depth - 1 - i];
+    }
+    return depth;
+}
+
+uint64_t PerfettoDumper::internFunctionName(const char* name, ProtoWriter& interned) {
+    std::string key(name, strnlen(name, kMaxSymbolLength));
+    auto result = mFunctionNames.emplace(std::move(key), mNextIid);
+    if (result.second) {
+        auto entry = interned.beginNested(interned::kFunctionNames);
+        interned.writeVarint(kIid, mNextIid);
+        interned.writeBytes(kInternedString, result.first->first.data(),
+                            result.first->first.length());
+        interned.endNested(entry);
+        mNextIid++;
+    }
+    return result.first->second;
+}
+
+uint64_t PerfettoDumper::internJavaFrame(uint64_t method, ProtoWriter& interned) {
+    auto found = mJavaFrames.find(method);
+    if (found != mJavaFrames.end()) {
+        return found->second;
+    }
+    auto& javaMapping = mMappings[0];
+    if (javaMapping.iid == 0) {
+        javaMapping.iid = mNextIid++;
+        auto path = interned.beginNested(interned::kMappingPaths);
+        interned.writeVarint(kIid, javaMapping.iid);
+        interned.writeString(kInternedString, "java");
+        interned.endNested(path);
+        auto mapping = interned.beginNested(interned::kMappings);
+        interned.writeVarint(kIid, javaMapping.iid);
+        interned.writeVarint(kMappingPathStringIds, javaMapping.iid);
+        interned.endNested(mapping);
+    }
+    const char* symbol = "<unknown>";
+    std::string symbolized;
+    if (symbolizeGuarded(method, &symbolized)) {
+        symbol = symbolized.c_str();
+    }
+    uint64_t nameIid = internFunctionName(symbol, interned);
+    uint64_t frameIid = mNextIid++;
+    auto frame = interned.beginNested(interned::kFrames);
+    interned.writeVarint(kIid, frameIid);
+    interned.writeVarint(kFrameFunctionNameId, nameIid);
+    interned.writeVarint(kFrameMappingId, javaMapping.iid);
+    // java frames have no pc, a distinct one keeps them from being merged
+    interned.writeVarint(kFrameRelPc, frameIid);
+    interned.endNested(frame);
+    mJavaFrames.emplace(method, frameIid);
+    return frameIid;
+}
+
+uint64_t PerfettoDumper::internNativeFrame(uint64_t pc, ProtoWriter& interned) {
+    auto found = mNativeFrames.find(pc);
+    if (found != mNativeFrames.end()) {
+        return found->second;
+    }
+    Dl_info info{};
+    bool resolved = dladdr(reinterpret_cast<void*>(pc), &info) != 0 && info.dli_fname != nullptr;
+    auto base = resolved ? reinterpret_cast<uintptr_t>(info.dli_fbase) : 1;
+    auto& mapping = mMappings[base];
+    if (mapping.iid == 0) {
+        mapping.iid = mNextIid++;
+        mapping.base = resolved ? base : 0;
+        const char* path = resolved ? info.dli_fname : "unknown";
+        auto pathEntry = interned.beginNested(interned::kMappingPaths);
+        interned.writeVarint(kIid, mapping.iid);
+        interned.writeBytes(kInternedString, path, strnlen(path, kMaxPathLength));
+        interned.endNested(pathEntry);
+        auto entry = interned.beginNested(interned::kMappings);
+        interned.writeVarint(kIid, mapping.iid);
+        interned.writeVarint(kMappingStart, mapping.base);
+        interned.writeVarint(kMappingPathStringIds, mapping.iid);
+        interned.endNested(entry);
+    }
+    uint64_t nameIid = 0;
+    if (resolved && info.dli_sname != nullptr) {
+        nameIid = internFunctionName(info.dli_sname, interned);
+    }
+    uint64_t frameIid = mNextIid++;
+    auto frame = interned.beginNested(interned::kFrames);
+    interned.writeVarint(kIid, frameIid);
+    if (nameIid != 0) {
+        interned.writeVarint(kFrameFunctionNameId, nameIid);
+    }
+    interned.writeVarint(kFrameMappingId, mapping.iid);
+    interned.writeVarint(kFrameRelPc, pc - mapping.base);
+    interned.endNested(frame);
+    mNativeFrames.emplace(pc, frameIid);
+    return frameIid;
+}
+
+uint64_t PerfettoDumper::internCallstack(const uint64_t* frameIds, uint32_t count,
+                                         ProtoWriter& interned) {
+    std::string key(reinterpret_cast<const char*>(frameIds), count * sizeof(uint64_t));
+    auto result = mCallstacks.emplace(std::move(key), mNextIid);
+    if (result.second) {
+        auto entry = interned.beginNested(interned::kCallstacks);
+        interned.writeVarint(kIid, mNextIid);
+        for (uint32_t i = 0; i < count; ++i) {
+            interned.writeVarint(kCallstackFrameIds, frameIds[i]);
+        }
+        interned.endNested(entry);
+        mNextIid++;
+    }
+    return result.first->second;
+}
+
+uint64_t PerfettoDumper::internEventName(SamplingType type, ProtoWriter& interned) {
+    auto result = mEventNames.emplace(static_cast<uint32_t>(type), mNextIid);
+    if (result.second) {
+        auto entry = interned.beginNested(interned::kEventNames);
+        interned.writeVarint(kIid, mNextIid);
+        interned.writeString(kEventName, typeName(type));
+        interned.endNested(entry);
+        mNextIid++;
+    }
+    return result.first->second;
+}
+
+uint64_t PerfettoDumper::internAnnotationName(const char* name, ProtoWriter& interned) {
+    auto result = mAnnotationNames.emplace(name, mNextIid);
+    if (result.second) {
+        auto entry = interned.beginNested(interned::kDebugAnnotationNames);
+        interned.writeVarint(kIid, mNextIid);
+        interned.writeString(kInternedString, name);
+        interned.endNested(entry);
+        mNextIid++;
+    }
+    return result.first->second;
+}
+
+struct Annotation {
+    uint64_t nameIid;
+    uint64_t value;
+};
+
+/**
+ * @param flowField kFlowIds or kTerminatingFlowIds if the event is connected by flow flowId.
+ */
+static void writeTrackEvent(ProtoWriter& writer, uint64_t time, uint32_t type, uint64_t trackUuid,
+                            uint64_t nameIid, const Annotation* annotations = nullptr,
+                            uint32_t annotationCount = 0, uint32_t flowField = 0,
+                            uint64_t flowId = 0) {
+    auto packet = writer.beginNested(kTracePacket);
+    writer.writeVarint(packet::kTimestamp, time);
+    writer.writeVarint(packet::kTrustedPacketSequenceId, kSequenceId);
+    writer.writeVarint(packet::kSequenceFlags, packet::kSeqNeedsIncrementalState);
+    auto event = writer.beginNested(packet::kTrackEvent);
+    writer.writeVarint(event::kType, type);
+    writer.writeVarint(event::kTrackUuid, trackUuid);
+    if (nameIid != 0) {
+        writer.writeVarint(event::kNameIid, nameIid);
+    }
+    for (uint32_t i = 0; i < annotationCount; ++i) {
+        auto annotation = writer.beginNested(event::kDebugAnnotations);
+        writer.writeVarint(kAnnotationNameIid, annotations[i].nameIid);
+        writer.writeVarint(kAnnotationUintValue, annotations[i].value);
+        writer.endNested(annotation);
+    }
+    if (flowField != 0) {
+        writer.writeFixed64(flowField, flowId);
+    }
+    writer.endNested(event);
+    writer.endNested(packet);
+}
+
+uint32_t PerfettoDumper::dumpRecord(JNIEnv* env, void* addr, void* r, PayloadArena* payload) {
+    auto* record = reinterpret_cast<SamplingRecord*>(r);
+    uint64_t javaFrames[MAX_STACK_DEPTH];
+    uint32_t javaDepth = readJavaFrames(record, payload, javaFrames);
+    if (javaDepth == 0) {
+        return 0;
+    }
+    uint64_t pcs[NativeUnwinder::kMaxDepth];
+    uint32_t nativeDepth = std::min(record->mNativeStack.mDepth, NativeUnwinder::kMaxDepth);
+    if (nativeDepth > 0 && (payload == nullptr ||
+                            !payload->read(record->mNativeStack.mPosition, pcs,
+                                           nativeDepth * sizeof(uint64_t)))) {
+        nativeDepth = 0;
+    }
+
+    ProtoWriter writer(reinterpret_cast<char*>(addr));
+    if (mFirstPacket) {
+        writeProcessTrack(writer);
+    }
+    if (mThreads.insert(record->mTid).second) {
+        writeThreadTrack(writer, record->mTid);
+    }
+
+    uint64_t end = record->mEndNanoTime == 0 ? record->mNanoTime : record->mEndNanoTime;
+    auto packet = writer.beginNested(kTracePacket);
+    writer.writeVarint(packet::kTimestamp, end);
+    writer.writeVarint(packet::kTrustedPacketSequenceId, kSequenceId);
+    writer.writeVarint(packet::kSequenceFlags, mFirstPacket ? packet::kSeqIncrementalStateCleared |
+                                                              packet::kSeqNeedsIncrementalState
+                                                            : packet::kSeqNeedsIncrementalState);
+    mFirstPacket = false;
+    auto interned = writer.beginNested(packet::kInternedData);
+    // frames are ordered from root to leaf, native frames are callees of the innermost java frame
+    uint64_t frameIds[kMaxFrames];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < javaDepth; ++i) {
+        frameIds[count++] = internJavaFrame(javaFrames[i], writer);
+    }
+    for (int32_t i = int32_t(nativeDepth) - 1; i >= 0; --i) {
+        frameIds[count++] = internNativeFrame(pcs[i], writer);
+    }
+    uint64_t callstackIid = internCallstack(frameIds, count, writer);
+    uint64_t nameIid = internEventName(record->mType, writer);
+    // what the stack doesn't tell, as perfetto has no place for it in a sample
+    Annotation annotations[kMaxAnnotations];
+    uint32_t annotationCount = 0;
+    if (record->mWakeeTid != 0) {
+        annotations[annotationCount++] = {internAnnotationName("wakee_tid", writer),
+                                          record->mWakeeTid};
+    }
+    if (isWakeup(record->mType) && end > record->mNanoTime) {
+        annotations[annotationCount++] = {internAnnotationName("blocked_ns", writer),
+                                          end - record->mNanoTime};
+    }
+    if (record->mSampledBytes != 0) {
+        annotations[annotationCount++] = {internAnnotationName("sampled_bytes", writer),
+                                          record->mSampledBytes};
+    }
+    uint64_t counters[PerfEventCounters::kCounterCount];
+    uint32_t counterMask = record->readPerfCounters(payload, counters);
+    for (uint32_t i = 0; i < PerfEventCounters::kCounterCount; ++i) {
+        if (counterMask & (1u << i)) {
+            // counted by the thread since its first sample, deltas of a thread are meaningful
+            annotations[annotationCount++] = {internAnnotationName(kCounterNames[i], writer),
+                                              counters[i]};
+        }
+    }
+    writer.endNested(interned, true);
+    auto sample = writer.beginNested(packet::kPerfSample);
+    writer.writeVarint(kSamplePid, getpid());
+    writer.writeVarint(kSampleTid, record->mTid);
+    writer.writeVarint(kSampleCallstackIid, callstackIid);
+    writer.endNested(sample);
+    writer.endNested(packet);
+
+    uint64_t trackUuid = threadUuid(record->mTid);
+    if (isWakeup(record->mType)) {
+        // begin of a wakeup is on the track of wakee, only the wake itself is on the waker's
+        uint16_t wakee = uint16_t(record->mWakeeTid);
+        uint64_t flowId = wakee != 0 ? kUuidSalt | mNextFlowId++ : 0;
+        writeTrackEvent(writer, end, event::kTypeInstant, trackUuid, nameIid, annotations,
+                        annotationCount, wakee != 0 ? event::kFlowIds : 0, flowId);
+        if (wakee != 0) {
+            if (mThreads.insert(wakee).second) {
+                writeThreadTrack(writer, wakee);
+            }
+            writeTrackEvent(writer, end, event::kTypeInstant, threadUuid(wakee), nameIid, nullptr,
+                            0, event::kTerminatingFlowIds, flowId);
+        }
+    } else if (record->mEndNanoTime != 0 && record->mEndNanoTime > record->mNanoTime) {
+        // scopes are hooked calls of this thread, so their slices nest
+        writeTrackEvent(writer, record->mNanoTime, event::kTypeSliceBegin, trackUuid, nameIid,
+                        annotations, annotationCount);
+        writeTrackEvent(writer, record->mEndNanoTime, event::kTypeSliceEnd, trackUuid, 0);
+    } else {
+        writeTrackEvent(writer, record->mNanoTime, event::kTypeInstant, trackUuid, nameIid,
+                        annotations, annotationCount);
+    }
+    return writer.size();
+}
+
+} // namespace rheatrace
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "../base/PerfBuffer.h"
+#include "../base/ProtoWriter.h"
+#include "SamplingRecord.h"
+#include "StackTable.h"
+
+namespace rheatrace {
+
+/**
+ * Dumper writing sampling records as a perfetto trace, which can be opened without converting.
+ * Every record becomes a PerfSample packet referring an interned callstack, plus a track event on
+ * the track of its thread: a slice for a hooked call sampled at its end, an instant otherwise. A
+ * wakeup is an instant at the wake, with a flow to an instant on the track of its wakee. Wakee tid,
+ * sampled bytes and perf counters of a record are debug annotations of its event. Function names, frames, mappings and callstacks are interned on one
+ * packet sequence, and are emitted along with the first record referring them, so the dump has
+ * neither header nor mapping file.
+ */
+class PerfettoDumper : public Dumper {
+public:
+    explicit PerfettoDumper(StackTable* stackTable);
+
+    ~PerfettoDumper() override;
+
+    uint32_t dumpRecord(JNIEnv* env, void* addr, void* r, PayloadArena* payload) override;
+
+    uint32_t maxRecordSize() override;
+
+    bool hasHeader() override {
+        return false;
+    }
+
+    bool hasMapping() override {
+        return false;
+    }
+
+    bool dumpMapping(int fd) override {
+        return true;
+    }
+
+private:
+    struct Mapping {
+        uint64_t iid;
+        uint64_t base;
+    };
+
+    void writeProcessTrack(ProtoWriter& writer);
+
+    void writeThreadTrack(ProtoWriter& writer, uint16_t tid);
+
+    /**
+     * Read java frames of record from caller to callee into frames.
+     * @return count of frames, 0 if frames are no longer available.
+     */
+    uint32_t readJavaFrames(SamplingRecord* record, PayloadArena* payload, uint64_t* frames);
+
+    uint64_t internJavaFrame(uint64_t method, ProtoWriter& interned);
+
+    uint64_t internNativeFrame(uint64_t pc, ProtoWriter& interned);
+
+    uint64_t internFunctionName(const char* name, ProtoWriter& interned);
+
+    uint64_t internCallstack(const uint64_t* frameIds, uint32_t count, ProtoWriter& interned);
+
+    uint64_t internEventName(SamplingType type, ProtoWriter& interned);
+
+    uint64_t internAnnotationName(const char* name, ProtoWriter& interned);
+
+    StackTable* mStackTable;
+    bool mFirstPacket;
+    uint64_t mNextIid;
+    uint64_t mNextFlowId;
+    std::unordered_map<uint16_t, std::string> mThreadNames;
+    std::unordered_set<uint16_t> mThreads;
+    std::unordered_map<uint64_t, uint64_t> mJavaFrames;
+    std::unordered_map<uint64_t, uint64_t> mNativeFrames;
+    std::unordered_map<std::string, uint64_t> mFunctionNames;
+    std::unordered_map<uintptr_t, Mapping> mMappings;
+    std::unordered_map<std::string, uint64_t> mCallstacks;
+    std::unordered_map<uint32_t, uint64_t> mEventNames;
+    std::unordered_map<std::string, uint64_t> mAnnotationNames;
+};
+
+} // namespace rheatrace
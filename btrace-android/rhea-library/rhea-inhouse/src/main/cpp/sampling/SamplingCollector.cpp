@@ -17,14 +17,27 @@
 #include "Stack.h"
 #include "StackVisitor.h"
 #include "../trace/SamplingTrace.h"
+#include "../trace/TraceThreadName.h"
 #include "../stat/JavaObjectStat.h"
 #include "SamplingRecord.h"
+#include "SamplingThreadState.h"
+#include "SymbolCache.h"
+#include "NativeUnwinder.h"
+#include "AggregationCollector.h"
+#include "PerfettoDumper.h"
+#include "../base/BufferedWriter.h"
 #include <unistd.h>
 #include <unordered_set>
 #include <setjmp.h>
 #include <sys/resource.h>
 #include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/stat.h>
 #include <string>
+#include <cmath>
+#include <vector>
 
 #include "../utils/time.h"
 #include "../utils/misc.h"
@@ -36,6 +49,34 @@
 namespace rheatrace {
 
 SamplingCollector* SamplingCollector::sInstance = nullptr;
+std::atomic<uint32_t> SamplingCollector::sGenerations(0);
+
+// an incremental payload saves nothing unless it shares more frames than its header takes
+static constexpr uint32_t kMinSharedDepth = sizeof(StackDeltaHeader) / sizeof(uint64_t) + 1;
+
+/**
+ * The last stack saved by current thread, which incremental mode compares the next stack with.
+ */
+struct PreviousStack {
+    uint32_t generation;
+    uint32_t depth;
+    // id of the stack if it was interned, and node ids of its frames
+    uint32_t stackId;
+    // arena payload of the stack if it was not interned, -1 otherwise
+    int64_t position;
+    uint32_t sharedDepth;
+    uint32_t sinceKeyframe;
+    uint64_t methods[MAX_STACK_DEPTH];
+    uint32_t nodeIds[MAX_STACK_DEPTH];
+};
+
+static thread_local PreviousStack sPreviousStack;
+
+// directory of buffer files, empty if buffers are never backed by files
+static std::string sPersistDir;
+static const char* const kBufferFileName = "sampling.buffer";
+// buffer file left by the previous process, moved aside until it is recovered
+static const char* const kPreviousBufferFileName = "sampling.buffer.prev";
 
 static uint64_t getStackRecordTime(SamplingRecord& r) {
     return r.mEndNanoTime == 0 ? r.mNanoTime : r.mEndNanoTime;
@@ -44,21 +85,42 @@ static uint64_t getStackRecordTime(SamplingRecord& r) {
 SamplingCollector* SamplingCollector::create(JNIEnv* env, jlongArray rawConfig) {
     if (sInstance == nullptr) {
         SamplingConfig config(env, rawConfig);
-        auto* buffer = PerfBuffer<SamplingRecord>::create(config.capacity, getStackRecordTime);
+        uint64_t payloadCapacity = config.capacity * config.averageStackDepth * sizeof(uint64_t);
+        PerfBuffer<SamplingRecord>* buffer = nullptr;
+        bool persist = config.persistBuffer && !sPersistDir.empty();
+        if (persist) {
+            std::string path = sPersistDir + "/" + kBufferFileName;
+            buffer = PerfBuffer<SamplingRecord>::create(config.capacity, getStackRecordTime,
+                                                        config.bufferShards, payloadCapacity,
+                                                        config.snapshotDump, path.c_str());
+            if (buffer == nullptr) {
+                ALOGE("create buffer file %s failed: %m", path.c_str());
+                persist = false;
+            }
+        }
+        if (buffer == nullptr) {
+            buffer = PerfBuffer<SamplingRecord>::create(config.capacity, getStackRecordTime,
+                                                        config.bufferShards, payloadCapacity,
+                                                        config.snapshotDump);
+        }
+        // stack table lives in anonymous memory and is lost with the process, so stacks of a
+        // persisted buffer are always copied into its payload arenas
+        StackTable* stackTable = config.stackTableCapacity > 0 && !persist ? StackTable::create(
+                config.stackTableCapacity) : nullptr;
         struct timespec ts{};
         clock_getres(config.clockId, &ts);
-        ALOGI("clockId is %d, resolution is %ldns, visitKind is %d, interval is %ldns", config.clockId, ts.tv_nsec, config.stackWalkKind, config.mainThreadJavaIntervalNs);
-        sInstance = new SamplingCollector(buffer, config);
+        ALOGI("clockId is %d, resolution is %ldns, visitKind is %d, interval is %ldns, shards is %u, snapshotDump is %d", config.clockId, ts.tv_nsec, config.stackWalkKind, config.mainThreadJavaIntervalNs, config.bufferShards, config.snapshotDump);
+        sInstance = new SamplingCollector(buffer, stackTable, config);
     }
     return sInstance;
 }
 
-thread_local uint64_t lastJavaNano = 0;
+thread_local SamplingThreadState sThreadState;
 
-thread_local uint32_t messageIndex = 0;
+ScopeGate sScopeGate;
 
 void SamplingCollector::newJavaMessageWillBegin() {
-    messageIndex++;
+    sThreadState.messageIndex++;
 }
 
 bool SamplingCollector::request(SamplingType type, void* self, bool force, bool captureAtEnd,
@@ -67,65 +129,375 @@ bool SamplingCollector::request(SamplingType type, void* self, bool force, bool
     if (collector == nullptr || collector->isPaused()) {
         return false;
     }
-    auto currentNano = current_clock_id_time_nanos(collector->config.clockId);
-    if (force || currentNano - lastJavaNano > (is_main_thread() ? collector->config.mainThreadJavaIntervalNs
-                                                                : collector->config.otherThreadJavaIntervalNs)) {
-        lastJavaNano = currentNano;
-        SamplingRecord r;
-        if (StackVisitor::visitOnce(r.mStack, self, collector->config.stackWalkKind)) {
-            if (r.mStack.mSavedDepth == 0 || r.mStack.mSavedDepth != r.mStack.mActualDepth) {
-                return false;
-            }
-        } else {
+    auto currentNano = collector->currentNanos();
+    auto& overhead = collector->mOverhead;
+    if (collector->mRateLimiter.limited(type)) {
+        // rate limited types are gated by their own bucket only, they neither wait for nor delay
+        // other types on the shared interval. Forced requests bypass the bucket without taking a
+        // token from it.
+        if (!force && !collector->mRateLimiter.tryAcquire(type, currentNano)) {
+            return false;
+        }
+    } else {
+        bool mainThread = is_main_thread();
+        uint64_t interval = mainThread ? collector->config.mainThreadJavaIntervalNs
+                                       : collector->config.otherThreadJavaIntervalNs;
+        if (overhead.enabled()) {
+            interval = overhead.adjustInterval(interval, mainThread);
+        }
+        auto& state = sThreadState;
+        if (!force && currentNano - state.lastJavaNano <= interval) {
+            return false;
+        }
+        state.lastJavaNano = currentNano;
+    }
+    return collector->measuredCapture(type, self, captureAtEnd, beginNano, beginCpuNano,
+                                      currentNano);
+}
+
+/**
+ * State of allocation sampling by bytes of current thread, touched by every allocation instead of
+ * every request, so it stays apart from SamplingThreadState.
+ */
+struct AllocationSampleState {
+    // byte threshold, see SamplingCollector::requestAllocation
+    uint64_t meanBytes;
+    int64_t remainingBytes;
+    uint64_t seed;
+    // bytes of samples dropped by budget or bucket, which the next sample carries
+    uint64_t carriedBytes;
+    uint64_t lastSampleNano;
+};
+
+static thread_local AllocationSampleState sAllocationState;
+
+/**
+ * Allocations are sampled as a poisson process over allocated bytes, so the interval between two
+ * samples of a thread is exponentially distributed.
+ */
+static int64_t nextAllocationSampleInterval(AllocationSampleState& state) {
+    // xorshift64*
+    state.seed ^= state.seed >> 12;
+    state.seed ^= state.seed << 25;
+    state.seed ^= state.seed >> 27;
+    uint64_t random = state.seed * 0x2545F4914F6CDD1DULL;
+    // uniform in (0, 1]
+    double uniform = double((random >> 11) + 1) / double(1ULL << 53);
+    return int64_t(-std::log(uniform) * double(state.meanBytes)) + 1;
+}
+
+/**
+ * @return bytes the sample of this allocation stands for, 0 if it is not sampled.
+ */
+static uint64_t sampleAllocation(uint64_t meanBytes, uint64_t bytes) {
+    auto& state = sAllocationState;
+    if (state.meanBytes != meanBytes) {
+        state.meanBytes = meanBytes;
+        state.seed = ((uint64_t(current_tid()) << 32) ^ fast_clock::boot_time_nanos()) | 1;
+        state.remainingBytes = nextAllocationSampleInterval(state);
+        state.carriedBytes = 0;
+    }
+    if (bytes >= meanBytes) {
+        // large allocations are always sampled with their exact size
+        return bytes;
+    }
+    state.remainingBytes -= int64_t(bytes);
+    if (state.remainingBytes > 0) {
+        return 0;
+    }
+    // every crossed threshold stands for mean bytes, which keeps the estimation unbiased
+    uint64_t samples = 0;
+    while (state.remainingBytes <= 0) {
+        samples++;
+        state.remainingBytes += nextAllocationSampleInterval(state);
+    }
+    return samples * meanBytes;
+}
+
+bool SamplingCollector::requestAllocation(void* self, size_t bytes) {
+    auto* collector = SamplingCollector::getInstance();
+    if (collector == nullptr || collector->isPaused()) {
+        return false;
+    }
+    uint64_t meanBytes = collector->config.allocationSampleBytes;
+    if (meanBytes == 0) {
+        return request(SamplingType::kObjectAllocation, self);
+    }
+    uint64_t sampledBytes = sampleAllocation(meanBytes, bytes);
+    if (sampledBytes == 0) {
+        return false;
+    }
+    // interval doesn't apply, samples are chosen by bytes. Those dropped by budget or bucket
+    // hand their bytes to the next sample, so that the sum by stack stays unbiased.
+    auto& state = sAllocationState;
+    auto currentNano = collector->currentNanos();
+    auto& overhead = collector->mOverhead;
+    auto type = SamplingType::kObjectAllocation;
+    if ((overhead.enabled() && currentNano - state.lastSampleNano < overhead.minSampleGap()) ||
+        (collector->mRateLimiter.limited(type) &&
+         !collector->mRateLimiter.tryAcquire(type, currentNano))) {
+        state.carriedBytes += sampledBytes;
+        return false;
+    }
+    sampledBytes += state.carriedBytes;
+    state.carriedBytes = 0;
+    state.lastSampleNano = currentNano;
+    if (!collector->measuredCapture(type, self, false, 0, 0, currentNano, sampledBytes)) {
+        state.carriedBytes = sampledBytes;
+        return false;
+    }
+    return true;
+}
+
+bool SamplingCollector::requestWakeup(SamplingType type, void* self, uint64_t blockedNano,
+                                      pid_t wakeeTid) {
+    auto* collector = SamplingCollector::getInstance();
+    if (collector == nullptr || collector->isPaused()) {
+        return false;
+    }
+    // wakeups are useless once dropped, so they don't share the interval with blocking records,
+    // but are still gated by a bucket of their own
+    auto currentNano = collector->currentNanos();
+    if (!collector->mRateLimiter.tryAcquire(type, currentNano)) {
+        return false;
+    }
+    return collector->measuredCapture(type, self, true, blockedNano, 0, currentNano, 0, wakeeTid);
+}
+
+bool SamplingCollector::measuredCapture(SamplingType type, void* self, bool captureAtEnd,
+                                        uint64_t beginNano, uint64_t beginCpuNano,
+                                        uint64_t currentNano, uint64_t sampledBytes,
+                                        pid_t wakeeTid) {
+    bool measure = mOverhead.enabled();
+    uint64_t costBegin = 0;
+    if (measure) {
+        // boot time is just read by caller
+        costBegin = config.clockId == CLOCK_BOOTTIME ? currentNano : fast_clock::boot_time_nanos();
+    }
+    bool result = capture(type, self, captureAtEnd, beginNano, beginCpuNano, currentNano,
+                          sampledBytes, wakeeTid);
+    if (measure) {
+        mOverhead.onRequestDone(costBegin, fast_clock::boot_time_nanos());
+    }
+    return result;
+}
+
+bool SamplingCollector::capture(SamplingType type, void* self, bool captureAtEnd,
+                                uint64_t beginNano, uint64_t beginCpuNano, uint64_t currentNano,
+                                uint64_t sampledBytes, pid_t wakeeTid) {
+    Stack stack;
+    if (StackVisitor::visitOnce(stack, self, config.stackWalkKind)) {
+        if (stack.mSavedDepth == 0 || stack.mSavedDepth != stack.mActualDepth) {
             return false;
         }
-        r.mType = type;
-        r.mTid = gettid();
-        r.mMessageId = messageIndex;
-
-        auto& objectStat = JavaObjectStat::getAllocatedObjectStat();
-        r.mAllocatedObjects = objectStat.objects;
-        r.mAllocatedBytes = objectStat.bytes;
-        if (collector->config.enableRusage) {
-            struct rusage ru;
-            if (getrusage(RUSAGE_THREAD, &ru) == 0) {
-                r.mMajFlt = ru.ru_majflt;
-                r.mNvCsw = ru.ru_nvcsw;
-                r.mNivCsw = ru.ru_nivcsw;
+    } else {
+        return false;
+    }
+    if (AggregationCollector::fold(type, stack, captureAtEnd, beginNano, beginCpuNano,
+                                   currentNano) && AggregationCollector::exclusive()) {
+        return true;
+    }
+    SamplingRecord r;
+    if (!writeStack(stack, r.mStack)) {
+        return false;
+    }
+    r.mNativeStack.mDepth = 0;
+    r.mNativeStack.mPosition = -1;
+    if (config.nativeStackDepth > 0) {
+        uint64_t pcs[NativeUnwinder::kMaxDepth];
+        uint32_t depth = NativeUnwinder::unwind(pcs, config.nativeStackDepth);
+        if (depth > 0) {
+            r.mNativeStack.mPosition = mBuffer->writePayload(pcs, depth * sizeof(uint64_t));
+            r.mNativeStack.mDepth = r.mNativeStack.mPosition >= 0 ? depth : 0;
+        }
+    }
+    r.mType = type;
+    r.mTid = current_tid();
+    r.mMessageId = sThreadState.messageIndex;
+
+    auto objectStat = JavaObjectStat::getAllocatedObjectStat();
+    r.mAllocatedObjects = objectStat.objects;
+    r.mAllocatedBytes = objectStat.bytes;
+    r.mSampledBytes = sampledBytes;
+    r.mWakeeTid = wakeeTid;
+    r.mMajFlt = 0;
+    r.mNvCsw = 0;
+    r.mNivCsw = 0;
+    r.mPerfMask = 0;
+    r.mPerfPosition = -1;
+    PerfEventCounters::Values counters;
+    if (PerfEventCounters::read(config.perfCounters, counters)) {
+        uint64_t packed[PerfEventCounters::kCounterCount];
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < PerfEventCounters::kCounterCount; ++i) {
+            if (counters.has(PerfEventCounters::Counter(i))) {
+                packed[count++] = counters.values[i];
             }
         }
-        if (captureAtEnd) {
-            r.mNanoTime = beginNano;
-            r.mCpuTime = beginCpuNano;
-            r.mEndNanoTime = currentNano;
-            r.mEndCpuTime = current_thread_cpu_time_nanos();
-        } else {
-            r.mNanoTime = current_boot_time_nanos();
-            r.mCpuTime = current_thread_cpu_time_nanos();
-            r.mEndNanoTime = 0;
-            r.mEndCpuTime = 0;
+        r.mPerfPosition = mBuffer->writePayload(packed, count * sizeof(uint64_t));
+        r.mPerfMask = r.mPerfPosition >= 0 ? counters.validMask : 0;
+    } else if (config.enableRusage) {
+        struct rusage ru;
+        if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+            r.mMajFlt = ru.ru_majflt;
+            r.mNvCsw = ru.ru_nvcsw;
+            r.mNivCsw = ru.ru_nivcsw;
         }
-        collector->write(r);
+    }
+    if (captureAtEnd) {
+        r.mNanoTime = beginNano;
+        r.mEndNanoTime = currentNano;
+        r.mEndCpuTime = current_thread_cpu_time_nanos();
+        // 0 if begin cpu time is unknown: wakeups begin when the wakee blocks, and throttled
+        // scopes skip reading it
+        r.mCpuTime = beginCpuNano;
+    } else {
+        // request has just read boot time unless another clock is configured
+        r.mNanoTime = config.clockId == CLOCK_BOOTTIME ? currentNano : fast_clock::boot_time_nanos();
+        r.mCpuTime = current_thread_cpu_time_nanos();
+        r.mEndNanoTime = 0;
+        r.mEndCpuTime = 0;
+    }
+    write(r);
+    return true;
+}
+
+bool SamplingCollector::writeStack(Stack& stack, StackRef& ref) {
+    ref.mSavedDepth = stack.mSavedDepth;
+    ref.mActualDepth = stack.mActualDepth;
+    ref.mSharedDepth = 0;
+    if (config.keyframeInterval != 0) {
+        return writeStackIncrementally(stack, ref);
+    }
+    ref.mStackId = mStackTable == nullptr ? 0 : mStackTable->insert(stack.mStackMethods,
+                                                                    stack.mSavedDepth);
+    if (ref.mStackId != 0) {
+        ref.mPosition = -1;
         return true;
     }
-    return false;
+    ref.mPosition = mBuffer->writePayload(stack.mStackMethods, stack.payloadSize());
+    return ref.mPosition >= 0;
+}
+
+bool SamplingCollector::writeStackIncrementally(Stack& stack, StackRef& ref) {
+    auto& previous = sPreviousStack;
+    if (previous.generation != mGeneration) {
+        previous.generation = mGeneration;
+        previous.depth = 0;
+        previous.stackId = 0;
+        previous.position = -1;
+        previous.sinceKeyframe = 0;
+    }
+    uint32_t depth = std::min(stack.mSavedDepth, MAX_STACK_DEPTH);
+    uint64_t* methods = stack.mStackMethods;
+    // frames are ordered from callee to caller, so shared frames are at the end
+    uint32_t shared = 0;
+    uint32_t limit = std::min(depth, previous.depth);
+    while (shared < limit && methods[depth - 1 - shared] ==
+                             previous.methods[previous.depth - 1 - shared]) {
+        shared++;
+    }
+
+    ref.mStackId = 0;
+    uint32_t nodeIds[MAX_STACK_DEPTH];
+    if (mStackTable != nullptr) {
+        // node ids of shared frames are known if previous stack was interned
+        uint32_t reused = previous.stackId != 0 ? shared : 0;
+        uint32_t parent = 0;
+        if (reused > 0) {
+            memcpy(nodeIds + depth - reused, previous.nodeIds + previous.depth - reused,
+                   reused * sizeof(uint32_t));
+            parent = nodeIds[depth - reused];
+        }
+        ref.mStackId = mStackTable->insert(methods, depth - reused, parent, nodeIds);
+    }
+    if (ref.mStackId != 0) {
+        ref.mPosition = -1;
+        previous.stackId = ref.mStackId;
+        previous.position = -1;
+        memcpy(previous.nodeIds, nodeIds, depth * sizeof(uint32_t));
+    } else {
+        bool keyframe = shared < kMinSharedDepth || previous.position < 0 ||
+                        previous.sinceKeyframe + 1 >= config.keyframeInterval ||
+                        !mBuffer->isPayloadRecent(previous.position);
+        if (keyframe) {
+            ref.mPosition = mBuffer->writePayload(methods, depth * sizeof(uint64_t));
+            previous.sinceKeyframe = 0;
+        } else {
+            char payload[sizeof(StackDeltaHeader) + MAX_STACK_DEPTH * sizeof(uint64_t)];
+            StackDeltaHeader header{previous.position, previous.depth, previous.sharedDepth};
+            uint32_t own = depth - shared;
+            memcpy(payload, &header, sizeof(header));
+            memcpy(payload + sizeof(header), methods, own * sizeof(uint64_t));
+            ref.mPosition = mBuffer->writePayload(payload,
+                                                  sizeof(header) + own * sizeof(uint64_t));
+            ref.mSharedDepth = shared;
+            previous.sinceKeyframe++;
+        }
+        previous.stackId = 0;
+        previous.position = ref.mPosition;
+        previous.sharedDepth = ref.mSharedDepth;
+    }
+    previous.depth = depth;
+    memcpy(previous.methods, methods, depth * sizeof(uint64_t));
+    return ref.mStackId != 0 || ref.mPosition >= 0;
 }
 
 void SamplingCollector::start(JNIEnv* env, jlongArray asyncConfigs) {
     paused = false;
     StackVisitor::init();
+    fast_clock::init();
+    if (config.nativeStackDepth > 0 && !NativeUnwinder::init()) {
+        config.nativeStackDepth = 0;
+    }
+    if (config.enabledThreadNames) {
+        TraceThreadName::init();
+    }
     trace::init(env, asyncConfigs, config.enableObjectAllocationStub, config.enableWakeup,
                 config.shadowPauseMode);
+    sScopeGate.active.store(true, std::memory_order_relaxed);
 }
 
+struct AddressRange {
+    uintptr_t start;
+    uintptr_t end;
+};
+
 class SamplingDumper : public Dumper {
 private:
-    std::unordered_set<uint64_t> mMethodIds;
+    SamplingEncodeState mState;
+    StackTable* mStackTable;
     bool enableThreadNames;
+    uint64_t mAllocationSampleBytes;
+    // records were written by a previous process, whose methods are only symbolized if they are
+    // in mRecoveredRanges, and whose native frames are not resolved
+    bool mRecovered;
+    std::vector<AddressRange> mRecoveredRanges;
+
+    void collectStackNodes(std::vector<uint32_t>& nodes);
+
+    bool isRecoveredSymbolizable(uint64_t method) {
+        for (auto& range : mRecoveredRanges) {
+            if (method >= range.start && method < range.end) {
+                return true;
+            }
+        }
+        return false;
+    }
 public:
-    explicit SamplingDumper(bool threadNames) : enableThreadNames(threadNames) {}
+    SamplingDumper(StackTable* stackTable, bool threadNames, uint64_t allocationSampleBytes)
+            : mStackTable(stackTable), enableThreadNames(threadNames),
+              mAllocationSampleBytes(allocationSampleBytes), mRecovered(false) {}
+
+    explicit SamplingDumper(std::vector<AddressRange> recoveredRanges)
+            : mStackTable(nullptr), enableThreadNames(false), mAllocationSampleBytes(0),
+              mRecovered(true), mRecoveredRanges(std::move(recoveredRanges)) {}
 
-    uint32_t dumpRecord(JNIEnv* env, void* addr, void* r) override;
+    uint32_t dumpRecord(JNIEnv* env, void* addr, void* r, PayloadArena* payload) override;
+
+    uint32_t maxRecordSize() override;
+
+    void beginChunk() override;
 
     bool hasMapping() override;
 
@@ -133,7 +505,96 @@ public:
 };
 
 Dumper* SamplingCollector::newDumper() {
-    return new SamplingDumper(config.enabledThreadNames);
+    if (config.perfettoDump) {
+        return new PerfettoDumper(mStackTable);
+    }
+    return new SamplingDumper(mStackTable, config.enabledThreadNames,
+                              config.allocationSampleBytes);
+}
+
+/**
+ * Boot image is mapped at the same address in all processes of a boot, and so are ArtMethods in it.
+ */
+static std::vector<AddressRange> bootImageRanges() {
+    std::vector<AddressRange> ranges;
+    FILE* f = fopen("/proc/self/maps", "r");
+    if (f == nullptr) {
+        return ranges;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        AddressRange range{};
+        if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR, &range.start, &range.end) == 2 &&
+            strstr(line, "boot") != nullptr && strstr(line, ".art") != nullptr) {
+            ranges.push_back(range);
+        }
+    }
+    fclose(f);
+    return ranges;
+}
+
+bool SamplingCollector::initPersistence(const char* dir) {
+    sPersistDir = dir;
+    std::string path = sPersistDir + "/" + kBufferFileName;
+    std::string previous = sPersistDir + "/" + kPreviousBufferFileName;
+    if (rename(path.c_str(), previous.c_str()) != 0 && errno != ENOENT) {
+        ALOGE("move aside buffer file %s failed: %m", path.c_str());
+    }
+    return access(previous.c_str(), F_OK) == 0;
+}
+
+int SamplingCollector::recover(JNIEnv* env, const char* outDir) {
+    if (sPersistDir.empty() || outDir == nullptr) {
+        return 1;
+    }
+    std::string previous = sPersistDir + "/" + kPreviousBufferFileName;
+    struct stat st{};
+    if (stat(previous.c_str(), &st) != 0) {
+        return 1;
+    }
+    auto* buffer = PerfBuffer<SamplingRecord>::recover(previous.c_str(), getStackRecordTime);
+    if (buffer == nullptr) {
+        ALOGE("buffer file %s is not recoverable", previous.c_str());
+        unlink(previous.c_str());
+        return 2;
+    }
+    // addresses of boot image change with reboot, a file last written before boot is of another
+    auto bootSeconds = time(nullptr) - int64_t(current_boot_time_millis() / 1000);
+    std::vector<AddressRange> ranges;
+    if (st.st_mtime >= bootSeconds) {
+        ranges = bootImageRanges();
+    }
+    int result = 0;
+    std::string dir(outDir);
+    if (mkdir(outDir, S_IRWXU) != 0 && errno != EEXIST) {
+        result = errno;
+    }
+    int fd = result != 0 ? -1 : open((dir + "/sampling").c_str(), O_RDWR | O_CREAT | O_TRUNC,
+                                     S_IRUSR | S_IWUSR | S_IRGRP);
+    int mappingFd = fd == -1 ? -1 : open((dir + "/sampling-mapping").c_str(),
+                                         O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP);
+    if (result == 0 && (fd == -1 || mappingFd == -1)) {
+        result = errno;
+    }
+    if (result == 0) {
+        char extra[64];
+        int32_t extraLen = snprintf(extra, sizeof(extra), "{\"processId\":%d,\"recovered\":true}",
+                                    buffer->ownerPid());
+        SamplingDumper dumper(std::move(ranges));
+        result = buffer->dump(env, fd, mappingFd, TYPE_SAMPLING, SAMPLING_DUMP_VERSION,
+                              current_boot_time_millis(), extra, extraLen, false, &dumper);
+        ALOGI("recovered buffer of process %d into %s, result is %d", buffer->ownerPid(), outDir,
+              result);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (mappingFd != -1) {
+        close(mappingFd);
+    }
+    delete buffer;
+    unlink(previous.c_str());
+    return result;
 }
 
 const char* SamplingCollector::getDumpPerfFileName() {
@@ -146,17 +607,68 @@ const char* SamplingCollector::getDumpMappingFileName() {
 
 void SamplingCollector::updateConfigs(JNIEnv* env, jlongArray rawUpdatableConfig) {
     config.update(env, rawUpdatableConfig);
+    mOverhead.configure(config.threadOverheadBudget, config.globalOverheadBudget);
+    configureRateLimits();
+    publishScopeGate();
+}
+
+int SamplingCollector::dump(JNIEnv* env, const char* outDir, const char* extra, int32_t extraLen) {
+    std::string fullExtra = mOverhead.appendStats(extra, extraLen);
+    return PerfCollectorBaseImpl::dump(env, outDir, fullExtra.c_str(), fullExtra.size());
 }
 
-uint32_t SamplingDumper::dumpRecord(JNIEnv* env, void* addr, void* r) {
+int SamplingCollector::dumpPart(JNIEnv* env, const char* outDir, const char* extra,
+                                int32_t extraLen, int64_t startTicket, int64_t endTicket) {
+    std::string fullExtra = mOverhead.appendStats(extra, extraLen);
+    return PerfCollectorBaseImpl::dumpPart(env, outDir, fullExtra.c_str(), fullExtra.size(),
+                                           startTicket, endTicket);
+}
+
+int SamplingCollector::dumpTimeWindows(JNIEnv* env, const char* outDir, const char* extra,
+                                       int32_t extraLen, int64_t endTicket,
+                                       const uint64_t* windows, uint32_t windowCount) {
+    std::string fullExtra = mOverhead.appendStats(extra, extraLen);
+    return PerfCollectorBaseImpl::dumpTimeWindows(env, outDir, fullExtra.c_str(),
+                                                  fullExtra.size(), endTicket, windows,
+                                                  windowCount);
+}
+
+uint32_t SamplingDumper::dumpRecord(JNIEnv* env, void* addr, void* r, PayloadArena* payload) {
     SamplingRecord* record = reinterpret_cast<SamplingRecord*>(r);
-    return record->encodeInto(reinterpret_cast<char*>(addr), &mMethodIds);
+    return record->encodeInto(reinterpret_cast<char*>(addr), &mState, payload);
+}
+
+void SamplingDumper::beginChunk() {
+    mState.resetDeltas();
+}
+
+uint32_t SamplingDumper::maxRecordSize() {
+    return SamplingRecord::maxBytes();
 }
 
 bool SamplingDumper::hasMapping() {
     return true;
 }
 
+/**
+ * Collect all nodes of dumped interned stacks, and add methods of them into method dictionary.
+ */
+void SamplingDumper::collectStackNodes(std::vector<uint32_t>& nodes) {
+    if (mStackTable == nullptr) {
+        return;
+    }
+    std::unordered_set<uint32_t> visited;
+    for (auto id : mState.mStackIds) {
+        uint32_t parent;
+        uint64_t method;
+        while (id != 0 && visited.insert(id).second && mStackTable->getNode(id, &parent, &method)) {
+            nodes.push_back(id);
+            mState.mMethods.indexOf(method);
+            id = parent;
+        }
+    }
+}
+
 thread_local struct sigaction preSEGVAction;
 thread_local jmp_buf dumpMappingJmp;
 
@@ -167,6 +679,85 @@ void dumpMappingSIGSEGVHandler(int signo, siginfo_t *info, void *context) {
     siglongjmp(dumpMappingJmp, 1);
 }
 
+/**
+ * Resolve native return addresses into module and offset, so that they can be symbolized offline.
+ * Modules are listed first, then frames in the order of native pc dictionary indexes.
+ */
+static void writeNativeFrames(BufferedWriter& writer, const std::vector<uint64_t>& pcs,
+                              bool resolve) {
+    struct NativeFrame {
+        uint32_t module;
+        uint64_t offset;
+        const char* symbol;
+    };
+    std::vector<const char*> modules;
+    std::unordered_map<uintptr_t, uint32_t> moduleIndexes;
+    std::vector<NativeFrame> frames;
+    frames.reserve(pcs.size());
+    for (auto pc : pcs) {
+        Dl_info info{};
+        if (!resolve || dladdr(reinterpret_cast<void*>(pc), &info) == 0 || info.dli_fname == nullptr) {
+            frames.push_back({UINT32_MAX, pc, nullptr});
+            continue;
+        }
+        auto base = reinterpret_cast<uintptr_t>(info.dli_fbase);
+        auto result = moduleIndexes.emplace(base, uint32_t(modules.size()));
+        if (result.second) {
+            modules.push_back(info.dli_fname);
+        }
+        frames.push_back({result.first->second, pc - base, info.dli_sname});
+    }
+    writer.writeValue<uint32_t>(modules.size());
+    for (auto path : modules) {
+        uint16_t len = strlen(path);
+        writer.writeValue(len);
+        writer.write(path, len);
+    }
+    writer.writeValue<uint32_t>(frames.size());
+    for (auto& frame : frames) {
+        uint16_t len = frame.symbol == nullptr ? 0 : strlen(frame.symbol);
+        writer.writeValue(frame.module);
+        writer.writeValue(frame.offset);
+        writer.writeValue(len);
+        if (len > 0) {
+            writer.write(frame.symbol, len);
+        }
+    }
+}
+
+/**
+ * Fallback of thread names when naming functions are not hooked, which only covers live threads.
+ */
+static void writeThreadNamesFromProc(BufferedWriter& writer) {
+    const char *task_dir = "/proc/self/task";
+    DIR *dir = opendir(task_dir);
+    if (dir == nullptr) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        // Skip the current (.) and parent (..) entries
+        if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            auto tid = (pid_t) atoi(entry->d_name);
+            char path[256];
+            snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+            FILE *file = fopen(path, "r");
+            if (file) {
+                char thread_name[17];
+                if (fgets(thread_name, sizeof(thread_name), file) != nullptr) {
+                    writer.write(&tid, 2);
+                    thread_name[16] = 0;
+                    uint8_t len = strlen(thread_name);
+                    writer.writeValue(len);
+                    writer.write(thread_name, len);
+                }
+                fclose(file);
+            }
+        }
+    }
+    closedir(dir);
+}
+
 bool SamplingDumper::dumpMapping(int fd) {
     struct sigaction act{};
     act.sa_flags = SA_SIGINFO;
@@ -176,53 +767,68 @@ bool SamplingDumper::dumpMapping(int fd) {
         return false;
     }
     if (sigsetjmp(dumpMappingJmp, 1) == 0) {
-        uint64_t magic = 0;
-        uint32_t version = 1;
-        write(fd, &magic, sizeof(magic));
-        write(fd, &version, sizeof(version));
-        uint32_t count = mMethodIds.size();
-        write(fd, &count, sizeof(count));
-        for (const auto &item: mMethodIds) {
-            write(fd, &item, sizeof(item));
-            std::string symbol = Stack::toString(reinterpret_cast<void *>(item));
+        auto begin = current_boot_time_millis();
+        std::vector<uint32_t> stackNodes;
+        collectStackNodes(stackNodes);
+        BufferedWriter writer(fd);
+        writer.writeValue<uint64_t>(0); // magic
+        writer.writeValue<uint32_t>(5); // version
+        // symbols are listed in the order of method dictionary indexes
+        auto& symbols = SymbolCache::instance();
+        size_t cachedCount = symbols.size();
+        writer.writeValue<uint32_t>(mState.mMethods.mMethods.size());
+        for (const auto &item: mState.mMethods.mMethods) {
+            std::string unresolved;
+            if (mRecovered && !isRecoveredSymbolizable(item)) {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "<unresolved 0x%" PRIx64 ">", item);
+                unresolved = buf;
+            }
+            const std::string& symbol = unresolved.empty() ? symbols.get(item) : unresolved;
             uint16_t len = symbol.length();
-            write(fd, &len, sizeof(len));
-            auto buf = symbol.c_str();
-            write(fd, buf, symbol.length());
+            writer.writeValue(item);
+            writer.writeValue(len);
+            writer.write(symbol.c_str(), len);
+        }
+        ALOGD("dump %zu symbols, %zu newly symbolized", mState.mMethods.mMethods.size(),
+              symbols.size() - cachedCount);
+        // interned stack nodes
+        writer.writeValue<uint32_t>(stackNodes.size());
+        for (auto id : stackNodes) {
+            uint32_t parent;
+            uint64_t method;
+            mStackTable->getNode(id, &parent, &method);
+            writer.writeValue(id);
+            writer.writeValue(parent);
+            writer.writeValue(method);
         }
+        // native frames
+        writeNativeFrames(writer, mState.mNativePcs.mMethods, !mRecovered);
+        // mean bytes between allocation samples, 0 if allocations are not sampled by bytes
+        writer.writeValue<uint64_t>(mAllocationSampleBytes);
         // thread names
         if (enableThreadNames) {
             auto now = current_boot_time_millis();
-            const char *task_dir = "/proc/self/task";
-            DIR *dir = opendir(task_dir);
-            if (dir != nullptr) {
-                struct dirent *entry;
-                while ((entry = readdir(dir)) != nullptr) {
-                    // Skip the current (.) and parent (..) entries
-                    if (entry->d_type == DT_DIR && strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-                        auto tid = (pid_t) atoi(entry->d_name);
-                        char path[256];
-                        snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
-                        FILE *file = fopen(path, "r");
-                        if (file) {
-                            char thread_name[17];
-                            if (fgets(thread_name, sizeof(thread_name), file) != nullptr) {
-                                write(fd, &tid, 2);
-                                thread_name[16] = 0;
-                                uint8_t len = strlen(thread_name);
-                                write(fd, &len, 1);
-                                write(fd, thread_name, len);
-                            }
-                            fclose(file);
-                        }
-                    }
+            std::vector<TraceThreadName::Entry> threadNames;
+            if (TraceThreadName::snapshot(threadNames)) {
+                for (auto& item : threadNames) {
+                    writer.write(&item.tid, 2);
+                    uint8_t len = strnlen(item.name, sizeof(item.name));
+                    writer.writeValue(len);
+                    writer.write(item.name, len);
                 }
+            } else {
+                writeThreadNamesFromProc(writer);
             }
-            closedir(dir);
             auto cost = current_boot_time_millis() - now;
-            ALOGD("dump thread names cost %lums", cost);
+            ALOGD("dump %zu thread names cost %lums", threadNames.size(), cost);
         }
-        return true;
+        bool success = writer.flush();
+        if (sigaction(SIGSEGV, &preSEGVAction, nullptr) != 0) {
+            ALOGE("restore SIGSEGV handler failed: %m");
+        }
+        ALOGD("dump mapping cost %lums", current_boot_time_millis() - begin);
+        return success;
     } else {
         return false;
     }
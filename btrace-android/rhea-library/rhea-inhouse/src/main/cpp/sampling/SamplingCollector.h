@@ -20,22 +20,52 @@
 #include "SamplingRecord.h"
 #include "SamplingConfig.h"
 #include "StackVisitor.h"
+#include "StackTable.h"
+#include "OverheadController.h"
+#include "TypeRateLimiter.h"
+#include "SamplingThreadState.h"
 #include "../utils/time.h"
+#include "../utils/FastClock.h"
+#include "../utils/misc.h"
 #include <unistd.h>
+#include <atomic>
 
 namespace rheatrace {
 
+static constexpr uint32_t SAMPLING_DUMP_VERSION = 12;
+
+// default bucket of each wakeup type per thread, unless configured by typeRates
+static constexpr uint32_t kWakeupRatePerSecond = 200;
+static constexpr uint32_t kWakeupBurst = 20;
+
+/**
+ * What ScopeSampling checks at begin of every hooked call, published by the collector so that the
+ * check reads neither the collector nor its config.
+ */
+struct ScopeGate {
+    std::atomic<bool> active;
+    // java intervals without overhead adjustment, 0 if the clock of config is not boot time
+    std::atomic<uint64_t> mainThreadIntervalNs;
+    std::atomic<uint64_t> otherThreadIntervalNs;
+    // bit i is set if type i is gated by its own bucket instead of the interval, see
+    // TypeRateLimiter::kMaxTypes
+    std::atomic<uint32_t> bucketTypes;
+};
+
+extern ScopeGate sScopeGate;
+
 /**
  * Collector of sampling stack trace. Major usage of this class is calling request() method in our
  * preset trace point to capture java stack synchronously and saved it to buffer inside this
  * collector.
  */
-class SamplingCollector : public PerfCollectorBaseImpl<rheatrace::TYPE_SAMPLING, 5, false, SamplingRecord> {
+class SamplingCollector : public PerfCollectorBaseImpl<rheatrace::TYPE_SAMPLING, SAMPLING_DUMP_VERSION, false, SamplingRecord> {
 public:
     static SamplingCollector* create(JNIEnv* env, jlongArray configs);
 
     static void destroy() {
         if (sInstance != nullptr) {
+            sScopeGate.active.store(false, std::memory_order_relaxed);
             delete sInstance;
             sInstance = nullptr;
         }
@@ -45,24 +75,94 @@ public:
         return sInstance;
     }
 
+    /**
+     * Keep buffer files of sessions configured with persistBuffer in dir, and set aside the file
+     * left by the previous process, so that a new session never overwrites it before recovery.
+     * @return true if there is a buffer file of a previous process to recover.
+     */
+    static bool initPersistence(const char* dir);
+
+    /**
+     * Dump the buffer file set aside by initPersistence() into outDir, with the same file names
+     * as a regular dump, and remove it. Only methods in the boot image, whose ArtMethods are at
+     * the same addresses in all processes of a boot, are symbolized, and native frames are left
+     * unresolved.
+     * @return 0 if succeeded.
+     */
+    static int recover(JNIEnv* env, const char* outDir);
+
     static bool
     request(SamplingType type, void* self = nullptr, bool force = false, bool captureAtEnd = false,
             uint64_t beginNano = 0, uint64_t beginCpuNano = 0);
 
+    /**
+     * Request a stack of java object allocation. When allocations are sampled by bytes, only
+     * allocations crossing the byte threshold of current thread are captured, and the record
+     * carries the bytes it stands for. They skip the interval, but not the overhead budget nor a
+     * bucket configured for the type, and bytes of a dropped sample go to the next one.
+     */
+    static bool requestAllocation(void* self, size_t bytes);
+
+    /**
+     * Request a stack of the thread waking wakee, which has been blocked since blockedNano.
+     */
+    static bool requestWakeup(SamplingType type, void* self, uint64_t blockedNano, pid_t wakeeTid);
+
     static void newJavaMessageWillBegin();
 
+    /**
+     * @return false if no request can capture now, checked before reading any time.
+     */
+    static bool isActive() {
+        return sScopeGate.active.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Cheap pre-check of request(type) at bootNano, without the overhead adjustment of interval.
+     * @return false if current thread is still inside its java interval, so that the request is
+     * dropped unless it completes after the interval ends.
+     */
+    static bool pastInterval(SamplingType type, uint64_t bootNano) {
+        auto& gate = sScopeGate;
+        auto index = static_cast<uint32_t>(type);
+        if (index < TypeRateLimiter::kMaxTypes && (gate.bucketTypes.load(std::memory_order_relaxed) & (1u << index))) {
+            return true;
+        }
+        uint64_t interval = is_main_thread()
+                            ? gate.mainThreadIntervalNs.load(std::memory_order_relaxed)
+                            : gate.otherThreadIntervalNs.load(std::memory_order_relaxed);
+        return bootNano - sThreadState.lastJavaNano > interval;
+    }
+
     void start(JNIEnv* env, jlongArray asyncConfigs) override;
 
     void updateConfigs(JNIEnv* env, jlongArray configs) override;
 
     void stop() override {
         paused = true;
+        sScopeGate.active.store(false, std::memory_order_relaxed);
     }
 
+    int dump(JNIEnv* env, const char* outDir, const char* extra, int32_t extraLen) override;
+
+    int dumpPart(JNIEnv* env, const char* outDir, const char* extra, int32_t extraLen,
+                 int64_t startTicket, int64_t endTicket) override;
+
+    int dumpTimeWindows(JNIEnv* env, const char* outDir, const char* extra, int32_t extraLen,
+                        int64_t endTicket, const uint64_t* windows, uint32_t windowCount) override;
+
     int64_t write(SamplingRecord& r) {
         return mBuffer->write(r);
     }
 
+    /**
+     * Save frames of stack, by interning it into stack table if enabled, or by copying frames into
+     * payload arena of buffer otherwise. In incremental mode, frames shared with the previous
+     * stack of current thread are neither interned nor copied again.
+     * @return false if stack is not saved.
+     */
+    bool writeStack(Stack& stack, StackRef& ref);
+
     bool isPaused() const {
         return paused;
     }
@@ -77,16 +177,85 @@ protected:
 
 private:
 
-    SamplingCollector(PerfBuffer<SamplingRecord>* buffer, SamplingConfig& config)
-            : PerfCollectorBaseImpl<rheatrace::TYPE_SAMPLING, 5, false, SamplingRecord>(buffer),
-              config(config), paused(false) {
+    SamplingCollector(PerfBuffer<SamplingRecord>* buffer, StackTable* stackTable, SamplingConfig& config)
+            : PerfCollectorBaseImpl<rheatrace::TYPE_SAMPLING, SAMPLING_DUMP_VERSION, false, SamplingRecord>(buffer),
+              mStackTable(stackTable), config(config), paused(false),
+              mGeneration(sGenerations.fetch_add(1, std::memory_order_relaxed) + 1) {
+        mOverhead.configure(config.threadOverheadBudget, config.globalOverheadBudget);
+        configureRateLimits();
+        publishScopeGate();
+    }
+
+    void configureRateLimits() {
+        for (uint32_t type = 0; type < TypeRateLimiter::kMaxTypes; ++type) {
+            mRateLimiter.configure(type, config.typeRates[type], config.typeBursts[type]);
+        }
+        // wakeups skip the interval, a bucket of their own keeps a storm of unlocks bounded
+        for (auto type : {SamplingType::kUnpark, SamplingType::kNotify, SamplingType::kUnlock}) {
+            auto index = static_cast<uint32_t>(type);
+            if (config.typeRates[index] == 0) {
+                mRateLimiter.configure(index, kWakeupRatePerSecond, kWakeupBurst);
+            }
+        }
+    }
+
+    void publishScopeGate() {
+        bool bootClock = config.clockId == CLOCK_BOOTTIME;
+        uint32_t bucketTypes = 0;
+        for (uint32_t type = 0; type < TypeRateLimiter::kMaxTypes; ++type) {
+            if (mRateLimiter.limited(static_cast<SamplingType>(type))) {
+                bucketTypes |= 1u << type;
+            }
+        }
+        sScopeGate.mainThreadIntervalNs.store(bootClock ? config.mainThreadJavaIntervalNs : 0,
+                                              std::memory_order_relaxed);
+        sScopeGate.otherThreadIntervalNs.store(bootClock ? config.otherThreadJavaIntervalNs : 0,
+                                               std::memory_order_relaxed);
+        sScopeGate.bucketTypes.store(bucketTypes, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return current time on the clock of config, read by fast clock if it is boot time.
+     */
+    uint64_t currentNanos() const {
+        return config.clockId == CLOCK_BOOTTIME ? fast_clock::boot_time_nanos()
+                                                : current_clock_id_time_nanos(config.clockId);
+    }
+
+    bool capture(SamplingType type, void* self, bool captureAtEnd, uint64_t beginNano,
+                 uint64_t beginCpuNano, uint64_t currentNano, uint64_t sampledBytes = 0,
+                 pid_t wakeeTid = 0);
+
+    /**
+     * capture() with its cost counted by overhead controller if enabled.
+     */
+    bool measuredCapture(SamplingType type, void* self, bool captureAtEnd, uint64_t beginNano,
+                         uint64_t beginCpuNano, uint64_t currentNano, uint64_t sampledBytes = 0,
+                 pid_t wakeeTid = 0);
+
+    bool writeStackIncrementally(Stack& stack, StackRef& ref);
+
+    ~SamplingCollector() override {
+        delete mStackTable;
     }
 
     static SamplingCollector* sInstance;
+    static std::atomic<uint32_t> sGenerations;
+    StackTable* mStackTable;
     SamplingConfig config;
+    OverheadController mOverhead;
+    TypeRateLimiter mRateLimiter;
     bool paused;
+    // tells thread local states of this collector from those of a destroyed one
+    const uint32_t mGeneration;
 };
 
+/**
+ * Samples a hooked call when it completes, with its begin time. Nothing is read if sampling is
+ * inactive, and thread cpu time, a syscall, is only read at begin if the call is already past the
+ * java interval. A call inside the interval is still sampled if it completes after the interval
+ * ends, with its begin cpu time unknown.
+ */
 class ScopeSampling {
 public:
     uint64_t beginNano_;
@@ -96,17 +265,22 @@ private:
     uint64_t beginCpuNano_;
     bool force_;
     bool condition_;
-    pid_t tid;
 public:
-    explicit ScopeSampling(SamplingType type, void *self = nullptr, bool force = false) : type_(type), self_(self), force_(force), condition_(true), tid(gettid()) {
-        beginNano_ = current_boot_time_nanos();
-        beginCpuNano_ = current_thread_cpu_time_nanos();
+    explicit ScopeSampling(SamplingType type, void *self = nullptr, bool force = false)
+            : beginNano_(0), self_(self), type_(type), beginCpuNano_(0), force_(force),
+              condition_(SamplingCollector::isActive()) {
+        if (condition_) {
+            beginNano_ = fast_clock::boot_time_nanos();
+            if (force || SamplingCollector::pastInterval(type, beginNano_)) {
+                beginCpuNano_ = current_thread_cpu_time_nanos();
+            }
+        }
     }
 
     ScopeSampling(ScopeSampling&) = delete;
 
     void setCondition(bool cond) {
-        condition_ = cond;
+        condition_ = condition_ && cond;
     }
 
     ~ScopeSampling() {
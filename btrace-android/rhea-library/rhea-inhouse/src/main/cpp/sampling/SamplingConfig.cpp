@@ -14,10 +14,43 @@
  * limitations under the License.
  */
 #include "SamplingConfig.h"
+#include "NativeUnwinder.h"
+
+#include <algorithm>
+#include <cstring>
 
 namespace rheatrace {
 
+static constexpr uint32_t DEFAULT_AVERAGE_STACK_DEPTH = 64;
+
+// chains of incremental payloads longer than this are not followed when dumping
+static constexpr uint32_t MAX_KEYFRAME_INTERVAL = 1024;
+
+static constexpr jlong DUMP_FORMAT_PERFETTO = 1;
+
+/**
+ * Rate limits are encoded as count at offset, followed by (type, ratePerSecond, burst) triples.
+ */
+static void parseRateLimits(const jlong* values, jsize length, jsize offset, uint32_t* rates,
+                            uint32_t* bursts) {
+    memset(rates, 0, sizeof(uint32_t) * TypeRateLimiter::kMaxTypes);
+    memset(bursts, 0, sizeof(uint32_t) * TypeRateLimiter::kMaxTypes);
+    if (length <= offset) {
+        return;
+    }
+    jlong count = values[offset];
+    for (jlong i = 0; i < count && offset + 3 * i + 3 < length; ++i) {
+        jlong type = values[offset + 3 * i + 1];
+        if (type < 0 || type >= TypeRateLimiter::kMaxTypes) {
+            continue;
+        }
+        rates[type] = values[offset + 3 * i + 2];
+        bursts[type] = values[offset + 3 * i + 3];
+    }
+}
+
 SamplingConfig::SamplingConfig(JNIEnv* env, jlongArray rawConfigArray) {
+    auto length = env->GetArrayLength(rawConfigArray);
     auto intervals = env->GetLongArrayElements(rawConfigArray, nullptr);
     capacity = intervals[0];
     mainThreadJavaIntervalNs = intervals[1];
@@ -37,13 +70,37 @@ SamplingConfig::SamplingConfig(JNIEnv* env, jlongArray rawConfigArray) {
     enableWakeup = intervals[7];
     enabledThreadNames = intervals[8];
     shadowPauseMode = intervals[9] != 0;
+    bufferShards = length > 10 && intervals[10] > 0 ? intervals[10] : 1;
+    averageStackDepth = length > 11 && intervals[11] > 0 ? intervals[11] : DEFAULT_AVERAGE_STACK_DEPTH;
+    stackTableCapacity = length > 12 ? intervals[12] : 0;
+    snapshotDump = length > 13 && intervals[13] != 0;
+    threadOverheadBudget = length > 14 ? intervals[14] : 0;
+    globalOverheadBudget = length > 15 ? intervals[15] : 0;
+    keyframeInterval = length > 16 && intervals[16] > 0
+                       ? std::min<jlong>(intervals[16], MAX_KEYFRAME_INTERVAL) : 0;
+    nativeStackDepth = length > 17 && intervals[17] > 0
+                       ? std::min<jlong>(intervals[17], NativeUnwinder::kMaxDepth) : 0;
+    perfettoDump = length > 18 && intervals[18] == DUMP_FORMAT_PERFETTO;
+    allocationSampleBytes = length > 19 && intervals[19] > 0 ? intervals[19] : 0;
+    perfCounters = length > 20 && intervals[20] > 0 && intervals[20] <= PerfEventCounters::kHardware
+                   ? PerfEventCounters::Mode(intervals[20]) : PerfEventCounters::kDisabled;
+    persistBuffer = length > 21 && intervals[21] != 0;
+    parseRateLimits(intervals, length, 22, typeRates, typeBursts);
     env->ReleaseLongArrayElements(rawConfigArray, intervals, JNI_ABORT);
 }
 
 void SamplingConfig::update(JNIEnv* env, jlongArray updatableConfigArray) {
+    auto length = env->GetArrayLength(updatableConfigArray);
     auto intervals = env->GetLongArrayElements(updatableConfigArray, nullptr);
     mainThreadJavaIntervalNs = intervals[0];
     otherThreadJavaIntervalNs = intervals[1];
+    if (length > 3) {
+        threadOverheadBudget = intervals[2];
+        globalOverheadBudget = intervals[3];
+    }
+    if (length > 4) {
+        parseRateLimits(intervals, length, 4, typeRates, typeBursts);
+    }
     env->ReleaseLongArrayElements(updatableConfigArray, intervals, JNI_ABORT);
 }
 
@@ -18,6 +18,8 @@
 #include <jni.h>
 #include <sys/types.h>
 #include "StackVisitor.h"
+#include "TypeRateLimiter.h"
+#include "../stat/PerfEventCounters.h"
 
 namespace rheatrace {
 
@@ -41,6 +43,27 @@ private:
     bool enableWakeup;
     bool enabledThreadNames;
     bool shadowPauseMode;
+    uint32_t bufferShards;
+    uint32_t averageStackDepth;
+    uint32_t stackTableCapacity;
+    bool snapshotDump;
+    uint32_t threadOverheadBudget;
+    uint32_t globalOverheadBudget;
+    // full stack is saved every keyframeInterval samples of a thread in incremental mode, 0 disables it
+    uint32_t keyframeInterval;
+    // max count of native frames captured with java stack, 0 disables native unwinding
+    uint32_t nativeStackDepth;
+    // dump records as a perfetto trace instead of sampling and mapping files
+    bool perfettoDump;
+    // mean bytes between two allocation samples of a thread, 0 samples every allocation by time
+    uint64_t allocationSampleBytes;
+    // perf event counters read instead of getrusage, which is still used if they are unavailable
+    PerfEventCounters::Mode perfCounters;
+    // back buffer by a file in app storage, so that records survive a crash of the process
+    bool persistBuffer;
+    // token bucket of each sampling type, rate 0 means the type shares the java interval
+    uint32_t typeRates[TypeRateLimiter::kMaxTypes];
+    uint32_t typeBursts[TypeRateLimiter::kMaxTypes];
 
     friend class SamplingCollector;
 };
@@ -18,6 +18,10 @@
 #include <cstdint>
 #include <memory>
 #include "Stack.h"
+#include "NativeUnwinder.h"
+#include "../base/common_write.h"
+#include "../stat/PerfEventCounters.h"
+#include <unordered_map>
 #include <unordered_set>
 
 namespace rheatrace {
@@ -48,12 +52,49 @@ enum class SamplingType {
     kUnlock,
 };
 
+/**
+ * Per-thread state of compact encoding. Times and counters of a record are encoded as deltas to
+ * previous record of the same thread.
+ */
+struct SamplingEncodeState {
+    struct ThreadState {
+        uint64_t nanoTime;
+        uint64_t cpuTime;
+        uint64_t allocatedObjects;
+        uint64_t allocatedBytes;
+        uint64_t majFlt;
+        uint64_t nvCsw;
+        uint64_t nivCsw;
+        uint64_t perfCounters[PerfEventCounters::kCounterCount];
+    };
+
+    std::unordered_map<uint16_t, ThreadState> mThreads;
+    MethodDictionary mMethods;
+    std::unordered_set<uint32_t> mStackIds;
+    // native return addresses, which mapping resolves to module and offset
+    MethodDictionary mNativePcs;
+
+    /**
+     * Forget per-thread deltas, so that following records can be decoded without preceding ones.
+     */
+    void resetDeltas() {
+        mThreads.clear();
+    }
+};
+
 struct SamplingRecord {
+    static constexpr uint8_t kFlagAbsolute = 1; // deltas are based on zero
+    static constexpr uint8_t kFlagHasEnd = 2;
+    static constexpr uint8_t kFlagSampledBytes = 4;
+    static constexpr uint8_t kFlagPerfCounters = 8;
+    static constexpr uint8_t kFlagWakee = 16;
+    static constexpr uint8_t kFlagNoBeginCpu = 32; // begin cpu time is encoded as the end one
+
     SamplingType mType;
     uint16_t mTid;
     uint32_t mMessageId;
     uint64_t mNanoTime; // when mType is kUnpark/kNotify/kUnlock, this property represents the time of corresponding park/wait/lock
-    uint64_t mCpuTime;
+    uint64_t mCpuTime; // 0 if unknown for a record with end time
     uint64_t mEndNanoTime;
     uint64_t mEndCpuTime;
     uint64_t mAllocatedObjects;
@@ -61,31 +102,110 @@ struct SamplingRecord {
     uint32_t mMajFlt;
     uint32_t mNvCsw;
     uint32_t mNivCsw;
-    Stack mStack;
+    // allocated bytes this record stands for when allocations are sampled by bytes, 0 otherwise
+    uint64_t mSampledBytes;
+    // thread woken by this record when mType is kUnpark/kNotify/kUnlock, 0 if unknown
+    uint32_t mWakeeTid;
+    // counters of perf events taking the place of rusage ones, bit i of mask tells counter i is
+    // valid. Valid counters are saved in order into payload at mPerfPosition, so that records
+    // don't reserve room for them when perf events are disabled.
+    uint32_t mPerfMask;
+    int64_t mPerfPosition;
+    StackRef mStack;
+    NativeStackRef mNativeStack;
 
-    uint32_t size() {
-        return 2 + 2 + 4 + 8 * 6 + 4 * 3 + mStack.size();
+    /**
+     * Upper bound of encodeInto(): varints of type, tid and message id, a flags byte, zigzag
+     * varints of 9 times and counters, varint of sampled bytes, mask and zigzag varints of perf
+     * counters, varint of wakee tid, the stack and the native stack.
+     */
+    static uint32_t maxBytes() {
+        return 3 + 3 + 5 + 1 + 10 * 9 + 10 + 1 + 10 * PerfEventCounters::kCounterCount + 5 +
+               StackRef::maxSize() +
+               NativeStackRef::maxSize(NativeUnwinder::kMaxDepth);
     }
 
-    static uint32_t maxBytes() {
-        return 2 + 2 + 4 + 8 * 6 + 4 * 3 + Stack::maxSize();
+    /**
+     * Read valid perf counters from payload into counters.
+     * @return mask of counters read, 0 if there is none or they have been overwritten.
+     */
+    uint32_t readPerfCounters(PayloadArena* arena, uint64_t* counters) {
+        uint32_t count = __builtin_popcount(mPerfMask);
+        uint64_t packed[PerfEventCounters::kCounterCount];
+        if (count == 0 || count > PerfEventCounters::kCounterCount || arena == nullptr ||
+            !arena->read(mPerfPosition, packed, count * sizeof(uint64_t))) {
+            return 0;
+        }
+        uint32_t index = 0;
+        for (uint32_t i = 0; i < PerfEventCounters::kCounterCount; ++i) {
+            if (mPerfMask & (1u << i)) {
+                counters[i] = packed[index++];
+            }
+        }
+        return mPerfMask;
     }
 
-    uint32_t encodeInto(char* out, std::unordered_set<uint64_t>* set) {
+    uint32_t encodeInto(char* out, SamplingEncodeState* state, PayloadArena* arena) {
+        auto found = state->mThreads.find(mTid);
+        bool absolute = found == state->mThreads.end();
+        auto& prev = state->mThreads[mTid];
+        if (absolute) {
+            prev = {};
+        }
+        bool hasEnd = mEndNanoTime != 0;
+        bool hasSampledBytes = mSampledBytes != 0;
+        uint64_t perfCounters[PerfEventCounters::kCounterCount];
+        uint32_t perfMask = readPerfCounters(arena, perfCounters);
+        bool hasPerfCounters = perfMask != 0;
+        bool hasWakee = mWakeeTid != 0;
+        bool noBeginCpu = hasEnd && mCpuTime == 0;
+        uint64_t cpuTime = noBeginCpu ? mEndCpuTime : mCpuTime;
+        uint8_t flags = (absolute ? kFlagAbsolute : 0) | (hasEnd ? kFlagHasEnd : 0) |
+                        (hasSampledBytes ? kFlagSampledBytes : 0) |
+                        (hasPerfCounters ? kFlagPerfCounters : 0) | (hasWakee ? kFlagWakee : 0) |
+                        (noBeginCpu ? kFlagNoBeginCpu : 0);
         int size = 0;
-        size += rheatrace::writeBuf(out + size, (uint16_t) mType);
-        size += rheatrace::writeBuf(out + size, (uint16_t) mTid);
-        size += rheatrace::writeBuf(out + size, mMessageId);
-        size += rheatrace::writeBuf(out + size, mNanoTime);
-        size += rheatrace::writeBuf(out + size, mEndNanoTime);
-        size += rheatrace::writeBuf(out + size, mCpuTime);
-        size += rheatrace::writeBuf(out + size, mEndCpuTime);
-        size += rheatrace::writeBuf(out + size, mAllocatedObjects);
-        size += rheatrace::writeBuf(out + size, mAllocatedBytes);
-        size += rheatrace::writeBuf(out + size, mMajFlt);
-        size += rheatrace::writeBuf(out + size, mNvCsw);
-        size += rheatrace::writeBuf(out + size, mNivCsw);
-        size += mStack.encodeInfo(out + size, set);
+        size += rheatrace::writeVarint(out + size, (uint16_t) mType);
+        size += rheatrace::writeVarint(out + size, mTid);
+        size += rheatrace::writeBuf(out + size, flags);
+        size += rheatrace::writeVarint(out + size, mMessageId);
+        size += rheatrace::writeZigzag(out + size, int64_t(mNanoTime - prev.nanoTime));
+        size += rheatrace::writeZigzag(out + size, int64_t(cpuTime - prev.cpuTime));
+        if (hasEnd) {
+            size += rheatrace::writeZigzag(out + size, int64_t(mEndNanoTime - mNanoTime));
+            size += rheatrace::writeZigzag(out + size, int64_t(mEndCpuTime - cpuTime));
+        }
+        size += rheatrace::writeZigzag(out + size, int64_t(mAllocatedObjects - prev.allocatedObjects));
+        size += rheatrace::writeZigzag(out + size, int64_t(mAllocatedBytes - prev.allocatedBytes));
+        size += rheatrace::writeZigzag(out + size, int64_t(mMajFlt - prev.majFlt));
+        size += rheatrace::writeZigzag(out + size, int64_t(mNvCsw - prev.nvCsw));
+        size += rheatrace::writeZigzag(out + size, int64_t(mNivCsw - prev.nivCsw));
+        if (hasSampledBytes) {
+            size += rheatrace::writeVarint(out + size, mSampledBytes);
+        }
+        if (hasPerfCounters) {
+            // counters missing from a record keep their previous values
+            size += rheatrace::writeVarint(out + size, perfMask);
+            for (uint32_t i = 0; i < PerfEventCounters::kCounterCount; ++i) {
+                if (perfMask & (1u << i)) {
+                    size += rheatrace::writeZigzag(out + size,
+                                                   int64_t(perfCounters[i] - prev.perfCounters[i]));
+                    prev.perfCounters[i] = perfCounters[i];
+                }
+            }
+        }
+        if (hasWakee) {
+            size += rheatrace::writeVarint(out + size, mWakeeTid);
+        }
+        size += mStack.encodeInfo(out + size, &state->mMethods, &state->mStackIds, arena);
+        size += mNativeStack.encodeInfo(out + size, &state->mNativePcs, arena);
+        prev.nanoTime = mNanoTime;
+        prev.cpuTime = cpuTime;
+        prev.allocatedObjects = mAllocatedObjects;
+        prev.allocatedBytes = mAllocatedBytes;
+        prev.majFlt = mMajFlt;
+        prev.nvCsw = mNvCsw;
+        prev.nivCsw = mNivCsw;
         return size;
     }
 };
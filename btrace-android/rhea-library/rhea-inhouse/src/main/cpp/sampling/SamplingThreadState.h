@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace rheatrace {
+
+/**
+ * Hot state of current thread touched by every request, packed into one cache line instead of
+ * thread locals scattered in several modules, so a request costs a single line of thread local
+ * storage. Large or rarely used states, like the previous stack, stay apart.
+ */
+struct alignas(64) SamplingThreadState {
+    // time of the last sample gated by java interval
+    uint64_t lastJavaNano;
+    // exponential moving average cost of requests
+    uint64_t averageCostNs;
+    uint32_t messageIndex;
+    // requests not folded into OverheadController yet, since foldBeginNano
+    uint32_t pendingRequests;
+    uint64_t pendingCostNs;
+    uint64_t foldBeginNano;
+};
+
+static_assert(sizeof(SamplingThreadState) == 64, "thread state should fit in one cache line");
+
+extern thread_local SamplingThreadState sThreadState;
+
+} // namespace rheatrace
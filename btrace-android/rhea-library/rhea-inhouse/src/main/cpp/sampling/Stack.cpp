@@ -16,7 +16,7 @@
 #include "Stack.h"
 
 #include "../base/common_write.h"
-#include "../utils/npth_dl.h"
+#include "../utils/SymbolOffsetCache.h"
 #include <sstream>
 #include <string>
 
@@ -26,18 +26,19 @@ static constexpr const char* ART_METHOD_PRETTY_METHOD = "_ZN3art9ArtMethod12Pret
 
 static constexpr const char* RUNTIME_METHOD_PREFIX = "<runtime method>";
 
+// guard against a corrupted chain of incremental payloads
+static constexpr uint32_t kMaxDeltaChain = 1024;
+
 bool Stack::sInited = false;
 Stack::PrettyMethod Stack::sPrettyMethodCall = nullptr;
 
-bool Stack::init(void* libartHandle) {
+bool Stack::init() {
     if (sInited) {
         return true;
     }
 
-    if (libartHandle != nullptr) {
-        sPrettyMethodCall = reinterpret_cast<PrettyMethod>(npth_dlsym(libartHandle, ART_METHOD_PRETTY_METHOD));
-        sInited = sPrettyMethodCall != nullptr;
-    }
+    sPrettyMethodCall = reinterpret_cast<PrettyMethod>(symbol_offset_cache::resolve("libart.so", ART_METHOD_PRETTY_METHOD));
+    sInited = sPrettyMethodCall != nullptr;
 
     return sInited;
 }
@@ -72,18 +73,97 @@ std::string Stack::toString(void* ptr) {
     return sPrettyMethodCall(ptr, true);
 }
 
-uint32_t Stack::encodeInfo(char* out, std::unordered_set<uint64_t>* set) {
-    int size = 0;
-    size += rheatrace::writeBuf(out + size, mSavedDepth);
-    size += rheatrace::writeBuf(out + size, mActualDepth);
-    for (int i = 0; i < mSavedDepth; ++i) {
-        size += rheatrace::writeBuf(out + size, mStackMethods[i]);
-        if (set != nullptr) {
-            set->insert(mStackMethods[i]);
+uint32_t StackRef::encodeInfo(char* out, MethodDictionary* methods,
+                              std::unordered_set<uint32_t>* stackIds, PayloadArena* arena) {
+    if (mStackId != 0) {
+        int size = 0;
+        size += rheatrace::writeVarint(out + size, mSavedDepth);
+        size += rheatrace::writeVarint(out + size, mActualDepth);
+        size += rheatrace::writeVarint(out + size, mStackId);
+        if (stackIds != nullptr) {
+            stackIds->insert(mStackId);
         }
+        return size;
+    }
+    uint64_t frames[MAX_STACK_DEPTH];
+    uint32_t savedDepth = std::min(mSavedDepth, MAX_STACK_DEPTH);
+    if (!readFrames(arena, frames)) {
+        int size = 0;
+        size += rheatrace::writeVarint(out + size, 0);
+        size += rheatrace::writeVarint(out + size, 0);
+        size += rheatrace::writeVarint(out + size, 0);
+        return size;
+    }
+    int size = 0;
+    size += rheatrace::writeVarint(out + size, savedDepth);
+    size += rheatrace::writeVarint(out + size, mActualDepth);
+    size += rheatrace::writeVarint(out + size, 0);
+    for (uint32_t i = 0; i < savedDepth; ++i) {
+        size += rheatrace::writeVarint(out + size, methods->indexOf(frames[i]));
+    }
+    return size;
+}
+
+uint32_t NativeStackRef::encodeInfo(char* out, MethodDictionary* pcs, PayloadArena* arena) {
+    uint64_t frames[MAX_STACK_DEPTH];
+    uint32_t depth = std::min(mDepth, MAX_STACK_DEPTH);
+    if (depth == 0 || arena == nullptr ||
+        !arena->read(mPosition, frames, depth * sizeof(uint64_t))) {
+        return rheatrace::writeVarint(out, 0);
+    }
+    int size = rheatrace::writeVarint(out, depth);
+    for (uint32_t i = 0; i < depth; ++i) {
+        size += rheatrace::writeVarint(out + size, pcs->indexOf(frames[i]));
     }
     return size;
 }
 
+bool StackRef::readFrames(PayloadArena* arena, uint64_t* frames) {
+    if (arena == nullptr) {
+        return false;
+    }
+    uint32_t savedDepth = std::min(mSavedDepth, MAX_STACK_DEPTH);
+    if (mSharedDepth == 0) {
+        return arena->read(mPosition, frames, savedDepth * sizeof(uint64_t));
+    }
+    if (mSharedDepth > savedDepth) {
+        return false;
+    }
+    StackDeltaHeader header{};
+    if (!arena->read(mPosition, &header, sizeof(header)) ||
+        !arena->read(mPosition + sizeof(header), frames,
+                     (savedDepth - mSharedDepth) * sizeof(uint64_t))) {
+        return false;
+    }
+    // outermost frames still missing, which are the last ones of the base
+    uint32_t missing = mSharedDepth;
+    for (uint32_t hops = 0; hops < kMaxDeltaChain; ++hops) {
+        uint32_t baseDepth = header.mBaseSavedDepth;
+        uint32_t baseShared = header.mBaseSharedDepth;
+        if (baseDepth > MAX_STACK_DEPTH || missing > baseDepth || baseShared > baseDepth) {
+            return false;
+        }
+        uint32_t baseOwn = baseDepth - baseShared;
+        uint32_t first = baseDepth - missing;
+        if (first < baseOwn) {
+            uint32_t count = baseOwn - first;
+            int64_t position = header.mBasePosition + (baseShared == 0 ? 0 : sizeof(header)) +
+                               first * sizeof(uint64_t);
+            if (!arena->read(position, frames + savedDepth - missing, count * sizeof(uint64_t))) {
+                return false;
+            }
+            missing -= count;
+        }
+        if (missing == 0) {
+            return true;
+        }
+        // the rest are shared by base with its own base
+        if (!arena->read(header.mBasePosition, &header, sizeof(header))) {
+            return false;
+        }
+    }
+    return false;
+}
+
 } // namespace rheatrace
 
@@ -16,7 +16,11 @@
 #pragma once
 
 
+#include <string>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
+#include "../base/PayloadArena.h"
 
 
 namespace rheatrace {
@@ -33,19 +37,96 @@ public:
     uint32_t mActualDepth;
     uint64_t mStackMethods[MAX_STACK_DEPTH];
 
-    uint32_t size() {
-        return 4 + 4 + mSavedDepth * 8;
+    uint32_t payloadSize() {
+        return mSavedDepth * sizeof(uint64_t);
     }
 
+    static bool init();
+    std::string toString();
+    static std::string toString(void* ptr);
+};
+
+/**
+ * Methods referred by a dump. Frames are encoded as indexes of this dictionary, and mapping file
+ * lists symbols in the same order.
+ */
+struct MethodDictionary {
+    std::unordered_map<uint64_t, uint32_t> mIndexes;
+    std::vector<uint64_t> mMethods;
+
+    uint32_t indexOf(uint64_t method) {
+        auto result = mIndexes.emplace(method, uint32_t(mMethods.size()));
+        if (result.second) {
+            mMethods.push_back(method);
+        }
+        return result.first->second;
+    }
+};
+
+/**
+ * Header of an incremental payload, which is followed by frames not shared with the base payload.
+ */
+struct StackDeltaHeader {
+    int64_t mBasePosition;
+    uint32_t mBaseSavedDepth;
+    uint32_t mBaseSharedDepth;
+};
+
+/**
+ * Stack saved in a sampling record. The stack is either interned in StackTable and referred by
+ * mStackId, or its frames are stored in the payload arena of the buffer at mPosition, so that a
+ * shallow stack doesn't cost as much buffer memory as a MAX_STACK_DEPTH one.
+ *
+ * If mSharedDepth is not 0, the payload is incremental: a StackDeltaHeader followed by the callee
+ * side frames, while the outermost mSharedDepth frames are the same as the base payload's.
+ */
+struct StackRef {
+    int64_t mPosition;
+    uint32_t mStackId;
+    uint32_t mSavedDepth;
+    uint32_t mActualDepth;
+    uint32_t mSharedDepth;
+
+    /**
+     * @return upper bound of encoded bytes, varints of depths, stack id and frame indexes take at
+     * most 5 bytes each.
+     */
     static uint32_t maxSize() {
-        return 4 + 4 + MAX_STACK_DEPTH * 8;
+        return 5 + 5 + 5 + MAX_STACK_DEPTH * 5;
     }
 
-    uint32_t encodeInfo(char* out, std::unordered_set<uint64_t>* set);
+    /**
+     * Encode depths, stack id and dictionary indexes of frames of a not interned stack. If frames
+     * have been overwritten in arena, an empty stack is encoded instead, which would be treated as
+     * invalid record by decoder.
+     */
+    uint32_t encodeInfo(char* out, MethodDictionary* methods,
+                        std::unordered_set<uint32_t>* stackIds, PayloadArena* arena);
 
-    static bool init(void* libartHandle);
-    std::string toString();
-    static std::string toString(void* ptr);
+    /**
+     * Copy full frames of a not interned stack into frames, following bases of incremental
+     * payloads.
+     * @return false if any payload on the way has been overwritten.
+     */
+    bool readFrames(PayloadArena* arena, uint64_t* frames);
+};
+
+/**
+ * Native return addresses saved in payload arena of the buffer, ordered from callee to caller.
+ */
+struct NativeStackRef {
+    int64_t mPosition;
+    uint32_t mDepth;
+
+    static uint32_t maxSize(uint32_t maxDepth) {
+        return 5 + maxDepth * 5;
+    }
+
+    /**
+     * Encode depth and dictionary indexes of return addresses, or an empty stack if they have
+     * been overwritten in arena.
+     */
+    uint32_t encodeInfo(char* out, MethodDictionary* pcs, PayloadArena* arena);
 };
 
 } // namespace rheatrace
\ No newline at end of file
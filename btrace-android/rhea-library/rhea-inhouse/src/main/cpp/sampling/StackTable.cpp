@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "StackTable.h"
+
+#include <sys/mman.h>
+#include <new>
+
+namespace rheatrace {
+
+static constexpr uint32_t kEmpty = 0;
+static constexpr uint32_t kWriting = 1;
+static constexpr uint32_t kReady = 2;
+
+// give up and let caller fallback when the table is crowded
+static constexpr uint32_t kMaxProbes = 64;
+
+static inline uint64_t hashNode(uint32_t parent, uint64_t method) {
+    uint64_t h = method * 0x9E3779B97F4A7C15ULL ^ (uint64_t(parent) * 0xC2B2AE3D27D4EB4FULL);
+    return h ^ (h >> 29);
+}
+
+StackTable* StackTable::create(uint32_t capacity) {
+    // round up to power of two for cheap masking
+    uint32_t realCapacity = 1;
+    while (realCapacity < capacity && realCapacity < (1u << 31)) {
+        realCapacity <<= 1;
+    }
+    size_t memorySize = sizeof(Node) * realCapacity;
+    void* memory = mmap(nullptr, memorySize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+    // anonymous memory is zero filled, which means every node is kEmpty
+    return new StackTable(reinterpret_cast<Node*>(memory), realCapacity, memorySize);
+}
+
+StackTable::~StackTable() {
+    munmap(mNodes, mMemorySize);
+}
+
+uint32_t StackTable::insert(const uint64_t* methods, uint32_t depth) {
+    return insert(methods, depth, 0, nullptr);
+}
+
+uint32_t StackTable::insert(const uint64_t* methods, uint32_t depth, uint32_t parent,
+                            uint32_t* nodeIds) {
+    for (int64_t i = int64_t(depth) - 1; i >= 0; --i) {
+        parent = insertNode(parent, methods[i]);
+        if (parent == 0) {
+            return 0;
+        }
+        if (nodeIds != nullptr) {
+            nodeIds[i] = parent;
+        }
+    }
+    return parent;
+}
+
+uint32_t StackTable::insertNode(uint32_t parent, uint64_t method) {
+    uint32_t mask = mCapacity - 1;
+    uint32_t index = hashNode(parent, method) & mask;
+    for (uint32_t probe = 0; probe < kMaxProbes; ++probe, index = (index + 1) & mask) {
+        Node& node = mNodes[index];
+        uint32_t state = node.state.load(std::memory_order_acquire);
+        if (state == kEmpty) {
+            if (node.state.compare_exchange_strong(state, kWriting, std::memory_order_acquire)) {
+                node.parent = parent;
+                node.method = method;
+                node.state.store(kReady, std::memory_order_release);
+                mSize.fetch_add(1, std::memory_order_relaxed);
+                return index + 1;
+            }
+        }
+        while (state == kWriting) {
+            state = node.state.load(std::memory_order_acquire);
+        }
+        if (node.parent == parent && node.method == method) {
+            return index + 1;
+        }
+    }
+    return 0;
+}
+
+bool StackTable::getNode(uint32_t id, uint32_t* parent, uint64_t* method) {
+    if (id == 0 || id > mCapacity) {
+        return false;
+    }
+    Node& node = mNodes[id - 1];
+    if (node.state.load(std::memory_order_acquire) != kReady) {
+        return false;
+    }
+    *parent = node.parent;
+    *method = node.method;
+    return true;
+}
+
+} // namespace rheatrace
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace rheatrace {
+
+/**
+ * Interning table of call stacks. Every stack is stored once as a chain of parent-linked nodes,
+ * and is represented by the id of its innermost node. Nodes are never removed, so ids stay valid
+ * for the whole lifetime of the table and can be resolved at dump time without locking.
+ */
+class StackTable {
+public:
+    struct Node {
+        std::atomic<uint32_t> state;
+        uint32_t parent;
+        uint64_t method;
+    };
+
+    static StackTable* create(uint32_t capacity);
+
+    ~StackTable();
+
+    /**
+     * Intern a stack.
+     * @param methods frames ordered from callee to caller, which is the order of Stack.
+     * @return stack id, or 0 if table is too full to hold this stack.
+     */
+    uint32_t insert(const uint64_t* methods, uint32_t depth);
+
+    /**
+     * Intern frames below an interned stack.
+     * @param parent id of the stack which frames are called from, 0 for root.
+     * @param nodeIds if not null, receives node id of every frame, in the order of methods.
+     * @return stack id, or 0 if table is too full to hold this stack.
+     */
+    uint32_t insert(const uint64_t* methods, uint32_t depth, uint32_t parent, uint32_t* nodeIds);
+
+    /**
+     * @return false if id is not a valid node id.
+     */
+    bool getNode(uint32_t id, uint32_t* parent, uint64_t* method);
+
+    uint32_t size() {
+        return mSize.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @return upper bound of node ids.
+     */
+    uint32_t capacity() const {
+        return mCapacity;
+    }
+
+private:
+    StackTable(Node* nodes, uint32_t capacity, size_t memorySize)
+            : mNodes(nodes), mCapacity(capacity), mMemorySize(memorySize), mSize(0) {}
+
+    uint32_t insertNode(uint32_t parent, uint64_t method);
+
+    Node* mNodes;
+    const uint32_t mCapacity;
+    const size_t mMemorySize;
+    std::atomic<uint32_t> mSize;
+};
+
+} // namespace rheatrace
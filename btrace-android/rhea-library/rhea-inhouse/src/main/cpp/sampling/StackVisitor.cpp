@@ -14,7 +14,7 @@
  * limitations under the License.
  */
 #include "StackVisitor.h"
-#include "../utils/npth_dl.h"
+#include "../utils/SymbolOffsetCache.h"
 
 #include <string>
 
@@ -54,23 +54,21 @@ bool StackVisitor::init() {
     if (sInited) {
         return true;
     }
-    auto *handle = npth_dlopen("libart.so");
-    if (handle == nullptr) {
-        return false;
-    }
-    sCurrentThreadCall = reinterpret_cast<CurrentThread>(npth_dlsym(handle, THREAD_CURRENT_FROM_GDB));
-    sConstructCall = reinterpret_cast<Construct>(npth_dlsym(handle, STACK_VISITOR_CTOR));
-    sDestructCall = reinterpret_cast<Destruct>(npth_dlsym(handle, STACK_VISITOR_DTOR));
-    sCreateContextCall = reinterpret_cast<CreateContext>(npth_dlsym(handle, CONTEXT_CREATE));
-    sGetMethodCall = reinterpret_cast<GetMethod>(npth_dlsym(handle, STACK_VISITOR_GET_METHOD));
-    sWalkStackCall = reinterpret_cast<WalkStack>(npth_dlsym(handle, STACK_VISITOR_WALK_STACK));
+    const char* symbols[] = {THREAD_CURRENT_FROM_GDB, STACK_VISITOR_CTOR, STACK_VISITOR_DTOR, CONTEXT_CREATE,
+                             STACK_VISITOR_GET_METHOD, STACK_VISITOR_WALK_STACK};
+    void* addresses[6];
+    symbol_offset_cache::resolve_batch("libart.so", symbols, addresses, 6);
+    sCurrentThreadCall = reinterpret_cast<CurrentThread>(addresses[0]);
+    sConstructCall = reinterpret_cast<Construct>(addresses[1]);
+    sDestructCall = reinterpret_cast<Destruct>(addresses[2]);
+    sCreateContextCall = reinterpret_cast<CreateContext>(addresses[3]);
+    sGetMethodCall = reinterpret_cast<GetMethod>(addresses[4]);
+    sWalkStackCall = reinterpret_cast<WalkStack>(addresses[5]);
 
     if (sConstructCall != nullptr && sCreateContextCall != nullptr && sGetMethodCall != nullptr && sWalkStackCall != nullptr) {
-        sInited = Stack::init(handle);
+        sInited = Stack::init();
     }
 
-    npth_dlclose(handle);
-
     return sInited;
 }
 
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "SymbolCache.h"
+
+#include <shadowhook.h>
+#include "Stack.h"
+#include "../utils/SymbolOffsetCache.h"
+
+#define LOG_TAG "RheaTrace:SymbolCache"
+#include "../utils/log.h"
+
+namespace rheatrace {
+
+// cleanup_cha is added in Android 9
+static constexpr const char* DELETE_CLASS_LOADER =
+        "_ZN3art11ClassLinker17DeleteClassLoaderEPNS_6ThreadERKNS0_15ClassLoaderDataEb";
+static constexpr const char* DELETE_CLASS_LOADER_O =
+        "_ZN3art11ClassLinker17DeleteClassLoaderEPNS_6ThreadERKNS0_15ClassLoaderDataE";
+
+static void proxyDeleteClassLoader(void* classLinker, void* self, const void* data,
+                                   bool cleanupCha) {
+    SHADOWHOOK_STACK_SCOPE();
+    SHADOWHOOK_CALL_PREV(proxyDeleteClassLoader, classLinker, self, data, cleanupCha);
+    SymbolCache::instance().clear();
+}
+
+SymbolCache& SymbolCache::instance() {
+    static auto* sInstance = new SymbolCache();
+    return *sInstance;
+}
+
+SymbolCache::SymbolCache() {
+    // nothing is cached before, so hooking here misses no unloading that matters
+    hookClassUnloading();
+}
+
+bool SymbolCache::hookClassUnloading() {
+    void* stub = symbol_offset_cache::hook("libart.so", DELETE_CLASS_LOADER,
+                                           reinterpret_cast<void*>(proxyDeleteClassLoader),
+                                           nullptr);
+    if (stub == nullptr) {
+        stub = symbol_offset_cache::hook("libart.so", DELETE_CLASS_LOADER_O,
+                                         reinterpret_cast<void*>(proxyDeleteClassLoader),
+                                         nullptr);
+    }
+    if (stub == nullptr) {
+        ALOGW("failed to hook class loader deletion, symbols of unloaded classes may be stale");
+        return false;
+    }
+    return true;
+}
+
+std::string SymbolCache::get(uint64_t method) {
+    uint32_t generation;
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        auto it = mSymbols.find(method);
+        if (it != mSymbols.end()) {
+            return it->second;
+        }
+        generation = mGeneration;
+    }
+    // symbolize without holding the lock, PrettyMethod may crash on a bad method and the dumper
+    // recovers from that by siglongjmp, which must not leave the lock held.
+    std::string symbol = Stack::toString(reinterpret_cast<void*>(method));
+    std::lock_guard<std::mutex> lock(mLock);
+    if (generation == mGeneration) {
+        mSymbols.emplace(method, symbol);
+    }
+    return symbol;
+}
+
+size_t SymbolCache::size() {
+    std::lock_guard<std::mutex> lock(mLock);
+    return mSymbols.size();
+}
+
+void SymbolCache::clear() {
+    std::lock_guard<std::mutex> lock(mLock);
+    mSymbols.clear();
+    mGeneration++;
+}
+
+} // namespace rheatrace
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace rheatrace {
+
+/**
+ * Cache of ArtMethod symbols. PrettyMethod is only called the first time a method is dumped, so
+ * later dumps in the same process only pay for newly sampled methods. Methods of unloaded classes
+ * are freed with their class loader and the addresses may be reused, so the whole cache is dropped
+ * once ART deletes a class loader.
+ */
+class SymbolCache {
+public:
+    static SymbolCache& instance();
+
+    /**
+     * @return symbol of method, which is copied out since entries are dropped on class unloading.
+     */
+    std::string get(uint64_t method);
+
+    size_t size();
+
+    /**
+     * Drop all symbols, called after classes are unloaded.
+     */
+    void clear();
+
+private:
+    SymbolCache();
+
+    /**
+     * Hook class loader deletion of ART.
+     * @return false if it could not be hooked, cached symbols are never dropped then.
+     */
+    static bool hookClassUnloading();
+
+    std::unordered_map<uint64_t, std::string> mSymbols;
+    // bumped by clear(), so that a symbol resolved before that is not cached
+    uint32_t mGeneration = 0;
+    std::mutex mLock;
+};
+
+} // namespace rheatrace
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "TypeRateLimiter.h"
+
+#include <algorithm>
+
+namespace rheatrace {
+
+static thread_local uint64_t sTheoreticalArrivals[TypeRateLimiter::kMaxTypes] = {};
+
+void TypeRateLimiter::configure(uint32_t type, uint32_t ratePerSecond, uint32_t burst) {
+    if (type >= kMaxTypes) {
+        return;
+    }
+    uint64_t interval = ratePerSecond == 0 ? 0 : std::max<uint64_t>(1, 1000000000 / ratePerSecond);
+    mTolerances[type].store(interval * (std::max(burst, 1u) - 1), std::memory_order_relaxed);
+    mIntervals[type].store(interval, std::memory_order_relaxed);
+}
+
+bool TypeRateLimiter::tryAcquire(SamplingType type, uint64_t nowNano) {
+    auto index = static_cast<uint32_t>(type);
+    if (index >= kMaxTypes) {
+        return true;
+    }
+    uint64_t interval = mIntervals[index].load(std::memory_order_relaxed);
+    if (interval == 0) {
+        return true;
+    }
+    uint64_t tolerance = mTolerances[index].load(std::memory_order_relaxed);
+    uint64_t& arrival = sTheoreticalArrivals[index];
+    if (arrival > nowNano + tolerance) {
+        return false;
+    }
+    arrival = std::max(arrival, nowNano) + interval;
+    return true;
+}
+
+} // namespace rheatrace
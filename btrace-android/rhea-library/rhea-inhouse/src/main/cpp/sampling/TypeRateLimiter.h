@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "SamplingRecord.h"
+
+namespace rheatrace {
+
+/**
+ * Per-thread token buckets of sampling types. A type with a bucket is only gated by its own
+ * bucket, so that bursts of a cheap and frequent type can't starve rare ones on the same thread.
+ *
+ * Buckets are implemented as GCRA, which is equivalent to a token bucket but only needs the
+ * theoretical arrival time of next token per thread and type.
+ */
+class TypeRateLimiter {
+public:
+    static constexpr uint32_t kMaxTypes = 32;
+
+    /**
+     * @param ratePerSecond tokens refilled per second, 0 removes bucket of type.
+     * @param burst capacity of bucket.
+     */
+    void configure(uint32_t type, uint32_t ratePerSecond, uint32_t burst);
+
+    bool limited(SamplingType type) const {
+        auto index = static_cast<uint32_t>(type);
+        return index < kMaxTypes && mIntervals[index].load(std::memory_order_relaxed) != 0;
+    }
+
+    /**
+     * Take a token of type for current thread.
+     * @return false if bucket is empty.
+     */
+    bool tryAcquire(SamplingType type, uint64_t nowNano);
+
+private:
+    // nanoseconds between two tokens, 0 means no bucket
+    std::atomic<uint64_t> mIntervals[kMaxTypes] = {};
+    // how far the theoretical arrival time may run ahead of now, which makes the burst
+    std::atomic<uint64_t> mTolerances[kMaxTypes] = {};
+};
+
+} // namespace rheatrace
@@ -16,26 +16,96 @@
 #include "JavaObjectStat.h"
 
 #include <atomic>
+#include <mutex>
 
 namespace rheatrace {
 
-thread_local JavaObjectStat::ObjectStat stats;
-std::atomic_uint64_t globalBytes = 0;
-std::atomic_uint64_t globalObjects = 0;
+namespace {
+
+/**
+ * Counters of a thread. Only the owner thread writes them, so a relaxed load and store is enough
+ * and no locked instruction is needed, while registry may read them from other threads.
+ */
+struct ThreadCounters {
+    std::atomic<size_t> bytes{0};
+    std::atomic<size_t> objects{0};
+    ThreadCounters* prev = nullptr;
+    ThreadCounters* next = nullptr;
+
+    ThreadCounters();
+
+    ~ThreadCounters();
+};
+
+/**
+ * Live thread counters, and totals of exited threads.
+ */
+struct Registry {
+    std::mutex lock;
+    ThreadCounters* head = nullptr;
+    size_t retiredBytes = 0;
+    size_t retiredObjects = 0;
+
+    static Registry& instance() {
+        // never destroyed, threads may exit after static destructors have run
+        static auto* sInstance = new Registry();
+        return *sInstance;
+    }
+};
+
+ThreadCounters::ThreadCounters() {
+    auto& registry = Registry::instance();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    next = registry.head;
+    if (next != nullptr) {
+        next->prev = this;
+    }
+    registry.head = this;
+}
+
+ThreadCounters::~ThreadCounters() {
+    auto& registry = Registry::instance();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    registry.retiredBytes += bytes.load(std::memory_order_relaxed);
+    registry.retiredObjects += objects.load(std::memory_order_relaxed);
+    if (prev != nullptr) {
+        prev->next = next;
+    } else {
+        registry.head = next;
+    }
+    if (next != nullptr) {
+        next->prev = prev;
+    }
+}
+
+thread_local ThreadCounters counters;
+
+}
 
 void JavaObjectStat::onObjectAllocated(size_t b) {
-    stats.objects++;
-    stats.bytes += b;
-    globalBytes.fetch_add(b, std::memory_order_relaxed);
-    globalObjects.fetch_add(1, std::memory_order_relaxed);
+    auto& c = counters;
+    c.objects.store(c.objects.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    c.bytes.store(c.bytes.load(std::memory_order_relaxed) + b, std::memory_order_relaxed);
+}
+
+JavaObjectStat::ObjectStat JavaObjectStat::getAllocatedObjectStat() {
+    auto& c = counters;
+    return {c.bytes.load(std::memory_order_relaxed), c.objects.load(std::memory_order_relaxed)};
 }
 
-JavaObjectStat::ObjectStat& JavaObjectStat::getAllocatedObjectStat() {
-    return stats;
+JavaObjectStat::ObjectStat JavaObjectStat::getGlobalAllocatedObjectStat() {
+    auto& registry = Registry::instance();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    ObjectStat stat{registry.retiredBytes, registry.retiredObjects};
+    for (auto* item = registry.head; item != nullptr; item = item->next) {
+        stat.bytes += item->bytes.load(std::memory_order_relaxed);
+        stat.objects += item->objects.load(std::memory_order_relaxed);
+    }
+    return stat;
 }
 
 uint64_t JavaObjectStat::getGlobalAllocatedBytes() {
-    return globalBytes.load(std::memory_order_relaxed);
+    return getGlobalAllocatedObjectStat().bytes;
 }
 
-}
\ No newline at end of file
+}
@@ -15,10 +15,15 @@
  */
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 
 namespace rheatrace {
 
+/**
+ * Counters of java objects allocated by each thread. Allocating threads only touch their own
+ * counters, process totals are summed up on demand from live threads and threads exited before.
+ */
 class JavaObjectStat {
 public:
     struct ObjectStat {
@@ -28,10 +33,18 @@ public:
 
     static void onObjectAllocated(size_t bytes);
 
-    static ObjectStat &getAllocatedObjectStat();
+    /**
+     * @return counters of current thread.
+     */
+    static ObjectStat getAllocatedObjectStat();
+
+    /**
+     * @return counters of the whole process, which is much slower than getAllocatedObjectStat().
+     */
+    static ObjectStat getGlobalAllocatedObjectStat();
 
     static uint64_t getGlobalAllocatedBytes();
 
 };
 
-}
\ No newline at end of file
+}
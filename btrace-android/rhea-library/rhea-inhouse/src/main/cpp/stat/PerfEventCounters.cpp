@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "PerfEventCounters.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define LOG_TAG "RheaTrace:PerfEvent"
+#include "../utils/log.h"
+
+namespace rheatrace {
+
+namespace {
+
+struct EventSpec {
+    uint32_t type;
+    uint64_t config;
+};
+
+const EventSpec kEvents[PerfEventCounters::kCounterCount] = {
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+};
+
+constexpr uint32_t kFirstHardware = PerfEventCounters::kInstructions;
+
+/**
+ * Whether kernel side events can be counted, context switches happen in kernel and are missed
+ * when kernel is excluded. Learned by the first thread opening events, and shared by others.
+ */
+enum KernelAccess : int {
+    kUnknown = 0,
+    kIncludeKernel,
+    kExcludeKernel,
+    // perf events are not allowed at all, no thread tries again
+    kUnavailable,
+};
+
+std::atomic<int> sKernelAccess(kUnknown);
+std::atomic<bool> sHardwareUnavailable(false);
+// threads which may still open counters, see PerfEventCounters::kMaxThreads
+std::atomic<int32_t> sFreeSlots(PerfEventCounters::kMaxThreads);
+
+bool acquireSlot() {
+    int32_t free = sFreeSlots.load(std::memory_order_relaxed);
+    while (free > 0) {
+        if (sFreeSlots.compare_exchange_weak(free, free - 1, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int openEvent(const EventSpec& spec, int groupFd, bool excludeKernel) {
+    struct perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = spec.type;
+    attr.config = spec.config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = excludeKernel;
+    attr.exclude_hv = 1;
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, PERF_FLAG_FD_CLOEXEC);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t readPmc(uint32_t index) {
+    uint32_t low;
+    uint32_t high;
+    asm volatile("rdpmc" : "=a"(low), "=d"(high) : "c"(index));
+    return low | ((uint64_t) high << 32);
+}
+#define RHEA_HAS_USER_PMC 1
+#elif defined(__aarch64__)
+#define READ_PMEVCNTR(n) \
+    case n: \
+        asm volatile("mrs %0, pmevcntr" #n "_el0" : "=r"(value)); \
+        break;
+
+/**
+ * Event counters of arm64 can only be read by an immediate register name, index 31 stands for
+ * the cycle counter. Readable from user space since linux 5.18 when perf_user_access is set.
+ */
+static inline uint64_t readPmc(uint32_t index) {
+    uint64_t value = 0;
+    switch (index) {
+        READ_PMEVCNTR(0) READ_PMEVCNTR(1) READ_PMEVCNTR(2) READ_PMEVCNTR(3)
+        READ_PMEVCNTR(4) READ_PMEVCNTR(5) READ_PMEVCNTR(6) READ_PMEVCNTR(7)
+        READ_PMEVCNTR(8) READ_PMEVCNTR(9) READ_PMEVCNTR(10) READ_PMEVCNTR(11)
+        READ_PMEVCNTR(12) READ_PMEVCNTR(13) READ_PMEVCNTR(14) READ_PMEVCNTR(15)
+        READ_PMEVCNTR(16) READ_PMEVCNTR(17) READ_PMEVCNTR(18) READ_PMEVCNTR(19)
+        READ_PMEVCNTR(20) READ_PMEVCNTR(21) READ_PMEVCNTR(22) READ_PMEVCNTR(23)
+        READ_PMEVCNTR(24) READ_PMEVCNTR(25) READ_PMEVCNTR(26) READ_PMEVCNTR(27)
+        READ_PMEVCNTR(28) READ_PMEVCNTR(29) READ_PMEVCNTR(30)
+        case 31:
+            asm volatile("mrs %0, pmccntr_el0" : "=r"(value));
+            break;
+        default:
+            break;
+    }
+    return value;
+}
+#undef READ_PMEVCNTR
+#define RHEA_HAS_USER_PMC 1
+#endif
+
+/**
+ * Counters of current thread. Hardware ones are in a separate group read from mmap'd pages when
+ * user space reading is allowed, since they may be multiplexed or unsupported. Otherwise they
+ * join the group of software ones, so that a single read() gets all counters.
+ */
+struct ThreadEvents {
+    PerfEventCounters::Mode mode = PerfEventCounters::kDisabled;
+    // holds one of sFreeSlots while any fd is open
+    bool hasSlot = false;
+    // opened without a slot, tries again once one is freed
+    bool waitingSlot = false;
+    int fds[PerfEventCounters::kCounterCount];
+    perf_event_mmap_page* pages[PerfEventCounters::kCounterCount];
+    // counters in the order they joined software and hardware group
+    uint32_t swOrder[PerfEventCounters::kCounterCount];
+    uint32_t swCount = 0;
+    uint32_t hwOrder[PerfEventCounters::kCounterCount];
+    uint32_t hwCount = 0;
+
+    ThreadEvents() {
+        for (uint32_t i = 0; i < PerfEventCounters::kCounterCount; ++i) {
+            fds[i] = -1;
+            pages[i] = nullptr;
+        }
+    }
+
+    ~ThreadEvents() {
+        close();
+    }
+
+    void close() {
+        for (uint32_t i = 0; i < PerfEventCounters::kCounterCount; ++i) {
+            if (pages[i] != nullptr) {
+                munmap(pages[i], getpagesize());
+                pages[i] = nullptr;
+            }
+            if (fds[i] >= 0) {
+                ::close(fds[i]);
+                fds[i] = -1;
+            }
+        }
+        swCount = 0;
+        hwCount = 0;
+        mode = PerfEventCounters::kDisabled;
+        waitingSlot = false;
+        if (hasSlot) {
+            hasSlot = false;
+            sFreeSlots.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Close counters of the previous mode and open those of newMode if a slot is free.
+     */
+    void open(PerfEventCounters::Mode newMode);
+
+    void openEvents(PerfEventCounters::Mode newMode);
+
+    /**
+     * Open hardware counters into group of leader, or a group of their own if leader is -1.
+     * @return false if there is no pmu at all.
+     */
+    bool openHardware(int leader, uint32_t* order, uint32_t& count, bool map);
+
+    void closeHardware();
+
+    bool readGroup(const uint32_t* order, uint32_t count, PerfEventCounters::Values& out);
+
+    bool readMapped(uint32_t counter, uint64_t& value);
+};
+
+void ThreadEvents::open(PerfEventCounters::Mode newMode) {
+    close();
+    mode = newMode;
+    if (sKernelAccess.load(std::memory_order_relaxed) == kUnavailable) {
+        return;
+    }
+    if (!acquireSlot()) {
+        waitingSlot = true;
+        return;
+    }
+    hasSlot = true;
+    openEvents(newMode);
+    if (swCount == 0 && hwCount == 0) {
+        // gives the slot back
+        close();
+        mode = newMode;
+    }
+}
+
+void ThreadEvents::openEvents(PerfEventCounters::Mode newMode) {
+    int access = sKernelAccess.load(std::memory_order_relaxed);
+    bool excludeKernel = access == kExcludeKernel;
+    for (uint32_t i = 0; i < kFirstHardware; ++i) {
+        int leader = swCount == 0 ? -1 : fds[swOrder[0]];
+        int fd = openEvent(kEvents[i], leader, excludeKernel);
+        if (fd < 0 && (errno == EACCES || errno == EPERM) && !excludeKernel && swCount == 0) {
+            // counting kernel is not allowed by perf_event_paranoid, user space only then
+            excludeKernel = true;
+            fd = openEvent(kEvents[i], leader, excludeKernel);
+        }
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                // fds belong to the app first, this thread falls back to getrusage for good
+                ALOGD("perf events of thread dropped: %s", strerror(errno));
+                close();
+                return;
+            }
+            if (swCount == 0 && (errno == EACCES || errno == EPERM || errno == ENOSYS)) {
+                ALOGD("perf events unavailable: %s", strerror(errno));
+                sKernelAccess.store(kUnavailable, std::memory_order_relaxed);
+                return;
+            }
+            continue;
+        }
+        fds[i] = fd;
+        swOrder[swCount++] = i;
+    }
+    if (swCount > 0 && access == kUnknown) {
+        sKernelAccess.store(excludeKernel ? kExcludeKernel : kIncludeKernel,
+                            std::memory_order_relaxed);
+    }
+    if (newMode != PerfEventCounters::kHardware ||
+        sHardwareUnavailable.load(std::memory_order_relaxed)) {
+        return;
+    }
+#ifdef RHEA_HAS_USER_PMC
+    if (!openHardware(-1, hwOrder, hwCount, true)) {
+        return;
+    }
+    // the kernel tells whether user space may read counters once they are mapped and scheduled
+    auto* page = hwCount > 0 ? pages[hwOrder[0]] : nullptr;
+    if (page != nullptr && page->cap_user_rdpmc) {
+        return;
+    }
+    closeHardware();
+#endif
+    if (swCount > 0) {
+        openHardware(fds[swOrder[0]], swOrder, swCount, false);
+    } else {
+        openHardware(-1, hwOrder, hwCount, false);
+    }
+}
+
+bool ThreadEvents::openHardware(int leader, uint32_t* order, uint32_t& count, bool map) {
+    uint32_t first = count;
+    for (uint32_t i = kFirstHardware; i < PerfEventCounters::kCounterCount; ++i) {
+        int groupFd = leader >= 0 ? leader : (count == first ? -1 : fds[order[first]]);
+        // rdpmc only ever sees user space, count the same when read by syscall
+        int fd = openEvent(kEvents[i], groupFd, true);
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                // software counters are kept, hardware ones are left out
+                return true;
+            }
+            if (count == first && (errno == ENOENT || errno == EOPNOTSUPP || errno == ENODEV)) {
+                // no pmu, as in most emulators and containers
+                sHardwareUnavailable.store(true, std::memory_order_relaxed);
+                return false;
+            }
+            continue;
+        }
+        fds[i] = fd;
+        order[count++] = i;
+        if (map) {
+            void* page = mmap(nullptr, getpagesize(), PROT_READ, MAP_SHARED, fd, 0);
+            if (page != MAP_FAILED) {
+                pages[i] = (perf_event_mmap_page*) page;
+            }
+        }
+    }
+    return true;
+}
+
+void ThreadEvents::closeHardware() {
+    for (uint32_t i = 0; i < hwCount; ++i) {
+        uint32_t counter = hwOrder[i];
+        if (pages[counter] != nullptr) {
+            munmap(pages[counter], getpagesize());
+            pages[counter] = nullptr;
+        }
+        ::close(fds[counter]);
+        fds[counter] = -1;
+    }
+    hwCount = 0;
+}
+
+bool ThreadEvents::readGroup(const uint32_t* order, uint32_t count, PerfEventCounters::Values& out) {
+    if (count == 0) {
+        return false;
+    }
+    // nr followed by values in the order of joining group
+    uint64_t buf[1 + PerfEventCounters::kCounterCount];
+    ssize_t size = ::read(fds[order[0]], buf, sizeof(uint64_t) * (1 + count));
+    if (size < (ssize_t) sizeof(uint64_t) || buf[0] != count) {
+        return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        out.values[order[i]] = buf[1 + i];
+        out.validMask |= 1u << order[i];
+    }
+    return true;
+}
+
+/**
+ * Read counter from its mmap'd page without syscall, as documented in perf_event_open(2).
+ * @return false if user space reading is not allowed or counter is not on a pmu right now.
+ */
+bool ThreadEvents::readMapped(uint32_t counter, uint64_t& value) {
+#ifdef RHEA_HAS_USER_PMC
+    auto* page = pages[counter];
+    if (page == nullptr) {
+        return false;
+    }
+    uint32_t seq;
+    do {
+        seq = page->lock;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        uint32_t index = page->index;
+        if (!page->cap_user_rdpmc || index == 0) {
+            return false;
+        }
+        int64_t count = page->offset;
+        uint16_t width = page->pmc_width;
+        int64_t pmc = readPmc(index - 1);
+        pmc <<= 64 - width;
+        pmc >>= 64 - width;
+        value = count + pmc;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    } while (page->lock != seq);
+    return true;
+#else
+    return false;
+#endif
+}
+
+thread_local ThreadEvents sThreadEvents;
+
+}
+
+bool PerfEventCounters::read(Mode mode, Values& out) {
+    out.validMask = 0;
+    if (mode == kDisabled) {
+        return false;
+    }
+    auto& events = sThreadEvents;
+    if (events.mode != mode ||
+        (events.waitingSlot && sFreeSlots.load(std::memory_order_relaxed) > 0)) {
+        events.open(mode);
+    }
+    events.readGroup(events.swOrder, events.swCount, out);
+    if (events.hwCount > 0) {
+        bool mapped = true;
+        for (uint32_t i = 0; i < events.hwCount && mapped; ++i) {
+            uint32_t counter = events.hwOrder[i];
+            mapped = events.readMapped(counter, out.values[counter]);
+        }
+        if (mapped) {
+            for (uint32_t i = 0; i < events.hwCount; ++i) {
+                out.validMask |= 1u << events.hwOrder[i];
+            }
+        } else {
+            events.readGroup(events.hwOrder, events.hwCount, out);
+        }
+    }
+    return out.validMask != 0;
+}
+
+} // namespace rheatrace
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+
+namespace rheatrace {
+
+/**
+ * Per-thread counters of perf events, which take the place of getrusage(RUSAGE_THREAD) in
+ * sampling records. Software counters are opened as one group and read by a single read(), and
+ * hardware counters are read from their mmap'd pages without syscall where the kernel allows user
+ * access (rdpmc on x86, pmu registers on arm64 with perf_user_access), or join the software group
+ * otherwise. Counters are opened lazily on the first read of a thread, so they count
+ * from then on, and closed when the thread exits. Each thread takes 3 to 5 fds out of the limit
+ * of the app, so at most kMaxThreads threads hold counters at the same time, and others get a
+ * slot once one is freed. Whenever perf events are unavailable, the budget is used up or fds run
+ * out, read() fails and callers should fall back to getrusage.
+ */
+class PerfEventCounters {
+public:
+    enum Mode : uint32_t {
+        kDisabled = 0,
+        kSoftware,
+        // software counters plus instructions and cycles
+        kHardware,
+    };
+
+    enum Counter : uint32_t {
+        kContextSwitches = 0,
+        kMajorFaults,
+        kCpuMigrations,
+        kInstructions,
+        kCycles,
+        kCounterCount,
+    };
+
+    // threads holding counters at the same time
+    static constexpr uint32_t kMaxThreads = 32;
+
+    struct Values {
+        uint64_t values[kCounterCount];
+        // bit of each counter read successfully
+        uint32_t validMask;
+
+        bool has(Counter counter) const {
+            return (validMask & (1u << counter)) != 0;
+        }
+    };
+
+    /**
+     * Read counters of current thread, opening them if not yet.
+     * @return false if none of counters is available.
+     */
+    static bool read(Mode mode, Values& out);
+};
+
+} // namespace rheatrace
@@ -22,6 +22,7 @@
 
 #include "../utils/misc.h"
 #include "../utils/time.h"
+#include "../utils/SymbolOffsetCache.h"
 
 #define LOG_TAG "RheaTrace.SamplingTrace"
 #include "../utils/log.h"
@@ -86,6 +87,7 @@ bool doInit(JNIEnv* env) {
     TraceLoadLibrary::init();
     TraceObjectWait::init(env, enableWakeup_, configArray_);
     TraceUnsafePark::init(env, enableWakeup_, configArray_);
+    symbol_offset_cache::persist();
     ALOGD("rheatrace hooks cost %lums", current_boot_time_millis() - now);
     inited = true;
     return true;
@@ -16,6 +16,7 @@
 
 #include "TraceBinderCall.h"
 #include "../sampling/SamplingCollector.h"
+#include "../utils/SymbolOffsetCache.h"
 
 #include <shadowhook.h>
 
@@ -30,7 +31,7 @@ int32_t IPCThreadState_transact(void *IPCThreadState, int32_t handle, uint32_t c
 }
 
 void TraceBinderCall::init() {
-    stub = shadowhook_hook_sym_name("libbinder.so", "_ZN7android14IPCThreadState8transactEijRKNS_6ParcelEPS1_j", (void *) IPCThreadState_transact, nullptr);
+    stub = symbol_offset_cache::hook("libbinder.so", "_ZN7android14IPCThreadState8transactEijRKNS_6ParcelEPS1_j", (void *) IPCThreadState_transact, nullptr);
 }
 
 void TraceBinderCall::destroy() {
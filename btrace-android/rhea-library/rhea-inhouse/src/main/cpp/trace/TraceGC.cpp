@@ -19,12 +19,14 @@
 #include <shadowhook.h>
 #include "../sampling/SamplingCollector.h"
 #include "../utils/time.h"
+#include "../utils/FastClock.h"
+#include "../utils/SymbolOffsetCache.h"
 
 namespace rheatrace {
 
 static void* proxyWaitForGcToCompleteLocked(void* proxy, void* cause, void* self) {
     SHADOWHOOK_STACK_SCOPE();
-    uint64_t beginNano = current_boot_time_nanos();
+    uint64_t beginNano = fast_clock::boot_time_nanos();
     uint64_t beginCpuNano = current_thread_cpu_time_nanos();
     void* result = SHADOWHOOK_CALL_PREV(proxyWaitForGcToCompleteLocked, proxy, cause, self);
     SamplingCollector::request(SamplingType::kGC, self, true, true, beginNano, beginCpuNano);
@@ -34,7 +36,7 @@ static void* proxyWaitForGcToCompleteLocked(void* proxy, void* cause, void* self
 static void *stub = nullptr;
 
 void TraceGC::init() {
-    stub = shadowhook_hook_sym_name(
+    stub = symbol_offset_cache::hook(
             "libart.so",
             "_ZN3art2gc4Heap25WaitForGcToCompleteLockedENS0_7GcCauseEPNS_6ThreadE",
             reinterpret_cast<void *>(proxyWaitForGcToCompleteLocked),
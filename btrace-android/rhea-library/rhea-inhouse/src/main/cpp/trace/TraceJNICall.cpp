@@ -21,6 +21,7 @@
 #include <shadowhook.h>
 #include "../sampling//SamplingCollector.h"
 #include "../utils/misc.h"
+#include "../utils/SymbolOffsetCache.h"
 
 #define LOG_TAG "RheaTrace:JNI"
 #include "../utils/log.h"
@@ -57,7 +58,7 @@ static void *jniStub = nullptr;
 void TraceJNICall::init() {
     auto sdk = get_android_sdk_version();
     auto jniTrampoline = sdk < ANDROID_11_SDK_INT ? (void *) JNI_artQuickGenericJniTrampoline_8to10 : (void *) JNI_artQuickGenericJniTrampoline_11to14;
-    jniStub = shadowhook_hook_sym_name("libart.so", "artQuickGenericJniTrampoline", jniTrampoline, nullptr);
+    jniStub = symbol_offset_cache::hook("libart.so", "artQuickGenericJniTrampoline", jniTrampoline, nullptr);
     ALOGE("artQuickGenericJniTrampoline %p", jniStub);
 }
 
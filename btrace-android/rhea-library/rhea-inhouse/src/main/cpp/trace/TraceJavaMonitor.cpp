@@ -17,8 +17,10 @@
 #include "TraceJavaMonitor.h"
 
 #include <shadowhook.h>
+#include "WakeupRegistry.h"
 #include "../sampling/SamplingCollector.h"
 #include "../utils/misc.h"
+#include "../utils/SymbolOffsetCache.h"
 
 #define LOG_TAG "RheaTrace:Monitor"
 #include "../utils/log.h"
@@ -26,55 +28,43 @@
 namespace rheatrace {
 
 static bool wakeupEnabled = false;
-static void *currentMainMonitor = nullptr;
-static uint64_t currentMainNano = 0;
 
 void *Monitor_MonitorEnter(void *self, void *obj, bool trylock) {
     SHADOWHOOK_STACK_SCOPE();
-    if (wakeupEnabled && is_main_thread()) {
-        ScopeSampling ss(SamplingType::kMonitor, self);
-        currentMainMonitor = obj;
-        currentMainNano = ss.beginNano_;
-        void *result = SHADOWHOOK_CALL_PREV(Monitor_MonitorEnter, self, obj, trylock);
-        currentMainMonitor = nullptr;
-        return result;
+    ScopeSampling ss(SamplingType::kMonitor, self);
+    if (wakeupEnabled && !trylock) {
+        WakeupRegistry::Blocked blocked(WakeupRegistry::kMonitor, (uintptr_t) obj, ss.beginNano_);
+        return SHADOWHOOK_CALL_PREV(Monitor_MonitorEnter, self, obj, trylock);
     } else {
-        ScopeSampling ss(SamplingType::kMonitor, self);
         return SHADOWHOOK_CALL_PREV(Monitor_MonitorEnter, self, obj, trylock);
     }
 }
 
 bool Monitor_MonitorExit(void *self, void *obj) {
     SHADOWHOOK_STACK_SCOPE();
-    if (!is_main_thread()) {
-        if (currentMainMonitor == obj) {
-            SamplingCollector::request(SamplingType::kUnlock, self, true, true, currentMainNano);
-            ALOGD("Monitor_MonitorExit wakeup main lock %ld", currentMainNano);
-        }
+    if (WakeupRegistry::anyBlocked(WakeupRegistry::kMonitor)) {
+        WakeupRegistry::wake(WakeupRegistry::kMonitor, (uintptr_t) obj, SamplingType::kUnlock, self,
+                             false);
     }
     return SHADOWHOOK_CALL_PREV(Monitor_MonitorExit, self, obj);
 }
 
 void Monitor_Lock(void *monitor, void *threadSelf) {
     SHADOWHOOK_STACK_SCOPE();
-    if (wakeupEnabled && is_main_thread()) {
-        ScopeSampling ss(SamplingType::kMonitor, threadSelf);
-        currentMainMonitor = monitor;
-        currentMainNano = ss.beginNano_;
+    ScopeSampling ss(SamplingType::kMonitor, threadSelf);
+    if (wakeupEnabled) {
+        WakeupRegistry::Blocked blocked(WakeupRegistry::kMonitor, (uintptr_t) monitor,
+                                        ss.beginNano_);
         SHADOWHOOK_CALL_PREV(Monitor_Lock, monitor, threadSelf);
-        currentMainMonitor = nullptr;
     } else {
-        ScopeSampling ss(SamplingType::kMonitor, threadSelf);
         SHADOWHOOK_CALL_PREV(Monitor_Lock, monitor, threadSelf);
     }
 }
 
 bool Monitor_Unlock(void *monitor, void *threadSelf) {
-    if (!is_main_thread()) {
-        if (currentMainMonitor == monitor) {
-            SamplingCollector::request(SamplingType::kUnlock, threadSelf, true, true, currentMainNano);
-            ALOGD("wakeup main lock %ld", currentMainNano);
-        }
+    if (WakeupRegistry::anyBlocked(WakeupRegistry::kMonitor)) {
+        WakeupRegistry::wake(WakeupRegistry::kMonitor, (uintptr_t) monitor, SamplingType::kUnlock,
+                             threadSelf, false);
     }
     return SHADOWHOOK_CALL_PREV(Monitor_Unlock, monitor, threadSelf);
 }
@@ -84,9 +74,9 @@ static void *stubExit = nullptr;
 
 void TraceJavaMonitor::init(bool enableWakeup) {
     wakeupEnabled = enableWakeup;
-    stubEnter = shadowhook_hook_sym_name("libart.so", "_ZN3art7Monitor12MonitorEnterEPNS_6ThreadENS_6ObjPtrINS_6mirror6ObjectEEEb", (void *) Monitor_MonitorEnter, nullptr);
+    stubEnter = symbol_offset_cache::hook("libart.so", "_ZN3art7Monitor12MonitorEnterEPNS_6ThreadENS_6ObjPtrINS_6mirror6ObjectEEEb", (void *) Monitor_MonitorEnter, nullptr);
     if (enableWakeup) {
-        stubExit = shadowhook_hook_sym_name("libart.so", "_ZN3art7Monitor11MonitorExitEPNS_6ThreadENS_6ObjPtrINS_6mirror6ObjectEEE", (void *) Monitor_MonitorExit, nullptr);
+        stubExit = symbol_offset_cache::hook("libart.so", "_ZN3art7Monitor11MonitorExitEPNS_6ThreadENS_6ObjPtrINS_6mirror6ObjectEEE", (void *) Monitor_MonitorExit, nullptr);
     }
 }
 
@@ -20,6 +20,7 @@
 #include <shadowhook.h>
 
 #include "../sampling/SamplingCollector.h"
+#include "../utils/SymbolOffsetCache.h"
 
 namespace rheatrace {
 
@@ -33,8 +34,8 @@ myJvmNativeLoad(JNIEnv* env, jstring javaFilename, jobject javaLoader, jstring j
 static void *stub = nullptr;
 
 void TraceLoadLibrary::init() {
-    stub = shadowhook_hook_sym_name("libopenjdkjvm.so", "JVM_NativeLoad", (void*) myJvmNativeLoad,
-                                    nullptr);
+    stub = symbol_offset_cache::hook("libopenjdkjvm.so", "JVM_NativeLoad", (void*) myJvmNativeLoad,
+                                     nullptr);
 }
 
 void TraceLoadLibrary::destroy() {
@@ -16,6 +16,7 @@
 
 #include "TraceObjectWait.h"
 
+#include "WakeupRegistry.h"
 #include "../sampling/SamplingCollector.h"
 #include "../utils/JNIHook.h"
 #include "../utils/misc.h"
@@ -31,60 +32,41 @@ static void (* Origin_notify)(JNIEnv*, jobject) = nullptr;
 static void (* Origin_notifyAll)(JNIEnv*, jobject) = nullptr;
 
 static bool wakeupEnabled = false;
-static jint currentMainWait = 0;
-static uint64_t currentMainNano = 0;
-
-static jint (* identityHashCode)(JNIEnv* env, jclass cls, jobject obj) = nullptr;
-
-static jint identityHashCodeFallback(JNIEnv* env, jclass cls, jobject obj) {
-    ALOGD(__FUNCTION__);
-    return 0;
-}
 
 static void Object_waitJI(JNIEnv* env, jobject java_this, jlong ms, jint ns) {
-    if (wakeupEnabled && is_main_thread()) {
-        ScopeSampling ss(SamplingType::kWait);
-        currentMainWait = identityHashCode(env, nullptr, java_this);
-        currentMainNano = ss.beginNano_;
-        ALOGD("wakeup main WAIT on %ld", currentMainNano);
+    ScopeSampling ss(SamplingType::kWait);
+    // no begin time while sampling is inactive, when the hash, which is also written into the
+    // lock word of the object, is not needed
+    if (wakeupEnabled && ss.beginNano_ != 0) {
+        WakeupRegistry::Blocked blocked(WakeupRegistry::kWait,
+                                        WakeupRegistry::identityHash(env, java_this),
+                                        ss.beginNano_);
         Origin_waitJI(env, java_this, ms, ns);
-        currentMainWait = 0;
     } else {
-        ScopeSampling ss(SamplingType::kWait);
         Origin_waitJI(env, java_this, ms, ns);
     }
 }
 
 static void Object_notify(JNIEnv* env, jobject java_this) {
-    if (currentMainWait != 0 && currentMainWait == identityHashCode(env, nullptr, java_this)) {
-        SamplingCollector::request(SamplingType::kNotify, nullptr,
-                                                  true, true, currentMainNano);
-        ALOGD("wakeup main wait %ld", currentMainNano);
+    if (WakeupRegistry::anyBlocked(WakeupRegistry::kWait)) {
+        WakeupRegistry::wake(WakeupRegistry::kWait, WakeupRegistry::identityHash(env, java_this),
+                             SamplingType::kNotify, nullptr, false);
     }
     Origin_notify(env, java_this);
 }
 
 static void Object_notifyAll(JNIEnv* env, jobject java_this) {
-    if (currentMainWait != 0 && currentMainWait == identityHashCode(env, nullptr, java_this)) {
-        SamplingCollector::request(SamplingType::kNotify, nullptr,
-                                                  true, true, currentMainNano);
-        ALOGD("wakeup main wait %ld", currentMainNano);
+    if (WakeupRegistry::anyBlocked(WakeupRegistry::kWait)) {
+        WakeupRegistry::wake(WakeupRegistry::kWait, WakeupRegistry::identityHash(env, java_this),
+                             SamplingType::kNotify, nullptr, true);
     }
     Origin_notifyAll(env, java_this);
 }
 
 void TraceObjectWait::init(JNIEnv* env, bool enableWakeup, const jlong* isNatives) {
     wakeupEnabled = enableWakeup;
-    if (enableWakeup && identityHashCode == nullptr) {
-        identityHashCode =
-                (jint(*)(JNIEnv*, jclass, jobject)) rheatrace::jni_hook::getStaticEntrance(
-                        env,
-                        "java/lang/Object",
-                        "identityHashCodeNative",
-                        "(Ljava/lang/Object;)I");
-    }
-    if (identityHashCode == nullptr) {
-        identityHashCode = identityHashCodeFallback;
+    if (enableWakeup) {
+        WakeupRegistry::init(env);
     }
     if (isNatives[0] > 0 && Origin_waitJI == nullptr) {
         rheatrace::jni_hook::hookMethodId(
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "TraceThreadName.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <shadowhook.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#include "../utils/SymbolOffsetCache.h"
+
+#define LOG_TAG "RheaTrace:ThreadName"
+#include "../utils/log.h"
+
+namespace rheatrace {
+
+// tids are bounded by pid_max, this only guards against a pathological pid_max
+static constexpr size_t kMaxEntries = 64 * 1024;
+
+static std::mutex sLock;
+static std::unordered_map<pid_t, std::array<char, TraceThreadName::kMaxNameLength>> sNames;
+static bool sHooked = false;
+
+static void *setNameStub = nullptr;
+static void *prctlStub = nullptr;
+static void *createStub = nullptr;
+
+static void recordName(pid_t tid, const char* name) {
+    if (tid <= 0 || name == nullptr) {
+        return;
+    }
+    std::array<char, TraceThreadName::kMaxNameLength> value{};
+    // kernel truncates thread names to 15 chars as well
+    strncpy(value.data(), name, value.size() - 1);
+    std::lock_guard<std::mutex> lock(sLock);
+    if (sNames.size() >= kMaxEntries && sNames.find(tid) == sNames.end()) {
+        return;
+    }
+    sNames[tid] = value;
+}
+
+static int proxyPthreadSetNameNp(pthread_t thread, const char* name) {
+    SHADOWHOOK_STACK_SCOPE();
+    int result = SHADOWHOOK_CALL_PREV(proxyPthreadSetNameNp, thread, name);
+    if (result == 0) {
+        recordName(pthread_gettid_np(thread), name);
+    }
+    return result;
+}
+
+static int proxyPrctl(int option, unsigned long arg2, unsigned long arg3, unsigned long arg4,
+                      unsigned long arg5) {
+    SHADOWHOOK_STACK_SCOPE();
+    int result = SHADOWHOOK_CALL_PREV(proxyPrctl, option, arg2, arg3, arg4, arg5);
+    if (result == 0 && option == PR_SET_NAME) {
+        recordName(gettid(), reinterpret_cast<const char*>(arg2));
+    }
+    return result;
+}
+
+struct ThreadStartArgs {
+    void* (*routine)(void*);
+    void* arg;
+};
+
+/**
+ * Record the name inherited from creator before running the real start routine, so that threads
+ * which are never renamed are still in the table.
+ */
+static void* threadStart(void* raw) {
+    auto* args = reinterpret_cast<ThreadStartArgs*>(raw);
+    auto routine = args->routine;
+    auto arg = args->arg;
+    delete args;
+    char name[TraceThreadName::kMaxNameLength] = {0};
+    if (prctl(PR_GET_NAME, name) == 0) {
+        recordName(gettid(), name);
+    }
+    return routine(arg);
+}
+
+static int proxyPthreadCreate(pthread_t* thread, const pthread_attr_t* attr,
+                              void* (*routine)(void*), void* arg) {
+    SHADOWHOOK_STACK_SCOPE();
+    auto* args = new ThreadStartArgs{routine, arg};
+    int result = SHADOWHOOK_CALL_PREV(proxyPthreadCreate, thread, attr, threadStart, args);
+    if (result != 0) {
+        delete args;
+    }
+    return result;
+}
+
+static void seedFromProc() {
+    DIR *dir = opendir("/proc/self/task");
+    if (dir == nullptr) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (entry->d_type != DT_DIR || entry->d_name[0] == '.') {
+            continue;
+        }
+        auto tid = (pid_t) atoi(entry->d_name);
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+        FILE *file = fopen(path, "r");
+        if (file == nullptr) {
+            continue;
+        }
+        char name[TraceThreadName::kMaxNameLength + 1] = {0};
+        if (fgets(name, sizeof(name), file) != nullptr) {
+            name[strcspn(name, "\n")] = 0;
+            recordName(tid, name);
+        }
+        fclose(file);
+    }
+    closedir(dir);
+}
+
+bool TraceThreadName::init() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+        // hook first, so that no naming event is missed between seeding and hooking
+        setNameStub = symbol_offset_cache::hook("libc.so", "pthread_setname_np",
+                                                (void *) proxyPthreadSetNameNp, nullptr);
+        prctlStub = symbol_offset_cache::hook("libc.so", "prctl", (void *) proxyPrctl, nullptr);
+        createStub = symbol_offset_cache::hook("libc.so", "pthread_create",
+                                               (void *) proxyPthreadCreate, nullptr);
+        seedFromProc();
+        sHooked = setNameStub != nullptr && prctlStub != nullptr && createStub != nullptr;
+        if (!sHooked) {
+            ALOGE("hook thread name failed: %d", shadowhook_get_errno());
+        }
+    });
+    return sHooked;
+}
+
+bool TraceThreadName::snapshot(std::vector<Entry>& out) {
+    if (!sHooked) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(sLock);
+    out.reserve(out.size() + sNames.size());
+    for (auto& item : sNames) {
+        Entry entry{};
+        entry.tid = item.first;
+        memcpy(entry.name, item.second.data(), kMaxNameLength);
+        out.push_back(entry);
+    }
+    return true;
+}
+
+} // namespace rheatrace
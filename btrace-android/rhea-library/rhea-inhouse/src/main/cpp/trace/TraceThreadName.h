@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <sys/types.h>
+#include <vector>
+
+namespace rheatrace {
+
+/**
+ * Maintain a tid to name table from thread naming events, so that dump doesn't need to read
+ * /proc/self/task. Names of exited threads are kept until their tids are reused.
+ */
+class TraceThreadName {
+public:
+    static constexpr int kMaxNameLength = 16;
+
+    struct Entry {
+        pid_t tid;
+        char name[kMaxNameLength];
+    };
+
+    /**
+     * Seed the table with current threads and hook naming functions. Hooks stay installed for the
+     * rest of the process, otherwise the table would go stale.
+     * @return true if every hook is installed.
+     */
+    static bool init();
+
+    /**
+     * Copy the table into out.
+     * @return false if table is not maintained by hooks, caller should read names elsewhere.
+     */
+    static bool snapshot(std::vector<Entry>& out);
+};
+
+} // namespace rheatrace
@@ -16,6 +16,7 @@
 
 #include "TraceUnsafePark.h"
 
+#include "WakeupRegistry.h"
 #include "../sampling/SamplingCollector.h"
 #include "../RheaContext.h"
 #include "../utils/JNIHook.h"
@@ -27,18 +28,16 @@
 namespace rheatrace {
 
 static bool wakeupEnabled = false;
-static bool currentMainPark = false;
-static uint64_t currentMainNano = 0;
 
 static void (*Unsafe_park_origin)(JNIEnv *, jobject, jboolean, jlong) = nullptr;
 
 static void Unsafe_park(JNIEnv *env, jobject java_this, jboolean isAbsolute, jlong time) {
-    if (wakeupEnabled && is_main_thread()) {
+    if (wakeupEnabled) {
         ScopeSampling ss(SamplingType::kPark);
-        currentMainPark = true;
-        currentMainNano = ss.beginNano_;
+        // the thread object is only looked up once sampling is active
+        uintptr_t thread = ss.beginNano_ != 0 ? WakeupRegistry::currentThreadHash(env) : 0;
+        WakeupRegistry::Blocked blocked(WakeupRegistry::kPark, thread, ss.beginNano_);
         Unsafe_park_origin(env, java_this, isAbsolute, time);
-        currentMainPark = false;
     } else {
         Unsafe_park_origin(env, java_this, isAbsolute, time);
     }
@@ -47,17 +46,19 @@ static void Unsafe_park(JNIEnv *env, jobject java_this, jboolean isAbsolute, jlo
 static void (*Unsafe_unpark_origin)(JNIEnv *, jobject, jobject) = nullptr;
 
 static void Unsafe_unpark(JNIEnv *env, jobject java_this, jobject target) {
-    if (currentMainPark && env->IsSameObject(target, rheatrace::RheaContext::javaMainThread)) {
-        SamplingCollector::request(SamplingType::kUnpark, nullptr, true, true, currentMainNano);
-        ALOGD("wakeup main park %ld", currentMainNano);
-        Unsafe_unpark_origin(env, java_this, target);
-    } else {
-        Unsafe_unpark_origin(env, java_this, target);
+    if (WakeupRegistry::anyBlocked(WakeupRegistry::kPark)) {
+        // unpark wakes exactly the target thread
+        WakeupRegistry::wake(WakeupRegistry::kPark, WakeupRegistry::identityHash(env, target),
+                             SamplingType::kUnpark, nullptr, true);
     }
+    Unsafe_unpark_origin(env, java_this, target);
 }
 
 void TraceUnsafePark::init(JNIEnv *env, bool enableWakeup, const jlong *isNatives) {
     wakeupEnabled = enableWakeup;
+    if (enableWakeup) {
+        WakeupRegistry::init(env);
+    }
     if (Unsafe_park_origin != nullptr && Unsafe_unpark_origin != nullptr) {
         return;
     }
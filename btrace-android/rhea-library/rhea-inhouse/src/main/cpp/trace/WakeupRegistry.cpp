@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "WakeupRegistry.h"
+
+#include "../sampling/SamplingCollector.h"
+#include "../utils/JNIHook.h"
+#include "../utils/misc.h"
+#define LOG_TAG "RheaTrace:Wakeup"
+#include "../utils/log.h"
+
+namespace rheatrace {
+
+WakeupRegistry::BlockedCounter WakeupRegistry::sBlocked[kCounterShards];
+
+namespace {
+
+constexpr uint32_t kBucketCount = 256;
+constexpr uint32_t kBucketSlots = 8;
+// a slot being filled or emptied, never equal to any key since kind is never 0
+constexpr uintptr_t kReserved = ~uintptr_t(3);
+
+struct BlockedSlot {
+    // object with kind in its low 2 bits, 0 if free
+    std::atomic<uintptr_t> key;
+    std::atomic<uint64_t> beginNano;
+    std::atomic<int32_t> tid;
+};
+
+BlockedSlot sSlots[kBucketCount * kBucketSlots];
+
+jint (* sIdentityHashCode)(JNIEnv* env, jclass cls, jobject obj) = nullptr;
+jclass sThreadClass = nullptr;
+jmethodID sCurrentThread = nullptr;
+
+uintptr_t makeKey(WakeupRegistry::Kind kind, uintptr_t object) {
+    // identity hashes are shifted, pointers are aligned and keep their low bits clear
+    return kind == WakeupRegistry::kMonitor ? (object | kind) : ((object << 2) | kind);
+}
+
+uint32_t bucketOf(uintptr_t key) {
+    uint64_t hash = uint64_t(key) * 0x9E3779B97F4A7C15ULL;
+    return uint32_t(hash >> 56) % kBucketCount * kBucketSlots;
+}
+
+}
+
+void WakeupRegistry::init(JNIEnv* env) {
+    if (sIdentityHashCode == nullptr) {
+        sIdentityHashCode = (jint(*)(JNIEnv*, jclass, jobject)) jni_hook::getStaticEntrance(
+                env, "java/lang/Object", "identityHashCodeNative", "(Ljava/lang/Object;)I");
+        if (sIdentityHashCode == nullptr) {
+            ALOGD("identityHashCodeNative not found");
+        }
+    }
+    if (sThreadClass == nullptr) {
+        jclass threadClass = env->FindClass("java/lang/Thread");
+        sCurrentThread = env->GetStaticMethodID(threadClass, "currentThread",
+                                                "()Ljava/lang/Thread;");
+        sThreadClass = (jclass) env->NewGlobalRef(threadClass);
+        env->DeleteLocalRef(threadClass);
+    }
+}
+
+uintptr_t WakeupRegistry::identityHash(JNIEnv* env, jobject obj) {
+    if (sIdentityHashCode == nullptr || obj == nullptr) {
+        return 0;
+    }
+    return uint32_t(sIdentityHashCode(env, nullptr, obj));
+}
+
+uintptr_t WakeupRegistry::currentThreadHash(JNIEnv* env) {
+    static thread_local uintptr_t hash = 0;
+    if (hash == 0 && sThreadClass != nullptr) {
+        jobject thread = env->CallStaticObjectMethod(sThreadClass, sCurrentThread);
+        hash = identityHash(env, thread);
+        env->DeleteLocalRef(thread);
+    }
+    return hash;
+}
+
+WakeupRegistry::Blocked::Blocked(Kind kind, uintptr_t object, uint64_t beginNano) : mSlot(-1) {
+    if (object == 0 || beginNano == 0) {
+        return;
+    }
+    uintptr_t key = makeKey(kind, object);
+    uint32_t bucket = bucketOf(key);
+    for (uint32_t i = 0; i < kBucketSlots; ++i) {
+        auto& slot = sSlots[bucket + i];
+        uintptr_t expected = 0;
+        if (slot.key.load(std::memory_order_relaxed) == 0 &&
+            slot.key.compare_exchange_strong(expected, kReserved, std::memory_order_acquire)) {
+            slot.beginNano.store(beginNano, std::memory_order_relaxed);
+            slot.tid.store(current_tid(), std::memory_order_relaxed);
+            slot.key.store(key, std::memory_order_release);
+            sBlocked[current_tid() % kCounterShards].counts[kind].fetch_add(
+                    1, std::memory_order_relaxed);
+            mSlot = int32_t(bucket + i);
+            return;
+        }
+    }
+}
+
+WakeupRegistry::Blocked::~Blocked() {
+    if (mSlot < 0) {
+        return;
+    }
+    auto& slot = sSlots[mSlot];
+    auto kind = slot.key.load(std::memory_order_relaxed) & 3;
+    sBlocked[current_tid() % kCounterShards].counts[kind].fetch_sub(1, std::memory_order_relaxed);
+    slot.key.store(0, std::memory_order_release);
+}
+
+void WakeupRegistry::wake(Kind kind, uintptr_t object, SamplingType type, void* self, bool all) {
+    uintptr_t key = makeKey(kind, object);
+    uint32_t bucket = bucketOf(key);
+    pid_t current = current_tid();
+    uint64_t wakeeNanos[kBucketSlots];
+    pid_t wakees[kBucketSlots];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < kBucketSlots; ++i) {
+        auto& slot = sSlots[bucket + i];
+        if (slot.key.load(std::memory_order_acquire) != key) {
+            continue;
+        }
+        uint64_t beginNano = slot.beginNano.load(std::memory_order_relaxed);
+        pid_t tid = slot.tid.load(std::memory_order_relaxed);
+        // the slot may have been released and taken again while being read
+        if (slot.key.load(std::memory_order_acquire) != key || tid == current) {
+            continue;
+        }
+        if (all || count == 0) {
+            wakeeNanos[count] = beginNano;
+            wakees[count] = tid;
+            count++;
+        } else if (beginNano < wakeeNanos[0]) {
+            wakeeNanos[0] = beginNano;
+            wakees[0] = tid;
+        }
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        SamplingCollector::requestWakeup(type, self, wakeeNanos[i], wakees[i]);
+    }
+}
+
+} // namespace rheatrace
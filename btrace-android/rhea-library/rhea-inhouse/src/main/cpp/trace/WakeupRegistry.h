@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <jni.h>
+#include <atomic>
+#include <cstdint>
+#include <sys/types.h>
+#include "../sampling/SamplingRecord.h"
+
+namespace rheatrace {
+
+/**
+ * Lock-free registry of threads blocked in wait, monitor enter and park, keyed by what they are
+ * blocked on: identity hash of the waited object, the monitor or object pointer, and identity
+ * hash of the parked java thread. Any thread notifying, unlocking or unparking looks the key up
+ * and emits a wakeup record for the threads it wakes, carrying tid and block begin time of the
+ * wakee, so that offline tools can pair it with the blocking record of any thread.
+ * Slots live in small fixed buckets, a thread which finds its bucket full is not registered.
+ */
+class WakeupRegistry {
+public:
+    enum Kind : uintptr_t {
+        kWait = 1,
+        kMonitor = 2,
+        kPark = 3,
+    };
+
+    static void init(JNIEnv* env);
+
+    /**
+     * @return identity hash of obj as a key, 0 if unavailable.
+     */
+    static uintptr_t identityHash(JNIEnv* env, jobject obj);
+
+    /**
+     * @return identity hash of java thread of current thread, which unpark() is given.
+     */
+    static uintptr_t currentThreadHash(JNIEnv* env);
+
+    /**
+     * Registers current thread as blocked on object during its scope, does nothing if object or
+     * beginNano is 0, as when sampling is inactive.
+     */
+    class Blocked {
+    public:
+        Blocked(Kind kind, uintptr_t object, uint64_t beginNano);
+
+        ~Blocked();
+
+        Blocked(const Blocked&) = delete;
+
+        Blocked& operator=(const Blocked&) = delete;
+
+    private:
+        int32_t mSlot;
+    };
+
+    /**
+     * Emit a record of type for threads blocked on object.
+     * @param all wakes every blocked thread, otherwise only the one blocked for longest, as which
+     * one notify() or unlock wakes is not known.
+     */
+    static void wake(Kind kind, uintptr_t object, SamplingType type, void* self, bool all);
+
+    /**
+     * @return true if any thread may be blocked on kind, a cheap check before computing keys.
+     */
+    static bool anyBlocked(Kind kind) {
+        for (auto& counter : sBlocked) {
+            if (counter.counts[kind].load(std::memory_order_relaxed) > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static constexpr uint32_t kCounterShards = 8;
+
+    /**
+     * Blocked threads of each kind counted on a cache line of their own, picked by tid, so that
+     * threads blocking at the same time rarely write the same line, while checks which are on
+     * every unlock only read lines that are seldom written.
+     */
+    struct alignas(64) BlockedCounter {
+        std::atomic<int32_t> counts[4];
+    };
+
+    static BlockedCounter sBlocked[kCounterShards];
+};
+
+} // namespace rheatrace
@@ -20,7 +20,6 @@
 #include "TraceJavaAlloc.h"
 
 #include <memory>
-#include "../../utils/npth_dl.h"
 #include <shadowhook.h>
 #include <mutex>
 #include "java_alloc_common.h"
@@ -31,6 +30,7 @@
 #include "../../RheaContext.h"
 #include "../../utils/log.h"
 #include "../../utils/misc.h"
+#include "../../utils/SymbolOffsetCache.h"
 
 #ifdef LOG_TAG
 #undef LOG_TAG
@@ -117,17 +117,17 @@ public:
 
 void onObjectAllocated(void* self, void* obj, size_t byte_count) {
     JavaObjectStat::onObjectAllocated(byte_count);
-    SamplingCollector::request(SamplingType::kObjectAllocation, self);
+    SamplingCollector::requestAllocation(self, byte_count);
 }
 
 bool hookSelfSetEntrypoints() {
     if (s_stub_SetEntrypointsInstrumented != nullptr) {
         return true;
     }
-    void *stub = shadowhook_hook_sym_name("libart.so",
-                                          "_ZN3art15instrumentation15Instrumentation26SetEntrypointsInstrumentedEb",
-                                          (void *) (SetEntrypointsInstrumentedWithCheckpoint),
-                                          nullptr);
+    void *stub = symbol_offset_cache::hook("libart.so",
+                                           "_ZN3art15instrumentation15Instrumentation26SetEntrypointsInstrumentedEb",
+                                           (void *) (SetEntrypointsInstrumentedWithCheckpoint),
+                                           nullptr);
     if (stub == nullptr) {
         int error_num = shadowhook_get_errno();
         const char *error_msg = shadowhook_to_errmsg(error_num);
@@ -254,45 +254,40 @@ void registerAllocationListener() {
 }
 
 bool TraceJavaAlloc::init() {
-    std::shared_ptr<void> scope = std::shared_ptr<void>(npth_dlopen("libart.so"), npth_dlclose);
-    if (scope.get() == nullptr) {
-        ALOGE("Cannot open libart.so");
+    if(!init_checkpoint()) {
         return false;
     }
 
-    void* art_lib = scope.get();
-    if(!init_checkpoint(art_lib)) {
-        return false;
-    }
+    const char* symbols[] = {HEAP_SET_ALLOC_LISTENER, HEAP_REMOVE_ALLOC_LISTENER,
+                             Thread_RESET_QUICK_ALLOC_ENTRY_POINTS_FOR_THREAD,
+                             Thread_RESET_QUICK_ALLOC_ENTRY_POINTS_FOR_THREAD_BOOL,
+                             SET_QUICK_ALLOC_ENTRY_POINTS_INSTRUMENTED};
+    void* addresses[5];
+    symbol_offset_cache::resolve_batch("libart.so", symbols, addresses, 5);
 
-    SetAllocationListenerFunc = (SetPtr_) npth_dlsym(art_lib,
-                                                            HEAP_SET_ALLOC_LISTENER);
+    SetAllocationListenerFunc = (SetPtr_) addresses[0];
     if(SetAllocationListenerFunc == nullptr) {
         ALOGE("Cannot find SetAllocationListener");
         return false;
     }
-    RemoveAllocationListenerFunc = (CallVoid_) npth_dlsym(art_lib,
-                                                                 HEAP_REMOVE_ALLOC_LISTENER);
+    RemoveAllocationListenerFunc = (CallVoid_) addresses[1];
     if(RemoveAllocationListenerFunc == nullptr) {
         ALOGE("Cannot find RemoveAllocationListener");
         return false;
     }
 
     s_use_thread_ResetQuickAllocEntryPointsForThread_bool = false;
-    Thread_ResetQuickAllocEntryPointsForThreadFunc = npth_dlsym(art_lib,
-                                                                       Thread_RESET_QUICK_ALLOC_ENTRY_POINTS_FOR_THREAD);
+    Thread_ResetQuickAllocEntryPointsForThreadFunc = addresses[2];
     if(Thread_ResetQuickAllocEntryPointsForThreadFunc == nullptr) {
         s_use_thread_ResetQuickAllocEntryPointsForThread_bool = true;
-        Thread_ResetQuickAllocEntryPointsForThreadFunc = npth_dlsym(art_lib,
-                                                                           Thread_RESET_QUICK_ALLOC_ENTRY_POINTS_FOR_THREAD_BOOL);
+        Thread_ResetQuickAllocEntryPointsForThreadFunc = addresses[3];
     }
     if(Thread_ResetQuickAllocEntryPointsForThreadFunc == nullptr) {
         ALOGE("Cannot find ResetQuickAllocEntryPointsForThread");
         return false;
     }
 
-    SetQuickAllocEntryPointsInstrumentedFunc = (SetQuickAllocEntryPointsInstrumented_) npth_dlsym(
-            art_lib, SET_QUICK_ALLOC_ENTRY_POINTS_INSTRUMENTED);
+    SetQuickAllocEntryPointsInstrumentedFunc = (SetQuickAllocEntryPointsInstrumented_) addresses[4];
     if(SetQuickAllocEntryPointsInstrumentedFunc == nullptr) {
         ALOGE("Cannot find SetQuickAllocEntryPointsInstrumented");
         return false;
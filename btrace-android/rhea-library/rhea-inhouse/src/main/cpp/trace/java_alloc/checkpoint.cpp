@@ -20,7 +20,7 @@
 #include "checkpoint.h"
 #include <stdint.h>
 #include <shadowhook.h>
-#include "../../utils/npth_dl.h"
+#include "../../utils/SymbolOffsetCache.h"
 #include "java_alloc_common.h"
 #include "../../RheaContext.h"
 #include "../../utils/log.h"
@@ -51,13 +51,13 @@ size_t run_checkpoint(void *closure) {
     }
 }
 
-bool init_checkpoint(void* lib) {
-
-    ThreadList_RunCheckpointFunc = (ThreadList_RunCheckpoint_) npth_dlsym(lib,
-                                                                                 ThreadList_RUN_CHECKPOINT);
+bool init_checkpoint() {
+    const char* symbols[] = {ThreadList_RUN_CHECKPOINT, ThreadList_RUN_CHECKPOINT_15};
+    void* addresses[2];
+    symbol_offset_cache::resolve_batch("libart.so", symbols, addresses, 2);
+    ThreadList_RunCheckpointFunc = (ThreadList_RunCheckpoint_) addresses[0];
     if(ThreadList_RunCheckpointFunc == nullptr) {
-        ThreadList_RunCheckpointFunc_15 = (ThreadList_RunCheckpoint_15_) npth_dlsym(lib,
-                                                                                     ThreadList_RUN_CHECKPOINT_15);
+        ThreadList_RunCheckpointFunc_15 = (ThreadList_RunCheckpoint_15_) addresses[1];
     }
     if (ThreadList_RunCheckpointFunc == nullptr && ThreadList_RunCheckpointFunc_15 == nullptr) {
         ALOGE("Cannot get ThreadList_RunCheckpoint");
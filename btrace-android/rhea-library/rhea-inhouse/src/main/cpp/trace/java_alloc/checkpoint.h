@@ -30,7 +30,7 @@ public:
 };
 
 size_t run_checkpoint(void *closure);
-bool init_checkpoint(void* lib);
+bool init_checkpoint();
 
 }
 
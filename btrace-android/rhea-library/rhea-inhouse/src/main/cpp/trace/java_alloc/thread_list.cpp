@@ -18,6 +18,7 @@
 #include <shadowhook.h>
 #include "java_alloc_common.h"
 #include "../../RheaContext.h"
+#include "../../utils/SymbolOffsetCache.h"
 #include "../../utils/log.h"
 
 #ifdef LOG_TAG
@@ -62,17 +63,17 @@ bool init_thread_list() {
     if (RheaContext::threadList != nullptr || (sThreadInitHookStub!= nullptr && sFinalizerStub!= nullptr)) {
         return true;
     }
-    sThreadInitHookStub = shadowhook_hook_sym_name("libart.so", THREAD_INIT,
-                                                   reinterpret_cast<void*>(proxyThreadInit),
-                                                   nullptr);
+    sThreadInitHookStub = symbol_offset_cache::hook("libart.so", THREAD_INIT,
+                                                    reinterpret_cast<void*>(proxyThreadInit),
+                                                    nullptr);
     if (sThreadInitHookStub== nullptr) {
         ALOGE("failed to hook %s", THREAD_INIT);
         return false;
     }
-    sFinalizerStub = shadowhook_hook_sym_name("libart.so",
-                                             "_ZN3art2gc4Heap21AddFinalizerReferenceEPNS_6ThreadEPNS_6ObjPtrINS_6mirror6ObjectEEE",
-                                             reinterpret_cast<void*>(MyAddFinalizerReference),
-                                             nullptr);
+    sFinalizerStub = symbol_offset_cache::hook("libart.so",
+                                              "_ZN3art2gc4Heap21AddFinalizerReferenceEPNS_6ThreadEPNS_6ObjPtrINS_6mirror6ObjectEEE",
+                                              reinterpret_cast<void*>(MyAddFinalizerReference),
+                                              nullptr);
     if (sFinalizerStub== nullptr) {
         ALOGE("failed to hook %s", "_ZN3art2gc4Heap21AddFinalizerReferenceEPNS_6ThreadEPNS_6ObjPtrINS_6mirror6ObjectEEE");
         return false;
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "FastClock.h"
+
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+
+#define LOG_TAG "RheaTrace:FastClock"
+#include "log.h"
+
+namespace rheatrace::fast_clock {
+
+// calibration is given up if counter disagrees with boot time by more than this
+static constexpr int64_t kMaxErrorNanos = 100000;
+// counter is taken as stopped in suspend if it lags boot time by more than kMaxErrorNanos plus
+// this part of counter time since the last anchor, which covers frequency error and slewing
+static constexpr uint64_t kMaxDriftRatio = 1000;
+
+namespace internal {
+
+std::atomic<bool> sReady(false);
+uint64_t sMult = 0;
+uint64_t sAnchorTicks = 0;
+std::atomic<int64_t> sOffset(0);
+std::atomic<uint64_t> sNextAnchor(0);
+
+uint64_t anchor(uint64_t counter) {
+    uint64_t boot = current_boot_time_nanos();
+    uint64_t next = sNextAnchor.load(std::memory_order_relaxed);
+    // only one of threads reading at the same time anchors, older anchors must not win
+    if (counter >= next &&
+        sNextAnchor.compare_exchange_strong(next, counter + sAnchorTicks,
+                                            std::memory_order_relaxed)) {
+        if (sReady.load(std::memory_order_relaxed)) {
+            uint64_t predicted = scale(counter) + sOffset.load(std::memory_order_relaxed);
+            uint64_t elapsed = scale(counter - (next - sAnchorTicks));
+            if (boot > predicted + kMaxErrorNanos + elapsed / kMaxDriftRatio) {
+                sReady.store(false, std::memory_order_relaxed);
+                ALOGI("fast clock disabled, counter lags boot time by %lluns",
+                      (unsigned long long) (boot - predicted));
+            }
+        }
+        sOffset.store(int64_t(boot - scale(counter)), std::memory_order_relaxed);
+    }
+    return boot;
+}
+
+} // namespace internal
+
+/**
+ * @return ticks per second of counter, 0 if unknown.
+ */
+static uint64_t counter_frequency() {
+#if defined(__aarch64__)
+    uint64_t frequency;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+    return frequency;
+#elif defined(__x86_64__) || defined(__i386__)
+    // tsc frequency is not exposed to user space, measure it against boot time
+    uint64_t beginBoot = current_boot_time_nanos();
+    uint64_t beginCounter = internal::read_counter();
+    usleep(2000);
+    uint64_t endBoot = current_boot_time_nanos();
+    uint64_t endCounter = internal::read_counter();
+    if (endBoot <= beginBoot || endCounter <= beginCounter) {
+        return 0;
+    }
+    return uint64_t((unsigned __int128) (endCounter - beginCounter) * 1000000000ULL /
+                    (endBoot - beginBoot));
+#else
+    return 0;
+#endif
+}
+
+void init() {
+    static std::atomic<bool> sStarted(false);
+    if (sStarted.exchange(true, std::memory_order_relaxed)) {
+        return;
+    }
+    std::thread(calibrate).detach();
+}
+
+bool calibrate() {
+    if (internal::sReady.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    uint64_t frequency = counter_frequency();
+    if (frequency == 0) {
+        ALOGI("fast clock unavailable");
+        return false;
+    }
+    internal::sMult = uint64_t(((unsigned __int128) 1000000000ULL << 32) / frequency);
+    internal::sAnchorTicks = uint64_t((unsigned __int128) frequency * internal::kAnchorNanos /
+                                      1000000000ULL);
+    internal::sNextAnchor.store(0, std::memory_order_relaxed);
+    internal::anchor(internal::read_counter());
+    usleep(1000);
+    int64_t error = int64_t(internal::scale(internal::read_counter()) +
+                            internal::sOffset.load(std::memory_order_relaxed) -
+                            current_boot_time_nanos());
+    if (std::llabs(error) > kMaxErrorNanos) {
+        ALOGI("fast clock disabled, error is %lldns", (long long) error);
+        return false;
+    }
+    internal::sReady.store(true, std::memory_order_release);
+    ALOGI("fast clock enabled, frequency is %llu, error is %lldns", (unsigned long long) frequency,
+          (long long) error);
+    return true;
+}
+
+} // namespace rheatrace::fast_clock
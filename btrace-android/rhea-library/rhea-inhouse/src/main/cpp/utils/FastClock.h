@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "time.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * Boot time read from the arm64 virtual counter or the x86 tsc in user space, which costs a few
+ * cycles instead of a clock_gettime call. The counter is scaled by its frequency and anchored to
+ * CLOCK_BOOTTIME, and is anchored again by the first read after every kAnchorNanos of counter
+ * time to correct the drift. Time never goes back on a thread when an anchor does so.
+ *
+ * The arm64 system counter is always on by architecture and keeps counting in suspend, unless the
+ * device tree says "arm,no-tick-in-suspend", while the tsc usually stops in suspend. A counter
+ * which stopped makes reads lag boot time by the whole suspend until the next anchor, so an anchor
+ * finding such a lag turns the fast clock off for good, and the error is bounded by the first
+ * kAnchorNanos of counter time after the first resume. Before calibration succeeds or after the
+ * fast clock is turned off, time is read by clock_gettime.
+ */
+namespace rheatrace::fast_clock {
+
+namespace internal {
+
+// released after sMult and sAnchorTicks are set, cleared if counter stops in suspend
+extern std::atomic<bool> sReady;
+// nanos per tick in 32.32 fixed point
+extern uint64_t sMult;
+// ticks of kAnchorNanos
+extern uint64_t sAnchorTicks;
+// boot time minus scaled counter
+extern std::atomic<int64_t> sOffset;
+// counter after which boot time is read by clock_gettime again
+extern std::atomic<uint64_t> sNextAnchor;
+
+static constexpr uint64_t kAnchorNanos = 10000000;
+
+/**
+ * Anchor counter to boot time unless another thread has just done it, and turn the fast clock off
+ * if counter lags boot time more than the drift since the last anchor explains.
+ * @return boot time.
+ */
+uint64_t anchor(uint64_t counter);
+
+static inline uint64_t read_counter() {
+#if defined(__aarch64__)
+    uint64_t value;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(value) :: "memory");
+    return value;
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static inline uint64_t scale(uint64_t counter) {
+    return uint64_t(((unsigned __int128) counter * sMult) >> 32);
+}
+
+} // namespace internal
+
+/**
+ * Calibrate the counter on a background thread once per process, since calibration sleeps a few
+ * milliseconds. Time is read by clock_gettime until it is done.
+ */
+void init();
+
+/**
+ * Calibrate the counter against CLOCK_BOOTTIME on current thread, keeps using clock_gettime if
+ * the counter is unavailable or inconsistent with boot time.
+ * @return true if the fast clock is enabled.
+ */
+bool calibrate();
+
+static inline uint64_t boot_time_nanos() {
+    if (!internal::sReady.load(std::memory_order_acquire)) {
+        return current_boot_time_nanos();
+    }
+    uint64_t counter = internal::read_counter();
+    uint64_t now;
+    if (counter >= internal::sNextAnchor.load(std::memory_order_relaxed)) {
+        now = internal::anchor(counter);
+    } else {
+        now = internal::scale(counter) + internal::sOffset.load(std::memory_order_relaxed);
+    }
+    // an anchor may move time back a little, durations measured by a thread must not wrap
+    static thread_local uint64_t sLast = 0;
+    if (now < sLast) {
+        return sLast;
+    }
+    sLast = now;
+    return now;
+}
+
+} // namespace rheatrace::fast_clock
@@ -0,0 +1,388 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "SymbolOffsetCache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <link.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <shadowhook.h>
+
+#include "npth_dl.h"
+
+#define LOG_TAG "RheaTrace:SymbolOffsetCache"
+#include "log.h"
+
+namespace rheatrace::symbol_offset_cache {
+
+static constexpr const char* kFileName = "symbol_offsets";
+static constexpr const char* kFileMagic = "rhea-symbol-offsets 1";
+// symbol is absent from .dynsym
+static constexpr uintptr_t kMissingDynamic = ~uintptr_t(0);
+// symbol is absent from both .dynsym and .symtab
+static constexpr uintptr_t kMissingAll = ~uintptr_t(1);
+
+struct Segment {
+    uintptr_t begin;
+    uintptr_t end;
+};
+
+struct Library {
+    std::string name;
+    // build-id of the offsets, replaced by the one of the loaded library once located
+    std::string buildId;
+    bool located = false;
+    uintptr_t loadBias = 0;
+    std::vector<Segment> executables;
+    void* handle = nullptr;
+    std::unordered_map<std::string, uintptr_t> offsets;
+};
+
+using DlIterate = int (*)(int (*)(struct dl_phdr_info*, size_t, void*), void*);
+
+static std::mutex sLock;
+static std::string sPath;
+static bool sDirty = false;
+static auto* sLibraries = new std::vector<std::unique_ptr<Library>>();
+
+/**
+ * Same rule as npth_dlopen: basenames are compared if only one of the names is absolute.
+ */
+static bool same_library(const char* wanted, const char* loaded) {
+    if ('/' == wanted[0] && '/' != loaded[0]) {
+        wanted = strrchr(wanted, '/') + 1;
+    } else if ('/' != wanted[0] && '/' == loaded[0]) {
+        loaded = strrchr(loaded, '/') + 1;
+    }
+    return strcmp(wanted, loaded) == 0;
+}
+
+static std::string read_build_id(struct dl_phdr_info* info) {
+    static const char* kHex = "0123456789abcdef";
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        if (phdr.p_type != PT_NOTE) {
+            continue;
+        }
+        auto note = info->dlpi_addr + phdr.p_vaddr;
+        auto noteEnd = note + phdr.p_memsz;
+        while (note + sizeof(ElfW(Nhdr)) <= noteEnd) {
+            auto* nhdr = reinterpret_cast<const ElfW(Nhdr)*>(note);
+            auto desc = note + sizeof(ElfW(Nhdr)) + ((nhdr->n_namesz + 3) & ~3u);
+            if (nhdr->n_type == NT_GNU_BUILD_ID && desc + nhdr->n_descsz <= noteEnd) {
+                std::string buildId;
+                auto* bytes = reinterpret_cast<const uint8_t*>(desc);
+                for (uint32_t j = 0; j < nhdr->n_descsz; ++j) {
+                    buildId.push_back(kHex[bytes[j] >> 4]);
+                    buildId.push_back(kHex[bytes[j] & 0xf]);
+                }
+                return buildId;
+            }
+            note = desc + ((nhdr->n_descsz + 3) & ~3u);
+        }
+    }
+    return "";
+}
+
+static int locate_callback(struct dl_phdr_info* info, size_t, void* data) {
+    if (info->dlpi_name == nullptr) {
+        return 0;
+    }
+    auto* pending = static_cast<std::vector<Library*>*>(data);
+    for (auto it = pending->begin(); it != pending->end(); ++it) {
+        Library* lib = *it;
+        if (!same_library(lib->name.c_str(), info->dlpi_name)) {
+            continue;
+        }
+        lib->located = true;
+        lib->loadBias = info->dlpi_addr;
+        for (int i = 0; i < info->dlpi_phnum; ++i) {
+            const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+            if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X) != 0) {
+                uintptr_t begin = info->dlpi_addr + phdr.p_vaddr;
+                lib->executables.push_back({begin, begin + phdr.p_memsz});
+            }
+        }
+        std::string buildId = read_build_id(info);
+        if (buildId.empty() || buildId != lib->buildId) {
+            // library is updated by OTA or not identifiable, none of the offsets is trusted
+            if (!lib->offsets.empty()) {
+                ALOGI("build-id of %s changed, drop %zu offsets", lib->name.c_str(), lib->offsets.size());
+                lib->offsets.clear();
+                sDirty = true;
+            }
+            lib->buildId = buildId;
+        }
+        pending->erase(it);
+        break;
+    }
+    return pending->empty() ? 1 : 0;
+}
+
+/**
+ * Locates every library not yet located in a single pass of dl_iterate_phdr.
+ */
+static void locate_all() {
+    std::vector<Library*> pending;
+    for (auto& lib : *sLibraries) {
+        if (!lib->located) {
+            pending.push_back(lib.get());
+        }
+    }
+    if (pending.empty()) {
+        return;
+    }
+    auto iterate = reinterpret_cast<DlIterate>(npth_dliterater());
+    if (iterate != nullptr) {
+        iterate(locate_callback, &pending);
+    }
+}
+
+static Library* find_library(const char* name, bool create) {
+    for (auto& lib : *sLibraries) {
+        if (lib->name == name) {
+            return lib.get();
+        }
+    }
+    if (!create) {
+        return nullptr;
+    }
+    sLibraries->emplace_back(new Library());
+    Library* lib = sLibraries->back().get();
+    lib->name = name;
+    return lib;
+}
+
+static void load() {
+    FILE* file = fopen(sPath.c_str(), "re");
+    if (file == nullptr) {
+        return;
+    }
+    char* line = nullptr;
+    size_t capacity = 0;
+    ssize_t length;
+    Library* lib = nullptr;
+    bool valid = false;
+    while ((length = getline(&line, &capacity, file)) > 0) {
+        if (line[length - 1] == '\n') {
+            line[--length] = '\0';
+        }
+        if (!valid) {
+            valid = strcmp(line, kFileMagic) == 0;
+            if (!valid) {
+                break;
+            }
+            continue;
+        }
+        // L <library> <build-id>, S <offset> <symbol>, D <symbol>, A <symbol>
+        if (length < 3 || line[1] != ' ') {
+            continue;
+        }
+        char* value = line + 2;
+        if (line[0] == 'L') {
+            char* space = strchr(value, ' ');
+            if (space == nullptr) {
+                lib = nullptr;
+                continue;
+            }
+            *space = '\0';
+            lib = find_library(value, true);
+            if (lib->located) {
+                // looked up before init, keep what was found in this launch
+                lib = lib->buildId == space + 1 ? lib : nullptr;
+            } else {
+                lib->buildId = space + 1;
+            }
+        } else if (lib == nullptr) {
+            continue;
+        } else if (line[0] == 'S') {
+            char* symbol = nullptr;
+            uintptr_t offset = strtoull(value, &symbol, 16);
+            if (symbol != value && *symbol == ' ') {
+                lib->offsets.emplace(symbol + 1, offset);
+            }
+        } else if (line[0] == 'D') {
+            lib->offsets.emplace(value, kMissingDynamic);
+        } else if (line[0] == 'A') {
+            lib->offsets.emplace(value, kMissingAll);
+        }
+    }
+    free(line);
+    fclose(file);
+}
+
+void init(const char* dir) {
+    std::lock_guard<std::mutex> lock(sLock);
+    if (dir == nullptr || !sPath.empty()) {
+        return;
+    }
+    sPath = std::string(dir) + "/" + kFileName;
+    load();
+    locate_all();
+}
+
+static bool is_executable(Library* lib, uintptr_t address) {
+    for (auto& segment : lib->executables) {
+        if (address >= segment.begin && address < segment.end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @return true if symbol is answered by the cache, in which case address is set.
+ */
+static bool lookup_cached(Library* lib, const char* symbol, bool full, void** address) {
+    auto it = lib->offsets.find(symbol);
+    if (it == lib->offsets.end()) {
+        return false;
+    }
+    if (it->second == kMissingAll || (it->second == kMissingDynamic && !full)) {
+        *address = nullptr;
+        return true;
+    }
+    if (it->second == kMissingDynamic) {
+        return false;
+    }
+    uintptr_t cached = lib->loadBias + it->second;
+    if (!is_executable(lib, cached)) {
+        ALOGE("cached offset %zx of %s is out of %s", it->second, symbol, lib->name.c_str());
+        return false;
+    }
+    *address = reinterpret_cast<void*>(cached);
+    return true;
+}
+
+size_t resolve_batch(const char* library, const char** symbols, void** out, size_t count, bool full) {
+    std::lock_guard<std::mutex> lock(sLock);
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = nullptr;
+    }
+    Library* lib = find_library(library, true);
+    locate_all();
+    if (!lib->located) {
+        return 0;
+    }
+    std::vector<size_t> missed;
+    for (size_t i = 0; i < count; ++i) {
+        if (!lookup_cached(lib, symbols[i], full, &out[i])) {
+            missed.push_back(i);
+        }
+    }
+    if (!missed.empty()) {
+        if (lib->handle == nullptr) {
+            lib->handle = npth_dlopen_full(library);
+        }
+        std::vector<const char*> names;
+        std::vector<void*> addresses(missed.size(), nullptr);
+        for (auto i : missed) {
+            names.push_back(symbols[i]);
+        }
+        if (lib->handle == nullptr) {
+            // not cached as missing, the library may be opened next time
+            names.clear();
+        } else if (full) {
+            npth_dlsym_batch(lib->handle, names.data(), addresses.data(), names.size());
+        } else {
+            for (size_t j = 0; j < names.size(); ++j) {
+                addresses[j] = npth_dlsym(lib->handle, names[j]);
+            }
+        }
+        for (size_t j = 0; j < names.size(); ++j) {
+            uintptr_t offset = full ? kMissingAll : kMissingDynamic;
+            if (addresses[j] != nullptr) {
+                offset = reinterpret_cast<uintptr_t>(addresses[j]) - lib->loadBias;
+            }
+            lib->offsets[names[j]] = offset;
+            out[missed[j]] = addresses[j];
+        }
+        sDirty |= !names.empty();
+    }
+    size_t resolved = 0;
+    for (size_t i = 0; i < count; ++i) {
+        resolved += out[i] != nullptr ? 1 : 0;
+    }
+    return resolved;
+}
+
+void* resolve(const char* library, const char* symbol, bool full) {
+    void* address = nullptr;
+    resolve_batch(library, &symbol, &address, 1, full);
+    return address;
+}
+
+void* hook(const char* library, const char* symbol, void* proxy, void** orig) {
+    void* address = resolve(library, symbol, true);
+    if (address != nullptr) {
+        return shadowhook_hook_sym_addr(address, proxy, orig);
+    }
+    return shadowhook_hook_sym_name(library, symbol, proxy, orig);
+}
+
+static bool write_file(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "we");
+    if (file == nullptr) {
+        return false;
+    }
+    fprintf(file, "%s\n", kFileMagic);
+    for (auto& lib : *sLibraries) {
+        // libraries not loaded in this launch keep the offsets read from the file
+        if (lib->buildId.empty()) {
+            continue;
+        }
+        fprintf(file, "L %s %s\n", lib->name.c_str(), lib->buildId.c_str());
+        for (auto& entry : lib->offsets) {
+            if (entry.second == kMissingAll) {
+                fprintf(file, "A %s\n", entry.first.c_str());
+            } else if (entry.second == kMissingDynamic) {
+                fprintf(file, "D %s\n", entry.first.c_str());
+            } else {
+                fprintf(file, "S %zx %s\n", entry.second, entry.first.c_str());
+            }
+        }
+    }
+    bool success = ferror(file) == 0;
+    return fclose(file) == 0 && success;
+}
+
+void persist() {
+    std::lock_guard<std::mutex> lock(sLock);
+    for (auto& lib : *sLibraries) {
+        if (lib->handle != nullptr) {
+            npth_dlclose(lib->handle);
+            lib->handle = nullptr;
+        }
+    }
+    if (!sDirty || sPath.empty()) {
+        return;
+    }
+    // readers of a later launch see either the old file or the complete new one
+    std::string temp = sPath + ".tmp";
+    if (write_file(temp) && rename(temp.c_str(), sPath.c_str()) == 0) {
+        sDirty = false;
+    } else {
+        ALOGE("failed to persist symbol offsets to %s", sPath.c_str());
+        remove(temp.c_str());
+    }
+}
+
+} // namespace rheatrace::symbol_offset_cache
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Offsets of libart/libbinder symbols resolved by earlier launches, keyed by the ELF build-id of
+ * each library and persisted in app storage. A cached offset is trusted only if the loaded
+ * library has the same build-id and the address lands in one of its executable segments,
+ * otherwise the symbol is looked up again by npth_dlsym and the cache is updated.
+ */
+namespace rheatrace::symbol_offset_cache {
+
+/**
+ * Loads offsets persisted in dir and locates every cached library in one dl_iterate_phdr pass.
+ * Symbols resolved before init() are looked up directly and persisted along with the others.
+ */
+void init(const char* dir);
+
+/**
+ * @return address of symbol in library, nullptr if library is not loaded or symbol is absent.
+ * .symtab is also searched if full is true.
+ */
+void* resolve(const char* library, const char* symbol, bool full = false);
+
+/**
+ * Resolves count symbols of library into out like resolve(), the ones not cached are looked up
+ * together through a shared handle of library, .symtab is scanned at most once.
+ * @return number of symbols resolved.
+ */
+size_t resolve_batch(const char* library, const char** symbols, void** out, size_t count, bool full = false);
+
+/**
+ * Hooks symbol of library at its resolved address, falls back to shadowhook_hook_sym_name if
+ * the address is unknown.
+ * @return stub of shadowhook, nullptr if failed.
+ */
+void* hook(const char* library, const char* symbol, void* proxy, void** orig);
+
+/**
+ * Writes offsets if any changed since the last persist and releases opened library handles.
+ */
+void persist();
+
+} // namespace rheatrace::symbol_offset_cache
@@ -15,11 +15,23 @@
  */
 #pragma once
 
+#include <sys/system_properties.h>
 #include <unistd.h>
 
+/**
+ * @return tid of current thread, cached in thread local storage.
+ */
+static inline pid_t current_tid() {
+    static thread_local pid_t tid = 0;
+    if (tid == 0) {
+        tid = gettid();
+    }
+    return tid;
+}
+
 static int is_main_thread() {
     static int pid = getpid();
-    return pid == gettid();
+    return pid == current_tid();
 }
 
 static int get_android_sdk_version() {
@@ -365,6 +365,17 @@ static void free_soinfo(nsoinfo_t* si)
     }
 }
 
+// bionic keeps d_ptr of .dynamic as vaddr. glibc relocates it into an address in place, except
+// for read-only .dynamic like that of vdso, so hosts tell them apart by value.
+static ElfW(Addr) dyn_addr(nsoinfo_t* si, ElfW(Addr) ptr)
+{
+#ifdef __BIONIC__
+    return si->load_bias + ptr;
+#else
+    return ptr < si->load_bias ? si->load_bias + ptr : ptr;
+#endif
+}
+
 static nsoinfo_t* parse_soinfo(dl_search_t* search)
 {
     nsoinfo_t* si = alloc_soinfo();
@@ -395,19 +406,19 @@ static nsoinfo_t* parse_soinfo(dl_search_t* search)
         switch (d->d_tag)
         {
             case DT_HASH:
-                fill_elf_hash_struct(si, si->load_bias + d->d_un.d_ptr);
+                fill_elf_hash_struct(si, dyn_addr(si, d->d_un.d_ptr));
                 break;
 
             case DT_GNU_HASH:
-                fill_gnu_hash_struct(si, si->load_bias + d->d_un.d_ptr);
+                fill_gnu_hash_struct(si, dyn_addr(si, d->d_un.d_ptr));
                 break;
 
             case DT_STRTAB:
-                si->dynstr = (const char *)(si->load_bias + d->d_un.d_ptr);
+                si->dynstr = (const char *)dyn_addr(si, d->d_un.d_ptr);
                 break;
 
             case DT_SYMTAB:
-                si->dynsym = (ElfW(Sym) *)(si->load_bias + d->d_un.d_ptr);
+                si->dynsym = (ElfW(Sym) *)dyn_addr(si, d->d_un.d_ptr);
                 break;
 
             default:
@@ -622,6 +633,90 @@ void* npth_dlsym_full(void* handle, const char* sym_str)
     return npth_dlsym_full_with_size(handle, sym_str, NULL);
 }
 
+typedef struct {
+    uint64_t prefix;
+    uint64_t mask;
+} name_prefix_t;
+
+// first 8 bytes of a name including its terminator if shorter, and a mask of the bytes compared
+static void name_prefix(const char* str, name_prefix_t* out)
+{
+    size_t length = strnlen(str, sizeof(uint64_t) - 1) + 1;
+    uint8_t mask[sizeof(uint64_t)] = {0};
+
+    if (length > sizeof(uint64_t)) length = sizeof(uint64_t);
+
+    memset(mask, 0xff, length);
+    out->prefix = 0;
+    memcpy(&out->prefix, str, length);
+    memcpy(&out->mask, mask, sizeof(mask));
+}
+
+__attribute__ ((visibility ("default")))
+size_t npth_dlsym_batch(void* handle, const char** sym_strs, void** out, size_t count)
+{
+    if (handle == NULL || sym_strs == NULL || out == NULL) return 0;
+
+    nsoinfo_t *si = (nsoinfo_t *) handle;
+
+    size_t pending = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        out[i] = npth_dlsym(handle, sym_strs[i]);
+        if (out[i] == NULL) pending++;
+    }
+
+    // symbols missing from .dynsym are searched in .symtab, all of them in one scan
+    if (pending == 0 || NULL == si->path) return count - pending;
+
+    if (si->mapdata == 0) load_symtab(si);
+
+    if (si->symtab == NULL || si->strtab == NULL) return count - pending;
+
+    // names of .symtab are filtered by a single load of their first 8 bytes, so that names which
+    // can't match are never scanned to their end, only equal prefixes are compared by strcmp
+    name_prefix_t* prefixes = (name_prefix_t *)malloc(count * sizeof(name_prefix_t));
+
+    if (prefixes == NULL) return count - pending;
+
+    for (size_t j = 0; j < count; j++)
+    {
+        name_prefix(sym_strs[j], prefixes + j);
+    }
+
+    for (size_t i = 0; i < si->nsymtab && pending > 0; i++)
+    {
+        const ElfW(Sym)* s = si->symtab + i;
+
+        if (s->st_shndx == SHN_UNDEF || s->st_name == 0 || s->st_name >= si->nstrtab) continue;
+
+        const char* name = si->strtab + s->st_name;
+        // names near the end of .strtab can't be loaded as a whole word, compare them directly
+        int whole = s->st_name + sizeof(uint64_t) <= si->nstrtab;
+        uint64_t word = 0;
+
+        if (whole) memcpy(&word, name, sizeof(word));
+
+        for (size_t j = 0; j < count; j++)
+        {
+            if (out[j] != NULL) continue;
+
+            if (whole && (word & prefixes[j].mask) != prefixes[j].prefix) continue;
+
+            if (strncmp(name, sym_strs[j], si->nstrtab - s->st_name) == 0)
+            {
+                out[j] = (void*)(si->load_bias + s->st_value);
+                pending--;
+            }
+        }
+    }
+
+    free(prefixes);
+
+    return count - pending;
+}
+
 
 __attribute__ ((visibility ("default")))
 void npth_dlclose(void* handle) {
@@ -911,7 +1006,8 @@ void* npth_dliterater(void)
 {
     void* handle = dlopen("libdl.so", RTLD_NOW);
 
-    if (NULL == handle) return NULL;
+    // glibc only ships libdl.so.2, where dl_iterate_phdr is in libc anyway
+    if (NULL == handle) return dlsym(RTLD_DEFAULT, "dl_iterate_phdr");
 
     void *iterate = dlsym(handle, "dl_iterate_phdr");
 
@@ -28,6 +28,12 @@ extern void* npth_dlsym(void* handle, const char* sym_str);
 extern void* npth_dlopen_full(const char* so_name);
 extern void* npth_dlsym_full(void* handle, const char* sym_str);
 extern void* npth_dlsym_full_with_size(void* handle, const char* sym_str, size_t* sym_size_ptr);
+/**
+ * Resolves count symbols into out, nullptr for the ones not found. Symbols absent from .dynsym
+ * are searched in .symtab in a single scan if handle is opened by npth_dlopen_full.
+ * @return number of symbols resolved.
+ */
+extern size_t npth_dlsym_batch(void* handle, const char** sym_strs, void** out, size_t count);
 extern void npth_dlclose(void* handle);
 extern void* npth_dliterater(void);
 extern char* npth_dlbuildid(const char*);
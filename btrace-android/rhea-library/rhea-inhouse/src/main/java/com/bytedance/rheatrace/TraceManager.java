@@ -18,6 +18,7 @@ package com.bytedance.rheatrace;
 import android.annotation.SuppressLint;
 import android.content.Context;
 import android.os.Process;
+import android.text.TextUtils;
 import android.util.Log;
 
 import com.bytedance.rheatrace.server.HttpServer;
@@ -27,11 +28,13 @@ import com.bytedance.rheatrace.trace.base.TraceAbility;
 import com.bytedance.rheatrace.trace.base.TraceGlobal;
 import com.bytedance.rheatrace.trace.base.TraceMeta;
 import com.bytedance.rheatrace.utils.HandlerThreadUtils;
+import com.bytedance.rheatrace.utils.ProcessUtils;
 
 import org.json.JSONException;
 import org.json.JSONObject;
 
 import java.io.File;
+import java.util.Arrays;
 import java.util.Collections;
 import java.util.List;
 
@@ -39,8 +42,14 @@ import java.util.List;
 public class TraceManager {
 
     private static final String TAG = "RheaTrace:Manager";
+    private static final long STREAM_SEGMENT_BYTES = 4 * 1024 * 1024;
+    private static final int STREAM_MAX_SEGMENTS = 16;
 
     private String tracingDirPath;
+    private String streamDirPath;
+    private String symbolCacheDirPath;
+    private String persistDirPath;
+    private String recoveredDirPath;
     private long[] traceTokens = null;
 
     public static TraceManager getInstance() {
@@ -48,10 +57,19 @@ public class TraceManager {
     }
 
     public void init(Context context) {
+        tracingDirPath = context.getFilesDir().getAbsolutePath() + "/rhea/tracing/" + Process.myPid();
+        streamDirPath = context.getFilesDir().getAbsolutePath() + "/rhea/stream/" + Process.myPid();
+        symbolCacheDirPath = context.getFilesDir().getAbsolutePath() + "/rhea/symbols";
+        // 同一应用的多个进程各自持有 buffer 文件，避免互相覆盖正在映射的文件
+        String processName = ProcessUtils.getProcessName(context);
+        if (TextUtils.isEmpty(processName)) {
+            processName = "default";
+        }
+        persistDirPath = context.getFilesDir().getAbsolutePath() + "/rhea/persist/" + processName;
+        recoveredDirPath = context.getFilesDir().getAbsolutePath() + "/rhea/recovered/" + processName;
         if (TraceProperties.shouldStartWhenAppLaunch()) {
             startTracing(false);
         }
-        tracingDirPath = context.getFilesDir().getAbsolutePath() + "/rhea/tracing/" + Process.myPid();
         Thread serverThread = new Thread(() -> HttpServer.start(context.getExternalFilesDir(null), tracingDirPath));
         serverThread.start();
     }
@@ -61,10 +79,12 @@ public class TraceManager {
             Log.e(TAG, "start failed: already started and not yet stopped");
             return false;
         }
-        if (!TraceGlobal.init()) {
+        makeDumpDir(symbolCacheDirPath);
+        if (!TraceGlobal.init(symbolCacheDirPath)) {
             Log.e(TAG, "start failed: global dependency init failed");
             return false;
         }
+        recoverPersistedBuffer();
         List<TraceMeta> traceMetas = requireTraceMetas();
         if (traceMetas.isEmpty()) {
             return false;
@@ -77,6 +97,7 @@ public class TraceManager {
                     tokens[i] = traceAbilities.get(i).start();
                 }
                 this.traceTokens = tokens;
+                startStreaming(traceAbilities);
             });
             startThread.start();
         } else {
@@ -86,6 +107,7 @@ public class TraceManager {
                 tokens[i] = traceAbilities.get(i).start();
             }
             this.traceTokens = tokens;
+            startStreaming(traceAbilities);
         }
         return true;
     }
@@ -122,11 +144,48 @@ public class TraceManager {
                     Log.e(TAG, "dumping failed for " + traceMetas.get(i).getName() + ", error code is " + result);
                 }
             }
+            for (TraceAbility<?> ability : traceAbilities) {
+                ability.stopStreaming();
+            }
             HttpServer.getServer().onTraceDumpFinished(0, getDumpPath(), traceMetas, startTokens, endTokens);
         });
         return true;
     }
 
+    /**
+     * 上一个进程遗留的 buffer 文件在新 buffer 创建前已被移开，恢复 dump 放到后台执行，不阻塞启动。
+     */
+    private void recoverPersistedBuffer() {
+        if (!makeDumpDir(persistDirPath) || !TraceGlobal.initPersistence(persistDirPath)) {
+            return;
+        }
+        HandlerThreadUtils.getCollectorThreadHandler().post(() -> {
+            if (!makeDumpDir(recoveredDirPath)) {
+                Log.e(TAG, "make recovered dir failed: " + recoveredDirPath);
+                return;
+            }
+            int result = TraceGlobal.recoverBuffer(recoveredDirPath);
+            if (result != 0) {
+                Log.e(TAG, "recovering persisted buffer failed, error code is " + result);
+            } else {
+                Log.i(TAG, "persisted buffer of previous process is recovered to " + recoveredDirPath);
+            }
+        });
+    }
+
+    private void startStreaming(List<TraceAbility<?>> traceAbilities) {
+        long intervalMs = TraceProperties.getStreamFlushIntervalMs();
+        if (intervalMs <= 0 || streamDirPath == null || !makeDumpDir(streamDirPath)) {
+            return;
+        }
+        for (TraceAbility<?> ability : traceAbilities) {
+            int result = ability.startStreaming(streamDirPath, intervalMs, STREAM_SEGMENT_BYTES, STREAM_MAX_SEGMENTS);
+            if (result != 0) {
+                Log.e(TAG, "start streaming failed, error code is " + result);
+            }
+        }
+    }
+
     public void clearAfterTracing() {
         File directory = new File(tracingDirPath);
         if (directory.exists() && directory.isDirectory()) {
@@ -141,8 +200,12 @@ public class TraceManager {
     }
 
     private List<TraceMeta> requireTraceMetas() {
-        // currently there is only sampling trace data, we will extend it later
-        return Collections.singletonList(TraceMeta.Sampling);
+        if (TraceProperties.getAggregationMode() == TraceProperties.AGGREGATION_DISABLED) {
+            return Collections.singletonList(TraceMeta.Sampling);
+        }
+        // aggregation folds stacks captured by sampling, so sampling is always required. In exclusive
+        // mode its buffer is kept small, see SamplingConfigCreator
+        return Arrays.asList(TraceMeta.Sampling, TraceMeta.Aggregation);
     }
 
     private String getDumpPath() {
@@ -20,6 +20,8 @@ import android.annotation.SuppressLint;
 import com.bytedance.rheatrace.trace.sampling.SamplingConfig;
 
 import java.lang.reflect.Method;
+import java.util.ArrayList;
+import java.util.List;
 
 public class TraceProperties {
 
@@ -27,6 +29,23 @@ public class TraceProperties {
     private static final String KEY_WAIT_TRACE_TIMEOUT = "debug.rhea3.waitTraceTimeout";
     private static final String KEY_BUFFER_SIZE = "debug.rhea3.methodIdMaxSize";
     private static final String KEY_SAMPLE_INTERVAL = "debug.rhea3.sampleInterval";
+    private static final String KEY_BUFFER_SHARDS = "debug.rhea3.bufferShards";
+    private static final String KEY_STREAM_FLUSH_INTERVAL = "debug.rhea3.streamFlushInterval";
+    private static final String KEY_THREAD_OVERHEAD_BUDGET = "debug.rhea3.threadOverheadBudget";
+    private static final String KEY_GLOBAL_OVERHEAD_BUDGET = "debug.rhea3.globalOverheadBudget";
+    private static final String KEY_NATIVE_STACK_DEPTH = "debug.rhea3.nativeStackDepth";
+    private static final String KEY_AGGREGATION = "debug.rhea3.aggregation";
+    private static final String KEY_DUMP_FORMAT = "debug.rhea3.dumpFormat";
+    private static final String KEY_ALLOCATION_SAMPLE_BYTES = "debug.rhea3.allocationSampleBytes";
+    private static final String KEY_PERF_COUNTERS = "debug.rhea3.perfCounters";
+    private static final String KEY_PERSIST_BUFFER = "debug.rhea3.persistBuffer";
+    private static final String KEY_TYPE_RATE_LIMITS = "debug.rhea3.typeRateLimits";
+
+    public static final int AGGREGATION_DISABLED = 0;
+    // aggregate samples while keeping raw records
+    public static final int AGGREGATION_ENABLED = 1;
+    // aggregate samples only, raw records are not kept
+    public static final int AGGREGATION_EXCLUSIVE = 2;
 
     private static final int DEFAULT_WAIT_TRACE_TIMEOUT_SECONDS = 20;
 
@@ -83,6 +102,163 @@ public class TraceProperties {
         return defaultIntervalNs;
     }
 
+    public static int getBufferShardsOrDefault(int defaultShards) {
+        String shardsStr = Fetcher.fetch(KEY_BUFFER_SHARDS);
+        if (shardsStr == null) {
+            return defaultShards;
+        }
+        try {
+            int shards = Integer.parseInt(shardsStr);
+            return shards > 0 ? shards : defaultShards;
+        } catch (Exception e) {
+            return defaultShards;
+        }
+    }
+
+    /**
+     * @return interval in milliseconds of streaming flush, 0 means streaming flush is disabled.
+     */
+    public static long getStreamFlushIntervalMs() {
+        String intervalStr = Fetcher.fetch(KEY_STREAM_FLUSH_INTERVAL);
+        if (intervalStr == null) {
+            return 0;
+        }
+        try {
+            long interval = Long.parseLong(intervalStr);
+            return interval > 0 ? interval : 0;
+        } catch (Exception e) {
+            return 0;
+        }
+    }
+
+    /**
+     * @return sampling cost budget of a single thread in 1/10000 of one CPU, 0 means unlimited.
+     */
+    public static int getThreadOverheadBudgetOrDefault(int defaultBudget) {
+        return getBudgetOrDefault(KEY_THREAD_OVERHEAD_BUDGET, defaultBudget);
+    }
+
+    /**
+     * @return sampling cost budget of the whole process in 1/10000 of one CPU, 0 means unlimited.
+     */
+    public static int getGlobalOverheadBudgetOrDefault(int defaultBudget) {
+        return getBudgetOrDefault(KEY_GLOBAL_OVERHEAD_BUDGET, defaultBudget);
+    }
+
+    /**
+     * @return max depth of native stacks captured along with java stacks, 0 means disabled.
+     */
+    public static int getNativeStackDepth() {
+        String depthStr = Fetcher.fetch(KEY_NATIVE_STACK_DEPTH);
+        if (depthStr == null) {
+            return 0;
+        }
+        try {
+            int depth = Integer.parseInt(depthStr);
+            return Math.max(depth, 0);
+        } catch (Exception e) {
+            return 0;
+        }
+    }
+
+    /**
+     * @return mean bytes between two sampled allocations of a thread, 0 means allocations are
+     * sampled by time.
+     */
+    public static long getAllocationSampleBytes() {
+        String bytesStr = Fetcher.fetch(KEY_ALLOCATION_SAMPLE_BYTES);
+        if (bytesStr == null) {
+            return 0;
+        }
+        try {
+            long bytes = Long.parseLong(bytesStr);
+            return Math.max(bytes, 0);
+        } catch (Exception e) {
+            return 0;
+        }
+    }
+
+    /**
+     * @return one of SamplingConfig.PERF_COUNTERS_*, "software" or "hardware" enables perf event
+     * counters of sampled threads.
+     */
+    public static int getPerfCounters() {
+        String mode = Fetcher.fetch(KEY_PERF_COUNTERS);
+        if ("software".equals(mode)) {
+            return SamplingConfig.PERF_COUNTERS_SOFTWARE;
+        } else if ("hardware".equals(mode)) {
+            return SamplingConfig.PERF_COUNTERS_HARDWARE;
+        }
+        return SamplingConfig.PERF_COUNTERS_DISABLED;
+    }
+
+    /**
+     * @return true if sampling buffer is backed by a file, so that records of a crashed process
+     * are dumped on next launch.
+     */
+    public static boolean shouldPersistBuffer() {
+        return "1".equals(Fetcher.fetch(KEY_PERSIST_BUFFER));
+    }
+
+    /**
+     * @return {type, ratePerSecond, burst} of sampling types limited by their own token buckets,
+     * configured as comma separated "type:ratePerSecond:burst", empty if none is limited.
+     */
+    public static List<int[]> getTypeRateLimits() {
+        List<int[]> limits = new ArrayList<>();
+        String limitsStr = Fetcher.fetch(KEY_TYPE_RATE_LIMITS);
+        if (limitsStr == null || limitsStr.isEmpty()) {
+            return limits;
+        }
+        for (String item : limitsStr.split(",")) {
+            String[] fields = item.trim().split(":");
+            if (fields.length != 3) {
+                continue;
+            }
+            try {
+                limits.add(new int[]{Integer.parseInt(fields[0]), Integer.parseInt(fields[1]), Integer.parseInt(fields[2])});
+            } catch (Exception ignored) {
+            }
+        }
+        return limits;
+    }
+
+    /**
+     * @return one of AGGREGATION_DISABLED, AGGREGATION_ENABLED and AGGREGATION_EXCLUSIVE.
+     */
+    public static int getAggregationMode() {
+        String modeStr = Fetcher.fetch(KEY_AGGREGATION);
+        if (modeStr == null) {
+            return AGGREGATION_DISABLED;
+        }
+        try {
+            int mode = Integer.parseInt(modeStr);
+            return mode == AGGREGATION_ENABLED || mode == AGGREGATION_EXCLUSIVE ? mode : AGGREGATION_DISABLED;
+        } catch (Exception e) {
+            return AGGREGATION_DISABLED;
+        }
+    }
+
+    /**
+     * @return SamplingConfig.DUMP_FORMAT_PERFETTO if sampling should be dumped as a perfetto trace.
+     */
+    public static int getDumpFormat() {
+        return "perfetto".equals(Fetcher.fetch(KEY_DUMP_FORMAT)) ? SamplingConfig.DUMP_FORMAT_PERFETTO : SamplingConfig.DUMP_FORMAT_RHEA;
+    }
+
+    private static int getBudgetOrDefault(String key, int defaultBudget) {
+        String budgetStr = Fetcher.fetch(key);
+        if (budgetStr == null) {
+            return defaultBudget;
+        }
+        try {
+            int budget = Integer.parseInt(budgetStr);
+            return budget >= 0 ? budget : defaultBudget;
+        } catch (Exception e) {
+            return defaultBudget;
+        }
+    }
+
     private static class Fetcher {
         private static Method sGetPropertiesMethod = null;
 
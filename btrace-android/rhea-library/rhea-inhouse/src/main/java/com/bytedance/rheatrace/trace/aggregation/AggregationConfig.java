@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.bytedance.rheatrace.trace.aggregation;
+
+import com.bytedance.rheatrace.trace.base.TraceConfig;
+
+public class AggregationConfig extends TraceConfig {
+
+    public static final int CAPACITY_DEFAULT = 1 << 16;
+
+    private int capacity; // 聚合堆栈节点容量，决定聚合模式的固定内存大小
+    private boolean exclusive; // 聚合模式下是否不再保存原始采样记录
+
+    public AggregationConfig(AggregationConfigCreator creator) {
+        super(creator);
+    }
+
+    public int getCapacity() {
+        return capacity;
+    }
+
+    public void setCapacity(int capacity) {
+        this.capacity = capacity;
+    }
+
+    public boolean isExclusive() {
+        return exclusive;
+    }
+
+    public void setExclusive(boolean exclusive) {
+        this.exclusive = exclusive;
+    }
+
+    @Override
+    public long[] deflate() {
+        long[] results = new long[2];
+        results[0] = capacity;
+        results[1] = exclusive ? 1 : 0;
+        return results;
+    }
+
+    @Override
+    public long[] deflateUpdatable() {
+        return new long[0];
+    }
+}
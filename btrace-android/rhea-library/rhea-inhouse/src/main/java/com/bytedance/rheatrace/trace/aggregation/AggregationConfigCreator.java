@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.bytedance.rheatrace.trace.aggregation;
+
+import com.bytedance.rheatrace.prop.TraceProperties;
+import com.bytedance.rheatrace.trace.base.TraceConfigCreator;
+
+public class AggregationConfigCreator implements TraceConfigCreator<AggregationConfig> {
+
+    @Override
+    public AggregationConfig create() {
+        AggregationConfig config = new AggregationConfig(this);
+        config.setCapacity(AggregationConfig.CAPACITY_DEFAULT);
+        config.setExclusive(TraceProperties.getAggregationMode() == TraceProperties.AGGREGATION_EXCLUSIVE);
+        return config;
+    }
+
+    @Override
+    public void update(AggregationConfig config) {
+    }
+}
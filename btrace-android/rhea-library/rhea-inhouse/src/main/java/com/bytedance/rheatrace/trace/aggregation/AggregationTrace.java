@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.bytedance.rheatrace.trace.aggregation;
+
+import androidx.annotation.NonNull;
+
+import com.bytedance.rheatrace.trace.base.TraceAbility;
+import com.bytedance.rheatrace.trace.base.TraceMeta;
+
+/**
+ * 将采样堆栈在端上聚合为火焰图，内存固定，适合长时间采集。依赖 {@link TraceMeta#Sampling} 抓栈，dump 结果为 folded stack 文本。
+ */
+public class AggregationTrace extends TraceAbility<AggregationConfig> {
+
+    @NonNull
+    @Override
+    protected TraceMeta getMeta() {
+        return TraceMeta.Aggregation;
+    }
+
+    @Override
+    protected long[] getExtraStartConfig() {
+        return new long[0];
+    }
+}
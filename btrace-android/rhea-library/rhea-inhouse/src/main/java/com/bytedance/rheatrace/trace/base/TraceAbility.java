@@ -58,6 +58,39 @@ public abstract class TraceAbility<T extends TraceConfig> {
         }
     }
 
+    /**
+     * Dump data of several time windows before end token into one file.
+     *
+     * @param windows pairs of [begin, end) in nanoseconds of {@link android.os.SystemClock#elapsedRealtimeNanos()}
+     */
+    public int dumpTimeWindows(long end, long[] windows, String path, String extra) {
+        TraceMeta meta = getMeta();
+        if (meta.isCore()) {
+            return nativeDumpTimeWindows(nativeCollectorPtr, end, windows, path, extra);
+        } else {
+            return nativeDumpTimeWindows(nativeCollectorPtr, end, windows, path, null);
+        }
+    }
+
+    /**
+     * Drain collected data into segment files under dir in background, so that dumping only needs
+     * to concatenate segments.
+     *
+     * @return 0 if streaming is started.
+     */
+    public synchronized int startStreaming(String dir, long intervalMs, long segmentBytes, int maxSegments) {
+        if (nativeCollectorPtr == 0) {
+            return -1;
+        }
+        return nativeStartStreaming(nativeCollectorPtr, dir, intervalMs, segmentBytes, maxSegments);
+    }
+
+    public synchronized void stopStreaming() {
+        if (nativeCollectorPtr != 0) {
+            nativeStopStreaming(nativeCollectorPtr);
+        }
+    }
+
     @NonNull
     protected abstract TraceMeta getMeta();
 
@@ -90,5 +123,11 @@ public abstract class TraceAbility<T extends TraceConfig> {
 
     private native int nativeDumpTokenRange(long collector, long start, long end, String path, String extra);
 
+    private native int nativeDumpTimeWindows(long collector, long end, long[] windows, String path, String extra);
+
+    private native int nativeStartStreaming(long collector, String dir, long intervalMs, long segmentBytes, int maxSegments);
+
+    private native void nativeStopStreaming(long collector);
+
     private native void nativeStop(long collector);
 }
\ No newline at end of file
@@ -25,6 +25,8 @@ public class TraceGlobal {
     private static final String TAG = "RheaTrace:Deps";
 
     private static boolean success;
+    private static boolean symbolCacheInited;
+    private static boolean persistenceInited;
 
     static {
         try {
@@ -42,8 +44,51 @@ public class TraceGlobal {
         return success;
     }
 
+    /**
+     * @param symbolCacheDir 系统库符号偏移的缓存目录，按 build-id 校验后供之后的启动复用
+     */
+    public static synchronized boolean init(String symbolCacheDir) {
+        if (success && !symbolCacheInited) {
+            nativeInitSymbolCache(symbolCacheDir);
+            symbolCacheInited = true;
+        }
+        return success;
+    }
+
+    /**
+     * 只在进程内第一次调用时生效，需在创建采样 buffer 之前调用。
+     *
+     * @param persistDir 开启 persistBuffer 时采样 buffer 映射的文件所在目录，进程崩溃或被杀后数据仍保留在文件中
+     * @return 是否有上一个进程遗留的 buffer 文件需要通过 recoverBuffer 恢复
+     */
+    public static synchronized boolean initPersistence(String persistDir) {
+        if (!success || persistenceInited) {
+            return false;
+        }
+        persistenceInited = true;
+        return nativeInitPersistence(persistDir);
+    }
+
+    /**
+     * 将上一个进程遗留的 buffer 按普通 dump 的文件格式输出到 outDir，完成后删除遗留文件。
+     *
+     * @return 0 表示成功
+     */
+    public static int recoverBuffer(String outDir) {
+        if (!success) {
+            return -1;
+        }
+        return nativeRecoverBuffer(outDir);
+    }
+
     private static native void nativeInit(Thread mainThread);
 
+    private static native void nativeInitSymbolCache(String dir);
+
+    private static native boolean nativeInitPersistence(String dir);
+
+    private static native int nativeRecoverBuffer(String outDir);
+
     public static void capture(boolean force) {
         if (success) {
             nativeCapture(force);
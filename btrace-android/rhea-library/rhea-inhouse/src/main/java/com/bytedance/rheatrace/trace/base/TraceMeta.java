@@ -15,6 +15,8 @@
  */
 package com.bytedance.rheatrace.trace.base;
 
+import com.bytedance.rheatrace.trace.aggregation.AggregationConfigCreator;
+import com.bytedance.rheatrace.trace.aggregation.AggregationTrace;
 import com.bytedance.rheatrace.trace.sampling.SamplingConfigCreator;
 import com.bytedance.rheatrace.trace.sampling.SamplingTrace;
 
@@ -24,7 +26,8 @@ import com.bytedance.rheatrace.trace.sampling.SamplingTrace;
 public enum TraceMeta {
 
     Sampling("sampling",true, 0, SamplingTrace.class, SamplingConfigCreator.class),
-    Max("invalid", false, 1, null, null);
+    Aggregation("aggregation", false, 1, AggregationTrace.class, AggregationConfigCreator.class),
+    Max("invalid", false, 2, null, null);
 
 
     private final String name;
@@ -17,12 +17,39 @@ package com.bytedance.rheatrace.trace.sampling;
 
 import com.bytedance.rheatrace.trace.base.TraceConfig;
 
+import java.util.Map;
+import java.util.TreeMap;
+
 public class SamplingConfig extends TraceConfig {
 
     public static final int OFFLINE_BUFFER_SIZE_DEFAULT = 200_000;
 
+    // 独占聚合模式下原始记录只在聚合暂停时写入，buffer 只需保留少量记录
+    public static final int EXCLUSIVE_AGGREGATION_BUFFER_SIZE = 1024;
+
     public static final long OFFLINE_JAVA_SAMPLE_INTERVAL_DEFAULT = 1000_000;
 
+    public static final int AVERAGE_STACK_DEPTH_DEFAULT = 64;
+
+    public static final int STACK_TABLE_CAPACITY_DEFAULT = 1 << 18;
+
+    public static final int THREAD_OVERHEAD_BUDGET_DEFAULT = 500;
+
+    public static final int GLOBAL_OVERHEAD_BUDGET_DEFAULT = 1000;
+
+    public static final int KEYFRAME_INTERVAL_DEFAULT = 16;
+
+    public static final int DUMP_FORMAT_RHEA = 0;
+    public static final int DUMP_FORMAT_PERFETTO = 1;
+
+    public static final int PERF_COUNTERS_DISABLED = 0;
+    public static final int PERF_COUNTERS_SOFTWARE = 1; // 上下文切换、主缺页、CPU 迁移次数
+    public static final int PERF_COUNTERS_HARDWARE = 2; // 软件计数之外再加上指令数和时钟周期数
+
+    // 与 native 层 SamplingType 取值保持一致
+    public static final int TYPE_OBJECT_ALLOCATION = 9;
+    public static final int TYPE_JNI_TRAMPOLINE = 10;
+
     private int bufferSize;
     private long mainThreadIntervalNs;
     private long otherThreadIntervalNs;
@@ -33,6 +60,19 @@ public class SamplingConfig extends TraceConfig {
     private boolean enableWakeup; // 开启锁、park、wait 唤醒监控
     private boolean enableThreadNames; // 是否采集线程名称
     private boolean shadowPause;
+    private int bufferShards; // 大于 1 时按线程分片写入 buffer，降低多线程写入竞争
+    private int averageStackDepth; // 每条记录平均预留的栈帧数，用于计算栈帧存储区大小
+    private int stackTableCapacity; // 堆栈去重表的节点容量，为 0 时不做堆栈去重
+    private boolean snapshotDump; // dump 时直接校验读取 buffer 快照，不再额外分配备份 buffer
+    private int threadOverheadBudget; // 单线程采样开销上限，单位为万分之一 CPU，为 0 时不限制
+    private int globalOverheadBudget; // 进程整体采样开销上限，单位为万分之一 CPU，为 0 时不限制
+    private int keyframeInterval; // 增量抓栈时每隔多少次采样保存一次完整堆栈，为 0 时关闭增量抓栈
+    private int nativeStackDepth; // 同时采集的 native 栈帧最大深度，为 0 时不采集 native 堆栈
+    private int dumpFormat; // dump 文件格式，DUMP_FORMAT_PERFETTO 时直接输出 perfetto trace，无需 mapping 文件和转换
+    private long allocationSampleBytes; // 对象分配按字节泊松采样的平均间隔，为 0 时每次分配都按时间间隔采样
+    private int perfCounters; // 通过 perf_event 读取线程计数代替 rusage，不可用时回退到 rusage
+    private boolean persistBuffer; // buffer 映射到应用存储中的文件，进程崩溃后下次启动仍可恢复 dump
+    private final Map<Integer, int[]> typeRateLimits = new TreeMap<>(); // 按采样类型配置的线程级令牌桶，value 为 {每秒令牌数, 桶容量}
 
     public SamplingConfig(SamplingConfigCreator creator) {
         super(creator);
@@ -118,9 +158,134 @@ public class SamplingConfig extends TraceConfig {
         this.shadowPause = shadowPause;
     }
 
+    public int getBufferShards() {
+        return bufferShards;
+    }
+
+    public void setBufferShards(int bufferShards) {
+        this.bufferShards = bufferShards;
+    }
+
+    public int getAverageStackDepth() {
+        return averageStackDepth;
+    }
+
+    public void setAverageStackDepth(int averageStackDepth) {
+        this.averageStackDepth = averageStackDepth;
+    }
+
+    public int getStackTableCapacity() {
+        return stackTableCapacity;
+    }
+
+    public void setStackTableCapacity(int stackTableCapacity) {
+        this.stackTableCapacity = stackTableCapacity;
+    }
+
+    public boolean isSnapshotDump() {
+        return snapshotDump;
+    }
+
+    public void setSnapshotDump(boolean snapshotDump) {
+        this.snapshotDump = snapshotDump;
+    }
+
+    public int getThreadOverheadBudget() {
+        return threadOverheadBudget;
+    }
+
+    public void setThreadOverheadBudget(int threadOverheadBudget) {
+        this.threadOverheadBudget = threadOverheadBudget;
+    }
+
+    public int getGlobalOverheadBudget() {
+        return globalOverheadBudget;
+    }
+
+    public void setGlobalOverheadBudget(int globalOverheadBudget) {
+        this.globalOverheadBudget = globalOverheadBudget;
+    }
+
+    public int getKeyframeInterval() {
+        return keyframeInterval;
+    }
+
+    public void setKeyframeInterval(int keyframeInterval) {
+        this.keyframeInterval = keyframeInterval;
+    }
+
+    public int getNativeStackDepth() {
+        return nativeStackDepth;
+    }
+
+    public void setNativeStackDepth(int nativeStackDepth) {
+        this.nativeStackDepth = nativeStackDepth;
+    }
+
+    public int getDumpFormat() {
+        return dumpFormat;
+    }
+
+    public void setDumpFormat(int dumpFormat) {
+        this.dumpFormat = dumpFormat;
+    }
+
+    public long getAllocationSampleBytes() {
+        return allocationSampleBytes;
+    }
+
+    public void setAllocationSampleBytes(long allocationSampleBytes) {
+        this.allocationSampleBytes = allocationSampleBytes;
+    }
+
+    public int getPerfCounters() {
+        return perfCounters;
+    }
+
+    public void setPerfCounters(int perfCounters) {
+        this.perfCounters = perfCounters;
+    }
+
+    public boolean isPersistBuffer() {
+        return persistBuffer;
+    }
+
+    public void setPersistBuffer(boolean persistBuffer) {
+        this.persistBuffer = persistBuffer;
+    }
+
+    /**
+     * 为指定采样类型设置独立的令牌桶，该类型不再与其他类型共用采样间隔。
+     *
+     * @param ratePerSecond 每秒补充的令牌数，为 0 时移除该类型的令牌桶
+     * @param burst         桶容量，即允许的突发采样次数
+     */
+    public void setTypeRateLimit(int type, int ratePerSecond, int burst) {
+        if (ratePerSecond <= 0) {
+            typeRateLimits.remove(type);
+        } else {
+            typeRateLimits.put(type, new int[]{ratePerSecond, Math.max(burst, 1)});
+        }
+    }
+
+    public Map<Integer, int[]> getTypeRateLimits() {
+        return typeRateLimits;
+    }
+
+    private long[] withRateLimits(long[] results, int offset) {
+        results[offset] = typeRateLimits.size();
+        int index = offset + 1;
+        for (Map.Entry<Integer, int[]> entry : typeRateLimits.entrySet()) {
+            results[index++] = entry.getKey();
+            results[index++] = entry.getValue()[0];
+            results[index++] = entry.getValue()[1];
+        }
+        return results;
+    }
+
     @Override
     public long[] deflate() {
-        long[] results = new long[10];
+        long[] results = new long[23 + typeRateLimits.size() * 3];
         results[0] = bufferSize;
         results[1] = mainThreadIntervalNs;
         results[2] = otherThreadIntervalNs;
@@ -131,14 +296,28 @@ public class SamplingConfig extends TraceConfig {
         results[7] = enableWakeup ? 1 : 0;
         results[8] = enableThreadNames ? 1 : 0;
         results[9] = shadowPause? 1 : 0;
-        return results;
+        results[10] = bufferShards;
+        results[11] = averageStackDepth;
+        results[12] = stackTableCapacity;
+        results[13] = snapshotDump ? 1 : 0;
+        results[14] = threadOverheadBudget;
+        results[15] = globalOverheadBudget;
+        results[16] = keyframeInterval;
+        results[17] = nativeStackDepth;
+        results[18] = dumpFormat;
+        results[19] = allocationSampleBytes;
+        results[20] = perfCounters;
+        results[21] = persistBuffer ? 1 : 0;
+        return withRateLimits(results, 22);
     }
 
     @Override
     public long[] deflateUpdatable() {
-        long[] results = new long[2];
+        long[] results = new long[5 + typeRateLimits.size() * 3];
         results[0] = mainThreadIntervalNs;
         results[1] = otherThreadIntervalNs;
-        return results;
+        results[2] = threadOverheadBudget;
+        results[3] = globalOverheadBudget;
+        return withRateLimits(results, 4);
     }
 }
\ No newline at end of file
@@ -23,7 +23,13 @@ public class SamplingConfigCreator implements TraceConfigCreator<SamplingConfig>
     @Override
     public SamplingConfig create() {
         SamplingConfig config = new SamplingConfig(this);
-        config.setBufferSize(TraceProperties.getCoreBufferSizeOrDefault(SamplingConfig.OFFLINE_BUFFER_SIZE_DEFAULT));
+        boolean exclusiveAggregation = TraceProperties.getAggregationMode() == TraceProperties.AGGREGATION_EXCLUSIVE;
+        if (exclusiveAggregation) {
+            // 采样只为聚合抓栈，不保留原始记录，也就不需要大 buffer 和栈去重表
+            config.setBufferSize(SamplingConfig.EXCLUSIVE_AGGREGATION_BUFFER_SIZE);
+        } else {
+            config.setBufferSize(TraceProperties.getCoreBufferSizeOrDefault(SamplingConfig.OFFLINE_BUFFER_SIZE_DEFAULT));
+        }
         long intervalNs = TraceProperties.getSampleIntervalOrDefault(SamplingConfig.OFFLINE_JAVA_SAMPLE_INTERVAL_DEFAULT);
         config.setMainThreadIntervalNs(intervalNs);
         config.setOtherThreadIntervalNs(intervalNs);
@@ -34,6 +40,23 @@ public class SamplingConfigCreator implements TraceConfigCreator<SamplingConfig>
         config.setEnableWakeup(true);
         config.setEnableThreadNames(true);
         config.setShadowPause(true);
+        config.setBufferShards(TraceProperties.getBufferShardsOrDefault(1));
+        config.setAverageStackDepth(SamplingConfig.AVERAGE_STACK_DEPTH_DEFAULT);
+        config.setStackTableCapacity(exclusiveAggregation ? 0 : SamplingConfig.STACK_TABLE_CAPACITY_DEFAULT);
+        config.setSnapshotDump(true);
+        config.setThreadOverheadBudget(TraceProperties.getThreadOverheadBudgetOrDefault(SamplingConfig.THREAD_OVERHEAD_BUDGET_DEFAULT));
+        config.setGlobalOverheadBudget(TraceProperties.getGlobalOverheadBudgetOrDefault(SamplingConfig.GLOBAL_OVERHEAD_BUDGET_DEFAULT));
+        config.setKeyframeInterval(SamplingConfig.KEYFRAME_INTERVAL_DEFAULT);
+        config.setNativeStackDepth(TraceProperties.getNativeStackDepth());
+        config.setDumpFormat(TraceProperties.getDumpFormat());
+        // 按字节采样时对象分配不受时间间隔限制，由采样间隔决定采样频率，但仍受开销预算和令牌桶约束，被丢弃样本的字节计入下一个样本
+        config.setAllocationSampleBytes(TraceProperties.getAllocationSampleBytes());
+        config.setPerfCounters(TraceProperties.getPerfCounters());
+        config.setPersistBuffer(!exclusiveAggregation && TraceProperties.shouldPersistBuffer());
+        // 按类型限流默认关闭，对象分配和 JNI 调用等高频类型可按需配置，如 "9:100:10,10:200:20"
+        for (int[] limit : TraceProperties.getTypeRateLimits()) {
+            config.setTypeRateLimit(limit[0], limit[1], limit[2]);
+        }
         return config;
     }
 
@@ -42,5 +65,7 @@ public class SamplingConfigCreator implements TraceConfigCreator<SamplingConfig>
         long intervalNs = TraceProperties.getSampleIntervalOrDefault(SamplingConfig.OFFLINE_JAVA_SAMPLE_INTERVAL_DEFAULT);
         config.setMainThreadIntervalNs(intervalNs);
         config.setOtherThreadIntervalNs(intervalNs);
+        config.setThreadOverheadBudget(TraceProperties.getThreadOverheadBudgetOrDefault(SamplingConfig.THREAD_OVERHEAD_BUDGET_DEFAULT));
+        config.setGlobalOverheadBudget(TraceProperties.getGlobalOverheadBudgetOrDefault(SamplingConfig.GLOBAL_OVERHEAD_BUDGET_DEFAULT));
     }
 }
\ No newline at end of file
@@ -34,7 +34,7 @@ public class ProcessUtils {
         return context.getPackageName().equals(getProcessName(context));
     }
 
-    private static String getProcessName(Context context) {
+    public static String getProcessName(Context context) {
         if (sProcessName != null) {
             return sProcessName;
         }
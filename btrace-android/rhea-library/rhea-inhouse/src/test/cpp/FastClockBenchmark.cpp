@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <benchmark/benchmark.h>
+#include "utils/FastClock.h"
+
+namespace rheatrace {
+namespace {
+
+/**
+ * Boot time from the calibrated counter, falls back to clock_gettime if calibration fails.
+ */
+void BM_FastBootTime(benchmark::State& state) {
+    if (!fast_clock::calibrate()) {
+        state.SkipWithError("fast clock unavailable");
+        return;
+    }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(fast_clock::boot_time_nanos());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FastBootTime)->ThreadRange(1, 8)->UseRealTime();
+
+/**
+ * Boot time by clock_gettime, which fast clock uses before init() and on anchors.
+ */
+void BM_ClockGettimeBootTime(benchmark::State& state) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(current_boot_time_nanos());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ClockGettimeBootTime)->ThreadRange(1, 8)->UseRealTime();
+
+} // namespace
+} // namespace rheatrace
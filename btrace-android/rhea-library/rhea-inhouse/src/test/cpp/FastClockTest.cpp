@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "utils/FastClock.h"
+
+namespace rheatrace {
+namespace {
+
+TEST(FastClockTest, InitCalibratesInBackground) {
+    // calibration sleeps at least 1ms, which must not block the caller
+    uint64_t begin = current_boot_time_nanos();
+    fast_clock::init();
+    EXPECT_LT(current_boot_time_nanos() - begin, 1000000);
+    for (int i = 0; i < 100 && !fast_clock::internal::sReady.load(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    uint64_t before = current_boot_time_nanos();
+    uint64_t fast = fast_clock::boot_time_nanos();
+    EXPECT_GT(fast + 1000000, before);
+}
+
+TEST(FastClockTest, NeverGoesBackOnAThread) {
+    fast_clock::calibrate();
+    std::vector<std::thread> threads;
+    std::vector<int> backwards(4, 0);
+    for (size_t i = 0; i < backwards.size(); ++i) {
+        threads.emplace_back([&backwards, i]() {
+            uint64_t last = fast_clock::boot_time_nanos();
+            uint64_t end = current_boot_time_nanos() + 3 * fast_clock::internal::kAnchorNanos;
+            while (current_boot_time_nanos() < end) {
+                uint64_t now = fast_clock::boot_time_nanos();
+                if (now < last) {
+                    backwards[i] = 1;
+                }
+                last = now;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (int item : backwards) {
+        EXPECT_EQ(0, item);
+    }
+}
+
+TEST(FastClockTest, StaysCloseToBootTime) {
+    fast_clock::calibrate();
+    for (int i = 0; i < 1000; ++i) {
+        uint64_t before = current_boot_time_nanos();
+        uint64_t fast = fast_clock::boot_time_nanos();
+        uint64_t after = current_boot_time_nanos();
+        // anchored at most kAnchorNanos ago, drift since then is far below 1ms
+        EXPECT_GT(fast + 1000000, before);
+        EXPECT_LT(fast, after + 1000000);
+    }
+}
+
+TEST(FastClockTest, TurnsOffIfCounterStopsInSuspend) {
+    if (!fast_clock::calibrate()) {
+        GTEST_SKIP() << "fast clock unavailable";
+    }
+    // a counter which stopped for a second in suspend lags boot time by a second
+    fast_clock::internal::sOffset.fetch_sub(1000000000);
+    fast_clock::internal::sNextAnchor.store(fast_clock::internal::read_counter());
+    uint64_t before = current_boot_time_nanos();
+    uint64_t now = fast_clock::boot_time_nanos();
+    EXPECT_GE(now, before);
+    EXPECT_FALSE(fast_clock::internal::sReady.load());
+    EXPECT_GE(fast_clock::boot_time_nanos(), now);
+    EXPECT_TRUE(fast_clock::calibrate());
+}
+
+} // namespace
+} // namespace rheatrace
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include "stat/JavaObjectStat.h"
+
+namespace rheatrace {
+namespace {
+
+/**
+ * Counting one allocation, which only touches counters of the allocating thread.
+ */
+void BM_OnObjectAllocated(benchmark::State& state) {
+    for (auto _ : state) {
+        JavaObjectStat::onObjectAllocated(32);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_OnObjectAllocated)->ThreadRange(1, 8)->UseRealTime();
+
+/**
+ * Counting with process wide atomics as before, for comparison.
+ */
+void BM_SharedAtomicCounters(benchmark::State& state) {
+    static std::atomic<size_t> bytes{0};
+    static std::atomic<size_t> objects{0};
+    for (auto _ : state) {
+        objects.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(32, std::memory_order_relaxed);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SharedAtomicCounters)->ThreadRange(1, 8)->UseRealTime();
+
+/**
+ * Summing counters of live threads while other threads keep allocating.
+ */
+void BM_GlobalAllocatedBytes(benchmark::State& state) {
+    for (auto _ : state) {
+        if (state.thread_index() == 0) {
+            benchmark::DoNotOptimize(JavaObjectStat::getGlobalAllocatedBytes());
+        } else {
+            JavaObjectStat::onObjectAllocated(32);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GlobalAllocatedBytes)->ThreadRange(1, 8)->UseRealTime();
+
+} // namespace
+} // namespace rheatrace
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include "sampling/NativeUnwinder.h"
+
+namespace rheatrace {
+namespace {
+
+constexpr uint32_t kFrames = 8;
+// words of a frame, the record {previous fp, return address} comes first
+constexpr uint32_t kFrameWords = 4;
+
+/**
+ * A synthetic stack of kFrames frames, each of which links to the next one at a higher address.
+ */
+class NativeUnwinderTest : public testing::Test {
+protected:
+    alignas(16) uintptr_t mStack[kFrames * kFrameWords] = {};
+
+    void SetUp() override {
+        for (uint32_t i = 0; i < kFrames; ++i) {
+            uintptr_t* record = frame(i);
+            record[0] = i + 1 < kFrames ? address(i + 1) : 0;
+            record[1] = pcOf(i);
+        }
+    }
+
+    uintptr_t* frame(uint32_t i) {
+        return mStack + i * kFrameWords;
+    }
+
+    uintptr_t address(uint32_t i) {
+        return reinterpret_cast<uintptr_t>(frame(i));
+    }
+
+    uintptr_t low() {
+        return address(0);
+    }
+
+    uintptr_t high() {
+        return reinterpret_cast<uintptr_t>(mStack + kFrames * kFrameWords);
+    }
+
+    static uint64_t pcOf(uint32_t i) {
+        return 0x1000 + i * 0x10;
+    }
+
+    uint32_t walk(uintptr_t fp, uintptr_t stackLow, uintptr_t stackHigh, uint64_t* pcs,
+                  uint32_t maxDepth = NativeUnwinder::kMaxDepth) {
+        return NativeUnwinder::walkFramePointers(fp, stackLow, stackHigh, pcs, maxDepth);
+    }
+};
+
+TEST_F(NativeUnwinderTest, WalksWholeChain) {
+    uint64_t pcs[NativeUnwinder::kMaxDepth];
+    ASSERT_EQ(walk(low(), low(), high(), pcs), kFrames);
+    for (uint32_t i = 0; i < kFrames; ++i) {
+        EXPECT_EQ(pcs[i], pcOf(i));
+    }
+}
+
+TEST_F(NativeUnwinderTest, StopsAtMaxDepth) {
+    uint64_t pcs[NativeUnwinder::kMaxDepth];
+    EXPECT_EQ(walk(low(), low(), high(), pcs, 3), 3u);
+}
+
+TEST_F(NativeUnwinderTest, StopsBelowLowBound) {
+    uint64_t pcs[NativeUnwinder::kMaxDepth];
+    // a start frame under the low bound, like one in the guard pages
+    EXPECT_EQ(walk(address(1), address(2), high(), pcs), 0u);
+    // a frame linking back below the low bound
+    frame(3)[0] = address(0);
+    EXPECT_EQ(walk(address(2), address(2), high(), pcs), 2u);
+}
+
+TEST_F(NativeUnwinderTest, StopsWhenRecordCrossesHighBound) {
+    uint64_t pcs[NativeUnwinder::kMaxDepth];
+    // record of the last frame ends exactly at the high bound
+    uintptr_t lastRecordEnd = address(kFrames - 1) + 2 * sizeof(uintptr_t);
+    EXPECT_EQ(walk(low(), low(), lastRecordEnd, pcs), kFrames);
+    // and is partly out of the stack with a lower bound
+    EXPECT_EQ(walk(low(), low(), lastRecordEnd - 1, pcs), kFrames - 1);
+    // a frame pointer far out of the stack
+    frame(4)[0] = high() + 4096;
+    EXPECT_EQ(walk(low(), low(), high(), pcs), 5u);
+}
+
+TEST_F(NativeUnwinderTest, StopsAtMisalignedFramePointer) {
+    uint64_t pcs[NativeUnwinder::kMaxDepth];
+    frame(2)[0] = address(3) + 1;
+    EXPECT_EQ(walk(low(), low(), high(), pcs), 3u);
+    EXPECT_EQ(walk(low() + 2, low(), high(), pcs), 0u);
+}
+
+TEST_F(NativeUnwinderTest, StopsAtLoopOrNullReturnAddress) {
+    uint64_t pcs[NativeUnwinder::kMaxDepth];
+    // frames of callers must be at higher addresses
+    frame(2)[0] = address(2);
+    EXPECT_EQ(walk(low(), low(), high(), pcs), 3u);
+    frame(2)[0] = address(1);
+    EXPECT_EQ(walk(low(), low(), high(), pcs), 3u);
+    frame(2)[0] = address(3);
+    frame(5)[1] = 0;
+    EXPECT_EQ(walk(low(), low(), high(), pcs), 5u);
+}
+
+#if defined(__aarch64__)
+TEST_F(NativeUnwinderTest, StripsPointerAuthentication) {
+    uint64_t pcs[NativeUnwinder::kMaxDepth];
+    frame(0)[1] = pcOf(0) | (uintptr_t(0x7f) << 56);
+    ASSERT_EQ(walk(low(), low(), high(), pcs), kFrames);
+    EXPECT_EQ(pcs[0], pcOf(0));
+}
+#endif
+
+} // namespace
+} // namespace rheatrace
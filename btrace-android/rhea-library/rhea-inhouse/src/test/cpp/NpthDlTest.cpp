@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include <dlfcn.h>
+#include "utils/npth_dl.h"
+
+extern "C" void* npth_probe_address(int which);
+
+namespace rheatrace {
+namespace {
+
+TEST(NpthDlTest, ResolvesDynamicSymbolsOfSystemLibraries) {
+    for (const char* library : {"libc.so.6", "libm.so.6"}) {
+        void* handle = npth_dlopen(library);
+        ASSERT_NE(nullptr, handle) << library;
+        void* system = dlopen(library, RTLD_NOW | RTLD_NOLOAD);
+        ASSERT_NE(nullptr, system) << library;
+        // plain functions, dlsym returns the implementation of an ifunc such as cos
+        const char* symbol = library[3] == 'c' ? "malloc" : "cbrt";
+        EXPECT_EQ(dlsym(system, symbol), npth_dlsym(handle, symbol)) << symbol;
+        EXPECT_EQ(nullptr, npth_dlsym(handle, "npth_no_such_symbol"));
+        dlclose(system);
+        npth_dlclose(handle);
+    }
+}
+
+TEST(NpthDlTest, BatchResolvesSystemLibrarySymbols) {
+    void* handle = npth_dlopen_full("libc.so.6");
+    ASSERT_NE(nullptr, handle);
+    void* system = dlopen("libc.so.6", RTLD_NOW | RTLD_NOLOAD);
+    ASSERT_NE(nullptr, system);
+    const char* symbols[] = {"malloc", "npth_no_such_symbol", "free", "pthread_create"};
+    void* out[4] = {};
+    // a libc without .symtab is only searched in .dynsym
+    EXPECT_EQ(3u, npth_dlsym_batch(handle, symbols, out, 4));
+    EXPECT_EQ(dlsym(system, "malloc"), out[0]);
+    EXPECT_EQ(nullptr, out[1]);
+    EXPECT_EQ(dlsym(system, "free"), out[2]);
+    EXPECT_EQ(dlsym(system, "pthread_create"), out[3]);
+    dlclose(system);
+    npth_dlclose(handle);
+}
+
+TEST(NpthDlTest, BatchFindsSymtabOnlySymbols) {
+    void* handle = npth_dlopen_full("libnpth_probe.so");
+    ASSERT_NE(nullptr, handle);
+    // hidden symbols are not in .dynsym
+    EXPECT_EQ(nullptr, npth_dlsym(handle, "npth_probe_hidden_first"));
+    const char* symbols[] = {
+            "npth_probe_hidden_second", "npth_probe_hidden_first", "nph", "npth_probe_exported",
+            "npth_probe_hidden_third", "np",
+    };
+    void* out[6] = {};
+    EXPECT_EQ(4u, npth_dlsym_batch(handle, symbols, out, 6));
+    EXPECT_EQ(npth_probe_address(1), out[0]);
+    EXPECT_EQ(npth_probe_address(0), out[1]);
+    EXPECT_EQ(npth_probe_address(2), out[2]);
+    EXPECT_EQ(npth_probe_address(3), out[3]);
+    EXPECT_EQ(nullptr, out[4]);
+    EXPECT_EQ(nullptr, out[5]);
+    EXPECT_EQ(npth_probe_address(0), npth_dlsym_full(handle, "npth_probe_hidden_first"));
+    npth_dlclose(handle);
+}
+
+} // namespace
+} // namespace rheatrace
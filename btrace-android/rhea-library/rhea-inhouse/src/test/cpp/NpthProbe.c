@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+/*
+ * Library for NpthDlTest, whose hidden symbols are only in .symtab and share the first 8 bytes of
+ * their names.
+ */
+#include <stddef.h>
+
+#define HIDDEN __attribute__((visibility("hidden"), noinline))
+
+HIDDEN int npth_probe_hidden_first(void) { return 1; }
+
+HIDDEN int npth_probe_hidden_second(void) { return 2; }
+
+HIDDEN int nph(void) { return 3; }
+
+int npth_probe_exported(void) { return 4; }
+
+void* npth_probe_address(int which)
+{
+    switch (which)
+    {
+        case 0: return (void*)&npth_probe_hidden_first;
+        case 1: return (void*)&npth_probe_hidden_second;
+        case 2: return (void*)&nph;
+        default: return (void*)&npth_probe_exported;
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <benchmark/benchmark.h>
+#include "sampling/OverheadController.h"
+#include "sampling/SamplingThreadState.h"
+#include "utils/FastClock.h"
+
+namespace rheatrace {
+namespace {
+
+OverheadController* sharedController() {
+    static auto* controller = []() {
+        auto* result = new OverheadController();
+        result->configure(500, 1000);
+        return result;
+    }();
+    return controller;
+}
+
+/**
+ * Accounting of one request, with the clock read which measures its end.
+ */
+void BM_OnRequestDone(benchmark::State& state) {
+    auto* controller = sharedController();
+    for (auto _ : state) {
+        uint64_t now = fast_clock::boot_time_nanos();
+        controller->onRequestDone(now - 2000, now);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_OnRequestDone)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_AdjustInterval(benchmark::State& state) {
+    auto* controller = sharedController();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(controller->adjustInterval(1000000, state.thread_index() == 0));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AdjustInterval)->ThreadRange(1, 8)->UseRealTime();
+
+} // namespace
+} // namespace rheatrace
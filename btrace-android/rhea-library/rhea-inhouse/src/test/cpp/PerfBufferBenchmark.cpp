@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <benchmark/benchmark.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <map>
+#include <mutex>
+#include <random>
+#include "base/PerfBuffer.h"
+#include "sampling/SamplingRecord.h"
+
+namespace rheatrace {
+namespace {
+
+constexpr uint32_t kStackDepth = 24;
+
+uint64_t recordTime(SamplingRecord& r) {
+    return r.mNanoTime;
+}
+
+/**
+ * Dumper without JNI and mapping, which encodes records the same way as the sampling dumper.
+ */
+class EncodingDumper : public Dumper {
+private:
+    SamplingEncodeState mState;
+public:
+    uint32_t dumpRecord(JNIEnv* env, void* addr, void* r, PayloadArena* payload) override {
+        return reinterpret_cast<SamplingRecord*>(r)->encodeInto(reinterpret_cast<char*>(addr),
+                                                                 &mState, payload);
+    }
+
+    uint32_t maxRecordSize() override {
+        return SamplingRecord::maxBytes();
+    }
+
+    bool hasMapping() override {
+        return false;
+    }
+
+    bool dumpMapping(int fd) override {
+        return false;
+    }
+};
+
+PerfBuffer<SamplingRecord>* newBuffer(uint64_t capacity, uint32_t shards, bool snapshotDump) {
+    return PerfBuffer<SamplingRecord>::create(capacity, recordTime, shards,
+                                              capacity * kStackDepth * sizeof(uint64_t),
+                                              snapshotDump);
+}
+
+/**
+ * A record of a stack of kStackDepth frames, whose frames are saved into payload arena if
+ * withStack, the same as a sample captured by SamplingCollector.
+ */
+SamplingRecord makeRecord(PerfBuffer<SamplingRecord>* buffer, uint64_t time, uint16_t tid,
+                          bool withStack = true) {
+    uint64_t frames[kStackDepth];
+    for (uint32_t i = 0; i < kStackDepth; ++i) {
+        frames[i] = 0x70000000 + (time % 64 + i) * 32;
+    }
+    SamplingRecord r{};
+    r.mType = SamplingType::kBinder;
+    r.mTid = tid;
+    r.mMessageId = time / 16;
+    r.mNanoTime = time;
+    r.mCpuTime = time / 2;
+    r.mStack.mSavedDepth = kStackDepth;
+    r.mStack.mActualDepth = kStackDepth;
+    r.mStack.mPosition = withStack ? buffer->writePayload(frames, sizeof(frames)) : -1;
+    r.mNativeStack.mPosition = -1;
+    return r;
+}
+
+PerfBuffer<SamplingRecord>* filledBuffer(uint64_t capacity, bool snapshotDump) {
+    auto* buffer = newBuffer(capacity, 1, snapshotDump);
+    for (uint64_t i = 0; i < capacity; ++i) {
+        SamplingRecord r = makeRecord(buffer, 1000 + i * 100, 100 + i % 8);
+        buffer->write(r);
+    }
+    return buffer;
+}
+
+/**
+ * Buffer shared by threads of a multi-threaded benchmark, created once for each shard count.
+ */
+PerfBuffer<SamplingRecord>* sharedBuffer(uint32_t shards) {
+    static std::mutex lock;
+    static std::map<uint32_t, PerfBuffer<SamplingRecord>*> buffers;
+    std::lock_guard<std::mutex> guard(lock);
+    auto& buffer = buffers[shards];
+    if (buffer == nullptr) {
+        buffer = newBuffer(1 << 16, shards, true);
+    }
+    return buffer;
+}
+
+void BM_Write(benchmark::State& state) {
+    auto* buffer = sharedBuffer(state.range(0));
+    SamplingRecord r = makeRecord(buffer, 1000, 100 + state.thread_index(), false);
+    for (auto _ : state) {
+        r.mNanoTime++;
+        benchmark::DoNotOptimize(buffer->write(r));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Write)->ArgName("shards")->Arg(1)->Arg(8)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_WriteWithStack(benchmark::State& state) {
+    auto* buffer = sharedBuffer(state.range(0));
+    uint64_t time = 1000;
+    for (auto _ : state) {
+        SamplingRecord r = makeRecord(buffer, time++, 100 + state.thread_index());
+        benchmark::DoNotOptimize(buffer->write(r));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_WriteWithStack)->ArgName("shards")->Arg(1)->Arg(8)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_Acquire(benchmark::State& state) {
+    auto* buffer = newBuffer(1 << 16, 1, true);
+    uint64_t time = 1000;
+    for (auto _ : state) {
+        SamplingRecord& r = buffer->acquire();
+        r.mNanoTime = time++;
+        benchmark::DoNotOptimize(&r);
+    }
+    delete buffer;
+}
+BENCHMARK(BM_Acquire);
+
+void BM_FindTimeTicket(benchmark::State& state) {
+    uint64_t capacity = state.range(0);
+    auto* buffer = filledBuffer(capacity, true);
+    int64_t end = buffer->mark();
+    std::mt19937_64 random(42);
+    for (auto _ : state) {
+        uint64_t time = 1000 + random() % (capacity * 100);
+        benchmark::DoNotOptimize(buffer->findTimeTicket(0, time, 0, end));
+    }
+    delete buffer;
+}
+BENCHMARK(BM_FindTimeTicket)->ArgName("capacity")->RangeMultiplier(8)->Range(1 << 10, 1 << 19);
+
+int dumpFile() {
+    return memfd_create("rhea-dump", 0);
+}
+
+/**
+ * Args are capacity, raw (1) or Dumper (0) path, and snapshot dump (1) or backup buffer (0).
+ */
+void BM_Dump(benchmark::State& state) {
+    uint64_t capacity = state.range(0);
+    bool raw = state.range(1) != 0;
+    auto* buffer = filledBuffer(capacity, state.range(2) != 0);
+    int fd = dumpFile();
+    for (auto _ : state) {
+        EncodingDumper dumper;
+        int result = buffer->dump(nullptr, fd, -1, 0, 11, 0, nullptr, 0, raw, &dumper);
+        if (result != 0) {
+            state.SkipWithError("dump failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * capacity);
+    close(fd);
+    delete buffer;
+}
+BENCHMARK(BM_Dump)->ArgNames({"capacity", "raw", "snapshot"})
+        ->ArgsProduct({{1 << 14, 1 << 17}, {0, 1}, {0, 1}})->Unit(benchmark::kMillisecond);
+
+/**
+ * Dump the newer half of the buffer between two marks.
+ */
+void BM_DumpPart(benchmark::State& state) {
+    uint64_t capacity = state.range(0);
+    bool raw = state.range(1) != 0;
+    auto* buffer = newBuffer(capacity, 1, true);
+    int64_t start = 0;
+    for (uint64_t i = 0; i < capacity; ++i) {
+        if (i == capacity / 2) {
+            start = buffer->mark();
+        }
+        SamplingRecord r = makeRecord(buffer, 1000 + i * 100, 100 + i % 8);
+        buffer->write(r);
+    }
+    int64_t end = buffer->mark();
+    int fd = dumpFile();
+    for (auto _ : state) {
+        EncodingDumper dumper;
+        int result = buffer->dumpPart(nullptr, fd, -1, 0, 11, 0, nullptr, 0, raw, &dumper, start,
+                                      end);
+        if (result != 0) {
+            state.SkipWithError("dump failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * (end - start));
+    close(fd);
+    delete buffer;
+}
+BENCHMARK(BM_DumpPart)->ArgNames({"capacity", "raw"})
+        ->ArgsProduct({{1 << 14, 1 << 17}, {0, 1}})->Unit(benchmark::kMillisecond);
+
+} // namespace
+} // namespace rheatrace
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include "base/PerfBuffer.h"
+#include "sampling/SamplingRecord.h"
+
+namespace rheatrace {
+namespace {
+
+uint64_t recordTime(SamplingRecord& r) {
+    return r.mNanoTime;
+}
+
+/**
+ * Dumper which only counts records.
+ */
+class CountingDumper : public Dumper {
+public:
+    uint32_t count = 0;
+
+    uint32_t dumpRecord(JNIEnv* env, void* addr, void* r, PayloadArena* payload) override {
+        count++;
+        *reinterpret_cast<char*>(addr) = 0;
+        return 1;
+    }
+
+    uint32_t maxRecordSize() override {
+        return 16;
+    }
+
+    bool hasMapping() override {
+        return false;
+    }
+
+    bool dumpMapping(int fd) override {
+        return false;
+    }
+};
+
+/**
+ * Dumper which writes records into the buffer being dumped and then kills the process, like a
+ * writer dying during a dump.
+ */
+class DyingDumper : public CountingDumper {
+public:
+    PerfBuffer<SamplingRecord>* buffer = nullptr;
+    uint32_t writes = 0;
+
+    uint32_t dumpRecord(JNIEnv* env, void* addr, void* r, PayloadArena* payload) override {
+        for (uint32_t i = 0; i < writes; ++i) {
+            SamplingRecord record{};
+            record.mNanoTime = i;
+            buffer->write(record);
+        }
+        raise(SIGKILL);
+        return CountingDumper::dumpRecord(env, addr, r, payload);
+    }
+};
+
+class PerfBufferTest : public testing::Test {
+protected:
+    PerfBuffer<SamplingRecord>* mBuffer = nullptr;
+    uint64_t mTime = 1000;
+    int mFd = -1;
+
+    void SetUp() override {
+        mFd = memfd_create("rhea-dump", 0);
+    }
+
+    void TearDown() override {
+        close(mFd);
+        delete mBuffer;
+    }
+
+    void create(uint64_t capacity, uint32_t shards) {
+        mBuffer = PerfBuffer<SamplingRecord>::create(capacity, recordTime, shards, 0, true);
+        ASSERT_NE(mBuffer, nullptr);
+    }
+
+    /**
+     * Writes count records from a new thread, which goes to the next shard of the last thread.
+     */
+    void writeFromNewThread(uint32_t count) {
+        std::thread([this, count]() {
+            for (uint32_t i = 0; i < count; ++i) {
+                SamplingRecord r{};
+                r.mType = SamplingType::kBinder;
+                r.mNanoTime = mTime++;
+                r.mStack.mPosition = -1;
+                r.mNativeStack.mPosition = -1;
+                mBuffer->write(r);
+            }
+        }).join();
+    }
+
+    int dumpPart(int64_t start, int64_t end, uint32_t* count) {
+        CountingDumper dumper;
+        int result = mBuffer->dumpPart(nullptr, mFd, -1, 0, 11, 0, nullptr, 0, false, &dumper,
+                                       start, end);
+        *count = dumper.count;
+        return result;
+    }
+};
+
+TEST_F(PerfBufferTest, ShardedMarksOutliveManyNewerMarks) {
+    create(1024, 4);
+    std::vector<int64_t> marks{mBuffer->mark()};
+    for (uint32_t i = 0; i < 100; ++i) {
+        writeFromNewThread(1);
+        marks.push_back(mBuffer->mark());
+    }
+    uint32_t count = 0;
+    ASSERT_EQ(dumpPart(marks[0], marks[100], &count), 0);
+    EXPECT_EQ(count, 100u);
+    ASSERT_EQ(dumpPart(marks[5], marks[10], &count), 0);
+    EXPECT_EQ(count, 5u);
+}
+
+TEST_F(PerfBufferTest, UnknownTokenIsAnError) {
+    create(1024, 4);
+    writeFromNewThread(3);
+    int64_t start = mBuffer->mark();
+    writeFromNewThread(3);
+    int64_t end = mBuffer->mark();
+    uint32_t count = 0;
+    EXPECT_EQ(dumpPart(start + 1, end, &count), 10);
+    EXPECT_EQ(dumpPart(start, end + 1, &count), 10);
+    EXPECT_EQ(count, 0u);
+
+    CountingDumper dumper;
+    uint64_t window[2] = {0, UINT64_MAX};
+    EXPECT_EQ(mBuffer->dumpTimeWindows(nullptr, mFd, -1, 0, 11, 0, nullptr, 0, false, &dumper,
+                                       end + 1, window, 1), 10);
+    EXPECT_EQ(mBuffer->dumpTimeWindows(nullptr, mFd, -1, 0, 11, 0, nullptr, 0, false, &dumper,
+                                       end, window, 1), 0);
+    EXPECT_EQ(dumper.count, 6u);
+}
+
+TEST_F(PerfBufferTest, OverwrittenStartCoversWholeBuffer) {
+    // 8 records per shard
+    create(16, 2);
+    writeFromNewThread(5);
+    int64_t start = mBuffer->mark();
+    for (uint32_t i = 0; i < 4; ++i) {
+        writeFromNewThread(50);
+    }
+    int64_t end = mBuffer->mark();
+    uint32_t count = 0;
+    ASSERT_EQ(dumpPart(start, end, &count), 0);
+    EXPECT_EQ(count, 16u);
+    // nothing of an overwritten end is left
+    EXPECT_EQ(dumpPart(0, start, &count), 8);
+}
+
+TEST_F(PerfBufferTest, SingleShardTokenIsTicket) {
+    create(64, 1);
+    writeFromNewThread(10);
+    int64_t start = mBuffer->mark();
+    writeFromNewThread(7);
+    int64_t end = mBuffer->mark();
+    EXPECT_EQ(end - start, 7);
+    uint32_t count = 0;
+    ASSERT_EQ(dumpPart(start, end, &count), 0);
+    EXPECT_EQ(count, 7u);
+}
+
+class PerfBufferRecoveryTest : public testing::Test {
+protected:
+    std::string mPath;
+
+    void SetUp() override {
+        mPath = testing::TempDir() + "rhea-buffer-" + std::to_string(getpid());
+    }
+
+    void TearDown() override {
+        unlink(mPath.c_str());
+    }
+
+    /**
+     * Writes count records to a file backed buffer in a child process, then kills the child, or
+     * lets it die during a dump which writes dumpWrites more records if dumpWrites is not 0.
+     */
+    void writeAndDie(bool snapshotDump, uint32_t count, uint32_t dumpWrites) {
+        pid_t pid = fork();
+        ASSERT_NE(pid, -1);
+        if (pid == 0) {
+            auto* buffer = PerfBuffer<SamplingRecord>::create(64, recordTime, 1, 0, snapshotDump,
+                                                              mPath.c_str());
+            if (buffer == nullptr) {
+                _exit(1);
+            }
+            for (uint32_t i = 0; i < count; ++i) {
+                SamplingRecord r{};
+                r.mNanoTime = i;
+                buffer->write(r);
+            }
+            if (dumpWrites > 0) {
+                DyingDumper dumper;
+                dumper.buffer = buffer;
+                dumper.writes = dumpWrites;
+                int fd = memfd_create("rhea-dump", 0);
+                buffer->dump(nullptr, fd, -1, 0, 11, 0, nullptr, 0, false, &dumper);
+            }
+            raise(SIGKILL);
+            _exit(1);
+        }
+        int status = 0;
+        ASSERT_EQ(waitpid(pid, &status, 0), pid);
+        ASSERT_TRUE(WIFSIGNALED(status));
+        EXPECT_EQ(WTERMSIG(status), SIGKILL);
+    }
+
+    uint32_t recoverAndCount() {
+        auto* buffer = PerfBuffer<SamplingRecord>::recover(mPath.c_str(), recordTime);
+        if (buffer == nullptr) {
+            ADD_FAILURE() << "no buffer recovered from " << mPath;
+            return 0;
+        }
+        int fd = memfd_create("rhea-dump", 0);
+        CountingDumper dumper;
+        EXPECT_EQ(buffer->dump(nullptr, fd, -1, 0, 11, 0, nullptr, 0, false, &dumper), 0);
+        close(fd);
+        delete buffer;
+        return dumper.count;
+    }
+};
+
+TEST_F(PerfBufferRecoveryTest, SnapshotBufferSurvivesKill) {
+    writeAndDie(true, 10, 0);
+    EXPECT_EQ(recoverAndCount(), 10u);
+}
+
+TEST_F(PerfBufferRecoveryTest, BackupBufferSurvivesKillDuringDump) {
+    writeAndDie(false, 10, 5);
+    // records written during the dump are only in the backup buffer
+    EXPECT_EQ(recoverAndCount(), 15u);
+}
+
+} // namespace
+} // namespace rheatrace
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include <atomic>
+#include <sched.h>
+#include <thread>
+#include <vector>
+#include "sampling/SamplingRecord.h"
+#include "stat/PerfEventCounters.h"
+
+namespace rheatrace {
+namespace {
+
+using Values = PerfEventCounters::Values;
+
+uint64_t sSink = 0;
+
+void busyLoop() {
+    for (uint64_t i = 0; i < 1000000; ++i) {
+        sSink = sSink * 31 + i;
+        asm volatile("" ::: "memory");
+    }
+}
+
+/**
+ * Counters that are valid must never go backwards on a thread. Hosts without perf events, such
+ * as containers with seccomp, only check that read() reports nothing so callers fall back.
+ */
+void expectMonotonic(PerfEventCounters::Mode mode) {
+    Values before{};
+    if (!PerfEventCounters::read(mode, before)) {
+        EXPECT_EQ(0u, before.validMask);
+        return;
+    }
+    busyLoop();
+    sched_yield();
+    Values after{};
+    ASSERT_TRUE(PerfEventCounters::read(mode, after));
+    EXPECT_EQ(before.validMask, after.validMask);
+    for (uint32_t i = 0; i < PerfEventCounters::kCounterCount; ++i) {
+        auto counter = PerfEventCounters::Counter(i);
+        if (before.has(counter)) {
+            EXPECT_GE(after.values[i], before.values[i]) << "counter " << i;
+        }
+    }
+    if (after.has(PerfEventCounters::kInstructions)) {
+        EXPECT_GT(after.values[PerfEventCounters::kInstructions],
+                  before.values[PerfEventCounters::kInstructions]);
+    }
+}
+
+TEST(PerfEventCountersTest, DisabledReadsNothing) {
+    Values values{};
+    values.validMask = ~0u;
+    EXPECT_FALSE(PerfEventCounters::read(PerfEventCounters::kDisabled, values));
+    EXPECT_EQ(0u, values.validMask);
+}
+
+TEST(PerfEventCountersTest, SoftwareCountersAreMonotonic) {
+    expectMonotonic(PerfEventCounters::kSoftware);
+}
+
+TEST(PerfEventCountersTest, HardwareCountersAreMonotonic) {
+    expectMonotonic(PerfEventCounters::kHardware);
+}
+
+TEST(PerfEventCountersTest, SoftwareModeHasNoHardwareCounters) {
+    Values values{};
+    PerfEventCounters::read(PerfEventCounters::kHardware, values);
+    PerfEventCounters::read(PerfEventCounters::kSoftware, values);
+    EXPECT_FALSE(values.has(PerfEventCounters::kInstructions));
+    EXPECT_FALSE(values.has(PerfEventCounters::kCycles));
+}
+
+TEST(PerfEventCountersTest, ThreadsCountSeparately) {
+    Values main{};
+    bool available = PerfEventCounters::read(PerfEventCounters::kSoftware, main);
+    std::vector<std::thread> threads;
+    std::vector<Values> results(4);
+    for (auto& result : results) {
+        threads.emplace_back([&result]() {
+            PerfEventCounters::read(PerfEventCounters::kSoftware, result);
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    for (auto& result : results) {
+        EXPECT_EQ(available ? main.validMask : 0u, result.validMask);
+    }
+}
+
+TEST(PerfEventCountersTest, ThreadsHoldingCountersAreCapped) {
+    Values main{};
+    bool available = PerfEventCounters::read(PerfEventCounters::kSoftware, main);
+    std::atomic<uint32_t> reads(0);
+    std::atomic<uint32_t> counted(0);
+    std::vector<std::thread> threads;
+    const uint32_t threadCount = PerfEventCounters::kMaxThreads + 8;
+    for (uint32_t i = 0; i < threadCount; ++i) {
+        threads.emplace_back([&]() {
+            Values values{};
+            bool read = PerfEventCounters::read(PerfEventCounters::kSoftware, values);
+            counted += read ? 1 : 0;
+            reads++;
+            // every thread keeps its counters until all of them have read
+            while (reads.load() < threadCount) {
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (!available) {
+        EXPECT_EQ(0u, counted.load());
+        return;
+    }
+    // the main thread holds one slot
+    EXPECT_EQ(PerfEventCounters::kMaxThreads - 1, counted.load());
+    // slots are given back when threads exit
+    Values later{};
+    std::thread([&later]() {
+        PerfEventCounters::read(PerfEventCounters::kSoftware, later);
+    }).join();
+    EXPECT_EQ(main.validMask, later.validMask);
+}
+
+class PerfCountersRecordTest : public testing::Test {
+protected:
+    static constexpr int64_t kArenaBytes = 256;
+    alignas(8) char mMemory[PayloadArena::calculateAllocationSize(kArenaBytes)];
+    PayloadArena* mArena = nullptr;
+
+    void SetUp() override {
+        mArena = PayloadArena::allocateAt(kArenaBytes, mMemory);
+    }
+
+    static SamplingRecord makeRecord() {
+        SamplingRecord r{};
+        r.mType = SamplingType::kBinder;
+        r.mTid = 1;
+        r.mNanoTime = 1000;
+        r.mStack.mPosition = -1;
+        r.mNativeStack.mPosition = -1;
+        r.mPerfPosition = -1;
+        return r;
+    }
+
+    static uint8_t flagsOf(const char* encoded) {
+        // type and tid are single byte varints here
+        return static_cast<uint8_t>(encoded[2]);
+    }
+};
+
+TEST_F(PerfCountersRecordTest, CountersAreReadFromPayload) {
+    SamplingRecord r = makeRecord();
+    uint64_t packed[] = {7, 9};
+    r.mPerfMask = (1u << PerfEventCounters::kContextSwitches) | (1u << PerfEventCounters::kCycles);
+    r.mPerfPosition = mArena->write(packed, sizeof(packed));
+    uint64_t counters[PerfEventCounters::kCounterCount] = {};
+    EXPECT_EQ(r.mPerfMask, r.readPerfCounters(mArena, counters));
+    EXPECT_EQ(7u, counters[PerfEventCounters::kContextSwitches]);
+    EXPECT_EQ(9u, counters[PerfEventCounters::kCycles]);
+
+    char out[512];
+    SamplingEncodeState state;
+    r.encodeInto(out, &state, mArena);
+    EXPECT_NE(0, flagsOf(out) & SamplingRecord::kFlagPerfCounters);
+}
+
+TEST_F(PerfCountersRecordTest, OverwrittenCountersAreDropped) {
+    SamplingRecord r = makeRecord();
+    uint64_t packed[] = {7};
+    r.mPerfMask = 1u << PerfEventCounters::kContextSwitches;
+    r.mPerfPosition = mArena->write(packed, sizeof(packed));
+    char filler[kArenaBytes] = {};
+    mArena->write(filler, sizeof(filler));
+    uint64_t counters[PerfEventCounters::kCounterCount] = {};
+    EXPECT_EQ(0u, r.readPerfCounters(mArena, counters));
+
+    char out[512];
+    SamplingEncodeState state;
+    r.encodeInto(out, &state, mArena);
+    EXPECT_EQ(0, flagsOf(out) & SamplingRecord::kFlagPerfCounters);
+}
+
+TEST_F(PerfCountersRecordTest, RecordWithoutCountersHasNoFlag) {
+    SamplingRecord r = makeRecord();
+    char out[512];
+    SamplingEncodeState state;
+    r.encodeInto(out, &state, mArena);
+    EXPECT_EQ(0, flagsOf(out) & SamplingRecord::kFlagPerfCounters);
+}
+
+} // namespace
+} // namespace rheatrace
@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include <vector>
+#include "sampling/SamplingRecord.h"
+
+namespace rheatrace {
+namespace {
+
+/**
+ * Reads varints back the way the trace processor decodes a sampling dump.
+ */
+struct Reader {
+    const uint8_t* mData;
+    uint32_t mSize = 0;
+
+    explicit Reader(const char* data) : mData(reinterpret_cast<const uint8_t*>(data)) {}
+
+    uint8_t byte() {
+        return mData[mSize++];
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (uint32_t shift = 0;; shift += 7) {
+            uint8_t b = byte();
+            value |= uint64_t(b & 0x7f) << shift;
+            if ((b & 0x80) == 0) {
+                return value;
+            }
+        }
+    }
+
+    int64_t zigzag() {
+        uint64_t value = varint();
+        return int64_t(value >> 1) ^ -int64_t(value & 1);
+    }
+};
+
+class SamplingRecordTest : public testing::Test {
+protected:
+    static constexpr int64_t kArenaBytes = 1024;
+    alignas(8) char mMemory[PayloadArena::calculateAllocationSize(kArenaBytes)];
+    PayloadArena* mArena = nullptr;
+    SamplingEncodeState mState;
+    char mOut[4096];
+
+    void SetUp() override {
+        mArena = PayloadArena::allocateAt(kArenaBytes, mMemory);
+    }
+
+    static SamplingRecord makeRecord(uint16_t tid, uint64_t nanoTime, uint64_t cpuTime) {
+        SamplingRecord r{};
+        r.mType = SamplingType::kBinder;
+        r.mTid = tid;
+        r.mMessageId = 3;
+        r.mNanoTime = nanoTime;
+        r.mCpuTime = cpuTime;
+        r.mAllocatedObjects = 10;
+        r.mAllocatedBytes = 200;
+        r.mMajFlt = 1;
+        r.mNvCsw = 4;
+        r.mNivCsw = 2;
+        r.mPerfPosition = -1;
+        r.mStack.mPosition = -1;
+        r.mNativeStack.mPosition = -1;
+        return r;
+    }
+
+    uint32_t encode(SamplingRecord& r) {
+        uint32_t size = r.encodeInto(mOut, &mState, mArena);
+        EXPECT_LE(size, SamplingRecord::maxBytes());
+        return size;
+    }
+
+    /**
+     * Write a stack payload of own frames, incremental on base if sharedDepth is not 0.
+     */
+    int64_t writeStack(const std::vector<uint64_t>& own, int64_t basePosition = -1,
+                       uint32_t baseSavedDepth = 0, uint32_t baseSharedDepth = 0,
+                       uint32_t sharedDepth = 0) {
+        if (sharedDepth == 0) {
+            return mArena->write(own.data(), own.size() * sizeof(uint64_t));
+        }
+        char payload[sizeof(StackDeltaHeader) + MAX_STACK_DEPTH * sizeof(uint64_t)];
+        StackDeltaHeader header{basePosition, baseSavedDepth, baseSharedDepth};
+        memcpy(payload, &header, sizeof(header));
+        memcpy(payload + sizeof(header), own.data(), own.size() * sizeof(uint64_t));
+        return mArena->write(payload, sizeof(header) + own.size() * sizeof(uint64_t));
+    }
+
+    /**
+     * Frame methods encoded as indexes of the method dictionary.
+     */
+    std::vector<uint64_t> readStack(Reader& reader, uint32_t& stackId) {
+        uint32_t savedDepth = reader.varint();
+        EXPECT_EQ(savedDepth, reader.varint());
+        stackId = reader.varint();
+        std::vector<uint64_t> frames;
+        for (uint32_t i = 0; stackId == 0 && i < savedDepth; ++i) {
+            frames.push_back(mState.mMethods.mMethods[reader.varint()]);
+        }
+        return frames;
+    }
+};
+
+TEST_F(SamplingRecordTest, DeltasFollowPreviousRecordOfSameThread) {
+    SamplingRecord first = makeRecord(1, 1000, 500);
+    uint32_t size = encode(first);
+    Reader reader(mOut);
+    EXPECT_EQ(uint64_t(SamplingType::kBinder), reader.varint());
+    EXPECT_EQ(1u, reader.varint());
+    EXPECT_EQ(SamplingRecord::kFlagAbsolute, reader.byte());
+    EXPECT_EQ(3u, reader.varint());
+    EXPECT_EQ(1000, reader.zigzag());
+    EXPECT_EQ(500, reader.zigzag());
+    EXPECT_EQ(10, reader.zigzag());
+    EXPECT_EQ(200, reader.zigzag());
+    EXPECT_EQ(1, reader.zigzag());
+    EXPECT_EQ(4, reader.zigzag());
+    EXPECT_EQ(2, reader.zigzag());
+    uint32_t stackId;
+    EXPECT_TRUE(readStack(reader, stackId).empty());
+    EXPECT_EQ(0u, reader.varint());
+    EXPECT_EQ(size, reader.mSize);
+
+    SamplingRecord second = makeRecord(1, 1300, 450);
+    second.mAllocatedBytes = 260;
+    encode(second);
+    reader = Reader(mOut);
+    reader.varint();
+    reader.varint();
+    EXPECT_EQ(0, reader.byte());
+    reader.varint();
+    EXPECT_EQ(300, reader.zigzag());
+    EXPECT_EQ(-50, reader.zigzag());
+    EXPECT_EQ(0, reader.zigzag());
+    EXPECT_EQ(60, reader.zigzag());
+
+    // another thread starts from zero
+    SamplingRecord other = makeRecord(2, 1400, 100);
+    encode(other);
+    reader = Reader(mOut);
+    reader.varint();
+    reader.varint();
+    EXPECT_EQ(SamplingRecord::kFlagAbsolute, reader.byte());
+    reader.varint();
+    EXPECT_EQ(1400, reader.zigzag());
+}
+
+TEST_F(SamplingRecordTest, ResetDeltasMakesNextRecordAbsolute) {
+    SamplingRecord first = makeRecord(1, 1000, 500);
+    encode(first);
+    mState.resetDeltas();
+    SamplingRecord second = makeRecord(1, 1300, 600);
+    encode(second);
+    Reader reader(mOut);
+    reader.varint();
+    reader.varint();
+    EXPECT_EQ(SamplingRecord::kFlagAbsolute, reader.byte());
+    reader.varint();
+    EXPECT_EQ(1300, reader.zigzag());
+    EXPECT_EQ(600, reader.zigzag());
+}
+
+TEST_F(SamplingRecordTest, EveryFlagCombinationRoundTrips) {
+    const uint8_t optional[] = {SamplingRecord::kFlagHasEnd, SamplingRecord::kFlagSampledBytes,
+                                SamplingRecord::kFlagPerfCounters, SamplingRecord::kFlagWakee,
+                                SamplingRecord::kFlagNoBeginCpu};
+    for (uint32_t combination = 0; combination < (1u << 5); ++combination) {
+        uint8_t expected = SamplingRecord::kFlagAbsolute;
+        for (uint32_t i = 0; i < 5; ++i) {
+            if (combination & (1u << i)) {
+                expected |= optional[i];
+            }
+        }
+        if ((expected & SamplingRecord::kFlagNoBeginCpu) &&
+            !(expected & SamplingRecord::kFlagHasEnd)) {
+            // begin cpu time is only unknown for records with an end
+            continue;
+        }
+        SCOPED_TRACE(testing::Message() << "flags " << int(expected));
+        mState = SamplingEncodeState();
+        SamplingRecord r = makeRecord(7, 1000, 500);
+        if (expected & SamplingRecord::kFlagHasEnd) {
+            r.mEndNanoTime = 1800;
+            r.mEndCpuTime = 900;
+        }
+        if (expected & SamplingRecord::kFlagNoBeginCpu) {
+            r.mCpuTime = 0;
+        }
+        if (expected & SamplingRecord::kFlagSampledBytes) {
+            r.mSampledBytes = 4096;
+        }
+        if (expected & SamplingRecord::kFlagPerfCounters) {
+            uint64_t packed[] = {5, 123456};
+            r.mPerfMask = (1u << PerfEventCounters::kMajorFaults) |
+                          (1u << PerfEventCounters::kInstructions);
+            r.mPerfPosition = mArena->write(packed, sizeof(packed));
+        }
+        if (expected & SamplingRecord::kFlagWakee) {
+            r.mWakeeTid = 321;
+        }
+        uint32_t size = encode(r);
+
+        Reader reader(mOut);
+        EXPECT_EQ(uint64_t(SamplingType::kBinder), reader.varint());
+        EXPECT_EQ(7u, reader.varint());
+        EXPECT_EQ(expected, reader.byte());
+        EXPECT_EQ(3u, reader.varint());
+        EXPECT_EQ(1000, reader.zigzag());
+        int64_t cpuTime = reader.zigzag();
+        EXPECT_EQ((expected & SamplingRecord::kFlagNoBeginCpu) ? 900 : 500, cpuTime);
+        if (expected & SamplingRecord::kFlagHasEnd) {
+            EXPECT_EQ(800, reader.zigzag());
+            EXPECT_EQ(900 - cpuTime, reader.zigzag());
+        }
+        for (int64_t counter : {10, 200, 1, 4, 2}) {
+            EXPECT_EQ(counter, reader.zigzag());
+        }
+        if (expected & SamplingRecord::kFlagSampledBytes) {
+            EXPECT_EQ(4096u, reader.varint());
+        }
+        if (expected & SamplingRecord::kFlagPerfCounters) {
+            EXPECT_EQ(r.mPerfMask, reader.varint());
+            EXPECT_EQ(5, reader.zigzag());
+            EXPECT_EQ(123456, reader.zigzag());
+        }
+        if (expected & SamplingRecord::kFlagWakee) {
+            EXPECT_EQ(321u, reader.varint());
+        }
+        uint32_t stackId;
+        readStack(reader, stackId);
+        EXPECT_EQ(0u, reader.varint());
+        EXPECT_EQ(size, reader.mSize);
+    }
+}
+
+TEST_F(SamplingRecordTest, PerfCountersKeepTheirOwnDeltas) {
+    SamplingRecord first = makeRecord(1, 1000, 500);
+    uint64_t firstCounters[] = {5, 100};
+    first.mPerfMask = (1u << PerfEventCounters::kContextSwitches) |
+                      (1u << PerfEventCounters::kCycles);
+    first.mPerfPosition = mArena->write(firstCounters, sizeof(firstCounters));
+    encode(first);
+    // a record without counters leaves their deltas alone
+    SamplingRecord second = makeRecord(1, 1100, 500);
+    encode(second);
+    SamplingRecord third = makeRecord(1, 1200, 500);
+    uint64_t thirdCounters[] = {180};
+    third.mPerfMask = 1u << PerfEventCounters::kCycles;
+    third.mPerfPosition = mArena->write(thirdCounters, sizeof(thirdCounters));
+    encode(third);
+
+    Reader reader(mOut);
+    reader.varint();
+    reader.varint();
+    EXPECT_EQ(SamplingRecord::kFlagPerfCounters, reader.byte());
+    reader.varint();
+    for (int i = 0; i < 7; ++i) {
+        reader.zigzag();
+    }
+    EXPECT_EQ(third.mPerfMask, reader.varint());
+    EXPECT_EQ(80, reader.zigzag());
+}
+
+TEST_F(SamplingRecordTest, InternedStackIsReferredById) {
+    SamplingRecord r = makeRecord(1, 1000, 500);
+    r.mStack.mStackId = 42;
+    r.mStack.mSavedDepth = 12;
+    r.mStack.mActualDepth = 12;
+    uint32_t size = encode(r);
+    Reader reader(mOut);
+    reader.varint();
+    reader.varint();
+    reader.byte();
+    reader.varint();
+    for (int i = 0; i < 7; ++i) {
+        reader.zigzag();
+    }
+    uint32_t stackId;
+    EXPECT_TRUE(readStack(reader, stackId).empty());
+    EXPECT_EQ(42u, stackId);
+    EXPECT_EQ(1u, mState.mStackIds.count(42));
+    EXPECT_EQ(0u, reader.varint());
+    EXPECT_EQ(size, reader.mSize);
+}
+
+TEST_F(SamplingRecordTest, DeltaChainResolvesToFullFrames) {
+    // frames go from callee to caller, incremental payloads share the outermost ones
+    std::vector<uint64_t> keyframe = {10, 11, 12, 13, 14, 15, 16, 17, 18, 19};
+    int64_t base = writeStack(keyframe);
+    std::vector<uint64_t> own1 = {20, 21, 22, 23};
+    int64_t delta1 = writeStack(own1, base, 10, 0, 8);
+    std::vector<uint64_t> own2 = {30, 31};
+    // shares one own frame of delta1 and the frames delta1 shares with the keyframe
+    int64_t delta2 = writeStack(own2, delta1, 12, 8, 9);
+
+    StackRef ref{};
+    ref.mPosition = delta2;
+    ref.mSavedDepth = 11;
+    ref.mActualDepth = 11;
+    ref.mSharedDepth = 9;
+    uint64_t frames[MAX_STACK_DEPTH];
+    ASSERT_TRUE(ref.readFrames(mArena, frames));
+    std::vector<uint64_t> expected = {30, 31, 23, 12, 13, 14, 15, 16, 17, 18, 19};
+    EXPECT_EQ(expected, std::vector<uint64_t>(frames, frames + 11));
+
+    uint32_t size = ref.encodeInfo(mOut, &mState.mMethods, &mState.mStackIds, mArena);
+    Reader reader(mOut);
+    uint32_t stackId;
+    EXPECT_EQ(expected, readStack(reader, stackId));
+    EXPECT_EQ(0u, stackId);
+    EXPECT_EQ(size, reader.mSize);
+}
+
+TEST_F(SamplingRecordTest, OverwrittenBaseEncodesEmptyStack) {
+    std::vector<uint64_t> keyframe = {10, 11, 12, 13, 14, 15, 16, 17};
+    int64_t base = writeStack(keyframe);
+    std::vector<uint64_t> own = {20, 21};
+    int64_t delta = writeStack(own, base, 8, 0, 6);
+    // overwrites the base, and leaves the incremental payload alive
+    std::vector<char> filler(kArenaBytes - (mArena->getCurrentPosition() - delta), 0);
+    mArena->write(filler.data(), filler.size());
+
+    StackRef ref{};
+    ref.mPosition = delta;
+    ref.mSavedDepth = 8;
+    ref.mActualDepth = 8;
+    ref.mSharedDepth = 6;
+    uint64_t frames[MAX_STACK_DEPTH];
+    EXPECT_FALSE(ref.readFrames(mArena, frames));
+
+    uint32_t size = ref.encodeInfo(mOut, &mState.mMethods, &mState.mStackIds, mArena);
+    Reader reader(mOut);
+    EXPECT_EQ(0u, reader.varint());
+    EXPECT_EQ(0u, reader.varint());
+    EXPECT_EQ(0u, reader.varint());
+    EXPECT_EQ(size, reader.mSize);
+    EXPECT_TRUE(mState.mMethods.mMethods.empty());
+}
+
+TEST_F(SamplingRecordTest, NativeStackIsEncodedByIndexes) {
+    uint64_t pcs[] = {0x1000, 0x2000, 0x1000};
+    NativeStackRef ref{mArena->write(pcs, sizeof(pcs)), 3};
+    uint32_t size = ref.encodeInfo(mOut, &mState.mNativePcs, mArena);
+    Reader reader(mOut);
+    EXPECT_EQ(3u, reader.varint());
+    EXPECT_EQ(0u, reader.varint());
+    EXPECT_EQ(1u, reader.varint());
+    EXPECT_EQ(0u, reader.varint());
+    EXPECT_EQ(size, reader.mSize);
+
+    std::vector<char> filler(kArenaBytes, 0);
+    mArena->write(filler.data(), filler.size());
+    EXPECT_EQ(1u, ref.encodeInfo(mOut, &mState.mNativePcs, mArena));
+    EXPECT_EQ(0, mOut[0]);
+}
+
+} // namespace
+} // namespace rheatrace
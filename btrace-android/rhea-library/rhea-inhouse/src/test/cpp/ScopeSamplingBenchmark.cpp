@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <benchmark/benchmark.h>
+#include "sampling/SamplingCollector.h"
+#include "utils/FastClock.h"
+
+namespace rheatrace {
+namespace {
+
+/**
+ * Opens the gate of ScopeSampling as a started collector does, with intervalNs for all threads.
+ */
+void openGate(uint64_t intervalNs) {
+    fast_clock::calibrate();
+    sScopeGate.mainThreadIntervalNs.store(intervalNs);
+    sScopeGate.otherThreadIntervalNs.store(intervalNs);
+    sScopeGate.bucketTypes.store(0);
+    sScopeGate.active.store(true);
+}
+
+/**
+ * A hooked binder or monitor call inside the java interval: a clock read and the pre-check at
+ * begin, and a request at end which is dropped by the host collector as the interval drops it.
+ */
+void BM_ThrottledScope(benchmark::State& state) {
+    // the whole run is inside one interval
+    openGate(3600ULL * 1000 * 1000 * 1000);
+    sThreadState.lastJavaNano = fast_clock::boot_time_nanos();
+    for (auto _ : state) {
+        ScopeSampling ss(SamplingType::kBinder);
+        benchmark::DoNotOptimize(ss.beginNano_);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ThrottledScope)->ThreadRange(1, 8)->UseRealTime();
+
+/**
+ * The same call past the interval, which reads thread cpu time at begin.
+ */
+void BM_PastIntervalScope(benchmark::State& state) {
+    openGate(0);
+    for (auto _ : state) {
+        ScopeSampling ss(SamplingType::kBinder);
+        benchmark::DoNotOptimize(ss.beginNano_);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PastIntervalScope)->ThreadRange(1, 8)->UseRealTime();
+
+} // namespace
+} // namespace rheatrace
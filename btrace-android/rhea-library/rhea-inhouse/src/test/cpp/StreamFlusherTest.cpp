@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <climits>
+#include <thread>
+#include "base/StreamFlusher.h"
+#include "sampling/SamplingRecord.h"
+
+namespace rheatrace {
+namespace {
+
+// set on time of the first record after beginChunk()
+constexpr uint64_t kChunkStart = 1ull << 63;
+// magic, type, version, time, count and extra length
+constexpr size_t kHeaderSize = 4 + 4 + 4 + 8 + 4 + 4;
+
+uint64_t recordTime(SamplingRecord& r) {
+    return r.mNanoTime;
+}
+
+/**
+ * Dumper which writes record time only.
+ */
+class TimeDumper : public Dumper {
+private:
+    bool mChunkStart = false;
+public:
+    uint32_t dumpRecord(JNIEnv* env, void* addr, void* r, PayloadArena* payload) override {
+        uint64_t time = reinterpret_cast<SamplingRecord*>(r)->mNanoTime;
+        if (mChunkStart) {
+            time |= kChunkStart;
+            mChunkStart = false;
+        }
+        memcpy(addr, &time, sizeof(time));
+        return sizeof(time);
+    }
+
+    uint32_t maxRecordSize() override {
+        return sizeof(uint64_t);
+    }
+
+    bool hasMapping() override {
+        return false;
+    }
+
+    bool dumpMapping(int fd) override {
+        return false;
+    }
+
+    void beginChunk() override {
+        mChunkStart = true;
+    }
+};
+
+class StreamFlusherTest : public testing::Test {
+protected:
+    PerfBuffer<SamplingRecord>* mBuffer = nullptr;
+    StreamFlusher<SamplingRecord>* mFlusher = nullptr;
+    std::string mDir;
+    uint64_t mTime = 1;
+    int mFd = -1;
+
+    void SetUp() override {
+        char dir[] = "/tmp/rhea-stream-XXXXXX";
+        ASSERT_NE(mkdtemp(dir), nullptr);
+        mDir = dir;
+        mFd = memfd_create("rhea-dump", 0);
+    }
+
+    void TearDown() override {
+        delete mFlusher;
+        delete mBuffer;
+        close(mFd);
+        rmdir(mDir.c_str());
+    }
+
+    void start(uint64_t capacity, uint32_t shards, uint64_t segmentBytes) {
+        mBuffer = PerfBuffer<SamplingRecord>::create(capacity, recordTime, shards, 0, true);
+        ASSERT_NE(mBuffer, nullptr);
+        // flushed by concat() only
+        mFlusher = new StreamFlusher<SamplingRecord>(mBuffer, new TimeDumper(), mDir.c_str(),
+                                                     "test", {3600 * 1000, segmentBytes, 64});
+        ASSERT_EQ(mFlusher->start(), 0);
+    }
+
+    /**
+     * Writes count records from a new thread, which goes to the next shard of the last thread.
+     */
+    void writeFromNewThread(uint32_t count) {
+        std::thread([this, count]() {
+            for (uint32_t i = 0; i < count; ++i) {
+                SamplingRecord r{};
+                r.mType = SamplingType::kBinder;
+                r.mNanoTime = mTime++;
+                r.mStack.mPosition = -1;
+                r.mNativeStack.mPosition = -1;
+                mBuffer->write(r);
+            }
+        }).join();
+    }
+
+    /**
+     * @return times of dumped records in file order, empty if concat failed.
+     */
+    std::vector<uint64_t> concat(int64_t start, int64_t end, int* result) {
+        *result = mFlusher->concat(nullptr, mFd, -1, 0, 11, 0, nullptr, 0, start, end);
+        std::vector<uint64_t> times;
+        if (*result != 0) {
+            return times;
+        }
+        uint32_t count;
+        EXPECT_EQ(pread(mFd, &count, sizeof(count), 20), ssize_t(sizeof(count)));
+        times.resize(count);
+        EXPECT_EQ(pread(mFd, times.data(), count * sizeof(uint64_t), kHeaderSize),
+                  ssize_t(count * sizeof(uint64_t)));
+        return times;
+    }
+
+    static std::vector<uint64_t> sorted(std::vector<uint64_t> times) {
+        for (auto& time : times) {
+            time &= ~kChunkStart;
+        }
+        std::sort(times.begin(), times.end());
+        return times;
+    }
+
+    static std::vector<uint64_t> range(uint64_t begin, uint64_t end) {
+        std::vector<uint64_t> result;
+        for (uint64_t time = begin; time < end; ++time) {
+            result.push_back(time);
+        }
+        return result;
+    }
+};
+
+TEST_F(StreamFlusherTest, ConcatCutsAtMarks) {
+    start(1024, 2, 1 << 20);
+    writeFromNewThread(10);
+    int64_t m1 = mBuffer->mark();
+    writeFromNewThread(5);
+    writeFromNewThread(5);
+    int64_t m2 = mBuffer->mark();
+    writeFromNewThread(7);
+
+    int result;
+    auto times = concat(m1, m2, &result);
+    ASSERT_EQ(result, 0);
+    ASSERT_FALSE(times.empty());
+    EXPECT_NE(times[0] & kChunkStart, 0u);
+    EXPECT_EQ(sorted(times), range(11, 21));
+
+    writeFromNewThread(4);
+    int64_t m3 = mBuffer->mark();
+    times = concat(m2, m3, &result);
+    ASSERT_EQ(result, 0);
+    EXPECT_NE(times[0] & kChunkStart, 0u);
+    EXPECT_EQ(sorted(times), range(21, 32));
+
+    times = concat(INT64_MIN, INT64_MAX, &result);
+    ASSERT_EQ(result, 0);
+    EXPECT_EQ(sorted(times), range(1, 32));
+}
+
+TEST_F(StreamFlusherTest, MarksSplitRolledSegments) {
+    // a segment rolls on every flush
+    start(1024, 1, 1);
+    std::vector<int64_t> marks{mBuffer->mark()};
+    for (uint32_t i = 0; i < 5; ++i) {
+        writeFromNewThread(3);
+        marks.push_back(mBuffer->mark());
+    }
+    int result;
+    auto times = concat(marks[1], marks[4], &result);
+    ASSERT_EQ(result, 0);
+    EXPECT_EQ(sorted(times), range(4, 13));
+    times = concat(marks[4], marks[5], &result);
+    ASSERT_EQ(result, 0);
+    EXPECT_EQ(sorted(times), range(13, 16));
+}
+
+TEST_F(StreamFlusherTest, InflightRecordIsCarriedToLaterBlock) {
+    start(4096, 1, 1 << 20);
+    writeFromNewThread(3);
+    int64_t m1 = mBuffer->mark();
+    // acquired and never committed, as if its writer is still running
+    mBuffer->acquire();
+    writeFromNewThread(2);
+    int64_t m2 = mBuffer->mark();
+
+    int result;
+    // records after the in-flight one are neither dumped before it nor dropped
+    concat(m1, m2, &result);
+    EXPECT_EQ(result, 8);
+    auto times = concat(INT64_MIN, INT64_MAX, &result);
+    ASSERT_EQ(result, 0);
+    EXPECT_EQ(sorted(times), range(1, 4));
+
+    // until it is abandoned
+    writeFromNewThread(1100);
+    times = concat(m1, INT64_MAX, &result);
+    ASSERT_EQ(result, 0);
+    EXPECT_EQ(sorted(times), range(4, 1106));
+}
+
+} // namespace
+} // namespace rheatrace
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <android/log.h>
+#include <shadowhook.h>
+#include <sys/system_properties.h>
+#include <cstdarg>
+#include <cstdio>
+#include "sampling/SamplingCollector.h"
+#include "sampling/SamplingThreadState.h"
+
+namespace rheatrace {
+
+// defined by SamplingCollector.cpp on device
+thread_local SamplingThreadState sThreadState;
+ScopeGate sScopeGate;
+
+// there is no collector on host, so requests passing the gate capture nothing
+bool SamplingCollector::request(SamplingType type, void* self, bool force, bool captureAtEnd,
+                                uint64_t beginNano, uint64_t beginCpuNano) {
+    return false;
+}
+
+} // namespace rheatrace
+
+extern "C" int __system_property_get(const char* name, char* value) {
+    value[0] = 0;
+    return 0;
+}
+
+extern "C" int __android_log_print(int prio, const char* tag, const char* fmt, ...) {
+    if (prio < ANDROID_LOG_WARN) {
+        return 0;
+    }
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "%s: ", tag);
+    int result = vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    return result;
+}
+
+extern "C" void* shadowhook_hook_sym_name(const char*, const char*, void*, void**) {
+    return nullptr;
+}
+
+extern "C" void* shadowhook_hook_sym_addr(void*, void*, void**) {
+    return nullptr;
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2021 ByteDance Inc
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+// Nothing is hooked on host, every hook fails.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void* shadowhook_hook_sym_name(const char* lib_name, const char* sym_name, void* new_addr,
+                               void** orig_addr);
+void* shadowhook_hook_sym_addr(void* sym_addr, void* new_addr, void** orig_addr);
+
+#ifdef __cplusplus
+}
+#endif
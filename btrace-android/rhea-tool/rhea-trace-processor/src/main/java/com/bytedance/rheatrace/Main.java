@@ -109,7 +109,8 @@ public class Main {
             sysCapture.stop();
             thread.join();
             Adb.Http.download("sampling", Workspace.samplingTrace());
-            Adb.Http.download("sampling-mapping", Workspace.samplingMapping());
+            // there is no mapping file if sampling is dumped as perfetto trace
+            Adb.Http.downloadSafe("sampling-mapping", Workspace.samplingMapping());
             showBufferUsage();
             sysCapture.process();
         } catch (Throwable e) {
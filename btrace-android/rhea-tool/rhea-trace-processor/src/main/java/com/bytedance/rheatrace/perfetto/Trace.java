@@ -42,6 +42,7 @@ public class Trace {
 
     private final TraceOuterClass.Trace.Builder perfettoTrace = TraceOuterClass.Trace.newBuilder();
     private final Map<Process, List<Thread>> processMap = new HashMap<>();
+    private final List<byte[]> rawPackets = new ArrayList<>();
 
     private boolean trackAssigned;
 
@@ -106,6 +107,16 @@ public class Trace {
     public void marshal(OutputStream out) throws IOException {
         injectProcessTreePacket();
         perfettoTrace.build().writeTo(out);
+        for (byte[] raw : rawPackets) {
+            out.write(raw);
+        }
+    }
+
+    /**
+     * Append packets which are already encoded, e.g. a trace dumped as perfetto format on device.
+     */
+    public void appendRaw(byte[] packets) {
+        rawPackets.add(packets);
     }
 
     public void setProcess(int pid, String name) {
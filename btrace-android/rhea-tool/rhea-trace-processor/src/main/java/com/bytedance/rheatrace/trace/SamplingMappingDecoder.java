@@ -19,13 +19,41 @@ import com.bytedance.rheatrace.Log;
 
 import java.nio.ByteBuffer;
 import java.nio.ByteOrder;
+import java.util.ArrayList;
 import java.util.HashMap;
+import java.util.List;
 import java.util.Map;
 
 public class SamplingMappingDecoder {
     private final byte[] mappingBytes;
     public final Map<Long, MethodSymbol> symbolMapping = new HashMap<>();
     public final Map<Integer, String> threadNames = new HashMap<>();
+    /**
+     * 方法字典，version 3 起采样数据中的栈帧以该列表下标表示
+     */
+    public final List<Long> methodPointers = new ArrayList<>();
+    public final Map<Integer, StackNode> stackNodes = new HashMap<>();
+    /**
+     * native 栈帧字典，version 4 起采样数据中的 native 栈帧以该列表下标表示
+     */
+    public final List<MethodSymbol> nativeFrames = new ArrayList<>();
+    /**
+     * version 5 起记录对象分配按字节采样的平均间隔，为 0 时对象分配按时间采样
+     */
+    public long allocationSampleBytes;
+
+    /**
+     * 去重后的堆栈节点，通过 parent 连接成从栈顶到栈底的链表
+     */
+    public static class StackNode {
+        public final int parent;
+        public final long method;
+
+        public StackNode(int parent, long method) {
+            this.parent = parent;
+            this.method = method;
+        }
+    }
 
     public SamplingMappingDecoder(byte[] mappingBytes) {
         this.mappingBytes = mappingBytes;
@@ -42,6 +70,7 @@ public class SamplingMappingDecoder {
         for (int i = 0; i < count; i++) {
             if (buffer.remaining() > 12) {
                 long pointer = buffer.getLong();
+                methodPointers.add(pointer);
                 short len = buffer.getShort();
                 if (len > 0) {
                     byte[] b = new byte[len];
@@ -52,6 +81,21 @@ public class SamplingMappingDecoder {
                 break;
             }
         }
+        if (version >= 2 && buffer.remaining() >= 4) {
+            int nodeCount = buffer.getInt();
+            for (int i = 0; i < nodeCount && buffer.remaining() >= 16; i++) {
+                int id = buffer.getInt();
+                int parent = buffer.getInt();
+                long method = buffer.getLong();
+                stackNodes.put(id, new StackNode(parent, method));
+            }
+        }
+        if (version >= 4 && buffer.remaining() >= 4) {
+            decodeNativeFrames(buffer);
+        }
+        if (version >= 5 && buffer.remaining() >= 8) {
+            allocationSampleBytes = buffer.getLong();
+        }
         while (buffer.hasRemaining()) {
             int tid = buffer.getShort();
             int len = buffer.get();
@@ -67,6 +111,34 @@ public class SamplingMappingDecoder {
         return this;
     }
 
+    private void decodeNativeFrames(ByteBuffer buffer) {
+        int moduleCount = buffer.getInt();
+        List<String> modules = new ArrayList<>(moduleCount);
+        for (int i = 0; i < moduleCount; i++) {
+            byte[] path = new byte[buffer.getShort() & 0xFFFF];
+            buffer.get(path);
+            String module = new String(path);
+            modules.add(module.substring(module.lastIndexOf('/') + 1));
+        }
+        int frameCount = buffer.getInt();
+        for (int i = 0; i < frameCount; i++) {
+            int module = buffer.getInt();
+            long offset = buffer.getLong();
+            int len = buffer.getShort() & 0xFFFF;
+            String symbol = null;
+            if (len > 0) {
+                byte[] b = new byte[len];
+                buffer.get(b);
+                symbol = new String(b);
+            }
+            String name = (module >= 0 && module < modules.size() ? modules.get(module) : "unknown") + "+0x" + Long.toHexString(offset);
+            if (symbol != null) {
+                name += " " + symbol;
+            }
+            nativeFrames.add(new MethodSymbol(offset, 0, name));
+        }
+    }
+
     public void retrace(ProguardMappingDecoder decoder) {
         for (MethodSymbol symbol : symbolMapping.values()) {
             symbol.symbol = decoder.retrace(symbol.symbol);
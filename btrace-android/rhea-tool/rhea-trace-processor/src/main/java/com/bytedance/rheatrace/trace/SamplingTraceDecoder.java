@@ -20,6 +20,7 @@ import com.bytedance.rheatrace.core.Arguments;
 import com.bytedance.rheatrace.core.TraceError;
 import com.bytedance.rheatrace.core.Workspace;
 import com.bytedance.rheatrace.perfetto.Trace;
+import com.bytedance.rheatrace.trace.utils.ByteFormatter;
 
 import org.apache.commons.io.FileUtils;
 import org.json.JSONObject;
@@ -29,6 +30,7 @@ import java.io.IOException;
 import java.nio.ByteBuffer;
 import java.nio.ByteOrder;
 import java.util.ArrayList;
+import java.util.HashMap;
 import java.util.List;
 import java.util.Map;
 
@@ -41,6 +43,17 @@ public class SamplingTraceDecoder {
     }
 
     public static Trace decode() throws IOException {
+        byte[] nativeTrace = readNativePerfettoTrace(Workspace.samplingTrace());
+        if (nativeTrace != null) {
+            Log.i("sampling is dumped as perfetto trace on device, skip converting");
+            if (Arguments.get().mappingPath != null) {
+                // method names are interned into the trace on device, there is no mapping to retrace
+                Log.w("-mapping is ignored, method names of perfetto trace dumped on device are not retraced");
+            }
+            Trace trace = new Trace();
+            trace.appendRaw(nativeTrace);
+            return trace;
+        }
         SamplingMappingDecoder mappingDecoder = decodeMapping(Workspace.samplingMapping());
         if (Arguments.get().mappingPath != null) {
             ProguardMappingDecoder proguardMappingDecoder = new ProguardMappingDecoder();
@@ -48,7 +61,7 @@ public class SamplingTraceDecoder {
             mappingDecoder.retrace(proguardMappingDecoder);
         }
         List<StackList> samplingTrace = new ArrayList<>();
-        JSONObject extra = decodeSampling(Workspace.samplingTrace(), mappingDecoder.symbolMapping, samplingTrace);
+        JSONObject extra = decodeSampling(Workspace.samplingTrace(), mappingDecoder, samplingTrace);
         if (samplingTrace.isEmpty()) {
             Log.red("sampling record empty");
             return null;
@@ -58,11 +71,29 @@ public class SamplingTraceDecoder {
             return null;
         }
         pid = extra.getInt("processId");
+        if (extra.has("samplingOverhead")) {
+            Log.i("sampling overhead: " + extra.getJSONObject("samplingOverhead"));
+        }
+        if (mappingDecoder.allocationSampleBytes > 0) {
+            logAllocationEstimates(samplingTrace, mappingDecoder.allocationSampleBytes);
+        }
 
         return StackTraceConvertor.convert(pid, samplingTrace, mappingDecoder.threadNames);
     }
 
-    private static JSONObject decodeSampling(File sampling, Map<Long, MethodSymbol> mapping, List<StackList> items) throws IOException {
+    /**
+     * @return content of sampling file if it is a perfetto trace, which starts with a TracePacket
+     * field instead of the magic number of rhea dump.
+     */
+    private static byte[] readNativePerfettoTrace(File sampling) throws IOException {
+        byte[] samplingBytes = FileUtils.readFileToByteArray(sampling);
+        if (samplingBytes.length > 0 && samplingBytes[0] == 0x0A) {
+            return samplingBytes;
+        }
+        return null;
+    }
+
+    private static JSONObject decodeSampling(File sampling, SamplingMappingDecoder mapping, List<StackList> items) throws IOException {
         byte[] samplingBytes = FileUtils.readFileToByteArray(sampling);
         ByteBuffer buffer = ByteBuffer.wrap(samplingBytes).order(ByteOrder.LITTLE_ENDIAN);
         if (buffer.remaining() < 28) {
@@ -89,6 +120,36 @@ public class SamplingTraceDecoder {
         return extra;
     }
 
+    private static final int ALLOCATION_TOP_STACKS = 10;
+    private static final int ALLOCATION_STACK_FRAMES = 8;
+
+    /**
+     * 对象分配按字节采样时，每条记录的 sampledBytes 即其代表的分配字节数，按堆栈累加得到无偏估计，
+     * 输出估计分配字节数最多的堆栈（由内到外）
+     */
+    private static void logAllocationEstimates(List<StackList> samplingTrace, long sampleBytes) {
+        Map<String, Long> estimates = new HashMap<>();
+        long total = 0;
+        for (StackList item : samplingTrace) {
+            if (item.sampledBytes == 0) {
+                continue;
+            }
+            StringBuilder stack = new StringBuilder();
+            for (int i = item.size() - 1; i >= 0 && i >= item.size() - ALLOCATION_STACK_FRAMES; i--) {
+                stack.append("\n    ").append(item.getName(i));
+            }
+            estimates.merge(stack.toString(), item.sampledBytes, Long::sum);
+            total += item.sampledBytes;
+        }
+        Log.i("allocation sampled every " + ByteFormatter.format(sampleBytes) + " on average, estimated total " + ByteFormatter.format(total));
+        List<Map.Entry<String, Long>> sorted = new ArrayList<>(estimates.entrySet());
+        sorted.sort((a, b) -> Long.compare(b.getValue(), a.getValue()));
+        for (int i = 0; i < sorted.size() && i < ALLOCATION_TOP_STACKS; i++) {
+            Map.Entry<String, Long> entry = sorted.get(i);
+            Log.i("estimated allocation " + ByteFormatter.format(entry.getValue()) + entry.getKey());
+        }
+    }
+
     private static SamplingMappingDecoder decodeMapping(File mapping) throws IOException {
         byte[] mappingBytes = FileUtils.readFileToByteArray(mapping);
         return new SamplingMappingDecoder(mappingBytes).decode();
@@ -29,6 +29,7 @@ import static com.bytedance.rheatrace.trace.CallNode.kWait;
 
 import java.nio.ByteBuffer;
 import java.util.ArrayList;
+import java.util.Arrays;
 import java.util.Comparator;
 import java.util.HashMap;
 import java.util.HashSet;
@@ -71,6 +72,21 @@ public class StackList {
     public long nvCsw;
     public long nivCsw;
     public long wakeupTid;
+    /**
+     * 按字节采样对象分配时，该条记录代表的分配字节数，按栈累加即为无偏估计；其他记录为 0
+     */
+    public long sampledBytes;
+    /**
+     * version 10 起由 perf_event 读取的线程计数，不可用时为 0
+     */
+    public long contextSwitches;
+    public long cpuMigrations;
+    public long instructions;
+    public long cycles;
+    /**
+     * version 12 起节流的阻塞调用不读取开始时的 cpu 时间，开始 cpu 时间以结束时的代替，不能用于计算 cpu 耗时
+     */
+    public boolean beginCpuUnknown;
 
     @Override
     public boolean equals(Object o) {
@@ -150,59 +166,216 @@ public class StackList {
         stackList.majFlt = majFlt;
         stackList.nvCsw = nvCsw;
         stackList.nivCsw = nivCsw;
+        stackList.copyPerfCounters(this);
         if (type == kBinder || type == kGC || type == kMonitor || type == kPark || type == kWait || type == kMutex) {
             stackList.blockDuration = stackList.duration;
         }
         return stackList;
     }
 
+    private void copyPerfCounters(StackList other) {
+        contextSwitches = other.contextSwitches;
+        cpuMigrations = other.cpuMigrations;
+        instructions = other.instructions;
+        cycles = other.cycles;
+    }
+
     private StackList setMessageId(int messageId) {
         this.messageId = messageId;
         return this;
     }
 
-    public static boolean decode(int version, Map<Long, MethodSymbol> mapping, ByteBuffer buffer, List<StackList> result, long traceBeginTime, int pid) {
-        Map<Long, Integer> wakers = new HashMap<>();
+    private static final int FLAG_ABSOLUTE = 1;
+    private static final int FLAG_HAS_END = 2;
+    private static final int FLAG_SAMPLED_BYTES = 4;
+    private static final int FLAG_PERF_COUNTERS = 8;
+    private static final int FLAG_WAKEE = 16;
+    private static final int FLAG_NO_BEGIN_CPU = 32;
+    // perf 计数下标，与 native 层 PerfEventCounters::Counter 保持一致
+    private static final int PERF_CONTEXT_SWITCHES = 0;
+    private static final int PERF_MAJOR_FAULTS = 1;
+    private static final int PERF_CPU_MIGRATIONS = 2;
+    private static final int PERF_INSTRUCTIONS = 3;
+    private static final int PERF_CYCLES = 4;
+    private static final int PERF_COUNTER_COUNT = 5;
+
+    private static long readVarint(ByteBuffer buffer) {
+        long result = 0;
+        int shift = 0;
+        while (true) {
+            byte b = buffer.get();
+            result |= (long) (b & 0x7f) << shift;
+            if ((b & 0x80) == 0) {
+                return result;
+            }
+            shift += 7;
+        }
+    }
+
+    private static long readZigzag(ByteBuffer buffer) {
+        long value = readVarint(buffer);
+        return (value >>> 1) ^ -(value & 1);
+    }
+
+    /**
+     * version 8 起 java 栈之后记录 native 栈帧（由内到外），作为最内层的调用追加到栈顶
+     */
+    private static StackItem[] appendNativeFrames(SamplingMappingDecoder mappingDecoder, ByteBuffer buffer, StackItem[] stack) {
+        int nativeDepth = (int) readVarint(buffer);
+        if (nativeDepth == 0) {
+            return stack;
+        }
+        StackItem[] result = Arrays.copyOf(stack, stack.length + nativeDepth);
+        for (int i = 0; i < nativeDepth; i++) {
+            int index = (int) readVarint(buffer);
+            MethodSymbol method = index < mappingDecoder.nativeFrames.size() ? mappingDecoder.nativeFrames.get(index) : new MethodSymbol(0, 0, "unknown");
+            result[result.length - i - 1] = new StackItem(method);
+        }
+        return result;
+    }
+
+    public static boolean decode(int version, SamplingMappingDecoder mappingDecoder, ByteBuffer buffer, List<StackList> result, long traceBeginTime, int pid) {
+        Map<Long, MethodSymbol> mapping = mappingDecoder.symbolMapping;
+        Map<Integer, SamplingMappingDecoder.StackNode> stackNodes = mappingDecoder.stackNodes;
+        // 唤醒记录按 被唤醒线程:阻塞开始时间 索引唤醒线程，version 11 前只记录主线程被唤醒
+        Map<String, Integer> wakers = new HashMap<>();
+        // version 7 起时间和计数按线程做差分编码，依次为 nanoTime, cpuTime, allocatedObjects, allocatedBytes, majFlt, nvCsw, nivCsw
+        Map<Integer, long[]> threadStates = new HashMap<>();
+        // version 10 起 perf 计数同样按线程差分编码，记录中缺失的计数沿用上一条记录的值
+        Map<Integer, long[]> threadPerfCounters = new HashMap<>();
         while (buffer.hasRemaining()) {
-            int type = buffer.getShort() & 0xffff;
-            int tid = buffer.getShort();
-            int messageId = buffer.getInt();
-            long nanoTime = buffer.getLong();
-            long nanoTimeEnd = buffer.getLong();
+            int type;
+            int tid;
+            int messageId;
+            long nanoTime;
+            long nanoTimeEnd;
+            long cpuTime;
+            long cpuTimeEnd;
+            Object arg = null;
+            long allocatedObjects;
+            long allocatedBytes;
+            int majFlt;
+            int nvCsw;
+            int nivCsw;
+            long sampledBytes = 0;
+            long[] perfCounters = null;
+            int wakeeTid = pid;
+            boolean beginCpuUnknown = false;
+            int savedDepth;
+            int actualDepth;
+            int stackId;
+            if (version >= 7) {
+                type = (int) readVarint(buffer);
+                tid = (short) readVarint(buffer);
+                int flags = buffer.get();
+                messageId = (int) readVarint(buffer);
+                long[] prev = threadStates.get(tid);
+                if (prev == null || (flags & FLAG_ABSOLUTE) != 0) {
+                    prev = new long[7];
+                    threadStates.put(tid, prev);
+                    threadPerfCounters.remove(tid);
+                }
+                prev[0] += readZigzag(buffer);
+                prev[1] += readZigzag(buffer);
+                nanoTime = prev[0];
+                cpuTime = prev[1];
+                if ((flags & FLAG_HAS_END) != 0) {
+                    nanoTimeEnd = nanoTime + readZigzag(buffer);
+                    cpuTimeEnd = cpuTime + readZigzag(buffer);
+                } else {
+                    nanoTimeEnd = 0;
+                    cpuTimeEnd = 0;
+                }
+                for (int i = 2; i < prev.length; i++) {
+                    prev[i] += readZigzag(buffer);
+                }
+                allocatedObjects = prev[2];
+                allocatedBytes = prev[3];
+                majFlt = (int) prev[4];
+                nvCsw = (int) prev[5];
+                nivCsw = (int) prev[6];
+                if (version >= 9 && (flags & FLAG_SAMPLED_BYTES) != 0) {
+                    sampledBytes = readVarint(buffer);
+                }
+                if (version >= 10 && (flags & FLAG_PERF_COUNTERS) != 0) {
+                    perfCounters = threadPerfCounters.get(tid);
+                    if (perfCounters == null) {
+                        perfCounters = new long[PERF_COUNTER_COUNT];
+                        threadPerfCounters.put(tid, perfCounters);
+                    }
+                    int mask = (int) readVarint(buffer);
+                    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+                        if ((mask & (1 << i)) != 0) {
+                            perfCounters[i] += readZigzag(buffer);
+                        }
+                    }
+                    majFlt = (int) perfCounters[PERF_MAJOR_FAULTS];
+                }
+                if (version >= 11 && (flags & FLAG_WAKEE) != 0) {
+                    wakeeTid = (short) readVarint(buffer); // 与 tid 一样按 16 位截断
+                }
+                beginCpuUnknown = version >= 12 && (flags & FLAG_NO_BEGIN_CPU) != 0;
+                savedDepth = (int) readVarint(buffer);
+                actualDepth = (int) readVarint(buffer);
+                stackId = (int) readVarint(buffer);
+            } else {
+                type = buffer.getShort() & 0xffff;
+                tid = buffer.getShort();
+                messageId = buffer.getInt();
+                nanoTime = buffer.getLong();
+                nanoTimeEnd = buffer.getLong();
+                cpuTime = buffer.getLong();
+                cpuTimeEnd = buffer.getLong();
+                if (type == kTraceArg) {
+                    arg = buffer.getLong();
+                }
+                allocatedObjects = version < 4 ? 0 : buffer.getLong();
+                allocatedBytes = version < 4 ? 0 : buffer.getLong();
+                majFlt = version < 5 ? 0 : buffer.getInt();
+                nvCsw = version < 5 ? 0 : buffer.getInt();
+                nivCsw = version < 5 ? 0 : buffer.getInt();
+                savedDepth = buffer.getInt();
+                actualDepth = buffer.getInt();
+                stackId = version < 6 ? 0 : buffer.getInt();
+            }
             if (traceBeginTime > 0 && nanoTime < traceBeginTime && nanoTimeEnd > nanoTime) {
                 nanoTime = traceBeginTime;
             }
-            long cpuTime = buffer.getLong();
-            long cpuTimeEnd = buffer.getLong();
             if (version >= 5) {
                 if (type == kUnlock || type == kUnpark || type == kNotify) {
-                    wakers.put(nanoTime, tid);
+                    wakers.put(wakeeTid + ":" + nanoTime, tid);
                     nanoTime = nanoTimeEnd;
                     cpuTime = cpuTimeEnd;
+                    beginCpuUnknown = false;
                 }
             }
-            Object arg = null;
-            if (type == kTraceArg) {
-                arg = buffer.getLong();
-            }
-            long allocatedObjects = version < 4 ? 0 : buffer.getLong();
-            long allocatedBytes = version < 4 ? 0 : buffer.getLong();
-            int majFlt = version < 5 ? 0 : buffer.getInt();
-            int nvCsw = version < 5 ? 0 : buffer.getInt();
-            int nivCsw = version < 5 ? 0 : buffer.getInt();
-            int savedDepth = buffer.getInt();
-            int actualDepth = buffer.getInt();
             boolean valid = actualDepth == savedDepth && savedDepth > 0; // invalid 数据可以快速处理
             if (savedDepth > Short.MAX_VALUE) {
                 throw new RuntimeException("invalid depth " + savedDepth);
             }
             StackItem[] stack = new StackItem[savedDepth];
-            for (int i = 0; i < savedDepth; i++) {
-                long pointer = buffer.getLong();
-                MethodSymbol method = mapping.get(pointer);
-                stack[savedDepth - i - 1] = new StackItem(method);
+            if (stackId != 0) {
+                // 去重后的堆栈，从栈顶节点沿 parent 还原
+                int nodeId = stackId;
+                for (int i = 0; i < savedDepth; i++) {
+                    SamplingMappingDecoder.StackNode node = stackNodes.get(nodeId);
+                    if (node == null) {
+                        throw new RuntimeException("stack node mapping missing " + nodeId);
+                    }
+                    stack[savedDepth - i - 1] = new StackItem(mapping.get(node.method));
+                    nodeId = node.parent;
+                }
+            } else {
+                for (int i = 0; i < savedDepth; i++) {
+                    long pointer = version >= 7 ? mappingDecoder.methodPointers.get((int) readVarint(buffer)) : buffer.getLong();
+                    MethodSymbol method = mapping.get(pointer);
+                    stack[savedDepth - i - 1] = new StackItem(method);
+                }
             }
-            if (type == kTraceArg) {
+            if (version >= 8) {
+                stack = appendNativeFrames(mappingDecoder, buffer, stack);
+            }
+            if (arg != null) {
                 stack[savedDepth - 2].arg = arg;
             }
             if (valid) {
@@ -231,15 +404,24 @@ public class StackList {
                     item.majFlt = preMain.majFlt;
                     item.nvCsw = preMain.nvCsw;
                     item.nivCsw = preMain.nivCsw;
+                    item.copyPerfCounters(preMain);
                     result.add(item);
                     result.add(item.dup(nanoTime, mockCPUTime));
                 } else {
                     StackList item = new StackList(nanoTime, cpuTime, stack, tid, type).setMessageId(messageId);
                     item.allocatedObjects = allocatedObjects;
                     item.allocatedBytes = allocatedBytes;
+                    item.sampledBytes = sampledBytes;
+                    item.beginCpuUnknown = beginCpuUnknown;
                     item.majFlt = majFlt;
                     item.nvCsw = nvCsw;
                     item.nivCsw = nivCsw;
+                    if (perfCounters != null) {
+                        item.contextSwitches = perfCounters[PERF_CONTEXT_SWITCHES];
+                        item.cpuMigrations = perfCounters[PERF_CPU_MIGRATIONS];
+                        item.instructions = perfCounters[PERF_INSTRUCTIONS];
+                        item.cycles = perfCounters[PERF_CYCLES];
+                    }
                     result.add(item);
                     if (nanoTimeEnd > nanoTime) { // 存在异常数据，nanoTimeEnd 小于 nanoTime 的情况，可能与时间戳同步有关，暂时忽略。
                         StackList end = item.dup(nanoTimeEnd, cpuTimeEnd);
@@ -249,8 +431,8 @@ public class StackList {
             }
         }
         for (StackList item : result) {
-            if (item.tid == pid && (item.type == kMonitor || item.type == kPark || item.type == kWait)) {
-                int wakeupTid = wakers.getOrDefault(item.nanoTime, 0);
+            if (item.type == kMonitor || item.type == kPark || item.type == kWait) {
+                int wakeupTid = wakers.getOrDefault(item.tid + ":" + item.nanoTime, 0);
                 if (wakeupTid != 0) {
                     item.wakeupTid = wakeupTid;
                 }
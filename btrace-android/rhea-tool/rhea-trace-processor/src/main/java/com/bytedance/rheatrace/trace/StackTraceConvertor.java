@@ -136,7 +136,9 @@ public class StackTraceConvertor {
             map.put("WakeUpBy", child.begin.wakeupTid);
         }
         map.put("BlockTime", child.blockTime / 1000000.0);
-        map.put("CPUTime", (child.endCPUTime - child.beginCPUTime) / 1000000.0);
+        if (!child.begin.beginCpuUnknown) {
+            map.put("CPUTime", (child.endCPUTime - child.beginCPUTime) / 1000000.0);
+        }
         map.put("Count", child.endIndex - child.beginIndex);
         map.put("Gap", child.gapTime / 1000000.0);
         map.put("Gap.CPU", child.gapCpuTime / 1000000.0);
@@ -150,6 +152,14 @@ public class StackTraceConvertor {
         map.put("MajFlt", child.end.majFlt - child.begin.majFlt);
         map.put("NvCsw", child.end.nvCsw - child.begin.nvCsw);
         map.put("NivCsw", child.end.nivCsw - child.begin.nivCsw);
+        if (child.end.contextSwitches != 0) {
+            map.put("Csw", child.end.contextSwitches - child.begin.contextSwitches);
+            map.put("CpuMigrations", child.end.cpuMigrations - child.begin.cpuMigrations);
+        }
+        if (child.end.cycles != 0) {
+            map.put("Instructions", child.end.instructions - child.begin.instructions);
+            map.put("Cycles", child.end.cycles - child.begin.cycles);
+        }
         map.put("_Begin", child.beginTime / 1000000.0);
         map.put("_End", child.endTime / 1000000.0);
         if (child.item.arg != null) {